@@ -0,0 +1,123 @@
+/*
+ * CRC32 benchmark
+ *
+ * Checks that all CRC32 implementations supported by the build and CPU agree,
+ * and measures each of them over the packet sizes found on CSP links: RDP
+ * control messages, small telemetry packets, full CSP buffers and KISS frames,
+ * and a large block as checksummed by SFP file transfers.
+ */
+
+#include <csp/csp.h>
+#include <csp/csp_crc32.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_MAX_SIZE 65536
+#define BENCH_TIME_NS 50000000
+
+static const uint32_t bench_sizes[] = {9, 16, 32, 64, 128, 256, 512, 1024, BENCH_MAX_SIZE};
+
+static uint8_t bench_data[BENCH_MAX_SIZE + 8];
+
+static uint64_t bench_now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+/* Compare implementation against the byte-wise reference, at all alignments and many lengths */
+static int bench_verify(csp_crc32_impl_t impl) {
+
+	/* Check value of CRC32C */
+	if (csp_crc32_memory((const uint8_t *)"123456789", 9) != 0xE3069283) {
+		return -1;
+	}
+
+	for (uint32_t offset = 0; offset < 8; offset++) {
+		for (uint32_t length = 0; length < 300; length++) {
+			csp_crc32_set_impl(CSP_CRC32_IMPL_BYTE);
+			const uint32_t expected = csp_crc32_memory(&bench_data[offset], length);
+			csp_crc32_set_impl(impl);
+			if (csp_crc32_memory(&bench_data[offset], length) != expected) {
+				return -1;
+			}
+			/* Split in two updates */
+			const uint32_t half = length / 3;
+			uint32_t crc = csp_crc32_update(CSP_CRC32_INIT, &bench_data[offset], half);
+			crc = csp_crc32_update(crc, &bench_data[offset + half], length - half);
+			if (csp_crc32_final(crc) != expected) {
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char * argv[]) {
+
+	csp_init();
+
+	srand(1);
+	for (unsigned int i = 0; i < sizeof(bench_data); i++) {
+		bench_data[i] = rand();
+	}
+
+	printf("Selected implementation: %s\n\n", csp_crc32_impl_name(csp_crc32_get_impl()));
+
+	printf("%-8s", "bytes");
+	for (unsigned int s = 0; s < sizeof(bench_sizes) / sizeof(bench_sizes[0]); s++) {
+		printf(" %10" PRIu32, bench_sizes[s]);
+	}
+	printf("\n");
+
+	int ret = 0;
+	static const csp_crc32_impl_t impls[] = {CSP_CRC32_IMPL_BYTE, CSP_CRC32_IMPL_SLICE8, CSP_CRC32_IMPL_SSE42, CSP_CRC32_IMPL_ARMV8};
+	for (unsigned int i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+
+		if (csp_crc32_set_impl(impls[i]) != CSP_ERR_NONE) {
+			printf("%-8s not supported\n", csp_crc32_impl_name(impls[i]));
+			continue;
+		}
+
+		if (bench_verify(impls[i]) != 0) {
+			printf("%-8s MISMATCH\n", csp_crc32_impl_name(impls[i]));
+			ret = 1;
+			continue;
+		}
+
+		/* ns per call, and MB/s */
+		double ns[sizeof(bench_sizes) / sizeof(bench_sizes[0])];
+		for (unsigned int s = 0; s < sizeof(bench_sizes) / sizeof(bench_sizes[0]); s++) {
+			volatile uint32_t sink = 0;
+			uint64_t calls = 0;
+			const uint64_t start = bench_now_ns();
+			uint64_t elapsed;
+			do {
+				for (unsigned int n = 0; n < 64; n++) {
+					sink ^= csp_crc32_memory(bench_data, bench_sizes[s]);
+				}
+				calls += 64;
+				elapsed = bench_now_ns() - start;
+			} while (elapsed < BENCH_TIME_NS);
+			(void)sink;
+			ns[s] = (double)elapsed / calls;
+		}
+
+		printf("%-8s", csp_crc32_impl_name(impls[i]));
+		for (unsigned int s = 0; s < sizeof(bench_sizes) / sizeof(bench_sizes[0]); s++) {
+			printf(" %8.1fns", ns[s]);
+		}
+		printf("\n%-8s", "");
+		for (unsigned int s = 0; s < sizeof(bench_sizes) / sizeof(bench_sizes[0]); s++) {
+			printf(" %6.0fMB/s", bench_sizes[s] * 1000.0 / ns[s]);
+		}
+		printf("\n");
+	}
+
+	return ret;
+}
@@ -0,0 +1,170 @@
+/*
+ * Deduplication benchmark
+ *
+ * Feeds packets through the router, as received from two interfaces, and
+ * checks that deduplication finds duplicates far apart in all scopes, that
+ * the scopes separate interfaces and flags as documented, and that entries
+ * expire after the window. Then measures the router cost per packet, with
+ * and without deduplication.
+ *
+ * Each check adds up to a quarter of the table, and the table fills up to
+ * three quarters. Duplicates may then be missed, but only as many as there
+ * were evictions.
+ */
+
+#include <csp/csp.h>
+#include <csp/csp_dedup.h>
+#include <csp/csp_interface.h>
+#include <csp_autoconfig.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_ADDR 1
+#define BENCH_PORT 10
+#define BENCH_SIZE 100
+#define BENCH_DISTANCE (CSP_DEDUP_COUNT / 4)
+#define BENCH_PACKETS 100000
+
+static csp_iface_t bench_iface[2] = {
+	{.name = "A", .addr = BENCH_ADDR},
+	{.name = "B", .addr = BENCH_ADDR},
+};
+
+static uint64_t bench_now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+/* Route packet number seq from iface, returns true if it was dropped as a duplicate */
+static bool bench_route(csp_iface_t * iface, uint32_t seq, uint8_t flags) {
+
+	csp_packet_t * packet = csp_buffer_get(BENCH_SIZE);
+	if (packet == NULL) {
+		printf("No buffers\n");
+		return false;
+	}
+
+	packet->id.pri = CSP_PRIO_NORM;
+	packet->id.flags = flags;
+	packet->id.src = 2;
+	packet->id.dst = BENCH_ADDR;
+	packet->id.sport = 20;
+	packet->id.dport = BENCH_PORT;
+	memset(packet->data, 0, BENCH_SIZE);
+	memcpy(packet->data, &seq, sizeof(seq));
+	packet->length = BENCH_SIZE;
+
+	const uint32_t drop = iface->drop;
+	csp_qfifo_write(packet, iface, NULL);
+	csp_route_work();
+
+	return (iface->drop != drop);
+}
+
+/* Route packets 0..count-1 from iface, returns the number dropped as duplicates */
+static uint32_t bench_route_range(csp_iface_t * iface, uint32_t count, uint8_t flags) {
+
+	uint32_t dropped = 0;
+	for (uint32_t seq = 0; seq < count; seq++) {
+		dropped += bench_route(iface, seq, flags);
+	}
+	return dropped;
+}
+
+static int bench_check(const char * name, bool ok) {
+	printf("%-60s %s\n", name, ok ? "ok" : "FAILED");
+	return ok ? 0 : 1;
+}
+
+static uint32_t bench_evictions(void) {
+	csp_dedup_stats_t stats;
+	csp_dedup_get_stats(&stats);
+	return stats.evictions;
+}
+
+/* Duplicates dropped, when expected, except for those evicted since the table was cleared */
+static bool bench_dropped(uint32_t dropped, uint32_t expected, uint32_t evictions_start) {
+	const uint32_t evicted = bench_evictions() - evictions_start;
+	return (dropped <= expected) && ((dropped + evicted) >= expected);
+}
+
+static int bench_verify(void) {
+
+	static const char * const names[] = {"global", "iface", "flow"};
+	int failed = 0;
+
+	for (csp_dedup_scope_t scope = CSP_DEDUP_SCOPE_GLOBAL; scope <= CSP_DEDUP_SCOPE_FLOW; scope++) {
+
+		char name[80];
+		csp_dedup_configure(10000, scope);
+		const uint32_t evictions = bench_evictions();
+
+		/* Each packet is repeated after BENCH_DISTANCE other packets */
+		snprintf(name, sizeof(name), "%s: new packets pass", names[scope]);
+		failed += bench_check(name, bench_route_range(&bench_iface[0], BENCH_DISTANCE, 0) == 0);
+		snprintf(name, sizeof(name), "%s: duplicates %u packets apart are dropped", names[scope], BENCH_DISTANCE);
+		failed += bench_check(name, bench_dropped(bench_route_range(&bench_iface[0], BENCH_DISTANCE, 0), BENCH_DISTANCE, evictions));
+
+		/* The same packets from the other interface, are only new per interface */
+		const uint32_t expected = (scope == CSP_DEDUP_SCOPE_IFACE) ? 0 : BENCH_DISTANCE;
+		snprintf(name, sizeof(name), "%s: duplicates from another interface", names[scope]);
+		failed += bench_check(name, bench_dropped(bench_route_range(&bench_iface[1], BENCH_DISTANCE, 0), expected, evictions));
+
+		/* The same packets with other flags, are only duplicates per flow */
+		const uint32_t expected_flags = (scope == CSP_DEDUP_SCOPE_FLOW) ? BENCH_DISTANCE : 0;
+		snprintf(name, sizeof(name), "%s: duplicates with other flags", names[scope]);
+		failed += bench_check(name, bench_dropped(bench_route_range(&bench_iface[0], BENCH_DISTANCE, CSP_FFRAG), expected_flags, evictions));
+
+		printf("%-60s %" PRIu32 "\n", "evictions", bench_evictions() - evictions);
+	}
+
+	/* Entries expire after the window */
+	csp_dedup_configure(40, CSP_DEDUP_SCOPE_GLOBAL);
+	bench_route(&bench_iface[0], 0, 0);
+	const bool within = bench_route(&bench_iface[0], 0, 0);
+	usleep(60 * 1000);
+	const bool after = bench_route(&bench_iface[0], 0, 0);
+	failed += bench_check("duplicate within the window is dropped", within);
+	failed += bench_check("duplicate after the window passes", !after);
+
+	return failed;
+}
+
+/* Route packets from a single interface, each repeated once, returns the time per packet */
+static double bench_measure(void) {
+
+	const uint64_t start = bench_now_ns();
+	for (uint32_t seq = 0; seq < BENCH_PACKETS / 2; seq++) {
+		bench_route(&bench_iface[0], seq, 0);
+		bench_route(&bench_iface[0], seq, 0);
+	}
+	return (double)(bench_now_ns() - start) / BENCH_PACKETS;
+}
+
+int main(int argc, char * argv[]) {
+
+	csp_conf.version = 2;
+	csp_conf.address = BENCH_ADDR;
+	csp_conf.dedup = CSP_DEDUP_ALL;
+	csp_init();
+
+	int failed = bench_verify();
+
+	csp_dedup_configure(CSP_DEDUP_WINDOW_MS, CSP_DEDUP_SCOPE_GLOBAL);
+	const double dedup_ns = bench_measure();
+	csp_conf.dedup = CSP_DEDUP_OFF;
+	const double plain_ns = bench_measure();
+
+	csp_dedup_stats_t stats;
+	csp_dedup_get_stats(&stats);
+
+	printf("\nRouter, %u byte packets: %.1f ns/packet with deduplication, %.1f ns/packet without\n", BENCH_SIZE, dedup_ns, plain_ns);
+	printf("Hits %" PRIu32 ", misses %" PRIu32 ", evictions %" PRIu32 "\n", stats.hits, stats.misses, stats.evictions);
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,176 @@
+/*
+ * HMAC-SHA1 benchmark
+ *
+ * Checks all SHA1 implementations supported by the build and CPU against known
+ * answers and the portable implementation, and measures for each of them:
+ * plain SHA1, HMAC computed from the key (csp_hmac_memory) and HMAC on packets
+ * with the precomputed key state (csp_hmac_append/csp_hmac_verify).
+ */
+
+#include <csp/csp.h>
+#include <csp/crypto/csp_hmac.h>
+#include <csp/crypto/csp_sha1.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_MAX_SIZE 65536
+#define BENCH_TIME_NS 50000000
+
+static uint8_t bench_data[BENCH_MAX_SIZE + 8];
+
+/* The KDF of csp_hmac_set_key() is SHA1, so the precomputed key state can be checked with csp_hmac_memory() */
+static uint8_t bench_key[CSP_SHA1_DIGESTSIZE];
+
+static const uint32_t bench_sha1_sizes[] = {16, 64, 128, 256, 1024, BENCH_MAX_SIZE};
+static const uint32_t bench_hmac_sizes[] = {16, 64, 128, 200};
+
+static uint64_t bench_now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+/* Known answers, and agreement with the portable implementation at all alignments and many lengths */
+static int bench_verify(csp_sha1_impl_t impl) {
+
+	static const uint8_t sha1_abc[CSP_SHA1_DIGESTSIZE] = {
+		0xa9, 0x99, 0x3e, 0x36, 0x47, 0x06, 0x81, 0x6a, 0xba, 0x3e, 0x25, 0x71, 0x78, 0x50, 0xc2, 0x6c, 0x9c, 0xd0, 0xd8, 0x9d};
+	/* RFC 2202, test case 1 */
+	static const uint8_t hmac_key[20] = {
+		0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b};
+	static const uint8_t hmac_hi_there[CSP_SHA1_DIGESTSIZE] = {
+		0xb6, 0x17, 0x31, 0x86, 0x55, 0x05, 0x72, 0x64, 0xe2, 0x8b, 0xc0, 0xb6, 0xfb, 0x37, 0x8c, 0x8e, 0xf1, 0x46, 0xbe, 0x00};
+
+	uint8_t hash[CSP_SHA1_DIGESTSIZE];
+	uint8_t expected[CSP_SHA1_DIGESTSIZE];
+
+	csp_sha1_set_impl(impl);
+	csp_sha1_memory("abc", 3, hash);
+	if (memcmp(hash, sha1_abc, sizeof(hash)) != 0) {
+		return -1;
+	}
+	csp_hmac_memory(hmac_key, sizeof(hmac_key), "Hi There", 8, hash);
+	if (memcmp(hash, hmac_hi_there, sizeof(hash)) != 0) {
+		return -1;
+	}
+
+	for (uint32_t offset = 0; offset < 8; offset++) {
+		for (uint32_t length = 0; length < 600; length += 7) {
+			csp_sha1_set_impl(CSP_SHA1_IMPL_PORTABLE);
+			csp_sha1_memory(&bench_data[offset], length, expected);
+			csp_sha1_set_impl(impl);
+			csp_sha1_memory(&bench_data[offset], length, hash);
+			if (memcmp(hash, expected, sizeof(hash)) != 0) {
+				return -1;
+			}
+		}
+	}
+
+	/* Precomputed key state */
+	for (uint32_t length = 0; length <= 200; length++) {
+		csp_packet_t * packet = csp_buffer_get(0);
+		memcpy(packet->data, bench_data, length);
+		packet->length = length;
+		csp_hmac_append(packet, false);
+		csp_hmac_memory(bench_key, 16, bench_data, length, expected);
+		const int ok = (memcmp(&packet->data[length], expected, CSP_HMAC_LENGTH) == 0) && (csp_hmac_verify(packet, false) == CSP_ERR_NONE);
+		csp_buffer_free(packet);
+		if (!ok) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char * argv[]) {
+
+	csp_init();
+
+	srand(1);
+	for (unsigned int i = 0; i < sizeof(bench_data); i++) {
+		bench_data[i] = rand();
+	}
+
+	csp_hmac_set_key("benchmark", 9);
+	csp_sha1_memory("benchmark", 9, bench_key);
+
+	printf("Selected implementation: %s\n\n", csp_sha1_impl_name(csp_sha1_get_impl()));
+
+	int ret = 0;
+	static const csp_sha1_impl_t impls[] = {CSP_SHA1_IMPL_PORTABLE, CSP_SHA1_IMPL_SHANI, CSP_SHA1_IMPL_ARMV8};
+	for (unsigned int i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+
+		if (csp_sha1_set_impl(impls[i]) != CSP_ERR_NONE) {
+			printf("%s: not supported\n\n", csp_sha1_impl_name(impls[i]));
+			continue;
+		}
+
+		if (bench_verify(impls[i]) != 0) {
+			printf("%s: MISMATCH\n\n", csp_sha1_impl_name(impls[i]));
+			ret = 1;
+			continue;
+		}
+
+		printf("%s:\n", csp_sha1_impl_name(impls[i]));
+
+		printf("  %-14s", "sha1");
+		for (unsigned int s = 0; s < sizeof(bench_sha1_sizes) / sizeof(bench_sha1_sizes[0]); s++) {
+			uint8_t hash[CSP_SHA1_DIGESTSIZE];
+			uint64_t calls = 0;
+			const uint64_t start = bench_now_ns();
+			uint64_t elapsed;
+			do {
+				csp_sha1_memory(bench_data, bench_sha1_sizes[s], hash);
+				calls++;
+				elapsed = bench_now_ns() - start;
+			} while (elapsed < BENCH_TIME_NS);
+			const double ns = (double)elapsed / calls;
+			printf(" %5" PRIu32 ": %8.1fns %5.0fMB/s", bench_sha1_sizes[s], ns, bench_sha1_sizes[s] * 1000.0 / ns);
+		}
+		printf("\n");
+
+		printf("  %-14s", "hmac_memory");
+		for (unsigned int s = 0; s < sizeof(bench_hmac_sizes) / sizeof(bench_hmac_sizes[0]); s++) {
+			uint8_t hash[CSP_SHA1_DIGESTSIZE];
+			uint64_t calls = 0;
+			const uint64_t start = bench_now_ns();
+			uint64_t elapsed;
+			do {
+				csp_hmac_memory(bench_key, 16, bench_data, bench_hmac_sizes[s], hash);
+				calls++;
+				elapsed = bench_now_ns() - start;
+			} while (elapsed < BENCH_TIME_NS);
+			printf(" %5" PRIu32 ": %8.1fns", bench_hmac_sizes[s], (double)elapsed / calls);
+		}
+		printf("\n");
+
+		printf("  %-14s", "append+verify");
+		csp_packet_t * packet = csp_buffer_get(0);
+		for (unsigned int s = 0; s < sizeof(bench_hmac_sizes) / sizeof(bench_hmac_sizes[0]); s++) {
+			memcpy(packet->data, bench_data, bench_hmac_sizes[s]);
+			packet->length = bench_hmac_sizes[s];
+			uint64_t calls = 0;
+			const uint64_t start = bench_now_ns();
+			uint64_t elapsed;
+			do {
+				csp_hmac_append(packet, false);
+				if (csp_hmac_verify(packet, false) != CSP_ERR_NONE) {
+					ret = 1;
+				}
+				calls++;
+				elapsed = bench_now_ns() - start;
+			} while (elapsed < BENCH_TIME_NS);
+			/* Two HMACs per iteration */
+			printf(" %5" PRIu32 ": %8.1fns", bench_hmac_sizes[s], (double)elapsed / calls / 2);
+		}
+		csp_buffer_free(packet);
+		printf("\n\n");
+	}
+
+	return ret;
+}
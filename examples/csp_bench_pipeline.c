@@ -0,0 +1,200 @@
+/*
+ * Integrity pipeline benchmark
+ *
+ * Sends HMAC and CRC32 protected packets over the loopback interface from a
+ * number of flows (sender tasks with different source ports) to a
+ * connection-less socket, with the integrity work done inline or on a pool of
+ * pipeline workers. Reports throughput, router task CPU time per packet, and
+ * checks that each flow is received in order.
+ *
+ * Run once per configuration, e.g. "csp_bench_pipeline -w 0" and
+ * "csp_bench_pipeline -w 4", as the pipeline cannot be stopped again.
+ */
+
+#include <csp/csp.h>
+#include <csp/csp_pipeline.h>
+#include <csp/crypto/csp_hmac.h>
+#include <csp/crypto/csp_sha1.h>
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_PORT 10
+#define BENCH_SPORT 16
+#define BENCH_MAX_FLOWS 16
+
+/* Run parameters */
+static unsigned int bench_workers = 0;
+static unsigned int bench_flows = 4;
+static unsigned int bench_count = 20000;
+static unsigned int bench_size = 200;
+static bool bench_portable = false;
+
+/* Payload header */
+typedef struct {
+	uint32_t flow;
+	uint32_t seq;
+} bench_header_t;
+
+static uint64_t bench_now_ns(clockid_t clock) {
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+static void * router_task(void * param) {
+	while (1) {
+		csp_route_work();
+	}
+	return NULL;
+}
+
+static void * worker_task(void * param) {
+	const unsigned int worker = (uintptr_t)param;
+	while (1) {
+		csp_pipeline_work(worker, 1000);
+	}
+	return NULL;
+}
+
+static void * sender_task(void * param) {
+
+	const unsigned int flow = (uintptr_t)param;
+
+	for (uint32_t seq = 0; seq < bench_count; seq++) {
+
+		csp_packet_t * packet;
+		while ((packet = csp_buffer_get(0)) == NULL) {
+			/* Wait for the router and receiver to free buffers */
+			usleep(50);
+		}
+
+		const bench_header_t header = {.flow = flow, .seq = seq};
+		memset(packet->data, 0x55, bench_size);
+		memcpy(packet->data, &header, sizeof(header));
+		packet->length = bench_size;
+
+		csp_sendto(CSP_PRIO_NORM, csp_get_address(), BENCH_PORT, BENCH_SPORT + flow, CSP_O_HMAC | CSP_O_CRC32, packet);
+	}
+
+	return NULL;
+}
+
+int main(int argc, char * argv[]) {
+
+	int opt;
+	while ((opt = getopt(argc, argv, "w:f:n:s:p")) != -1) {
+		switch (opt) {
+			case 'w':
+				bench_workers = atoi(optarg);
+				break;
+			case 'f':
+				bench_flows = atoi(optarg);
+				break;
+			case 'n':
+				bench_count = atoi(optarg);
+				break;
+			case 's':
+				bench_size = atoi(optarg);
+				break;
+			case 'p':
+				bench_portable = true;
+				break;
+			default:
+				printf("Usage:\n"
+					   " -w <count>       pipeline workers, default 0 (inline)\n"
+					   " -f <count>       flows, default 4\n"
+					   " -n <count>       packets per flow, default 20000\n"
+					   " -s <bytes>       packet size, default 200\n"
+					   " -p               portable SHA1, as on CPUs without SHA instructions\n");
+				exit(1);
+		}
+	}
+
+	/* Room for HMAC and CRC32 */
+	if ((bench_flows == 0) || (bench_flows > BENCH_MAX_FLOWS) || (bench_size < sizeof(bench_header_t)) ||
+		(bench_size + CSP_HMAC_LENGTH + sizeof(uint32_t) > csp_buffer_data_size())) {
+		printf("Invalid parameters\n");
+		exit(1);
+	}
+
+	csp_init();
+	csp_hmac_set_key("benchmark", 9);
+	if (bench_portable) {
+		csp_sha1_set_impl(CSP_SHA1_IMPL_PORTABLE);
+	}
+
+	if (bench_workers > 0) {
+		if (csp_pipeline_init(bench_workers) != CSP_ERR_NONE) {
+			printf("Failed to start pipeline with %u workers\n", bench_workers);
+			exit(1);
+		}
+		for (unsigned int i = 0; i < bench_workers; i++) {
+			pthread_t thread;
+			pthread_create(&thread, NULL, worker_task, (void *)(uintptr_t)i);
+		}
+	}
+
+	pthread_t router;
+	pthread_create(&router, NULL, router_task, NULL);
+	clockid_t router_clock;
+	pthread_getcpuclockid(router, &router_clock);
+
+	csp_socket_t sock = {.opts = CSP_SO_CONN_LESS | CSP_SO_HMACREQ | CSP_SO_CRC32REQ};
+	csp_bind(&sock, BENCH_PORT);
+	csp_listen(&sock, 0);
+
+	const uint64_t start = bench_now_ns(CLOCK_MONOTONIC);
+	const uint64_t router_start = bench_now_ns(router_clock);
+
+	for (unsigned int i = 0; i < bench_flows; i++) {
+		pthread_t thread;
+		pthread_create(&thread, NULL, sender_task, (void *)(uintptr_t)i);
+	}
+
+	/* Receive until all packets arrived, or nothing arrives for a while */
+	uint32_t next_seq[BENCH_MAX_FLOWS] = {0};
+	unsigned int received = 0;
+	unsigned int out_of_order = 0;
+	unsigned int invalid = 0;
+	uint64_t end = start;
+	csp_packet_t * packet;
+	while ((received < bench_flows * bench_count) && ((packet = csp_recvfrom(&sock, 500)) != NULL)) {
+		bench_header_t header;
+		memcpy(&header, packet->data, sizeof(header));
+		if ((packet->length != bench_size) || (header.flow >= bench_flows)) {
+			invalid++;
+		} else {
+			if (header.seq < next_seq[header.flow]) {
+				out_of_order++;
+			} else {
+				next_seq[header.flow] = header.seq + 1;
+			}
+		}
+		csp_buffer_free(packet);
+		received++;
+		end = bench_now_ns(CLOCK_MONOTONIC);
+	}
+
+	const uint64_t router_ns = bench_now_ns(router_clock) - router_start;
+	const double seconds = (end - start) / 1e9;
+
+	printf("Workers %u, flows %u, size %u, SHA1 %s: received %u/%u, %.0f packets/s, router %.0f ns/packet, out of order %u, invalid %u\n",
+		   bench_workers, bench_flows, bench_size, csp_sha1_impl_name(csp_sha1_get_impl()), received, bench_flows * bench_count,
+		   received / seconds, received ? (double)router_ns / received : 0, out_of_order, invalid);
+
+	if (bench_workers > 0) {
+		csp_pipeline_stats_t stats;
+		csp_pipeline_get_stats(&stats);
+		printf("Pipeline: rx %" PRIu32 " (failed %" PRIu32 ", dropped %" PRIu32 "), tx %" PRIu32 ", %.1f packets/batch\n",
+			   stats.rx, stats.rx_failed, stats.rx_dropped, stats.tx,
+			   stats.batches ? (double)(stats.rx + stats.tx) / stats.batches : 0);
+	}
+
+	return ((out_of_order == 0) && (invalid == 0) && (received > 0)) ? 0 : 1;
+}
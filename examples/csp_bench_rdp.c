@@ -0,0 +1,375 @@
+/*
+ * RDP benchmark
+ *
+ * Runs client and server in one process, connected through an emulated link
+ * with configurable loss, reordering, delay and bandwidth. The link is shared
+ * by both directions (half-duplex, like most radio links), so ACKs compete
+ * with data for bandwidth.
+ *
+ * For each combination of window size, delayed ACKs and packet size, a stream
+ * of packets is sent over a RDP connection, and goodput, retransmission ratio
+ * and latency percentiles (send call to delivery at the server) are reported.
+ */
+
+#include <csp/csp.h>
+#include <csp/csp_debug.h>
+#include <csp/csp_interface.h>
+#include <csp/csp_iflist.h>
+#include <csp/csp_id.h>
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_PORT 10
+#define LINK_QUEUE_LEN 64
+
+/* Header in each benchmark packet */
+typedef struct {
+	uint32_t seq;
+	uint64_t sent_us;
+} bench_header_t;
+
+/* Link emulation parameters */
+static unsigned int link_loss = 0;       // percent
+static unsigned int link_reorder = 0;    // percent
+static unsigned int link_delay = 10;     // mS, one way
+static unsigned int link_bandwidth = 0;  // bytes per second, 0 for unlimited
+
+/* Run parameters */
+static unsigned int run_count = 200;
+static unsigned int packet_timeout = 0;
+
+/* Link state */
+typedef struct {
+	csp_packet_t * packet;
+	uint64_t deliver_us;
+	uint32_t order;
+} link_slot_t;
+
+static link_slot_t link_queue[LINK_QUEUE_LEN];
+static unsigned int link_queued;
+static uint32_t link_order;
+static uint64_t link_busy_until;
+static unsigned int link_dropped;
+static pthread_mutex_t link_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t link_cond = PTHREAD_COND_INITIALIZER;
+
+/* Server results of the current run */
+static uint32_t * latencies_us;
+static unsigned int received;
+
+static uint64_t now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int link_tx(csp_iface_t * iface, uint16_t via, csp_packet_t * packet) {
+
+	pthread_mutex_lock(&link_lock);
+
+	if (((unsigned int)(rand() % 100) < link_loss) || (link_queued == LINK_QUEUE_LEN)) {
+		link_dropped++;
+		pthread_mutex_unlock(&link_lock);
+		csp_buffer_free(packet);
+		return CSP_ERR_NONE;
+	}
+
+	/* Serialize on the link, then propagate */
+	uint64_t now = now_us();
+	uint64_t start = (link_busy_until > now) ? link_busy_until : now;
+	if (link_bandwidth) {
+		link_busy_until = start + ((uint64_t)(packet->frame_length + packet->length) * 1000000) / link_bandwidth;
+	} else {
+		link_busy_until = start;
+	}
+	uint64_t deliver = link_busy_until + link_delay * 1000;
+
+	/* Reordered packets are held back, so later packets overtake them */
+	if ((unsigned int)(rand() % 100) < link_reorder) {
+		deliver += 1000 + (rand() % (link_delay + 10)) * 1000;
+	}
+
+	link_queue[link_queued].packet = packet;
+	link_queue[link_queued].deliver_us = deliver;
+	link_queue[link_queued].order = link_order++;
+	link_queued++;
+
+	pthread_cond_signal(&link_cond);
+	pthread_mutex_unlock(&link_lock);
+
+	return CSP_ERR_NONE;
+}
+
+static csp_iface_t link_iface = {
+	.name = "LINK",
+	.nexthop = link_tx,
+};
+
+static void * link_task(void * param) {
+
+	pthread_mutex_lock(&link_lock);
+	while (1) {
+
+		if (link_queued == 0) {
+			pthread_cond_wait(&link_cond, &link_lock);
+			continue;
+		}
+
+		unsigned int next = 0;
+		for (unsigned int i = 1; i < link_queued; i++) {
+			/* Packets due at the same time leave in the order they were sent */
+			if ((link_queue[i].deliver_us < link_queue[next].deliver_us) ||
+				((link_queue[i].deliver_us == link_queue[next].deliver_us) && (link_queue[i].order < link_queue[next].order))) {
+				next = i;
+			}
+		}
+
+		uint64_t now = now_us();
+		if (link_queue[next].deliver_us > now) {
+			uint64_t wait = link_queue[next].deliver_us - now;
+			struct timespec ts;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += wait / 1000000;
+			ts.tv_nsec += (wait % 1000000) * 1000;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&link_cond, &link_lock, &ts);
+			continue;
+		}
+
+		csp_packet_t * packet = link_queue[next].packet;
+		link_queue[next] = link_queue[--link_queued];
+
+		pthread_mutex_unlock(&link_lock);
+		csp_qfifo_write(packet, &link_iface, NULL);
+		pthread_mutex_lock(&link_lock);
+	}
+
+	return NULL;
+}
+
+static void * router_task(void * param) {
+	while (1) {
+		csp_route_work();
+	}
+	return NULL;
+}
+
+static void * server_task(void * param) {
+
+	csp_socket_t * sock = param;
+
+	csp_conn_t * conn = csp_accept(sock, 10000);
+	if (conn == NULL) {
+		return NULL;
+	}
+
+	csp_packet_t * packet;
+	while ((received < run_count) && ((packet = csp_read(conn, 10000)) != NULL)) {
+		bench_header_t header;
+		memcpy(&header, packet->data, sizeof(header));
+		if (header.seq < run_count) {
+			latencies_us[received++] = now_us() - header.sent_us;
+		}
+		csp_buffer_free(packet);
+	}
+
+	csp_close(conn);
+	return NULL;
+}
+
+static csp_packet_t * bench_buffer_get(size_t size) {
+
+	/* The buffer pool is small, wait for retransmission copies to be freed */
+	csp_packet_t * packet;
+	for (int i = 0; i < 10000; i++) {
+		if ((packet = csp_buffer_get(size)) != NULL) {
+			return packet;
+		}
+		usleep(100);
+	}
+	return NULL;
+}
+
+static int compare_u32(const void * a, const void * b) {
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+static uint32_t percentile(const uint32_t * sorted, unsigned int count, unsigned int pct) {
+	if (count == 0) {
+		return 0;
+	}
+	unsigned int index = (count * pct + 99) / 100;
+	return sorted[(index > 0) ? index - 1 : 0];
+}
+
+static void bench_run(csp_socket_t * sock, unsigned int window, unsigned int delayed_acks, unsigned int size) {
+
+	unsigned int ptimeout = packet_timeout;
+	if (ptimeout == 0) {
+		ptimeout = 4 * link_delay + 100;
+		if (link_bandwidth) {
+			ptimeout += (2 * window * size * 1000) / link_bandwidth;
+		}
+	}
+	csp_rdp_set_opt(window, 5000, ptimeout, delayed_acks, ptimeout / 4, (window > 1) ? window / 2 : 1);
+
+	received = 0;
+	pthread_t server;
+	pthread_create(&server, NULL, server_task, sock);
+
+	csp_conn_t * conn = NULL;
+	for (int i = 0; (i < 10) && (conn == NULL); i++) {
+		conn = csp_connect(CSP_PRIO_NORM, csp_get_address(), BENCH_PORT, 0, CSP_O_RDP);
+	}
+	if (conn == NULL) {
+		printf("%6u %5u %6u   connect failed\n", window, delayed_acks, size);
+		pthread_cancel(server);
+		pthread_join(server, NULL);
+		return;
+	}
+
+	uint64_t start = now_us();
+	unsigned int sent;
+	for (sent = 0; sent < run_count; sent++) {
+		csp_packet_t * packet = bench_buffer_get(size);
+		if (packet == NULL) {
+			break;
+		}
+		bench_header_t header = {.seq = sent, .sent_us = now_us()};
+		memset(packet->data, 0x55, size);
+		memcpy(packet->data, &header, sizeof(header));
+		packet->length = size;
+		csp_send(conn, packet);
+	}
+
+	pthread_join(server, NULL);
+	uint64_t elapsed = now_us() - start;
+
+	csp_rdp_stats_t stats;
+	csp_rdp_get_stats(conn, &stats);
+	csp_close(conn);
+
+	qsort(latencies_us, received, sizeof(latencies_us[0]), compare_u32);
+
+	double goodput = (elapsed > 0) ? ((double)received * size * 1000000.0) / elapsed : 0;
+	double retransmit_ratio = (stats.tx_segments > 0) ? (double)stats.retransmits / stats.tx_segments : 0;
+
+	printf("%6u %5u %6u %10.0f %7.3f %8.1f %8.1f %8.1f %8.1f %6u/%u\n",
+		   window, delayed_acks, size, goodput, retransmit_ratio,
+		   percentile(latencies_us, received, 50) / 1000.0,
+		   percentile(latencies_us, received, 90) / 1000.0,
+		   percentile(latencies_us, received, 99) / 1000.0,
+		   received ? latencies_us[received - 1] / 1000.0 : 0.0,
+		   received, run_count);
+
+	/* Let the connections close, before the next run */
+	usleep(2 * (4 * link_delay + 100) * 1000);
+}
+
+int main(int argc, char * argv[]) {
+
+#if (CSP_USE_RDP)
+	int opt;
+	while ((opt = getopt(argc, argv, "l:r:d:b:n:p:s:")) != -1) {
+		switch (opt) {
+			case 'l':
+				link_loss = atoi(optarg);
+				break;
+			case 'r':
+				link_reorder = atoi(optarg);
+				break;
+			case 'd':
+				link_delay = atoi(optarg);
+				break;
+			case 'b':
+				link_bandwidth = atoi(optarg);
+				break;
+			case 'n':
+				run_count = atoi(optarg);
+				break;
+			case 'p':
+				packet_timeout = atoi(optarg);
+				break;
+			case 's':
+				srand(atoi(optarg));
+				break;
+			default:
+				printf("Usage:\n"
+					   " -l <percent>     packet loss, default 0\n"
+					   " -r <percent>     packets reordered, default 0\n"
+					   " -d <ms>          one way link delay, default 10\n"
+					   " -b <bytes/s>     link bandwidth, default unlimited\n"
+					   " -n <count>       packets per run, default 200\n"
+					   " -p <ms>          RDP packet timeout, default derived from link\n"
+					   " -s <seed>        random seed for loss and reordering\n");
+				exit(1);
+		}
+	}
+
+	if (run_count == 0) {
+		exit(1);
+	}
+
+	latencies_us = calloc(run_count, sizeof(*latencies_us));
+	if (latencies_us == NULL) {
+		exit(1);
+	}
+
+	csp_conf.version = 2;
+	csp_conf.address = 1;
+	csp_init();
+
+	link_iface.addr = csp_conf.address;
+	link_iface.netmask = csp_id_get_host_bits();
+	csp_iflist_add(&link_iface);
+
+	pthread_t thread;
+	pthread_create(&thread, NULL, router_task, NULL);
+	pthread_create(&thread, NULL, link_task, NULL);
+
+	csp_socket_t sock = {0};
+	csp_bind(&sock, BENCH_PORT);
+	csp_listen(&sock, 5);
+
+	printf("Link: loss %u%%, reorder %u%%, delay %u ms, bandwidth %u B/s, %u packets per run\n",
+		   link_loss, link_reorder, link_delay, link_bandwidth, run_count);
+	printf("%6s %5s %6s %10s %7s %8s %8s %8s %8s %8s\n",
+		   "window", "dack", "size", "goodput", "rtx", "p50 ms", "p90 ms", "p99 ms", "max ms", "rcvd");
+
+	const unsigned int windows[] = {1, 2, 4, 8, 16};
+	const unsigned int sizes[] = {32, 64, 128, 192, 256, 512, 1024, 2048};
+	const unsigned int max_size = csp_buffer_data_size() - 5;  // Room for RDP header
+
+	for (unsigned int w = 0; w < sizeof(windows) / sizeof(windows[0]); w++) {
+		if (windows[w] > CSP_RDP_MAX_WINDOW) {
+			continue;
+		}
+		for (unsigned int delayed_acks = 0; delayed_acks <= 1; delayed_acks++) {
+			for (unsigned int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+				if ((sizes[s] > max_size) || (sizes[s] < sizeof(bench_header_t))) {
+					continue;
+				}
+				bench_run(&sock, windows[w], delayed_acks, sizes[s]);
+			}
+		}
+	}
+
+	printf("Link dropped %u packets\n", link_dropped);
+	free(latencies_us);
+	return 0;
+#else
+	printf("RDP is not enabled\n");
+	return 1;
+#endif
+}
@@ -0,0 +1,258 @@
+/*
+ * Routing lookup benchmark
+ *
+ * Fills the routing table with random routes over a set of interfaces with
+ * overlapping subnets, and checks for every CSP 2.x address that csp_sendto()
+ * delivers to the same interfaces and via addresses as a scan of the interface
+ * list and routing table. Then measures the routing table scan against
+ * csp_rtable_find_route_copy(), the interface list scan against the indexed
+ * csp_iflist_get_by_subnet() done by csp_send_direct() for every packet, and
+ * csp_sendto() as a whole, for increasing table sizes.
+ *
+ * Build with and without CSP_USE_RTABLE_FIB to compare csp_sendto().
+ */
+
+#include <csp/csp.h>
+#include <csp/csp_id.h>
+#include <csp/csp_rtable.h>
+#include <csp_autoconfig.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_TIME_NS 50000000
+#define BENCH_ADDRESSES (1 << 14)
+#define BENCH_MAX_TX 8
+
+/* Interfaces, with overlapping subnets and one without */
+static csp_iface_t bench_ifaces[] = {
+	{.name = "B0", .addr = 100, .netmask = 8},
+	{.name = "B1", .addr = 5000, .netmask = 10},
+	{.name = "B2", .addr = 9000, .netmask = 0},
+	{.name = "B3", .addr = 12000, .netmask = 6},
+	{.name = "B4", .addr = 110, .netmask = 12},
+};
+#define BENCH_IFACES (sizeof(bench_ifaces) / sizeof(bench_ifaces[0]))
+
+/* Transmissions of the last packet sent */
+static struct {
+	csp_iface_t * iface;
+	uint16_t via;
+} bench_tx[BENCH_MAX_TX];
+static unsigned int bench_tx_count;
+
+/* Copy of the routing table for the reference scan */
+static csp_route_t bench_routes[CSP_RTABLE_SIZE];
+static unsigned int bench_route_count;
+
+static uint64_t bench_now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+/* Next interface on the subnet of addr, by scanning the list as csp_iflist_get_by_subnet() did */
+static csp_iface_t * bench_scan_subnet(uint16_t addr, csp_iface_t * ifc) {
+
+	for (ifc = (ifc == NULL) ? csp_iflist_get() : ifc->next; ifc != NULL; ifc = ifc->next) {
+		if (ifc->netmask == 0) {
+			continue;
+		}
+		const uint16_t netmask = ((1 << ifc->netmask) - 1) << (csp_id_get_host_bits() - ifc->netmask);
+		if ((ifc->addr & netmask) == (addr & netmask)) {
+			return ifc;
+		}
+	}
+
+	return NULL;
+}
+
+static int bench_nexthop(csp_iface_t * iface, uint16_t via, csp_packet_t * packet) {
+	if (bench_tx_count < BENCH_MAX_TX) {
+		bench_tx[bench_tx_count].iface = iface;
+		bench_tx[bench_tx_count].via = via;
+	}
+	bench_tx_count++;
+	csp_buffer_free(packet);
+	return CSP_ERR_NONE;
+}
+
+static bool bench_copy_route(void * ctx, csp_route_t * route) {
+	bench_routes[bench_route_count++] = *route;
+	return true;
+}
+
+/* Longest prefix match by scanning the table, as csp_rtable_find_route() did */
+static const csp_route_t * bench_scan_route(uint16_t addr) {
+
+	int best_result = -1;
+	uint16_t best_result_mask = 0;
+
+	for (unsigned int i = 0; i < bench_route_count; i++) {
+		uint16_t hostbits = (1 << (csp_id_get_host_bits() - bench_routes[i].netmask)) - 1;
+		uint16_t netbits = ~hostbits;
+		if ((bench_routes[i].address & netbits) == (addr & netbits)) {
+			if (bench_routes[i].netmask >= best_result_mask) {
+				best_result = i;
+				best_result_mask = bench_routes[i].netmask;
+			}
+		}
+	}
+
+	return (best_result > -1) ? &bench_routes[best_result] : NULL;
+}
+
+static void bench_fill(unsigned int count) {
+
+	csp_rtable_clear();
+	for (unsigned int i = 0; i < count; i++) {
+		const int netmask = (rand() % 3 == 0) ? 14 : (rand() % 15);
+		const uint16_t via = (rand() % 2) ? CSP_NO_VIA_ADDRESS : (rand() % BENCH_ADDRESSES);
+		if (csp_rtable_set(rand() % BENCH_ADDRESSES, netmask, &bench_ifaces[rand() % BENCH_IFACES], via) != CSP_ERR_NONE) {
+			break;
+		}
+	}
+
+	bench_route_count = 0;
+	csp_rtable_iterate(bench_copy_route, NULL);
+}
+
+static int bench_send(uint16_t addr) {
+	csp_packet_t * packet = csp_buffer_get(0);
+	if (packet == NULL) {
+		return -1;
+	}
+	packet->length = 16;
+	bench_tx_count = 0;
+	csp_sendto(CSP_PRIO_NORM, addr, 10, 10, 0, packet);
+	return 0;
+}
+
+/* Compare the transmissions of each address with a scan of interfaces and routes */
+static int bench_verify(void) {
+
+	for (uint16_t addr = 1; addr < BENCH_ADDRESSES; addr++) {
+
+		if (bench_send(addr) != 0) {
+			return -1;
+		}
+
+		unsigned int expected = 0;
+		csp_iface_t * ifc = NULL;
+		while ((ifc = bench_scan_subnet(addr, ifc)) != NULL) {
+			if (csp_iflist_get_by_subnet(addr, (expected == 0) ? NULL : bench_tx[expected - 1].iface) != ifc) {
+				return -1;
+			}
+			if ((expected >= bench_tx_count) || (bench_tx[expected].iface != ifc) || (bench_tx[expected].via != CSP_NO_VIA_ADDRESS)) {
+				return -1;
+			}
+			expected++;
+		}
+
+		if (expected == 0) {
+			const csp_route_t * route = bench_scan_route(addr);
+			if (route != NULL) {
+				if ((bench_tx_count == 0) || (bench_tx[0].iface != route->iface) || (bench_tx[0].via != route->via)) {
+					return -1;
+				}
+				expected++;
+			}
+		}
+
+		if (bench_tx_count != expected) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char * argv[]) {
+
+	csp_conf.version = 2;
+	csp_init();
+
+	for (unsigned int i = 0; i < BENCH_IFACES; i++) {
+		bench_ifaces[i].nexthop = bench_nexthop;
+		csp_iflist_add(&bench_ifaces[i]);
+	}
+
+	srand(1);
+
+	int ret = 0;
+	printf("%-8s %14s %14s %14s %14s %14s\n", "routes", "scan", "find_route", "subnet scan", "get_by_subnet", "csp_sendto");
+
+	for (unsigned int size = 1;; size *= 2) {
+
+		if (size > CSP_RTABLE_SIZE) {
+			size = CSP_RTABLE_SIZE;
+		}
+
+		/* Several random tables of this size */
+		for (unsigned int n = 0; n < 10; n++) {
+			bench_fill(size);
+			if (bench_verify() != 0) {
+				printf("%-8u MISMATCH\n", size);
+				ret = 1;
+				break;
+			}
+		}
+
+		/* ns per lookup, over all addresses */
+		double ns[5];
+		for (unsigned int m = 0; m < 5; m++) {
+			volatile uintptr_t sink = 0;
+			uint64_t calls = 0;
+			const uint64_t start = bench_now_ns();
+			uint64_t elapsed;
+			do {
+				for (uint16_t addr = 1; addr < BENCH_ADDRESSES; addr += 7) {
+					switch (m) {
+						case 0:
+							sink ^= (uintptr_t)bench_scan_route(addr);
+							break;
+						case 1: {
+							csp_route_t route;
+							if (csp_rtable_find_route_copy(addr, &route)) {
+								sink ^= (uintptr_t)route.iface;
+							}
+							break;
+						}
+						case 2: {
+							csp_iface_t * ifc = NULL;
+							while ((ifc = bench_scan_subnet(addr, ifc)) != NULL) {
+								sink ^= (uintptr_t)ifc;
+							}
+							break;
+						}
+						case 3: {
+							csp_iface_t * ifc = NULL;
+							while ((ifc = csp_iflist_get_by_subnet(addr, ifc)) != NULL) {
+								sink ^= (uintptr_t)ifc;
+							}
+							break;
+						}
+						case 4:
+							bench_send(addr);
+							break;
+					}
+					calls++;
+				}
+				elapsed = bench_now_ns() - start;
+			} while (elapsed < BENCH_TIME_NS);
+			(void)sink;
+			ns[m] = (double)elapsed / calls;
+		}
+
+		printf("%-8u %12.1fns %12.1fns %12.1fns %12.1fns %12.1fns\n", bench_route_count, ns[0], ns[1], ns[2], ns[3], ns[4]);
+
+		if (size == CSP_RTABLE_SIZE) {
+			break;
+		}
+	}
+
+	return ret;
+}
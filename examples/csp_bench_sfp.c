@@ -0,0 +1,252 @@
+/*
+ * SFP selective retransmission benchmark
+ *
+ * Sends transfers with csp_sfp_send_selective() to csp_sfp_recv_selective(),
+ * both in one process, over a link that reorders, duplicates and drops
+ * fragments. Checks that each transfer arrives complete and intact, also when
+ * more disjoint ranges arrive than the receiver tracks (CSP_SFP_MAX_RANGES),
+ * and that a lost final acknowledgement (the NACK without ranges) leaves the
+ * receiver complete, while the sender times out as documented.
+ *
+ * Reports the time, fragments and NACKs of each transfer.
+ */
+
+#include <csp/csp.h>
+#include <csp/csp_iflist.h>
+#include <csp/csp_id.h>
+#include <csp/csp_interface.h>
+#include <csp/csp_sfp.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_PORT 10
+#define BENCH_MTU 32
+#define BENCH_SIZE (BENCH_MTU * ((3 * CSP_SFP_MAX_RANGES) + 5))
+#define BENCH_RX_TIMEOUT 50
+#define BENCH_TX_TIMEOUT 500
+#define BENCH_RETRIES 50
+#define LINK_HOLD 4
+#define LINK_RESERVE 6
+
+/* Link behaviour, fragments are counted from the start of a transfer */
+typedef struct {
+	const char * name;
+	unsigned int reorder;    // Fragments held back and delivered in reverse order, 0 for none
+	unsigned int duplicate;  // Every nth fragment is delivered twice, 0 for none
+	unsigned int drop;       // Every nth fragment is dropped, 0 for none
+	bool drop_ack;           // Drop the final acknowledgement
+	int send_result;         // Expected result of the sender
+} bench_scenario_t;
+
+static const bench_scenario_t bench_scenarios[] = {
+	{"in order", 0, 0, 0, false, CSP_ERR_NONE},
+	{"reordered", LINK_HOLD, 0, 0, false, CSP_ERR_NONE},
+	{"duplicated", 0, 3, 0, false, CSP_ERR_NONE},
+	{"dropped", 0, 0, 5, false, CSP_ERR_NONE},
+	{"every other dropped, range table full", 0, 0, 2, false, CSP_ERR_NONE},
+	{"reordered, duplicated and dropped", LINK_HOLD, 4, 3, false, CSP_ERR_NONE},
+	{"final acknowledgement lost", LINK_HOLD, 0, 4, true, CSP_ERR_TIMEDOUT},
+};
+
+/* Link state */
+static const bench_scenario_t * link_scenario;
+static csp_packet_t * link_held[LINK_HOLD];
+static unsigned int link_held_count;
+static unsigned int link_fragments;
+static unsigned int link_nacks;
+static pthread_mutex_t link_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static csp_iface_t link_iface = {
+	.name = "LINK",
+};
+
+/* Transfer data and the received copy */
+static uint8_t bench_data[BENCH_SIZE];
+static uint8_t bench_received[BENCH_SIZE];
+static uint32_t bench_written;
+
+static uint64_t bench_now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+/* Deliver the fragments held back, the last first */
+static void link_flush(void) {
+	while (link_held_count > 0) {
+		csp_qfifo_write(link_held[--link_held_count], &link_iface, NULL);
+	}
+}
+
+static int link_tx(csp_iface_t * iface, uint16_t via, csp_packet_t * packet) {
+
+	/* The buffer pool is small, so the sender waits for the receiver to free buffers, the NACKs from the receiver are never held up */
+	if (packet->id.flags & CSP_FFRAG) {
+		for (unsigned int i = 0; (i < 1000) && (csp_buffer_remaining() < LINK_RESERVE); i++) {
+			usleep(100);
+		}
+	}
+
+	pthread_mutex_lock(&link_lock);
+	const bench_scenario_t * scenario = link_scenario;
+
+	/* NACKs pass, after the fragments held back */
+	if ((packet->id.flags & CSP_FFRAG) == 0) {
+		link_nacks++;
+		link_flush();
+		if (scenario->drop_ack && (packet->length >= 2) && (packet->data[1] == 0)) {
+			csp_buffer_free(packet);
+		} else {
+			csp_qfifo_write(packet, &link_iface, NULL);
+		}
+		pthread_mutex_unlock(&link_lock);
+		return CSP_ERR_NONE;
+	}
+
+	const unsigned int n = ++link_fragments;
+	if (scenario->drop && ((n % scenario->drop) == 0)) {
+		csp_buffer_free(packet);
+		pthread_mutex_unlock(&link_lock);
+		return CSP_ERR_NONE;
+	}
+
+	if (scenario->duplicate && ((n % scenario->duplicate) == 0)) {
+		csp_packet_t * copy = csp_buffer_clone(packet);
+		if (copy != NULL) {
+			csp_qfifo_write(copy, &link_iface, NULL);
+		}
+	}
+
+	if (scenario->reorder) {
+		link_held[link_held_count++] = packet;
+		if (link_held_count == scenario->reorder) {
+			link_flush();
+		}
+	} else {
+		csp_qfifo_write(packet, &link_iface, NULL);
+	}
+
+	pthread_mutex_unlock(&link_lock);
+	return CSP_ERR_NONE;
+}
+
+static void * router_task(void * param) {
+	while (1) {
+		csp_route_work();
+	}
+	return NULL;
+}
+
+static int bench_write(uint32_t offset, const void * data, uint32_t length, uint32_t totalsize, void * context) {
+	if ((totalsize != BENCH_SIZE) || (offset > totalsize) || (length > (totalsize - offset))) {
+		return CSP_ERR_INVAL;
+	}
+	memcpy(&bench_received[offset], data, length);
+	bench_written += length;
+	return CSP_ERR_NONE;
+}
+
+typedef struct {
+	csp_socket_t * sock;
+	int sport;
+	int result;
+	uint32_t size;
+} bench_receiver_t;
+
+static void * receiver_task(void * param) {
+
+	bench_receiver_t * receiver = param;
+	receiver->result = CSP_ERR_TIMEDOUT;
+
+	/* Fragments retransmitted after the previous transfer completed open connections of their own, skip them */
+	csp_conn_t * conn;
+	while ((conn = csp_accept(receiver->sock, 1000)) != NULL) {
+		if (csp_conn_sport(conn) == receiver->sport) {
+			break;
+		}
+		csp_close(conn);
+	}
+	if (conn == NULL) {
+		return NULL;
+	}
+	receiver->result = csp_sfp_recv_selective(conn, bench_write, NULL, &receiver->size, BENCH_RX_TIMEOUT, BENCH_RETRIES, NULL);
+	csp_close(conn);
+	return NULL;
+}
+
+static bool bench_run(csp_socket_t * sock, const bench_scenario_t * scenario) {
+
+	pthread_mutex_lock(&link_lock);
+	link_scenario = scenario;
+	link_fragments = 0;
+	link_nacks = 0;
+	pthread_mutex_unlock(&link_lock);
+
+	memset(bench_received, 0, sizeof(bench_received));
+	bench_written = 0;
+
+	const uint64_t start = bench_now_us();
+	csp_conn_t * conn = csp_connect(CSP_PRIO_NORM, csp_get_address(), BENCH_PORT, 0, CSP_O_NONE);
+	if (conn == NULL) {
+		printf("%-40s connect failed\n", scenario->name);
+		return false;
+	}
+
+	bench_receiver_t receiver = {.sock = sock, .sport = csp_conn_dport(conn)};
+	pthread_t thread;
+	pthread_create(&thread, NULL, receiver_task, &receiver);
+
+	const int send_result = csp_sfp_send_selective(conn, bench_data, BENCH_SIZE, BENCH_MTU, BENCH_TX_TIMEOUT, (csp_memcpy_fnc_t)&memcpy);
+	csp_close(conn);
+	pthread_join(thread, NULL);
+	const uint64_t elapsed = bench_now_us() - start;
+
+	/* Each byte is written once */
+	const bool ok = (send_result == scenario->send_result) &&
+					(receiver.result == CSP_ERR_NONE) &&
+					(receiver.size == BENCH_SIZE) &&
+					(bench_written == BENCH_SIZE) &&
+					(memcmp(bench_data, bench_received, BENCH_SIZE) == 0);
+
+	printf("%-40s %8.1f %9u %6u %6d %6d   %s\n", scenario->name, elapsed / 1000.0, link_fragments, link_nacks,
+		   send_result, receiver.result, ok ? "ok" : "FAILED");
+
+	return ok;
+}
+
+int main(int argc, char * argv[]) {
+
+	csp_conf.version = 2;
+	csp_conf.address = 1;
+	csp_init();
+
+	link_iface.addr = csp_conf.address;
+	link_iface.netmask = csp_id_get_host_bits();
+	link_iface.nexthop = link_tx;
+	csp_iflist_add(&link_iface);
+
+	pthread_t router;
+	pthread_create(&router, NULL, router_task, NULL);
+
+	csp_socket_t sock = {0};
+	csp_bind(&sock, BENCH_PORT);
+	csp_listen(&sock, 1);
+
+	for (unsigned int i = 0; i < sizeof(bench_data); i++) {
+		bench_data[i] = (i * 7) + (i >> 8);
+	}
+
+	printf("%u bytes in fragments of %u bytes, receiver tracks %u ranges\n", BENCH_SIZE, BENCH_MTU, CSP_SFP_MAX_RANGES);
+	printf("%-40s %8s %9s %6s %6s %6s\n", "link", "ms", "fragments", "nacks", "send", "recv");
+
+	int failed = 0;
+	for (unsigned int i = 0; i < sizeof(bench_scenarios) / sizeof(bench_scenarios[0]); i++) {
+		failed += !bench_run(&sock, &bench_scenarios[i]);
+	}
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,210 @@
+/*
+ * UDP interface throughput benchmark
+ *
+ * Sets up UDP interfaces talking to a receiving UDP interface over loopback,
+ * one per sender task, and sends packets from them as fast as the sender tasks
+ * can get buffers. Each sender is a flow of its own (a UDP source port), so
+ * the flows can be spread over several receive tasks. The receiving interface
+ * hands the packets to the router, which delivers them to a callback counting
+ * them, and checking that the packets of each flow arrive in order.
+ *
+ * Reports packets per second sent and received, and the interface counters.
+ * With -R, the interfaces are served by the io_uring reactor, and the system
+ * calls per packet are reported too.
+ */
+
+#include <csp/csp.h>
+#include <csp/csp_iflist.h>
+#include <csp/csp_rtable.h>
+#include <csp/interfaces/csp_if_udp.h>
+#if (CSP_USE_IO_URING)
+#include <csp/drivers/reactor.h>
+#endif
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BENCH_PORT 10
+#define BENCH_MAX_SENDERS 16
+#define BENCH_TX_ADDR 100
+#define BENCH_RX_ADDR 200
+
+static csp_iface_t bench_tx_iface[BENCH_MAX_SENDERS];
+static csp_if_udp_conf_t bench_tx_conf[BENCH_MAX_SENDERS];
+static csp_iface_t bench_rx_iface;
+static csp_if_udp_conf_t bench_rx_conf = {.host = NULL, .lport = 9811};
+
+static unsigned int bench_seconds = 2;
+static unsigned int bench_senders = 1;
+static unsigned int bench_length = 100;
+static unsigned int bench_reactor = 0;
+
+static atomic_bool bench_running = true;
+static atomic_uint bench_sent;
+static atomic_uint bench_received;
+static atomic_uint bench_reordered;
+
+/* Last sequence number received from each sender */
+static uint32_t bench_last_seq[BENCH_MAX_SENDERS];
+
+static void bench_callback(csp_packet_t * packet) {
+	const unsigned int sender = packet->id.src - BENCH_TX_ADDR;
+	uint32_t seq;
+	memcpy(&seq, packet->data, sizeof(seq));
+	if ((sender < BENCH_MAX_SENDERS) && (seq <= bench_last_seq[sender])) {
+		atomic_fetch_add(&bench_reordered, 1);
+	}
+	bench_last_seq[sender] = seq;
+	atomic_fetch_add(&bench_received, 1);
+	csp_buffer_free(packet);
+}
+
+static void * bench_router(void * param) {
+	while (1) {
+		csp_route_work();
+	}
+	return NULL;
+}
+
+static void * bench_sender(void * param) {
+	csp_iface_t * iface = param;
+	uint32_t seq = 0;
+	while (atomic_load(&bench_running)) {
+		csp_packet_t * packet = csp_buffer_get(bench_length);
+		if (packet == NULL) {
+			sched_yield();
+			continue;
+		}
+		seq++;
+		memset(packet->data, 0x55, bench_length);
+		memcpy(packet->data, &seq, sizeof(seq));
+		packet->length = bench_length;
+		packet->id.pri = CSP_PRIO_NORM;
+		packet->id.src = iface->addr;
+		packet->id.dst = BENCH_RX_ADDR;
+		packet->id.dport = BENCH_PORT;
+		packet->id.sport = BENCH_PORT;
+		packet->id.flags = 0;
+		if (iface->nexthop(iface, CSP_NO_VIA_ADDRESS, packet) != CSP_ERR_NONE) {
+			csp_buffer_free(packet);
+			continue;
+		}
+		atomic_fetch_add(&bench_sent, 1);
+	}
+	return NULL;
+}
+
+int main(int argc, char * argv[]) {
+
+	int opt;
+	while ((opt = getopt(argc, argv, "l:n:r:R:s:t:")) != -1) {
+		switch (opt) {
+			case 'l':
+				bench_length = atoi(optarg);
+				break;
+			case 'n':
+				bench_rx_conf.rx_threads = atoi(optarg);
+				break;
+			case 'r':
+				bench_rx_conf.rcvbuf = atoi(optarg);
+				break;
+			case 'R':
+				bench_reactor = atoi(optarg);
+				break;
+			case 's':
+				bench_seconds = atoi(optarg);
+				break;
+			case 't':
+				bench_senders = atoi(optarg);
+				break;
+			default:
+				printf("Usage: %s [-l length] [-n rx tasks] [-r rcvbuf] [-R reactor tasks] [-s seconds] [-t senders]\n", argv[0]);
+				return 1;
+		}
+	}
+	if ((bench_senders == 0) || (bench_senders > BENCH_MAX_SENDERS) || (bench_length < sizeof(uint32_t)) || (bench_length > csp_buffer_data_size())) {
+		printf("Invalid options\n");
+		return 1;
+	}
+
+	csp_conf.version = 2;
+	csp_init();
+
+	if (bench_reactor > 0) {
+#if (CSP_USE_IO_URING)
+		if (csp_reactor_init(bench_reactor) != CSP_ERR_NONE) {
+			printf("Reactor not available\n");
+			return 1;
+		}
+#else
+		printf("Reactor not built\n");
+		return 1;
+#endif
+	}
+
+	bench_rx_iface.addr = BENCH_RX_ADDR;
+	csp_if_udp_init(&bench_rx_iface, &bench_rx_conf);
+	bench_rx_iface.name = "UDPRX";
+	csp_iflist_update(&bench_rx_iface);
+
+	for (unsigned int i = 0; i < bench_senders; i++) {
+		bench_tx_conf[i].host = "127.0.0.1";
+		bench_tx_conf[i].lport = 9830 + i;
+		bench_tx_conf[i].rport = bench_rx_conf.lport;
+		bench_tx_iface[i].addr = BENCH_TX_ADDR + i;
+		csp_if_udp_init(&bench_tx_iface[i], &bench_tx_conf[i]);
+	}
+
+	csp_bind_callback(bench_callback, BENCH_PORT);
+
+	/* One router task, several would reorder the packets of a flow */
+	pthread_t router;
+	pthread_create(&router, NULL, bench_router, NULL);
+
+	/* Let the receive tasks start */
+	usleep(100000);
+
+	pthread_t senders[BENCH_MAX_SENDERS];
+	for (unsigned int i = 0; i < bench_senders; i++) {
+		pthread_create(&senders[i], NULL, bench_sender, &bench_tx_iface[i]);
+	}
+
+	sleep(bench_seconds);
+	atomic_store(&bench_running, false);
+	for (unsigned int i = 0; i < bench_senders; i++) {
+		pthread_join(senders[i], NULL);
+	}
+
+	/* Let the last packets arrive */
+	usleep(100000);
+
+	const unsigned int sent = atomic_load(&bench_sent);
+	const unsigned int received = atomic_load(&bench_received);
+	printf("Senders %u, rx tasks %u, %u bytes: sent %.0f packets/s, received %.0f packets/s, lost %u, reordered %u\n",
+		   bench_senders, bench_rx_conf.rx_threads, bench_length, (double)sent / bench_seconds, (double)received / bench_seconds,
+		   sent - received, atomic_load(&bench_reordered));
+	printf("  %s rx %" PRIu32 " rx_error %" PRIu32 " drop %" PRIu32 "\n",
+		   bench_rx_iface.name, bench_rx_iface.rx, bench_rx_iface.rx_error, bench_rx_iface.drop);
+	for (unsigned int i = 0; i < bench_rx_conf.rx_threads; i++) {
+		const csp_if_udp_rx_t * rx = &bench_rx_conf.rx[i];
+		printf("  rx task %u: frames %" PRIu32 " bursts %" PRIu32 " rx_error %" PRIu32 " drop %" PRIu32 "\n",
+			   i, rx->frames, rx->bursts, rx->rx_error, rx->drop);
+	}
+#if (CSP_USE_IO_URING)
+	if (bench_reactor > 0) {
+		csp_reactor_stats_t stats;
+		csp_reactor_get_stats(&stats);
+		printf("  reactor tasks %u: enter %" PRIu32 " submitted %" PRIu32 " completed %" PRIu32 " rx %" PRIu32 " tx %" PRIu32 " tx_error %" PRIu32 " no_buffer %" PRIu32 ", %.2f system calls per packet\n",
+			   bench_reactor, stats.enter, stats.submitted, stats.completed, stats.rx, stats.tx, stats.tx_error, stats.no_buffer,
+			   (stats.rx + stats.tx) ? (double)stats.enter / (stats.rx + stats.tx) : 0.0);
+	}
+#endif
+
+	return ((received > 0) && (atomic_load(&bench_reordered) == 0)) ? 0 : 1;
+}
@@ -0,0 +1,139 @@
+/*
+ * UDP interface with several peers
+ *
+ * Sets up a UDP interface serving two stations, which are UDP interfaces in
+ * the same process, over loopback. Checks that packets are sent to the peer of
+ * their via address, or their destination, that packets without a peer are
+ * not sent, and that the peer of a station is learned from the frames it
+ * sends, only if allowed for its address.
+ */
+
+#include <csp/csp.h>
+#include <csp/csp_iflist.h>
+#include <csp/csp_rtable.h>
+#include <csp/interfaces/csp_if_udp.h>
+
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PEERS_HUB 100
+#define PEERS_STATION_A 10
+#define PEERS_STATION_B 11
+#define PEERS_UNKNOWN 12
+
+static csp_iface_t hub, station_a, station_b;
+static csp_if_udp_conf_t hub_conf = {.host = NULL, .lport = 9820};
+static csp_if_udp_conf_t station_a_conf = {.host = "127.0.0.1", .lport = 9821, .rport = 9820};
+static csp_if_udp_conf_t station_b_conf = {.host = "127.0.0.1", .lport = 9822, .rport = 9820};
+
+/* Send a packet on an interface, returns the result of the interface */
+static int peers_send(csp_iface_t * iface, uint16_t src, uint16_t dst, uint16_t via) {
+	csp_packet_t * packet = csp_buffer_get(0);
+	if (packet == NULL) {
+		return CSP_ERR_NOMEM;
+	}
+	packet->id.pri = CSP_PRIO_NORM;
+	packet->id.src = src;
+	packet->id.dst = dst;
+	packet->id.dport = 10;
+	packet->id.sport = 10;
+	packet->length = 8;
+	int ret = iface->nexthop(iface, via, packet);
+	if (ret != CSP_ERR_NONE) {
+		csp_buffer_free(packet);
+	}
+	return ret;
+}
+
+/* Wait for the frames sent to arrive */
+static bool peers_expect(const char * name, csp_iface_t * iface, uint32_t rx) {
+	for (unsigned int i = 0; (i < 100) && (iface->rx < rx); i++) {
+		usleep(10000);
+	}
+	if (iface->rx != rx) {
+		printf("%s: %s received %u, expected %u\n", name, iface->name, (unsigned int)iface->rx, (unsigned int)rx);
+		return false;
+	}
+	return true;
+}
+
+static void * peers_router(void * param) {
+	while (1) {
+		csp_route_work();
+	}
+	return NULL;
+}
+
+int main(int argc, char * argv[]) {
+
+	csp_conf.version = 2;
+	csp_init();
+
+	hub.addr = PEERS_HUB;
+	station_a.addr = PEERS_STATION_A;
+	station_b.addr = PEERS_STATION_B;
+	csp_if_udp_init(&hub, &hub_conf);
+	csp_if_udp_init(&station_a, &station_a_conf);
+	csp_if_udp_init(&station_b, &station_b_conf);
+	hub.name = "HUB";
+	station_a.name = "A";
+	station_b.name = "B";
+	csp_iflist_update(&hub);
+	csp_iflist_update(&station_a);
+	csp_iflist_update(&station_b);
+
+	pthread_t router;
+	pthread_create(&router, NULL, peers_router, NULL);
+
+	bool ok = true;
+	if (csp_if_udp_peer_load(&hub, "10 127.0.0.1:9821, 11 127.0.0.1:9822") != 2) {
+		printf("peers not loaded\n");
+		ok = false;
+	}
+	if (csp_if_udp_peer_load(&hub, "10 localhost:9821") >= 0) {
+		printf("invalid peer loaded\n");
+		ok = false;
+	}
+
+	/* Peer of the via address, or the destination */
+	ok &= (peers_send(&hub, PEERS_HUB, PEERS_STATION_A, CSP_NO_VIA_ADDRESS) == CSP_ERR_NONE);
+	ok &= peers_expect("destination", &station_a, 1);
+	ok &= (peers_send(&hub, PEERS_HUB, PEERS_UNKNOWN, PEERS_STATION_B) == CSP_ERR_NONE);
+	ok &= peers_expect("via", &station_b, 1);
+
+	/* No peer, and no default peer */
+	if (peers_send(&hub, PEERS_HUB, PEERS_UNKNOWN, CSP_NO_VIA_ADDRESS) != CSP_ERR_TX) {
+		printf("sent without peer\n");
+		ok = false;
+	}
+
+	/* Station B learns the endpoint of station A from a frame it sends, from another address */
+	if (csp_if_udp_peer_load(&station_b, "12 learn") != 1) {
+		printf("learning not allowed\n");
+		ok = false;
+	}
+	station_a_conf.peer_addr.sin_port = htons(station_b_conf.lport);
+	ok &= (peers_send(&station_a, PEERS_UNKNOWN, PEERS_STATION_B, CSP_NO_VIA_ADDRESS) == CSP_ERR_NONE);
+	ok &= peers_expect("learned", &station_b, 2);
+	csp_if_udp_peer_t peer;
+	if (!csp_if_udp_peer_get(&station_b, PEERS_UNKNOWN, &peer) || !peer.learned || (ntohs(peer.sockaddr.sin_port) != station_a_conf.lport)) {
+		printf("peer not learned\n");
+		ok = false;
+	}
+
+	/* Other peers are not learned */
+	csp_if_udp_peer_add(&station_b, PEERS_STATION_A, "127.0.0.2", 9999);
+	ok &= (peers_send(&station_a, PEERS_STATION_A, PEERS_STATION_B, CSP_NO_VIA_ADDRESS) == CSP_ERR_NONE);
+	ok &= peers_expect("configured", &station_b, 3);
+	if (!csp_if_udp_peer_get(&station_b, PEERS_STATION_A, &peer) || peer.learned || (ntohs(peer.sockaddr.sin_port) != 9999)) {
+		printf("configured peer changed\n");
+		ok = false;
+	}
+
+	printf("A rx %u, B rx %u, B peers %u\n", (unsigned int)station_a.rx, (unsigned int)station_b.rx, station_b_conf.peer_count);
+	printf("%s\n", ok ? "OK" : "FAILED");
+	return ok ? 0 : 1;
+}
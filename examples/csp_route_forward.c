@@ -0,0 +1,178 @@
+/*
+ * Forwarding benchmark
+ *
+ * Feeds packets not addressed to this node into the router, and routes them
+ * with csp_route_work(), as a node forwarding transit traffic. Checks that
+ * the cached next hops give the same result as the routing table: after a
+ * route changes, for multipath routes, for a destination on the subnet of an
+ * interface (sent without a copy of the packet), and for packets dropped by
+ * split horizon.
+ *
+ * Reports forwarded packets per second to cached next hops, and to the next
+ * hops of a multipath route, which are looked up for every packet.
+ */
+
+#include <csp/csp.h>
+#include <csp/csp_id.h>
+#include <csp/csp_iflist.h>
+#include <csp/csp_rtable.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FWD_PACKETS 1000000
+#define FWD_HOST_A 1000
+#define FWD_HOST_B 1001
+#define FWD_MULTIPATH 1002
+#define FWD_BACK 1003
+#define FWD_LOCAL 0x2010
+
+static csp_iface_t fwd_in = {.name = "IN", .addr = 9000, .netmask = 8};
+static csp_iface_t fwd_a = {.name = "A", .addr = 9001};
+static csp_iface_t fwd_b = {.name = "B", .addr = 9002};
+static csp_iface_t fwd_local = {.name = "L", .addr = 0x2001, .netmask = 6};
+
+/* Last packet sent */
+static csp_iface_t * fwd_last;
+static uint16_t fwd_last_src;
+
+static int fwd_nexthop(csp_iface_t * iface, uint16_t via, csp_packet_t * packet) {
+	fwd_last = iface;
+	fwd_last_src = packet->id.src;
+	csp_buffer_free(packet);
+	return CSP_ERR_NONE;
+}
+
+/* Forward a packet from IN, returns the interface sent on, or NULL */
+static csp_iface_t * fwd_send(uint16_t dst, uint8_t sport) {
+	csp_packet_t * packet = csp_buffer_get(0);
+	if (packet == NULL) {
+		return NULL;
+	}
+	packet->id.pri = CSP_PRIO_NORM;
+	packet->id.src = 10;
+	packet->id.dst = dst;
+	packet->id.dport = 10;
+	packet->id.sport = sport;
+	packet->length = 32;
+	fwd_last = NULL;
+	csp_qfifo_write(packet, &fwd_in, NULL);
+	csp_route_work();
+	return fwd_last;
+}
+
+static bool fwd_expect(const char * name, csp_iface_t * iface, csp_iface_t * expected) {
+	if (iface != expected) {
+		printf("%s: sent on %s, expected %s\n", name, iface ? iface->name : "none", expected ? expected->name : "none");
+		return false;
+	}
+	return true;
+}
+
+/* Forward packets to two destinations, returns the counters of the run */
+static csp_route_stats_t fwd_run(const char * name, uint16_t dst_a, uint16_t dst_b) {
+
+	csp_route_stats_t start_stats, stats;
+	csp_route_get_stats(&start_stats);
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (unsigned int i = 0; i < FWD_PACKETS; i++) {
+		fwd_send((i & 1) ? dst_a : dst_b, 1);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	const double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	csp_route_get_stats(&stats);
+	stats.fast -= start_stats.fast;
+	stats.slow -= start_stats.slow;
+	printf("%-10s %10.0f packets/s, fast %" PRIu32 ", slow %" PRIu32 "\n", name, FWD_PACKETS / seconds, stats.fast, stats.slow);
+
+	return stats;
+}
+
+int main(int argc, char * argv[]) {
+
+	csp_conf.version = 2;
+	csp_init();
+
+	csp_iface_t * ifaces[] = {&fwd_in, &fwd_a, &fwd_b, &fwd_local};
+	for (unsigned int i = 0; i < sizeof(ifaces) / sizeof(ifaces[0]); i++) {
+		ifaces[i]->nexthop = fwd_nexthop;
+		csp_iflist_add(ifaces[i]);
+	}
+
+	csp_rtable_set(FWD_HOST_A, -1, &fwd_a, CSP_NO_VIA_ADDRESS);
+	csp_rtable_set(FWD_HOST_B, -1, &fwd_b, CSP_NO_VIA_ADDRESS);
+	csp_rtable_add_nexthop(FWD_MULTIPATH, -1, &fwd_a, CSP_NO_VIA_ADDRESS, 1);
+	csp_rtable_add_nexthop(FWD_MULTIPATH, -1, &fwd_b, CSP_NO_VIA_ADDRESS, 1);
+	csp_rtable_set(FWD_BACK, -1, &fwd_in, CSP_NO_VIA_ADDRESS);
+
+	bool ok = true;
+	csp_route_stats_t stats;
+
+	/* Cached next hops, until the route changes */
+	for (unsigned int i = 0; i < 3; i++) {
+		ok &= fwd_expect("host A", fwd_send(FWD_HOST_A, 1), &fwd_a);
+		ok &= fwd_expect("host B", fwd_send(FWD_HOST_B, 1), &fwd_b);
+	}
+	csp_rtable_set(FWD_HOST_A, -1, &fwd_b, CSP_NO_VIA_ADDRESS);
+	ok &= fwd_expect("changed route", fwd_send(FWD_HOST_A, 1), &fwd_b);
+	csp_rtable_set(FWD_HOST_A, -1, &fwd_a, CSP_NO_VIA_ADDRESS);
+	ok &= fwd_expect("changed back", fwd_send(FWD_HOST_A, 1), &fwd_a);
+
+	/* Multipath next hops depend on the flow, and are not cached */
+	csp_iface_t * flows[2] = {fwd_send(FWD_MULTIPATH, 1), NULL};
+	for (uint8_t sport = 2; (sport < 64) && (flows[1] == NULL); sport++) {
+		csp_iface_t * iface = fwd_send(FWD_MULTIPATH, sport);
+		if (iface != flows[0]) {
+			flows[1] = iface;
+		}
+	}
+	if ((flows[0] == NULL) || (flows[1] == NULL)) {
+		printf("multipath: flows not spread\n");
+		ok = false;
+	}
+	csp_route_get_stats(&stats);
+	const uint32_t slow = stats.slow;
+	fwd_send(FWD_MULTIPATH, 1);
+	csp_route_get_stats(&stats);
+	if (stats.slow != slow + 1) {
+		printf("multipath: next hop cached\n");
+		ok = false;
+	}
+
+	/* Single interface on the subnet, sent without a copy, from the address of the interface */
+	const int buffers = csp_buffer_remaining();
+	for (unsigned int i = 0; i < 3; i++) {
+		ok &= fwd_expect("local", fwd_send(FWD_LOCAL, 1), &fwd_local);
+		if (fwd_last_src != fwd_local.addr) {
+			printf("local: source %u, expected %u\n", fwd_last_src, fwd_local.addr);
+			ok = false;
+		}
+	}
+	if (csp_buffer_remaining() != buffers) {
+		printf("local: buffers leaked\n");
+		ok = false;
+	}
+
+	/* Split horizon, the packet is dropped */
+	for (unsigned int i = 0; i < 3; i++) {
+		ok &= fwd_expect("split horizon", fwd_send(FWD_BACK, 1), NULL);
+	}
+
+	/* Throughput, misses only while the cache fills */
+	csp_route_stats_t fast = fwd_run("cached", FWD_HOST_A, FWD_HOST_B);
+	if (fast.slow > 2) {
+		ok = false;
+	}
+	fwd_run("multipath", FWD_MULTIPATH, FWD_MULTIPATH);
+
+	csp_route_get_stats(&stats);
+	printf("Total fast %" PRIu32 ", slow %" PRIu32 "\n", stats.fast, stats.slow);
+	printf("%s\n", ok ? "OK" : "FAILED");
+	return ok ? 0 : 1;
+}
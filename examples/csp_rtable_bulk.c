@@ -0,0 +1,234 @@
+/*
+ * Routing table bulk load benchmark
+ *
+ * Resizes the routing table for many routes, and loads a table of host routes,
+ * some with a backup next hop, in four ways: one route at a time, as one bulk
+ * change, from a string, and from a binary snapshot saved to a file and mapped
+ * into memory. Reports the time of each, and checks that each way gives the
+ * same table.
+ *
+ * Then checks that damaged snapshots, and snapshots of interfaces since
+ * changed, are rejected and leave the table unchanged.
+ */
+
+#include <csp/csp.h>
+#include <csp/csp_id.h>
+#include <csp/csp_iflist.h>
+#include <csp/csp_rtable.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BULK_FILE "/tmp/csp_rtable_bulk.bin"
+
+/* Interfaces without subnets */
+static csp_iface_t bulk_ifaces[] = {
+	{.name = "B0", .addr = 16000},
+	{.name = "B1", .addr = 16001},
+	{.name = "B2", .addr = 16002},
+};
+#define BULK_IFACES (sizeof(bulk_ifaces) / sizeof(bulk_ifaces[0]))
+
+typedef struct {
+	uint16_t address;
+	uint16_t netmask;
+	csp_iface_t * iface;
+	uint16_t via;
+	uint8_t weight;
+	uint8_t metric;
+} bulk_route_t;
+
+static unsigned int bulk_count = 5000;
+static bulk_route_t * bulk_routes;
+
+static int bulk_nexthop(csp_iface_t * iface, uint16_t via, csp_packet_t * packet) {
+	csp_buffer_free(packet);
+	return CSP_ERR_NONE;
+}
+
+static double bulk_ms(const struct timespec * start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/* Every fourth next hop is the backup of the route before */
+static void bulk_generate(void) {
+	bulk_routes = calloc(bulk_count, sizeof(*bulk_routes));
+	for (unsigned int i = 0; i < bulk_count; i++) {
+		bulk_route_t * route = &bulk_routes[i];
+		const bool backup = (i % 4) == 3;
+		route->address = 1 + i - (i + 1) / 4;
+		route->netmask = csp_id_get_host_bits();
+		route->iface = &bulk_ifaces[(i + backup) % BULK_IFACES];
+		route->via = i % 4096;
+		route->metric = backup ? 10 : 0;
+	}
+}
+
+/* Compare the table with the generated routes, in order */
+static bool bulk_compare_route(void * ctx, csp_route_t * route) {
+	unsigned int * index = ctx;
+	const bulk_route_t * expected = &bulk_routes[*index];
+	if ((*index == bulk_count) || (route->address != expected->address) || (route->netmask != expected->netmask) ||
+		(route->iface != expected->iface) || (route->via != expected->via) || (route->metric != expected->metric)) {
+		*index = bulk_count + 1;
+		return false;
+	}
+	(*index)++;
+	return true;
+}
+
+static bool bulk_check(const char * name) {
+	unsigned int index = 0;
+	csp_rtable_iterate(bulk_compare_route, &index);
+	if (index != bulk_count) {
+		printf("%s: table differs\n", name);
+		return false;
+	}
+	return true;
+}
+
+static void bulk_report(const char * name, double ms) {
+	printf("  %-16s %10.2f mS %8.3f uS/route\n", name, ms, ms * 1e3 / bulk_count);
+}
+
+static int bulk_load_file(void) {
+	const int fd = open(BULK_FILE, O_RDONLY);
+	struct stat st;
+	if ((fd < 0) || (fstat(fd, &st) != 0)) {
+		return CSP_ERR_INVAL;
+	}
+	void * map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		return CSP_ERR_INVAL;
+	}
+	const int res = csp_rtable_load_binary(map, st.st_size);
+	munmap(map, st.st_size);
+	return res;
+}
+
+int main(int argc, char * argv[]) {
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+			case 'n':
+				bulk_count = atoi(optarg);
+				break;
+			default:
+				printf("Usage: %s [-n routes]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	csp_conf.version = 2;
+	csp_init();
+
+	for (unsigned int i = 0; i < BULK_IFACES; i++) {
+		bulk_ifaces[i].nexthop = bulk_nexthop;
+		csp_iflist_add(&bulk_ifaces[i]);
+	}
+
+	if ((bulk_count == 0) || (bulk_count > 3 * csp_id_get_max_nodeid() / 4)) {
+		printf("Number of routes must be 1 - %u\n", 3 * csp_id_get_max_nodeid() / 4);
+		return 1;
+	}
+	if (csp_rtable_resize(bulk_count) != CSP_ERR_NONE) {
+		printf("Failed to resize routing table\n");
+		return 1;
+	}
+	bulk_generate();
+
+	int ret = 0;
+	struct timespec start;
+	printf("Loading %u routes, table size %u:\n", bulk_count, csp_rtable_get_size());
+
+	/* One at a time */
+	csp_rtable_clear();
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (unsigned int i = 0; i < bulk_count; i++) {
+		const bulk_route_t * route = &bulk_routes[i];
+		if (route->metric) {
+			csp_rtable_add_backup(route->address, route->netmask, route->iface, route->via, route->metric);
+		} else {
+			csp_rtable_set(route->address, route->netmask, route->iface, route->via);
+		}
+	}
+	bulk_report("one at a time", bulk_ms(&start));
+	ret |= !bulk_check("one at a time");
+
+	/* Bulk change */
+	csp_rtable_clear();
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	csp_rtable_batch_t * batch = csp_rtable_batch_begin(true);
+	for (unsigned int i = 0; i < bulk_count; i++) {
+		const bulk_route_t * route = &bulk_routes[i];
+		if (csp_rtable_batch_add(batch, route->address, route->netmask, route->iface, route->via, route->weight, route->metric) != CSP_ERR_NONE) {
+			break;
+		}
+	}
+	csp_rtable_batch_commit(batch);
+	bulk_report("bulk change", bulk_ms(&start));
+	ret |= !bulk_check("bulk change");
+
+	/* String */
+	const size_t string_size = bulk_count * 32;
+	char * string = malloc(string_size);
+	if (csp_rtable_save(string, string_size) != CSP_ERR_NONE) {
+		printf("Failed to save routing table\n");
+		return 1;
+	}
+	csp_rtable_clear();
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	const int loaded = csp_rtable_load(string);
+	bulk_report("string", bulk_ms(&start));
+	ret |= !bulk_check("string");
+	printf("  %zu bytes, %d entries\n", strlen(string), loaded);
+
+	/* Binary snapshot, through a file */
+	const int size = csp_rtable_save_binary(NULL, 0);
+	void * snapshot = malloc(size);
+	FILE * file = fopen(BULK_FILE, "wb");
+	if ((csp_rtable_save_binary(snapshot, size) != size) || (file == NULL) || (fwrite(snapshot, size, 1, file) != 1)) {
+		printf("Failed to save binary snapshot\n");
+		return 1;
+	}
+	fclose(file);
+	csp_rtable_clear();
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	const int restored = bulk_load_file();
+	bulk_report("binary snapshot", bulk_ms(&start));
+	ret |= !bulk_check("binary snapshot");
+	printf("  %d bytes, %d routes\n", size, restored);
+
+	/* Rejected snapshots leave the table */
+	uint8_t * damaged = malloc(size);
+	memcpy(damaged, snapshot, size);
+	damaged[size - 1] ^= 1;
+	if ((csp_rtable_load_binary(damaged, size) != CSP_ERR_INVAL) || (csp_rtable_load_binary(snapshot, size - 1) != CSP_ERR_INVAL)) {
+		printf("Damaged snapshot loaded\n");
+		ret = 1;
+	}
+	bulk_ifaces[1].addr++;
+	csp_iflist_update(&bulk_ifaces[1]);
+	if (csp_rtable_load_binary(snapshot, size) != CSP_ERR_INVAL) {
+		printf("Snapshot of changed interface loaded\n");
+		ret = 1;
+	}
+	bulk_ifaces[1].addr--;
+	csp_iflist_update(&bulk_ifaces[1]);
+	ret |= !bulk_check("rejected snapshot");
+
+	unlink(BULK_FILE);
+
+	printf("%s\n", ret ? "FAILED" : "OK");
+	return ret;
+}
@@ -0,0 +1,248 @@
+/*
+ * Multipath routing check
+ *
+ * Sets up a route with weighted next hops over three interfaces, and sends
+ * packets of many flows (source and destination ports). Checks that every
+ * packet of a flow takes the same next hop, that flows are spread by weight,
+ * that flows move away from a next hop whose interface reports transmit
+ * errors, and that only those flows move.
+ *
+ * Then sets up a route with a backup next hop, starts the route monitor and
+ * fails the primary interface while idle. Checks that the monitor probes find
+ * the failure, and that the route switches to the backup within the bound of
+ * (down_count + 1) * interval, and back again after the interface recovers.
+ */
+
+#include <csp/csp.h>
+#include <csp/csp_rtable.h>
+#include <csp/arch/csp_time.h>
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MP_FLOWS 1024
+#define MP_DST 200
+#define MP_BACKUP_DST 300
+#define MP_INTERVAL 50
+#define MP_DOWN_COUNT 2
+
+static csp_iface_t mp_ifaces[] = {
+	{.name = "M0", .addr = 9000},
+	{.name = "M1", .addr = 9001},
+	{.name = "M2", .addr = 9002},
+};
+#define MP_IFACES (sizeof(mp_ifaces) / sizeof(mp_ifaces[0]))
+
+static const uint8_t mp_weights[MP_IFACES] = {1, 2, 5};
+
+/* Interface of the last packet sent, not counting probes */
+static csp_iface_t * mp_last;
+
+/* Interfaces failing to transmit */
+static atomic_bool mp_failing[MP_IFACES];
+
+/* Time of the last monitor event, and state */
+static atomic_uint mp_event_ms;
+static atomic_bool mp_event_down;
+
+static int mp_nexthop(csp_iface_t * iface, uint16_t via, csp_packet_t * packet) {
+	if (atomic_load(&mp_failing[iface - mp_ifaces])) {
+		return CSP_ERR_TX;
+	}
+	if (packet->id.dport != CSP_PING) {
+		mp_last = iface;
+	}
+	csp_buffer_free(packet);
+	return CSP_ERR_NONE;
+}
+
+static void mp_event(void * ctx, csp_iface_t * iface, bool down) {
+	printf("  Event: %s %s\n", iface->name, down ? "down" : "up");
+	atomic_store(&mp_event_down, down);
+	atomic_store(&mp_event_ms, csp_get_ms());
+}
+
+static void * mp_router(void * param) {
+	while (1) {
+		csp_route_work();
+	}
+	return NULL;
+}
+
+/* Wait for a monitor event, returns the time it took in mS, or -1 */
+static int mp_wait_event(bool down) {
+	const uint32_t start = csp_get_ms();
+	while (csp_get_ms() - start < 20 * MP_INTERVAL) {
+		if ((atomic_load(&mp_event_ms) != 0) && (atomic_load(&mp_event_down) == down)) {
+			return atomic_load(&mp_event_ms) - start;
+		}
+		usleep(1000);
+	}
+	return -1;
+}
+
+/* Send a packet of a flow, returns the index of the interface used, or -1 */
+static int mp_send_to(uint16_t dst, unsigned int flow) {
+	csp_packet_t * packet = csp_buffer_get(0);
+	if (packet == NULL) {
+		return -1;
+	}
+	packet->length = 16;
+	mp_last = NULL;
+	csp_sendto(CSP_PRIO_NORM, dst, 2 + (flow % 60), 1 + (flow / 60), 0, packet);
+	return (mp_last != NULL) ? (int)(mp_last - mp_ifaces) : -1;
+}
+
+static int mp_send(unsigned int flow) {
+	return mp_send_to(MP_DST, flow);
+}
+
+static bool mp_print_route(void * ctx, csp_route_t * route) {
+	if (route->weight != 0) {
+		printf("  %s weight %u tx %" PRIu32 " avoided %" PRIu32 "\n", route->iface->name, route->weight, route->tx, route->tx_avoided);
+	}
+	return true;
+}
+
+int main(int argc, char * argv[]) {
+
+	csp_conf.version = 2;
+	csp_init();
+
+	for (unsigned int i = 0; i < MP_IFACES; i++) {
+		mp_ifaces[i].nexthop = mp_nexthop;
+		csp_iflist_add(&mp_ifaces[i]);
+	}
+
+	for (unsigned int i = 0; i < MP_IFACES; i++) {
+		if (csp_rtable_add_nexthop(MP_DST, -1, &mp_ifaces[i], CSP_NO_VIA_ADDRESS, mp_weights[i]) != CSP_ERR_NONE) {
+			printf("Failed to add next hop\n");
+			return 1;
+		}
+	}
+
+	int ret = 0;
+	int path[MP_FLOWS];
+	unsigned int flows[MP_IFACES] = {0};
+
+	/* Each flow takes one next hop */
+	for (unsigned int flow = 0; flow < MP_FLOWS; flow++) {
+		path[flow] = mp_send(flow);
+		if ((path[flow] < 0) || (mp_send(flow) != path[flow])) {
+			printf("Flow %u changed next hop\n", flow);
+			ret = 1;
+		}
+		if (path[flow] >= 0) {
+			flows[path[flow]]++;
+		}
+	}
+
+	/* Flows spread by weight, within 25% */
+	printf("Flows per next hop:\n");
+	for (unsigned int i = 0; i < MP_IFACES; i++) {
+		const unsigned int expected = MP_FLOWS * mp_weights[i] / (1 + 2 + 5);
+		printf("  %s weight %u: %u flows, expected %u\n", mp_ifaces[i].name, mp_weights[i], flows[i], expected);
+		if ((flows[i] < expected * 3 / 4) || (flows[i] > expected * 5 / 4)) {
+			ret = 1;
+		}
+	}
+
+	/* Transmit error on M2, only its flows move */
+	mp_ifaces[2].tx_error++;
+	unsigned int moved = 0;
+	for (unsigned int flow = 0; flow < MP_FLOWS; flow++) {
+		const int hop = mp_send(flow);
+		if (hop == 2) {
+			printf("Flow %u still uses failing next hop\n", flow);
+			ret = 1;
+		} else if (hop != path[flow]) {
+			if (path[flow] != 2) {
+				printf("Flow %u moved from healthy next hop\n", flow);
+				ret = 1;
+			}
+			moved++;
+		}
+	}
+	printf("Moved %u flows from failing %s\n", moved, mp_ifaces[2].name);
+	if (moved != flows[2]) {
+		ret = 1;
+	}
+
+	/* Flows return after the hold-down time */
+	usleep((CSP_RTABLE_MULTIPATH_HOLDDOWN_MS + 100) * 1000);
+	for (unsigned int flow = 0; flow < MP_FLOWS; flow++) {
+		if (mp_send(flow) != path[flow]) {
+			printf("Flow %u did not return to its next hop\n", flow);
+			ret = 1;
+			break;
+		}
+	}
+
+	csp_rtable_iterate(mp_print_route, NULL);
+
+	/* Removing next hops leaves a single route */
+	csp_rtable_remove_nexthop(MP_DST, -1, &mp_ifaces[0], CSP_NO_VIA_ADDRESS);
+	csp_rtable_remove_nexthop(MP_DST, -1, &mp_ifaces[2], CSP_NO_VIA_ADDRESS);
+	for (unsigned int flow = 0; flow < MP_FLOWS; flow += 17) {
+		if (mp_send(flow) != 1) {
+			printf("Flow %u not on the remaining next hop\n", flow);
+			ret = 1;
+			break;
+		}
+	}
+
+	/* Backup route, the monitor finds the idle primary failing by its probes */
+	pthread_t router;
+	pthread_create(&router, NULL, mp_router, NULL);
+
+	csp_rtable_set(MP_BACKUP_DST, -1, &mp_ifaces[0], CSP_NO_VIA_ADDRESS);
+	csp_rtable_add_backup(MP_BACKUP_DST, -1, &mp_ifaces[1], CSP_NO_VIA_ADDRESS, 10);
+	if (mp_send_to(MP_BACKUP_DST, 0) != 0) {
+		printf("Primary not used\n");
+		ret = 1;
+	}
+
+	const csp_rtable_monitor_conf_t conf = {
+		.interval = MP_INTERVAL,
+		.down_count = MP_DOWN_COUNT,
+		.up_count = 2,
+		.probe = true,
+		.event = mp_event,
+	};
+	csp_rtable_monitor_start(&conf);
+	usleep(3 * MP_INTERVAL * 1000);
+
+	printf("Failing %s, bound %u mS:\n", mp_ifaces[0].name, (MP_DOWN_COUNT + 1) * MP_INTERVAL);
+	atomic_store(&mp_failing[0], true);
+	int elapsed = mp_wait_event(true);
+	printf("  Down after %d mS\n", elapsed);
+	if ((elapsed < 0) || (elapsed > (MP_DOWN_COUNT + 1) * MP_INTERVAL + MP_INTERVAL / 2)) {
+		ret = 1;
+	}
+	for (unsigned int flow = 0; flow < MP_FLOWS; flow += 17) {
+		if (mp_send_to(MP_BACKUP_DST, flow) != 1) {
+			printf("Flow %u not on the backup next hop\n", flow);
+			ret = 1;
+			break;
+		}
+	}
+
+	printf("Recovering %s:\n", mp_ifaces[0].name);
+	atomic_store(&mp_failing[0], false);
+	elapsed = mp_wait_event(false);
+	printf("  Up after %d mS\n", elapsed);
+	if ((elapsed < 0) || (mp_send_to(MP_BACKUP_DST, 0) != 0)) {
+		printf("Primary not used again\n");
+		ret = 1;
+	}
+
+	csp_rtable_monitor_stop();
+
+	printf("%s\n", ret ? "FAILED" : "OK");
+	return ret;
+}
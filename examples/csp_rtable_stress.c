@@ -0,0 +1,175 @@
+/*
+ * Routing table stress test
+ *
+ * Sender tasks send packets to random destinations as fast as possible, while
+ * a churn task changes the routes to these destinations between interfaces,
+ * clears and reloads the table, and changes interface addresses. Each route
+ * encodes its interface and destination in the via address, so the interfaces
+ * can check that every packet was routed by a complete route entry.
+ *
+ * Reports packets and route changes per second, and the number of misrouted
+ * packets, which must be 0.
+ */
+
+#include <csp/csp.h>
+#include <csp/csp_rtable.h>
+#include <csp_autoconfig.h>
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Host routes, and a default route */
+#define STRESS_DESTINATIONS (CSP_RTABLE_SIZE - 1)
+#define STRESS_DEFAULT_VIA 4095
+#define STRESS_MAX_SENDERS 16
+
+/* Interfaces without subnets, so all packets are routed */
+static csp_iface_t stress_ifaces[] = {
+	{.name = "S0", .addr = 9000},
+	{.name = "S1", .addr = 9001},
+	{.name = "S2", .addr = 9002},
+	{.name = "S3", .addr = 9003},
+};
+#define STRESS_IFACES (sizeof(stress_ifaces) / sizeof(stress_ifaces[0]))
+
+static unsigned int stress_seconds = 5;
+static unsigned int stress_senders = 3;
+
+static atomic_bool stress_running = true;
+static atomic_uint stress_misrouted;
+static atomic_uint stress_changes;
+static atomic_uint stress_packets[STRESS_MAX_SENDERS];
+
+/* Via address of the route to a destination on an interface */
+static uint16_t stress_via(unsigned int iface, uint16_t dst) {
+	return (iface << 12) | dst;
+}
+
+static int stress_nexthop(csp_iface_t * iface, uint16_t via, csp_packet_t * packet) {
+
+	const unsigned int index = iface - stress_ifaces;
+	const bool host_route = (via == stress_via(index, packet->id.dst));
+	const bool default_route = (index == 0) && (via == STRESS_DEFAULT_VIA);
+	if (!host_route && !default_route) {
+		atomic_fetch_add(&stress_misrouted, 1);
+	}
+
+	csp_buffer_free(packet);
+	return CSP_ERR_NONE;
+}
+
+static void stress_load(void) {
+	csp_rtable_set(0, 0, &stress_ifaces[0], STRESS_DEFAULT_VIA);
+	for (uint16_t dst = 1; dst <= STRESS_DESTINATIONS; dst++) {
+		const unsigned int iface = rand() % STRESS_IFACES;
+		csp_rtable_set(dst, -1, &stress_ifaces[iface], stress_via(iface, dst));
+	}
+}
+
+static void * stress_sender(void * param) {
+
+	const unsigned int sender = (uintptr_t)param;
+	unsigned int seed = sender;
+
+	while (atomic_load(&stress_running)) {
+
+		csp_packet_t * packet = csp_buffer_get(0);
+		if (packet == NULL) {
+			continue;
+		}
+		packet->length = 16;
+
+		csp_sendto(CSP_PRIO_NORM, 1 + (rand_r(&seed) % STRESS_DESTINATIONS), 10, 10, 0, packet);
+		atomic_fetch_add(&stress_packets[sender], 1);
+	}
+
+	return NULL;
+}
+
+static void * stress_churn(void * param) {
+
+	while (atomic_load(&stress_running)) {
+
+		const unsigned int action = rand() % 100;
+		if (action == 0) {
+			/* Packets may find no route until reloaded, but never a wrong one */
+			csp_rtable_clear();
+			stress_load();
+		} else if (action == 1) {
+			/* Rebuilds the forwarding table */
+			stress_ifaces[STRESS_IFACES - 1].addr ^= 1;
+			csp_iflist_update(&stress_ifaces[STRESS_IFACES - 1]);
+		} else {
+			const uint16_t dst = 1 + (rand() % STRESS_DESTINATIONS);
+			const unsigned int iface = rand() % STRESS_IFACES;
+			csp_rtable_set(dst, -1, &stress_ifaces[iface], stress_via(iface, dst));
+		}
+		atomic_fetch_add(&stress_changes, 1);
+	}
+
+	return NULL;
+}
+
+int main(int argc, char * argv[]) {
+
+	int opt;
+	while ((opt = getopt(argc, argv, "t:s:")) != -1) {
+		switch (opt) {
+			case 't':
+				stress_seconds = atoi(optarg);
+				break;
+			case 's':
+				stress_senders = atoi(optarg);
+				break;
+			default:
+				printf("Usage:\n"
+					   " -t <seconds>     duration, default 5\n"
+					   " -s <count>       sender tasks, default 3\n");
+				exit(1);
+		}
+	}
+
+	if ((stress_senders == 0) || (stress_senders > STRESS_MAX_SENDERS)) {
+		printf("Invalid parameters\n");
+		exit(1);
+	}
+
+	csp_conf.version = 2;
+	csp_init();
+
+	for (unsigned int i = 0; i < STRESS_IFACES; i++) {
+		stress_ifaces[i].nexthop = stress_nexthop;
+		csp_iflist_add(&stress_ifaces[i]);
+	}
+
+	srand(1);
+	stress_load();
+
+	pthread_t threads[STRESS_MAX_SENDERS + 1];
+	for (unsigned int i = 0; i < stress_senders; i++) {
+		pthread_create(&threads[i], NULL, stress_sender, (void *)(uintptr_t)i);
+	}
+	pthread_create(&threads[stress_senders], NULL, stress_churn, NULL);
+
+	sleep(stress_seconds);
+	atomic_store(&stress_running, false);
+	for (unsigned int i = 0; i <= stress_senders; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	unsigned int packets = 0;
+	for (unsigned int i = 0; i < stress_senders; i++) {
+		packets += atomic_load(&stress_packets[i]);
+	}
+
+	printf("Senders %u: %.0f packets/s, %.0f route changes/s, misrouted %u\n",
+		   stress_senders, (double)packets / stress_seconds, (double)atomic_load(&stress_changes) / stress_seconds,
+		   atomic_load(&stress_misrouted));
+
+	return (atomic_load(&stress_misrouted) == 0) && (packets > 0) ? 0 : 1;
+}
@@ -398,6 +398,7 @@ int main(int argc, char * argv[]) {
         }
     } else if (default_iface) {
 	    default_iface->addr = address;
+	    csp_iflist_update(default_iface);
         csp_rtable_set(0, 0, default_iface, CSP_NO_VIA_ADDRESS);
     } else {
         /* no interfaces configured - run server and client in process, using loopback interface */
@@ -0,0 +1,240 @@
+/*
+ * Resumable SFP file transfer
+ *
+ * Sends files with csp_sfp_file_send() to csp_sfp_file_recv(), both in one
+ * process, over RDP and a link that can go down. The first transfer loses the
+ * link part way through; it is resumed on a new connection from the offset
+ * the receiver kept. The receiving file starts out larger than the files
+ * sent, and a smaller file is sent last, so the received file must be cut to
+ * the size of each transfer.
+ */
+
+#include <csp/csp.h>
+#include <csp/csp_iflist.h>
+#include <csp/csp_id.h>
+#include <csp/csp_interface.h>
+#include <csp/csp_sfp.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FILE_PORT 11
+#define FILE_MTU 100
+#define FILE_TIMEOUT 1000
+#define FILE_ATTEMPTS 5
+#define FILE_STALE_SIZE 30000
+
+typedef struct {
+	uint32_t transfer_id;
+	uint32_t size;
+	unsigned int drop_after;  // Fragments after which the link goes down on the first attempt, 0 for never
+} file_transfer_t;
+
+static const file_transfer_t file_transfers[] = {
+	{1, 20000, 60},
+	{2, 5000, 0},
+};
+
+/* Link state */
+static bool link_down;
+static unsigned int link_fragments;
+static unsigned int link_drop_after;
+static pthread_mutex_t link_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static csp_iface_t link_iface = {
+	.name = "LINK",
+};
+
+static int link_tx(csp_iface_t * iface, uint16_t via, csp_packet_t * packet) {
+
+	pthread_mutex_lock(&link_lock);
+	if ((packet->id.flags & CSP_FFRAG) && link_drop_after && (++link_fragments == link_drop_after)) {
+		link_down = true;
+	}
+	const bool down = link_down;
+	pthread_mutex_unlock(&link_lock);
+
+	if (down) {
+		csp_buffer_free(packet);
+	} else {
+		csp_qfifo_write(packet, &link_iface, NULL);
+	}
+	return CSP_ERR_NONE;
+}
+
+static void link_set(bool down, unsigned int drop_after) {
+	pthread_mutex_lock(&link_lock);
+	link_down = down;
+	link_fragments = 0;
+	link_drop_after = drop_after;
+	pthread_mutex_unlock(&link_lock);
+}
+
+static void * router_task(void * param) {
+	while (1) {
+		csp_route_work();
+	}
+	return NULL;
+}
+
+typedef struct {
+	csp_socket_t * sock;
+	int sport;
+	int fd;
+	csp_sfp_file_state_t * state;
+	int result;
+} file_receiver_t;
+
+static void * receiver_task(void * param) {
+
+	file_receiver_t * receiver = param;
+	receiver->result = CSP_ERR_TIMEDOUT;
+
+	/* Connections left over from a broken attempt are skipped */
+	csp_conn_t * conn;
+	while ((conn = csp_accept(receiver->sock, FILE_TIMEOUT)) != NULL) {
+		if (csp_conn_sport(conn) == receiver->sport) {
+			break;
+		}
+		csp_close(conn);
+	}
+	if (conn == NULL) {
+		return NULL;
+	}
+	receiver->result = csp_sfp_file_recv(conn, receiver->fd, receiver->state, FILE_TIMEOUT, NULL);
+	csp_close(conn);
+	return NULL;
+}
+
+static int file_create(const char * name, uint32_t size, uint8_t seed) {
+
+	char path[64];
+	snprintf(path, sizeof(path), "/tmp/csp_sfp_file_%s_XXXXXX", name);
+	int fd = mkstemp(path);
+	if (fd < 0) {
+		return -1;
+	}
+	unlink(path);
+
+	for (uint32_t i = 0; i < size; i++) {
+		uint8_t byte = (i * 13) + (i >> 9) + seed;
+		if (write(fd, &byte, 1) != 1) {
+			close(fd);
+			return -1;
+		}
+	}
+	return fd;
+}
+
+/* Compare size and content of two files */
+static bool file_equal(int a, int b) {
+
+	struct stat st_a, st_b;
+	if ((fstat(a, &st_a) != 0) || (fstat(b, &st_b) != 0) || (st_a.st_size != st_b.st_size)) {
+		return false;
+	}
+
+	uint8_t chunk_a[512], chunk_b[512];
+	for (off_t offset = 0; offset < st_a.st_size; offset += sizeof(chunk_a)) {
+		ssize_t length_a = pread(a, chunk_a, sizeof(chunk_a), offset);
+		ssize_t length_b = pread(b, chunk_b, sizeof(chunk_b), offset);
+		if ((length_a <= 0) || (length_a != length_b) || (memcmp(chunk_a, chunk_b, length_a) != 0)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool file_run(csp_socket_t * sock, int rx_fd, csp_sfp_file_state_t * state, const file_transfer_t * transfer) {
+
+	int tx_fd = file_create("tx", transfer->size, transfer->transfer_id);
+	if (tx_fd < 0) {
+		printf("transfer %u: creating file failed\n", (unsigned int)transfer->transfer_id);
+		return false;
+	}
+
+	bool ok = false;
+	for (unsigned int attempt = 1; attempt <= FILE_ATTEMPTS; attempt++) {
+
+		link_set(false, (attempt == 1) ? transfer->drop_after : 0);
+
+		csp_conn_t * conn = csp_connect(CSP_PRIO_NORM, csp_get_address(), FILE_PORT, 0, CSP_O_RDP);
+		if (conn == NULL) {
+			printf("transfer %u, attempt %u: connect failed\n", (unsigned int)transfer->transfer_id, attempt);
+			continue;
+		}
+
+		const uint32_t resume_offset = (state->transfer_id == transfer->transfer_id) ? state->offset : 0;
+		file_receiver_t receiver = {.sock = sock, .sport = csp_conn_dport(conn), .fd = rx_fd, .state = state};
+		pthread_t thread;
+		pthread_create(&thread, NULL, receiver_task, &receiver);
+
+		const int send_result = csp_sfp_file_send(conn, transfer->transfer_id, tx_fd, FILE_MTU, FILE_TIMEOUT);
+		csp_close(conn);
+		pthread_join(thread, NULL);
+
+		printf("transfer %u, attempt %u: %u bytes from offset %u, send %d, recv %d, received %u\n",
+			   (unsigned int)transfer->transfer_id, attempt, (unsigned int)transfer->size, (unsigned int)resume_offset,
+			   send_result, receiver.result, (unsigned int)state->offset);
+
+		if ((send_result == CSP_ERR_NONE) && (receiver.result == CSP_ERR_NONE)) {
+			ok = file_equal(tx_fd, rx_fd);
+			break;
+		}
+
+		/* Let the broken connections time out, before the next attempt */
+		link_set(false, 0);
+		usleep(2 * FILE_TIMEOUT * 1000);
+	}
+
+	printf("transfer %u: %s\n", (unsigned int)transfer->transfer_id, ok ? "ok" : "FAILED");
+	close(tx_fd);
+	return ok;
+}
+
+int main(int argc, char * argv[]) {
+
+#if (CSP_USE_RDP)
+	csp_conf.version = 2;
+	csp_conf.address = 1;
+	csp_init();
+
+	link_iface.addr = csp_conf.address;
+	link_iface.netmask = csp_id_get_host_bits();
+	link_iface.nexthop = link_tx;
+	csp_iflist_add(&link_iface);
+
+	csp_rdp_set_opt(4, FILE_TIMEOUT / 2, 100, 1, 50, 2);
+
+	pthread_t router;
+	pthread_create(&router, NULL, router_task, NULL);
+
+	csp_socket_t sock = {0};
+	csp_bind(&sock, FILE_PORT);
+	csp_listen(&sock, 4);
+
+	/* The receiving file holds stale data, beyond the size of any transfer */
+	int rx_fd = file_create("rx", FILE_STALE_SIZE, 0xff);
+	if (rx_fd < 0) {
+		printf("creating file failed\n");
+		return 1;
+	}
+
+	csp_sfp_file_state_t state = {0};
+	int failed = 0;
+	for (unsigned int i = 0; i < sizeof(file_transfers) / sizeof(file_transfers[0]); i++) {
+		failed += !file_run(&sock, rx_fd, &state, &file_transfers[i]);
+	}
+
+	close(rx_fd);
+	return failed ? 1 : 0;
+#else
+	printf("RDP is not enabled\n");
+	return 1;
+#endif
+}
@@ -0,0 +1,277 @@
+/*
+ * SFP transfer manager
+ *
+ * Runs outbound and inbound transfers concurrently on one csp_sfp_mgr service
+ * task, in one process over RDP on a loopback link. Two transfers are
+ * received into memory from the budget, and a third one, larger than the
+ * budget, is rejected. A fourth transfer, received through a write function,
+ * is cancelled by the sender part way through.
+ */
+
+#include <csp/csp.h>
+#include <csp/csp_iflist.h>
+#include <csp/csp_id.h>
+#include <csp/csp_interface.h>
+#include <csp/csp_sfp_mgr.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MGR_PORT_MEM 12
+#define MGR_PORT_WRITE 13
+#define MGR_MTU 200
+#define MGR_SIZE 6000
+#define MGR_BUDGET (2 * MGR_SIZE + 1000)
+#define MGR_TIMEOUT 10000
+
+typedef struct {
+	const char * name;
+	uint8_t port;
+	uint32_t size;
+	bool cancel;
+	int out_expect;  // Expected result of the outbound transfer, 1 for any error
+	int in_expect;   // Expected result of the inbound transfer, 1 for any error
+	/* Results */
+	int id;
+	bool out_done;
+	int out_result;
+	bool in_done;
+	int in_result;
+	uint8_t * data;
+} mgr_transfer_t;
+
+static mgr_transfer_t mgr_transfers[] = {
+	{"into memory", MGR_PORT_MEM, MGR_SIZE, false, CSP_ERR_NONE, CSP_ERR_NONE},
+	{"into memory, odd size", MGR_PORT_MEM, MGR_SIZE + 333, false, CSP_ERR_NONE, CSP_ERR_NONE},
+	{"over the memory budget", MGR_PORT_MEM, 4 * MGR_SIZE, false, 1, CSP_ERR_NOMEM},
+	{"cancelled", MGR_PORT_WRITE, 20 * MGR_SIZE, true, CSP_ERR_RESET, 1},
+};
+
+#define MGR_TRANSFERS (sizeof(mgr_transfers) / sizeof(mgr_transfers[0]))
+
+static pthread_mutex_t mgr_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mgr_cond = PTHREAD_COND_INITIALIZER;
+
+static csp_iface_t link_iface = {
+	.name = "LINK",
+};
+
+static int link_tx(csp_iface_t * iface, uint16_t via, csp_packet_t * packet) {
+	csp_qfifo_write(packet, &link_iface, NULL);
+	return CSP_ERR_NONE;
+}
+
+static void * router_task(void * param) {
+	while (1) {
+		csp_route_work();
+	}
+	return NULL;
+}
+
+static void * service_task(void * param) {
+	while (1) {
+		csp_sfp_mgr_work(1000);
+	}
+	return NULL;
+}
+
+/* The content of a transfer follows from its size */
+static uint8_t mgr_byte(uint32_t offset, uint32_t totalsize) {
+	return (offset * 31) + (offset >> 8) + totalsize;
+}
+
+/* Inbound transfers are matched by port and size */
+static mgr_transfer_t * mgr_find(uint8_t port, uint32_t size) {
+	for (unsigned int i = 0; i < MGR_TRANSFERS; i++) {
+		if ((mgr_transfers[i].port == port) && ((port == MGR_PORT_WRITE) || (mgr_transfers[i].size == size))) {
+			return &mgr_transfers[i];
+		}
+	}
+	return NULL;
+}
+
+static void mgr_out_done(const csp_sfp_mgr_transfer_t * transfer, int error, void * context) {
+	mgr_transfer_t * t = context;
+	pthread_mutex_lock(&mgr_lock);
+	t->out_result = error;
+	t->out_done = true;
+	pthread_cond_broadcast(&mgr_cond);
+	pthread_mutex_unlock(&mgr_lock);
+}
+
+static void mgr_in_done(const csp_sfp_mgr_transfer_t * transfer, int error, void * context) {
+
+	const uint8_t port = (uintptr_t)context;
+	mgr_transfer_t * t = mgr_find(port, transfer->totalsize);
+	if (t == NULL) {
+		printf("inbound transfer on port %u, %u bytes, error %d: unexpected\n", port, (unsigned int)transfer->totalsize, error);
+		return;
+	}
+
+	/* Received data is only valid during the callback */
+	if ((error == CSP_ERR_NONE) && transfer->data) {
+		for (uint32_t i = 0; i < transfer->totalsize; i++) {
+			if (((const uint8_t *)transfer->data)[i] != mgr_byte(i, transfer->totalsize)) {
+				error = CSP_ERR_SFP;
+				break;
+			}
+		}
+	}
+
+	pthread_mutex_lock(&mgr_lock);
+	t->in_result = error;
+	t->in_done = true;
+	pthread_cond_broadcast(&mgr_cond);
+	pthread_mutex_unlock(&mgr_lock);
+}
+
+static int mgr_write(uint32_t offset, const void * data, uint32_t length, uint32_t totalsize, void * context) {
+	for (uint32_t i = 0; i < length; i++) {
+		if (((const uint8_t *)data)[i] != mgr_byte(offset + i, totalsize)) {
+			return CSP_ERR_SFP;
+		}
+	}
+	return CSP_ERR_NONE;
+}
+
+static void * accept_task(void * param) {
+
+	csp_socket_t * sock = param;
+	while (1) {
+		csp_conn_t * conn = csp_accept(sock, CSP_MAX_TIMEOUT);
+		if (conn == NULL) {
+			continue;
+		}
+		const uint8_t port = csp_conn_dport(conn);
+		int id = csp_sfp_mgr_recv(conn, (port == MGR_PORT_WRITE) ? mgr_write : NULL, NULL, mgr_in_done, (void *)(uintptr_t)port);
+		if (id < 0) {
+			printf("csp_sfp_mgr_recv failed, error %d\n", id);
+			csp_close(conn);
+		}
+	}
+	return NULL;
+}
+
+static bool mgr_expected(int result, int expect) {
+	return (expect == 1) ? (result != CSP_ERR_NONE) : (result == expect);
+}
+
+int main(int argc, char * argv[]) {
+
+#if (CSP_USE_RDP)
+	csp_conf.version = 2;
+	csp_conf.address = 1;
+	csp_init();
+
+	link_iface.addr = csp_conf.address;
+	link_iface.netmask = csp_id_get_host_bits();
+	link_iface.nexthop = link_tx;
+	csp_iflist_add(&link_iface);
+
+	/* The windows of all transfers share a small buffer pool */
+	csp_rdp_set_opt(2, 2000, 200, 1, 50, 1);
+
+	if (csp_sfp_mgr_init(MGR_BUDGET, 5000) != CSP_ERR_NONE) {
+		printf("csp_sfp_mgr_init failed\n");
+		return 1;
+	}
+
+	pthread_t thread;
+	pthread_create(&thread, NULL, router_task, NULL);
+	pthread_create(&thread, NULL, service_task, NULL);
+
+	static csp_socket_t sock_mem, sock_write;
+	csp_bind(&sock_mem, MGR_PORT_MEM);
+	csp_listen(&sock_mem, MGR_TRANSFERS);
+	csp_bind(&sock_write, MGR_PORT_WRITE);
+	csp_listen(&sock_write, 1);
+	pthread_create(&thread, NULL, accept_task, &sock_mem);
+	pthread_create(&thread, NULL, accept_task, &sock_write);
+
+	/* Connect first, as transfers under way leave few buffers for the handshake */
+	csp_conn_t * conns[MGR_TRANSFERS];
+	for (unsigned int i = 0; i < MGR_TRANSFERS; i++) {
+		mgr_transfer_t * t = &mgr_transfers[i];
+		t->data = malloc(t->size);
+		for (uint32_t j = 0; j < t->size; j++) {
+			t->data[j] = mgr_byte(j, t->size);
+		}
+		conns[i] = csp_connect(CSP_PRIO_NORM, csp_get_address(), t->port, 0, CSP_O_RDP);
+		if (conns[i] == NULL) {
+			printf("%s: connect failed\n", t->name);
+			return 1;
+		}
+	}
+
+	/* Start all transfers, before any completes */
+	for (unsigned int i = 0; i < MGR_TRANSFERS; i++) {
+		mgr_transfer_t * t = &mgr_transfers[i];
+		t->id = csp_sfp_mgr_send(conns[i], t->data, t->size, MGR_MTU, mgr_out_done, t);
+		if (t->id < 0) {
+			printf("%s: csp_sfp_mgr_send failed, error %d\n", t->name, t->id);
+			csp_close(conns[i]);
+			return 1;
+		}
+	}
+
+	/* Cancel once under way */
+	for (unsigned int i = 0; i < MGR_TRANSFERS; i++) {
+		mgr_transfer_t * t = &mgr_transfers[i];
+		if (!t->cancel) {
+			continue;
+		}
+		csp_sfp_mgr_transfer_t progress;
+		while ((csp_sfp_mgr_progress(t->id, &progress) == CSP_ERR_NONE) && (progress.transferred < (t->size / 10))) {
+			usleep(1000);
+		}
+		printf("%s: cancelling after %u bytes\n", t->name, (unsigned int)progress.transferred);
+		csp_sfp_mgr_cancel(t->id);
+	}
+
+	/* Wait for both ends of all transfers */
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += MGR_TIMEOUT / 1000;
+	pthread_mutex_lock(&mgr_lock);
+	for (unsigned int i = 0; i < MGR_TRANSFERS; i++) {
+		while (!mgr_transfers[i].out_done || !mgr_transfers[i].in_done) {
+			if (pthread_cond_timedwait(&mgr_cond, &mgr_lock, &deadline) != 0) {
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&mgr_lock);
+
+	int failed = 0;
+	printf("%-24s %8s %6s %6s\n", "transfer", "bytes", "out", "in");
+	for (unsigned int i = 0; i < MGR_TRANSFERS; i++) {
+		mgr_transfer_t * t = &mgr_transfers[i];
+		pthread_mutex_lock(&mgr_lock);
+		const bool ok = t->out_done && t->in_done && mgr_expected(t->out_result, t->out_expect) && mgr_expected(t->in_result, t->in_expect);
+		printf("%-24s %8u %6d %6d   %s\n", t->name, (unsigned int)t->size, t->out_done ? t->out_result : 0, t->in_done ? t->in_result : 0, ok ? "ok" : "FAILED");
+		pthread_mutex_unlock(&mgr_lock);
+		failed += !ok;
+	}
+
+	/* The statistics are updated after the completion callback returns */
+	csp_sfp_mgr_stats_t stats;
+	csp_sfp_mgr_get_stats(&stats);
+	for (unsigned int i = 0; (i < 1000) && (stats.active > 0); i++) {
+		usleep(1000);
+		csp_sfp_mgr_get_stats(&stats);
+	}
+	printf("completed %u, failed %u, memory peak %zu of %u, rejected %u\n",
+		   (unsigned int)stats.completed, (unsigned int)stats.failed, stats.mem_peak, MGR_BUDGET, (unsigned int)stats.mem_rejected);
+	if ((stats.mem_peak > MGR_BUDGET) || (stats.mem_rejected != 1) || (stats.active != 0)) {
+		failed++;
+	}
+
+	return failed ? 1 : 0;
+#else
+	printf("RDP is not enabled\n");
+	return 1;
+#endif
+}
@@ -49,7 +49,14 @@ int csp_hmac_verify(csp_packet_t * packet, bool include_header);
 int csp_hmac_memory(const void * key, uint32_t keylen, const void * data, uint32_t datalen, uint8_t * hmac);
 
 /**
- * Save a copy of the key string for use by the append/verify functions
+ * Initialize the key used by the append/verify functions to all zero.
+ * Called by csp_init().
+ */
+void csp_hmac_init(void);
+
+/**
+ * Save a copy of the key string for use by the append/verify functions.
+ * May be called while packets are processed, each packet uses either the old or the new key.
  * @param key HMAC key
  * @param keylen HMAC key length
  * @return #CSP_ERR_NONE on success, otherwise an error code.
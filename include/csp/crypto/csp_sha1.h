@@ -7,6 +7,9 @@
    SHA1 support.
 
    Code originally from Python's SHA1 Module, who based it on libtom.org.
+
+   csp_sha1_select_impl() selects the block function at runtime: the SHA1 instructions of x86 (SHA-NI) or ARMv8 if the CPU has
+   them, otherwise the portable implementation.
 */
 
 #include <csp/csp_types.h>
@@ -33,6 +36,42 @@ typedef struct {
 	uint8_t  buf[CSP_SHA1_BLOCKSIZE];
 } csp_sha1_state_t;
 
+/**
+   SHA1 block function implementations.
+*/
+typedef enum {
+	CSP_SHA1_IMPL_PORTABLE,  //!< Portable C, always available.
+	CSP_SHA1_IMPL_SHANI,     //!< x86 SHA extensions.
+	CSP_SHA1_IMPL_ARMV8,     //!< ARMv8 SHA1 instructions.
+} csp_sha1_impl_t;
+
+/**
+   Select the fastest SHA1 implementation supported by the CPU.
+   Called by csp_init(), until then the portable implementation is used.
+*/
+void csp_sha1_select_impl(void);
+
+/**
+   Select SHA1 implementation, e.g. for benchmarking.
+   Must not be called while other tasks calculate hashes.
+   @param[in] impl implementation.
+   @return #CSP_ERR_NONE on success, #CSP_ERR_NOTSUP if not supported by the build or CPU.
+*/
+int csp_sha1_set_impl(csp_sha1_impl_t impl);
+
+/**
+   Get the SHA1 implementation in use.
+   @return implementation.
+*/
+csp_sha1_impl_t csp_sha1_get_impl(void);
+
+/**
+   Get name of SHA1 implementation.
+   @param[in] impl implementation.
+   @return name, e.g. "sha-ni".
+*/
+const char * csp_sha1_impl_name(csp_sha1_impl_t impl);
+
 /**
    Initialize the hash state
    @param[in] state hash state.
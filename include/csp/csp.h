@@ -118,6 +118,19 @@ void csp_send(csp_conn_t *conn, csp_packet_t *packet);
  */
 void csp_send_prio(uint8_t prio, csp_conn_t *conn, csp_packet_t *packet);
 
+/**
+   Send packet on a connection, without blocking.
+
+   If the RDP window is full, or the handshake of a non-blocking connect has not completed, the call returns
+   #CSP_ERR_AGAIN and the connection event handler is called with #CSP_CONN_EV_WRITABLE once the packet can be sent.
+   Unlike csp_send(), the packet is only consumed on success; on error it still belongs to the caller.
+
+   @param[in] conn connection
+   @param[in] packet packet to send
+   @return #CSP_ERR_NONE on success, #CSP_ERR_AGAIN if the connection is not writable, otherwise an error code.
+*/
+int csp_send_nonblock(csp_conn_t *conn, csp_packet_t *packet);
+
 /**
    Perform an entire request & reply transaction.
    Creates a connection, send \a outbuf, wait for reply, copy reply to \a inbuf and close the connection.
@@ -205,6 +218,60 @@ void csp_sendto_reply(const csp_packet_t * request, csp_packet_t * reply, uint32
 */
 csp_conn_t *csp_connect(uint8_t prio, uint16_t dst, uint8_t dst_port, uint32_t timeout, uint32_t opts);
 
+/**
+   @defgroup CSP_CONN_EVENTS Connection events.
+   Passed to a #csp_conn_event_t handler and returned by csp_conn_events().
+   @{
+*/
+#define CSP_CONN_EV_CONNECTED		0x01 //!< Connection is established (RDP handshake completed)
+#define CSP_CONN_EV_WRITABLE		0x02 //!< csp_send_nonblock() will accept a packet
+#define CSP_CONN_EV_READABLE		0x04 //!< A packet is ready for csp_read()
+#define CSP_CONN_EV_CLOSED		0x08 //!< Connection was reset, timed out or failed to connect
+/**@}*/
+
+/**
+   Connection event handler.
+   The handler is called from the router task and must not block. Typically it wakes an event loop, which then
+   calls csp_read(), csp_send_nonblock() or csp_close() on the connection.
+   @param[in] conn connection
+   @param[in] events events that occurred, see @ref CSP_CONN_EVENTS.
+   @param[in] context user context, as given to csp_connect_nonblock() or csp_conn_set_event_handler()
+*/
+typedef void (*csp_conn_event_t)(csp_conn_t *conn, unsigned int events, void *context);
+
+/**
+   Establish outgoing connection, without blocking.
+   For a RDP connection (#CSP_O_RDP), the call returns as soon as the SYN is sent. The handler is called with
+   #CSP_CONN_EV_CONNECTED when the other end acknowledges the connection, or with #CSP_CONN_EV_CLOSED if it
+   does not within the connection timeout, in which case the connection must be closed with csp_close().
+   Other connections are established on return.
+   @param[in] prio priority, see #csp_prio_t
+   @param[in] dst Destination address
+   @param[in] dst_port Destination port
+   @param[in] opts connection options, see @ref CSP_CONNECTION_OPTIONS.
+   @param[in] handler event handler, may be NULL if the connection is polled with csp_conn_events().
+   @param[in] context user context passed to \a handler
+   @return Pending connection or NULL on failure (no free connections, no buffers).
+*/
+csp_conn_t *csp_connect_nonblock(uint8_t prio, uint16_t dst, uint8_t dst_port, uint32_t opts,
+								 csp_conn_event_t handler, void *context);
+
+/**
+   Set event handler on a connection, e.g. on a connection returned by csp_accept().
+   Events occurring before the handler is set are not reported, so check csp_conn_events() after setting it.
+   @param[in] conn connection
+   @param[in] handler event handler, NULL to disable events.
+   @param[in] context user context passed to \a handler
+*/
+void csp_conn_set_event_handler(csp_conn_t *conn, csp_conn_event_t handler, void *context);
+
+/**
+   Return the current state of a connection as events.
+   @param[in] conn connection
+   @return mask of events currently true for the connection, see @ref CSP_CONN_EVENTS.
+*/
+unsigned int csp_conn_events(csp_conn_t *conn);
+
 /**
    Close an open connection.
    Any packets in the RX queue will be freed.
@@ -276,10 +343,28 @@ int csp_bind_callback(csp_callback_t callback, uint8_t port);
 /**
    Route packet from the incoming router queue and check RDP timeouts.
    In order for incoming packets to routed and RDP timeouts to be checked, this function must be called reguarly.
+   The function blocks until a packet arrives or the next RDP timer expires, so it can be called in a tight loop.
    @return #CSP_ERR_NONE on success, otherwise an error code.
 */
 int csp_route_work(void);
 
+/**
+   Forwarding statistics.
+   Packets not addressed to this node are forwarded by csp_route_work(). The next hop to a destination from an incoming
+   interface is cached, unless it depends on the flow (multipath routes) or the packet is sent on several interfaces, and
+   the cache is cleared by any change of the routing table or interface list.
+*/
+typedef struct {
+	uint32_t fast;  //!< Packets forwarded to the cached next hop.
+	uint32_t slow;  //!< Packets forwarded after a routing table lookup.
+} csp_route_stats_t;
+
+/**
+   Get forwarding statistics.
+   @param[out] stats statistics.
+*/
+void csp_route_get_stats(csp_route_stats_t * stats);
+
 /**
    Set the bridge interfaces.
 */
@@ -417,6 +502,55 @@ void csp_rdp_get_opt(unsigned int *window_size, unsigned int *conn_timeout_ms,
 		unsigned int *packet_timeout_ms, unsigned int *delayed_acks,
 		unsigned int *ack_timeout, unsigned int *ack_delay_count);
 
+/**
+   RDP connection statistics.
+   Counters are kept per connection and as totals across all connections.
+   @see csp_rdp_get_stats(), csp_rdp_get_stats_total()
+*/
+typedef struct {
+	uint32_t tx_segments;       /**< Data segments transmitted (excluding retransmissions) */
+	uint32_t tx_bytes;          /**< User data bytes transmitted (excluding retransmissions) */
+	uint32_t rx_segments;       /**< Data segments delivered to userspace */
+	uint32_t rx_bytes;          /**< User data bytes delivered to userspace */
+	uint32_t retransmits;       /**< Segments retransmitted after packet timeout */
+	uint32_t rx_duplicates;     /**< Duplicate segments received and discarded */
+	uint32_t rx_out_of_order;   /**< Segments received out of sequence and queued */
+	uint32_t acks_tx;           /**< ACK control messages transmitted */
+	uint32_t eacks_tx;          /**< Extended ACKs transmitted */
+	uint32_t eacks_rx;          /**< Extended ACKs received */
+	uint32_t window_stalls;     /**< Number of sends that had to wait for the TX window to open */
+	uint32_t tx_wait_ms;        /**< Total time in mS blocked on a full TX window */
+	uint32_t rtt_samples;       /**< Number of round trip time samples */
+	uint32_t rtt_last_ms;       /**< Last round trip time sample in mS */
+	uint32_t rtt_min_ms;        /**< Smallest round trip time sample in mS */
+	uint32_t rtt_max_ms;        /**< Largest round trip time sample in mS */
+	uint64_t rtt_sum_ms;        /**< Sum of all round trip time samples in mS (average = rtt_sum_ms / rtt_samples) */
+} csp_rdp_stats_t;
+
+#if (CSP_USE_RDP)
+
+/**
+   Get a snapshot of the statistics for a RDP connection.
+   @param[in] conn RDP connection.
+   @param[out] stats user supplied statistics.
+   @return #CSP_ERR_NONE on success, #CSP_ERR_INVAL if \a conn is not a RDP connection.
+*/
+int csp_rdp_get_stats(const csp_conn_t * conn, csp_rdp_stats_t * stats);
+
+/**
+   Get the statistics accumulated across all RDP connections since csp_init().
+   Counters are read one by one, without stopping the connections updating them.
+   @param[out] stats user supplied statistics.
+*/
+void csp_rdp_get_stats_total(csp_rdp_stats_t * stats);
+
+/**
+   Reset the statistics accumulated across all RDP connections.
+*/
+void csp_rdp_reset_stats_total(void);
+
+#endif
+
 /**
    Set platform specific memory copy function.
 */
@@ -426,9 +560,17 @@ void csp_cmp_set_memcpy(csp_memcpy_fnc_t fnc);
 
 /**
    Print connection table to stdout.
+   For RDP connections the per-connection statistics are printed as well.
 */
 void csp_conn_print_table(void);
 
+#if (CSP_USE_RDP)
+/**
+   Print RDP statistics accumulated across all connections to stdout.
+*/
+void csp_rdp_print_stats(void);
+#endif
+
 /**
    Hex dump memory to stdout.
    @param[in] desc description printed on first line.
@@ -440,6 +582,9 @@ void csp_hex_dump(const char *desc, void *addr, int len);
 #else
 
 inline void csp_conn_print_table(void) {}
+#if (CSP_USE_RDP)
+inline void csp_rdp_print_stats(void) {}
+#endif
 inline void csp_hex_dump(const char *desc, void *addr, int len) {}
 
 #endif
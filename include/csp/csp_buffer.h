@@ -65,6 +65,14 @@ size_t csp_buffer_size(void);
 */
 size_t csp_buffer_data_size(void);
 
+/**
+   Return the memory of all CSP buffers.
+   All buffers are within it, so drivers can register it once for zero-copy I/O, e.g. as io_uring fixed buffers.
+   @param[out] size size of the memory in bytes.
+   @return start of the memory, or NULL before csp_init().
+*/
+void * csp_buffer_pool(size_t * size);
+
 void csp_buffer_init(void);
 
 
@@ -0,0 +1,95 @@
+#pragma once
+
+/**
+   @file
+
+   Payload compression.
+
+   A small LZ77 codec, producing the LZ4 block format, meant for trading CPU time for bandwidth on slow links such as KISS/serial
+   and radio. It is used in two places:
+   - Per interface, packets larger than csp_iface_t.comp_threshold are compressed before transmission, and marked with #CSP_FCOMP.
+     The next hop decompresses the packet on reception, so both ends of the link must enable #CSP_USE_COMPRESS. A node without it
+     does not recognize #CSP_FCOMP, and passes the compressed data on as is.
+   - End-to-end in SFP file transfers, when negotiated between sender and receiver (see csp_sfp_file_send_opts()).
+     The other SFP transfers have no negotiation, and send data as is.
+
+   The codec uses a hash table on the stack of 2^#CSP_COMPRESS_HASH_BITS entries of 2 bytes, and no other memory.
+*/
+
+#include <stdbool.h>
+
+#include <csp/csp_types.h>
+
+#ifndef CSP_COMPRESS_HASH_BITS
+#define CSP_COMPRESS_HASH_BITS 10  //! Size of the compression hash table, as a power of 2.
+#endif
+
+/** Max. size of a block passed to csp_compress(). */
+#define CSP_COMPRESS_MAX_SIZE 65535
+
+/**
+   Compression statistics.
+   The compression ratio is in_bytes / out_bytes. Time is only measured on POSIX.
+*/
+typedef struct {
+	uint32_t compressed;      //!< Blocks compressed.
+	uint32_t incompressible;  //!< Blocks not compressed, because the result was not smaller.
+	uint32_t decompressed;    //!< Blocks decompressed.
+	uint32_t errors;          //!< Blocks failing to decompress.
+	uint64_t in_bytes;        //!< Bytes passed to csp_compress().
+	uint64_t out_bytes;       //!< Bytes after compression, counting incompressible blocks by their original size.
+	uint64_t compress_ns;     //!< Time spent compressing.
+	uint64_t decompress_ns;   //!< Time spent decompressing.
+} csp_compress_stats_t;
+
+/**
+   Initialize compression statistics.
+   Called by csp_init(), compression must not be used before.
+*/
+void csp_compress_init(void);
+
+/**
+   Compress a block.
+   @param[in] src data to compress, max #CSP_COMPRESS_MAX_SIZE bytes.
+   @param[in] srclen size of \a src.
+   @param[out] dst compressed data.
+   @param[in] dstmax size of \a dst, compression only pays off if less than \a srclen.
+   @return size of the compressed data, 0 if it does not fit in \a dstmax.
+*/
+uint32_t csp_compress(const void * src, uint32_t srclen, void * dst, uint32_t dstmax);
+
+/**
+   Decompress a block.
+   @param[in] src compressed data.
+   @param[in] srclen size of \a src.
+   @param[out] dst decompressed data.
+   @param[in] dstmax size of \a dst.
+   @return size of the decompressed data, #CSP_ERR_INVAL if the data is corrupt or does not fit in \a dstmax.
+*/
+int csp_decompress(const void * src, uint32_t srclen, void * dst, uint32_t dstmax);
+
+/**
+   Compress packet data in place, and set #CSP_FCOMP.
+   The packet is left unchanged, if compression does not make it smaller.
+   @param[in] packet packet to compress.
+   @return true if the packet was compressed.
+*/
+bool csp_compress_packet(csp_packet_t * packet);
+
+/**
+   Decompress packet data in place, and clear #CSP_FCOMP.
+   @param[in] packet packet with #CSP_FCOMP set.
+   @return #CSP_ERR_NONE on success, otherwise an error code.
+*/
+int csp_decompress_packet(csp_packet_t * packet);
+
+/**
+   Get compression statistics.
+   @param[out] stats statistics.
+*/
+void csp_compress_get_stats(csp_compress_stats_t * stats);
+
+/**
+   Reset compression statistics.
+*/
+void csp_compress_reset_stats(void);
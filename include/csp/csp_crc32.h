@@ -5,10 +5,50 @@
 /**
    @file
    CRC32 support.
+
+   The checksum is CRC32C (Castagnoli). csp_crc32_init() selects the fastest implementation at runtime: the CRC32C instructions of
+   x86 SSE4.2 or ARMv8 if the CPU has them, otherwise slicing-by-8 (#CSP_USE_CRC32_SLICE8) or a byte-wise table lookup.
 */
 
 #include <csp/csp.h>
 
+/**
+   CRC32 implementations.
+*/
+typedef enum {
+	CSP_CRC32_IMPL_BYTE,    //!< Byte-wise table lookup, always available.
+	CSP_CRC32_IMPL_SLICE8,  //!< Slicing-by-8 table lookup, requires #CSP_USE_CRC32_SLICE8, not on AVR.
+	CSP_CRC32_IMPL_SSE42,   //!< x86 SSE4.2 crc32 instruction.
+	CSP_CRC32_IMPL_ARMV8,   //!< ARMv8 crc32c instructions.
+} csp_crc32_impl_t;
+
+/**
+   Select the fastest CRC32 implementation supported by the CPU.
+   Called by csp_init(), until then the byte-wise implementation is used.
+*/
+void csp_crc32_init(void);
+
+/**
+   Select CRC32 implementation, e.g. for benchmarking.
+   Must not be called while other tasks calculate checksums.
+   @param[in] impl implementation.
+   @return #CSP_ERR_NONE on success, #CSP_ERR_NOTSUP if not supported by the build or CPU.
+*/
+int csp_crc32_set_impl(csp_crc32_impl_t impl);
+
+/**
+   Get the CRC32 implementation in use.
+   @return implementation.
+*/
+csp_crc32_impl_t csp_crc32_get_impl(void);
+
+/**
+   Get name of CRC32 implementation.
+   @param[in] impl implementation.
+   @return name, e.g. "sse4.2".
+*/
+const char * csp_crc32_impl_name(csp_crc32_impl_t impl);
+
 /**
    Append CRC32 checksum to packet
    @param[in] packet CSP packet, must be valid.
@@ -31,3 +71,29 @@ int csp_crc32_verify(csp_packet_t * packet);
 */
 uint32_t csp_crc32_memory(const uint8_t * addr, uint32_t length);
 
+/**
+   Initial value for csp_crc32_update().
+*/
+#define CSP_CRC32_INIT 0xFFFFFFFF
+
+/**
+   Update running checksum with a memory area.
+
+   Used to calculate the checksum of data not available in one piece: start with #CSP_CRC32_INIT, update with each piece in order,
+   and finish with csp_crc32_final(). The result equals csp_crc32_memory() of the concatenated data.
+
+   @param[in] crc running checksum.
+   @param[in] addr memory address
+   @param[in] length length of memory
+   @return updated running checksum
+*/
+uint32_t csp_crc32_update(uint32_t crc, const uint8_t * addr, uint32_t length);
+
+/**
+   Finish running checksum.
+   @param[in] crc running checksum from csp_crc32_update().
+   @return checksum
+*/
+static inline uint32_t csp_crc32_final(uint32_t crc) {
+	return crc ^ 0xFFFFFFFF;
+}
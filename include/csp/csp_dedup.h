@@ -0,0 +1,55 @@
+#pragma once
+
+/**
+   @file
+
+   Packet deduplication.
+
+   Enabled with csp_conf_t.dedup. Each packet is identified by a 64-bit hash of its header and data, stored in an
+   open-addressed table of #CSP_DEDUP_COUNT entries. A packet is a duplicate if the same packet was seen less than the
+   deduplication window ago. Entries are stamped with a time bucket of a quarter of the window, and expire when they are
+   4 buckets old, so the effective window is between 3/4 and all of the configured window.
+
+   Lookups probe at most #CSP_DEDUP_PROBE entries. If all of them are still within the window, the oldest is evicted,
+   so duplicates may be missed when the table gets full (see csp_dedup_stats_t.evictions). Size #CSP_DEDUP_COUNT to about
+   twice the number of packets expected per window.
+*/
+
+#include <csp/csp_types.h>
+
+#ifndef CSP_DEDUP_PROBE
+#define CSP_DEDUP_PROBE 8  //! Max. number of entries probed per lookup.
+#endif
+
+/**
+   What identifies a packet.
+*/
+typedef enum {
+	CSP_DEDUP_SCOPE_GLOBAL,  //!< Header and data, regardless of incoming interface.
+	CSP_DEDUP_SCOPE_IFACE,   //!< Header and data per incoming interface, i.e. the same packet on two interfaces is not a duplicate.
+	CSP_DEDUP_SCOPE_FLOW,    //!< Addresses, ports and data, ignoring priority and flags, e.g. packet source bits set by different ground stations.
+} csp_dedup_scope_t;
+
+/**
+   Deduplication statistics.
+*/
+typedef struct {
+	uint32_t hits;       //!< Duplicates found.
+	uint32_t misses;     //!< New packets.
+	uint32_t evictions;  //!< Entries replaced before they expired.
+} csp_dedup_stats_t;
+
+/**
+   Configure deduplication, and clear the table.
+   The default is a window of #CSP_DEDUP_WINDOW_MS and #CSP_DEDUP_SCOPE_GLOBAL.
+   @param[in] window_ms packets seen less than this long ago are duplicates, min. 4.
+   @param[in] scope what identifies a packet.
+   @return #CSP_ERR_NONE on success, otherwise an error code.
+*/
+int csp_dedup_configure(uint32_t window_ms, csp_dedup_scope_t scope);
+
+/**
+   Get deduplication statistics.
+   @param[out] stats statistics.
+*/
+void csp_dedup_get_stats(csp_dedup_stats_t * stats);
@@ -17,3 +17,6 @@ unsigned int csp_id_get_max_port(void);
 
 int csp_id_is_broadcast(uint16_t addr, uint16_t netmask);
 
+/* Hash of the addresses and ports, the same for all packets of a connection in one direction */
+uint32_t csp_id_flow_hash(const csp_id_t * id);
+
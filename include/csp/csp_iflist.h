@@ -2,6 +2,12 @@
 
 #include <csp/csp_interface.h>
 
+/**
+   Initialize the interface list.
+   Called by csp_init(), before the loopback interface is added.
+*/
+void csp_iflist_init(void);
+
 /**
    Add interface to the list.
 
@@ -10,6 +16,19 @@
 */
 int csp_iflist_add(csp_iface_t * iface);
 
+/**
+   Update interface, after changing its address, netmask or name.
+
+   Interfaces are indexed by address, subnet and name when added, so the lookups below take constant time. Call this
+   after changing an interface already added. The lookups below also find a changed address or netmask and index it
+   again, but the routing table scans its routes, instead of using the forwarding table, until the interface is
+   updated. A changed name is only found once the interface is updated.
+
+   @param[in] iface interface, already added.
+   @return #CSP_ERR_NONE on success, otherwise an error code.
+*/
+int csp_iflist_update(csp_iface_t * iface);
+
 csp_iface_t * csp_iflist_get_by_name(const char *name);
 csp_iface_t * csp_iflist_get_by_addr(uint16_t addr);
 csp_iface_t * csp_iflist_get_by_subnet(uint16_t addr, csp_iface_t * from);
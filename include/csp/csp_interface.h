@@ -21,6 +21,8 @@ struct csp_iface_s {
 	nexthop_t nexthop;          // Next hop (Tx) function
 	uint16_t mtu;               // Maximum Transmission Unit of interface
 	uint8_t split_horizon_off;  // Disable the route-loop prevention
+	uint16_t comp_threshold;    // Compress packets of at least this size, 0 to disable (requires CSP_USE_COMPRESS). Only for links where both ends support compression
+	uint8_t pipeline_tx;        // Transmit from the pipeline workers, for expensive Tx such as encryption (requires CSP_USE_PIPELINE)
 	uint32_t tx;                // Successfully transmitted packets
 	uint32_t rx;                // Successfully received packets
 	uint32_t tx_error;          // Transmit errors (packets)
@@ -31,6 +33,16 @@ struct csp_iface_s {
 	uint32_t txbytes;           // Transmitted bytes
 	uint32_t rxbytes;           // Received bytes
 	uint32_t irq;               // Interrupts
+	uint32_t comp_in;           // Bytes of packets compressed, before compression
+	uint32_t comp_out;          // Bytes of packets compressed, after compression
+	uint32_t tx_error_seen;     // Internal, tx_error when last checked by multipath routing, accessed atomically
+	uint32_t tx_error_ms;       // Internal, time tx_error was last seen increasing, accessed atomically
+	bool down;                  // Set by the route monitor, routes with a backup avoid the interface while down
+	uint8_t monitor_count;      // Internal, consecutive route monitor intervals contradicting down
+	uint32_t monitor_tx;        // Internal, tx when last checked by the route monitor
+	uint32_t monitor_tx_error;  // Internal, tx_error when last checked by the route monitor
+	uint16_t network;           // Internal, network of the subnet, computed when added or updated
+	uint16_t mask;              // Internal, mask of the subnet, computed when added or updated
 	struct csp_iface_s * next;  // Internal, interfaces are stored in a linked list
 };
 
@@ -0,0 +1,70 @@
+#pragma once
+
+/**
+   @file
+
+   Integrity pipeline.
+
+   Moves CRC32 and HMAC verification of incoming packets, CRC32 and HMAC calculation of outgoing packets, and
+   transmission on interfaces with expensive Tx (e.g. the encrypting TUN interface, see csp_iface_t.pipeline_tx) off the
+   router task and the sending tasks, to a pool of worker tasks. Each worker task calls csp_pipeline_work() in a loop,
+   in the same way as the router task calls csp_route_work().
+
+   Packets are assigned to a worker by a hash of source, destination and ports, so all packets of a connection (in each
+   direction) are handled by the same worker, in the order they were submitted. Verified packets re-enter the router
+   queue and are delivered from there, without being counted, deduplicated or verified again. Packets of a connection
+   without CRC32 or HMAC are not passed through the pipeline, so they may overtake packets still being verified.
+
+   Submitting a packet waits for room in the worker queue, so a busy pool slows down the router and senders instead of
+   dropping packets. Workers never wait for the router.
+
+   Until csp_pipeline_init() is called, all work is done inline as before.
+*/
+
+#include <csp/csp_types.h>
+
+#ifndef CSP_PIPELINE_MAX_WORKERS
+#define CSP_PIPELINE_MAX_WORKERS 8  //! Max. number of worker tasks.
+#endif
+
+#ifndef CSP_PIPELINE_QUEUE_LEN
+#define CSP_PIPELINE_QUEUE_LEN 32  //! Length of the queue of each worker.
+#endif
+
+#ifndef CSP_PIPELINE_BATCH
+#define CSP_PIPELINE_BATCH 8  //! Max. number of packets handled per call to csp_pipeline_work().
+#endif
+
+/**
+   Pipeline statistics, summed over all workers.
+*/
+typedef struct {
+    uint32_t rx;          //!< Incoming packets verified.
+    uint32_t rx_failed;   //!< Incoming packets failing verification (also counted in rx).
+    uint32_t rx_dropped;  //!< Verified packets dropped, because the router queue was full.
+    uint32_t tx;          //!< Outgoing packets handled.
+    uint32_t batches;     //!< Calls to csp_pipeline_work() handling packets.
+} csp_pipeline_stats_t;
+
+/**
+   Start the pipeline.
+   Must be called once, after csp_init() and before any traffic. Then start \a workers tasks calling
+   csp_pipeline_work() with worker numbers 0 .. \a workers - 1.
+   @param[in] workers number of worker tasks, max. #CSP_PIPELINE_MAX_WORKERS.
+   @return #CSP_ERR_NONE on success, #CSP_ERR_NOTSUP if compiled without #CSP_USE_PIPELINE, otherwise an error code.
+*/
+int csp_pipeline_init(unsigned int workers);
+
+/**
+   Handle a batch of packets for a worker.
+   @param[in] worker worker number.
+   @param[in] timeout max. time in mS to wait for the first packet.
+   @return #CSP_ERR_NONE if packets were handled, #CSP_ERR_TIMEDOUT if none arrived, otherwise an error code.
+*/
+int csp_pipeline_work(unsigned int worker, uint32_t timeout);
+
+/**
+   Get pipeline statistics.
+   @param[out] stats statistics.
+*/
+void csp_pipeline_get_stats(csp_pipeline_stats_t * stats);
@@ -9,19 +9,61 @@
 
    Normal routing: If the route's via address is set to #CSP_NO_VIA_ADDRESS, the packet will be sent directly to the destination address
    specified in the CSP header, otherwise the packet will be sent the to the route's via address.
+
+   Each change copies the table to a new snapshot, which replaces the current one atomically. Routing never waits for
+   a change, and never sees a partly changed table. A snapshot is reused once no task reads it any more.
+
+   Multipath routing: A route may have several next hops with weights, see csp_rtable_add_nexthop(). Packets are
+   spread over the next hops by a hash of addresses and ports, so all packets of a connection take the same next hop.
+   Flows of a next hop whose interface reported a transmit error within #CSP_RTABLE_MULTIPATH_HOLDDOWN_MS move to
+   the other next hops, and return once the interface stops failing.
+
+   Backup routes: Next hops with a higher metric, see csp_rtable_add_backup(), are only used when all next hops of the
+   route with lower metrics are down. An interface is down, when the route monitor has seen it fail, see
+   csp_rtable_monitor_start().
 */
 
 #include <csp/csp_iflist.h>
 
 #define CSP_NO_VIA_ADDRESS	0xFFFF
 
+#ifndef CSP_RTABLE_MULTIPATH_MAX
+#define CSP_RTABLE_MULTIPATH_MAX 8  //! Max. number of next hops of a route.
+#endif
+
+#ifndef CSP_RTABLE_MULTIPATH_HOLDDOWN_MS
+#define CSP_RTABLE_MULTIPATH_HOLDDOWN_MS 1000  //! Time a next hop is avoided after a transmit error on its interface.
+#endif
+
 typedef struct csp_route_s {
 	uint16_t address;
 	uint16_t netmask;
    uint16_t via;
    csp_iface_t * iface;
+   uint8_t weight;        //! Share of flows for a next hop of a multipath route, 0 for a single route.
+   uint32_t tx;           //! Packets sent via this next hop, not counting those forwarded to a cached next hop. Set in copies from csp_rtable_find_route_copy() and csp_rtable_iterate().
+   uint32_t tx_avoided;   //! Packets moved to another next hop, because this one was failing. Set as \a tx.
+   uint8_t metric;        //! Preference of a next hop, lowest first. 0 for a single route.
+   uint32_t counters;     //! Internal, index of the packet counters of the next hop.
 } csp_route_t;
 
+/**
+   Find route to destination address.
+   The route is copied, as the snapshot of the table it was found in is reused for later changes.
+   @param[in] dest_address destination address.
+   @param[out] route route found, the first next hop of a multipath route.
+   @return true if found, false if no route matches.
+*/
+bool csp_rtable_find_route_copy(uint16_t dest_address, csp_route_t * route);
+
+/**
+   Find route to destination address.
+
+   @deprecated version 2.0, use csp_rtable_find_route_copy(). The route is copied to a single static entry, which the next call
+   overwrites, so this is not safe to call from more than one task.
+   @param[in] dest_address destination address.
+   @return route found, the first next hop of a multipath route, or NULL if no route matches.
+*/
 csp_route_t * csp_rtable_find_route(uint16_t dest_address);
 
 /**
@@ -34,6 +76,117 @@ csp_route_t * csp_rtable_find_route(uint16_t dest_address);
 */
 int csp_rtable_set(uint16_t dest_address, int netmask, csp_iface_t *ifc, uint16_t via);
 
+/**
+   Add next hop to a multipath route, or change the weight of an existing next hop.
+   Next hops added to a route set by csp_rtable_set() share the flows with it, as if it had weight 1.
+   csp_rtable_set() replaces all next hops of the route.
+   @param[in] dest_address destination address.
+   @param[in] netmask number of bits in netmask (set to -1 for maximum number of bits)
+   @param[in] ifc interface.
+   @param[in] via assosicated via address.
+   @param[in] weight share of flows, relative to the other next hops (1 - 255).
+   @return #CSP_ERR_NONE on success, #CSP_ERR_NOMEM if the table or route is full, or an error code.
+*/
+int csp_rtable_add_nexthop(uint16_t dest_address, int netmask, csp_iface_t * ifc, uint16_t via, uint8_t weight);
+
+/**
+   Add backup next hop to a route, or change the metric of an existing next hop.
+   The next hops with the lowest metric, whose interfaces are not down, carry the traffic of the route. A new next hop
+   has weight 1, use csp_rtable_add_nexthop() to change it.
+   @param[in] dest_address destination address.
+   @param[in] netmask number of bits in netmask (set to -1 for maximum number of bits)
+   @param[in] ifc interface.
+   @param[in] via assosicated via address.
+   @param[in] metric preference, lowest first. Next hops set by csp_rtable_set() have metric 0.
+   @return #CSP_ERR_NONE on success, #CSP_ERR_NOMEM if the table or route is full, or an error code.
+*/
+int csp_rtable_add_backup(uint16_t dest_address, int netmask, csp_iface_t * ifc, uint16_t via, uint8_t metric);
+
+/**
+   Remove next hop from a route.
+   Removing the last next hop removes the route.
+   @param[in] dest_address destination address.
+   @param[in] netmask number of bits in netmask (set to -1 for maximum number of bits)
+   @param[in] ifc interface.
+   @param[in] via assosicated via address.
+   @return #CSP_ERR_NONE on success, #CSP_ERR_INVAL if not found, or an error code.
+*/
+int csp_rtable_remove_nexthop(uint16_t dest_address, int netmask, csp_iface_t * ifc, uint16_t via);
+
+/** Bulk change of the routing table, see csp_rtable_batch_begin(). */
+typedef struct csp_rtable_batch_s csp_rtable_batch_t;
+
+/**
+   Start a bulk change of the routing table.
+   The changes are made to a copy of the table, and take effect together on csp_rtable_batch_commit(), with a single
+   rebuild of the forwarding table. Other changes of the routing table block until the batch is committed or aborted,
+   routing continues with the current table.
+   @param[in] replace start from an empty table, instead of a copy of the current table.
+   @return batch.
+*/
+csp_rtable_batch_t * csp_rtable_batch_begin(bool replace);
+
+/**
+   Add route to a bulk change.
+   With weight and metric 0 this is csp_rtable_set(), otherwise csp_rtable_add_nexthop() and csp_rtable_add_backup().
+   @param[in] batch batch.
+   @param[in] dest_address destination address.
+   @param[in] netmask number of bits in netmask (set to -1 for maximum number of bits)
+   @param[in] ifc interface.
+   @param[in] via assosicated via address.
+   @param[in] weight share of flows of a next hop, 0 for the default.
+   @param[in] metric preference of a next hop, lowest first.
+   @return #CSP_ERR_NONE on success, #CSP_ERR_NOMEM if the table or route is full, or an error code.
+*/
+int csp_rtable_batch_add(csp_rtable_batch_t * batch, uint16_t dest_address, int netmask, csp_iface_t * ifc, uint16_t via, uint8_t weight, uint8_t metric);
+
+/**
+   Commit a bulk change, replacing the routing table.
+   @param[in] batch batch.
+*/
+void csp_rtable_batch_commit(csp_rtable_batch_t * batch);
+
+/**
+   Abort a bulk change, leaving the routing table unchanged.
+   @param[in] batch batch.
+*/
+void csp_rtable_batch_abort(csp_rtable_batch_t * batch);
+
+/**
+   Resize the routing table.
+   The table holds #CSP_RTABLE_SIZE routes in static memory, until resized. Resizing allocates memory for the new size,
+   and keeps the current routes. Must be called after csp_init(). The old memory is freed once no task reads it.
+   @param[in] size max. number of routes (next hops).
+   @return #CSP_ERR_NONE on success, #CSP_ERR_NOMEM if out of memory or the current routes do not fit, or an error code.
+*/
+int csp_rtable_resize(unsigned int size);
+
+/**
+   Get size of the routing table.
+   @return max. number of routes (next hops).
+*/
+unsigned int csp_rtable_get_size(void);
+
+/**
+   Save routing table as a binary snapshot.
+   The snapshot is compact and position independent, so it can be stored in a file and mapped into memory for
+   csp_rtable_load_binary(). It records the interfaces used by the routes, by name, address and netmask.
+   @param[out] buffer user supplied buffer, or NULL to get the size.
+   @param[in] buffer_size size of \a buffer.
+   @return size of the snapshot, or an error code if \a buffer is too small.
+*/
+int csp_rtable_save_binary(void * buffer, size_t buffer_size);
+
+/**
+   Replace routing table with a binary snapshot.
+   The snapshot is validated first, the table is only replaced if the snapshot is intact, was saved for the same
+   address size, and all its interfaces exist with the same address and netmask.
+   @param[in] buffer snapshot from csp_rtable_save_binary().
+   @param[in] buffer_size size of \a buffer.
+   @return number of routes on success, #CSP_ERR_NOMEM if the table is too small, or an error code.
+*/
+int csp_rtable_load_binary(const void * buffer, size_t buffer_size);
+
 #if (CSP_HAVE_STDIO)
 /**
    Save routing table as a string (readable format).
@@ -46,9 +199,12 @@ int csp_rtable_save(char * buffer, size_t buffer_size);
 
 /**
    Load routing table from a string.
-   Table will be loaded on-top of existing routes, possibly overwriting existing entries.
-   Format: \<address\>[/mask] \<interface\> [via][, next entry]
+   Table will be loaded on-top of existing routes, possibly overwriting existing entries. The entries are loaded as a
+   bulk change, so either all or none of them take effect.
+   Format: \<address\>[/mask] \<interface\> [via] [*weight] [+metric][, next entry]
    Example: "0/0 CAN, 8 KISS, 10 I2C 10", same as "0/0 CAN, 8/5 KISS, 10/5 I2C 10".
+   Entries with a weight or metric are next hops of a multipath route, e.g. "0/0 CAN *2, 0/0 KISS *1", or a route with
+   a backup "0/0 CAN, 0/0 KISS +10".
    @see csp_rtable_save(), csp_rtable_clear(), csp_rtable_free()
    @param[in] rtable routing table (nul terminated)
    @return @ref CSP_ERR or number of entries.
@@ -84,9 +240,48 @@ typedef bool (*csp_rtable_iterator_t)(void * ctx, csp_route_t * route);
 
 /**
    Iterate routing table.
+   Iterates a snapshot of the table, unaffected by concurrent changes. The iterator must not change the routing table.
+   @param[in] iter iterator, return false to stop.
+   @param[in] ctx passed to \a iter.
 */
 void csp_rtable_iterate(csp_rtable_iterator_t iter, void * ctx);
 
+/** Route monitor event, called when an interface goes down or comes up. */
+typedef void (*csp_rtable_monitor_event_t)(void * ctx, csp_iface_t * iface, bool down);
+
+/**
+   Route monitor configuration.
+*/
+typedef struct {
+   uint32_t interval;            //!< Check interval in mS.
+   uint8_t down_count;           //!< Failing intervals in a row, before an interface is set down.
+   uint8_t up_count;             //!< Working intervals in a row, before an interface is set up again.
+   bool probe;                   //!< Probe the next hops of routes with a ping every interval, to detect failure without traffic.
+   csp_rtable_monitor_event_t event;  //!< Called on changes, from the router task. May be NULL.
+   void * ctx;                   //!< Passed to \a event.
+} csp_rtable_monitor_conf_t;
+
+/**
+   Start route monitor.
+   Checks the transmit error rate of all interfaces every interval. An interval fails, if at least half of the packets
+   transmitted failed, and works if more than half succeeded, intervals without packets do not count. Probes are pings
+   sent directly on the interface of each next hop, to the via address (or the destination of host routes), ignoring
+   any reply, so a dead link also fails while idle. Without probes, intervals without packets count as working for an
+   interface that is down, as routes with a backup no longer use it, so it is set up again to be tried after up_count
+   intervals.
+   Routes switch to backup next hops as soon as an interface is set down, at most (down_count + 1) * interval after it
+   started failing. The monitor runs from the router task, see csp_route_work().
+   @param[in] conf configuration, copied.
+   @return #CSP_ERR_NONE on success, or an error code.
+*/
+int csp_rtable_monitor_start(const csp_rtable_monitor_conf_t * conf);
+
+/**
+   Stop route monitor.
+   Interfaces keep their state.
+*/
+void csp_rtable_monitor_stop(void);
+
 #if (CSP_ENABLE_CSP_PRINT)
 
 /**
@@ -14,9 +14,13 @@
    SFP is usually sent over a RDP connection (which also adds a header),
 */
 
+#include <stdbool.h>
 #include <string.h> // memcpy()
 
 #include <csp/csp_types.h>
+#if (CSP_POSIX)
+#include <sys/types.h> // off_t
+#endif
 
 
 
@@ -55,6 +59,66 @@ static inline int csp_sfp_send(csp_conn_t * conn, const void * data, unsigned in
     return csp_sfp_send_own_memcpy(conn, data, datasize, mtu, timeout, (csp_memcpy_fnc_t) &memcpy);
 }
     
+/**
+   Write function for streaming SFP receive.
+
+   Called with the data of each fragment as soon as it is received; in order of offset, except for csp_sfp_recv_reorder() and csp_sfp_recv_selective(). The fragment data is only valid during the call.
+
+   @param[in] offset offset of the fragment in the transfer.
+   @param[in] data fragment data.
+   @param[in] length length of \a data.
+   @param[in] totalsize total size of the transfer, as announced by the sender.
+   @param[in] context user context, passed to csp_sfp_recv_stream().
+   @return #CSP_ERR_NONE to continue the transfer, otherwise an error code, which aborts the transfer and is returned from csp_sfp_recv_stream().
+*/
+typedef int (*csp_sfp_write_fnc_t)(uint32_t offset, const void * data, uint32_t length, uint32_t totalsize, void * context);
+
+/**
+   Receive data over a CSP connection, streaming each fragment to a write function.
+
+   This is the counterpart to the csp_sfp_send() and csp_sfp_send_own_memcpy(). Unlike csp_sfp_recv(), the transfer is never held in memory as a whole,
+   only one packet is held at a time, and the consumer can start processing data before the transfer completes.
+
+   @param[in] conn established connection for receiving SFP packets.
+   @param[in] writefnc function called with each fragment.
+   @param[in] context user context, passed to \a writefnc.
+   @param[out] datasize size of received data on success, may be NULL.
+   @param[in] timeout timeout in ms to wait for csp_read()
+   @param[in] first_packet First packet of a SFP transfer. Use NULL to receive first packet on the connection.
+   @return #CSP_ERR_NONE on success, otherwise an error.
+*/
+int csp_sfp_recv_stream(csp_conn_t * conn, csp_sfp_write_fnc_t writefnc, void * context, uint32_t * datasize, uint32_t timeout, csp_packet_t * first_packet);
+
+/**
+   Receive data over a CSP connection into a caller provided buffer.
+
+   @param[in] conn established connection for receiving SFP packets.
+   @param[out] buf buffer for received data.
+   @param[in] bufsize size of \a buf. The transfer fails with #CSP_ERR_NOBUFS if the sender announces a larger transfer.
+   @param[out] datasize size of received data on success, may be NULL.
+   @param[in] timeout timeout in ms to wait for csp_read()
+   @param[in] first_packet First packet of a SFP transfer. Use NULL to receive first packet on the connection.
+   @return #CSP_ERR_NONE on success, otherwise an error.
+*/
+int csp_sfp_recv_buf(csp_conn_t * conn, void * buf, uint32_t bufsize, uint32_t * datasize, uint32_t timeout, csp_packet_t * first_packet);
+
+#if (CSP_POSIX || __DOXYGEN__)
+/**
+   Receive data over a CSP connection into a file.
+
+   Each fragment is written with pwrite() at \a base + fragment offset, as it is received. The file offset of \a fd is not changed.
+
+   @param[in] conn established connection for receiving SFP packets.
+   @param[in] fd file descriptor, open for writing.
+   @param[in] base file offset of the start of the transfer.
+   @param[out] datasize size of received data on success, may be NULL.
+   @param[in] timeout timeout in ms to wait for csp_read()
+   @param[in] first_packet First packet of a SFP transfer. Use NULL to receive first packet on the connection.
+   @return #CSP_ERR_NONE on success, #CSP_ERR_DRIVER if writing to \a fd failed, otherwise an error.
+*/
+int csp_sfp_recv_fd(csp_conn_t * conn, int fd, off_t base, uint32_t * datasize, uint32_t timeout, csp_packet_t * first_packet);
+#endif
+
 /**
    Receive data over a CSP connection.
 
@@ -83,3 +147,226 @@ int csp_sfp_recv_fp(csp_conn_t * conn, void ** dataout, int * datasize, uint32_t
 static inline int csp_sfp_recv(csp_conn_t * conn, void ** dataout, int * datasize, uint32_t timeout) {
     return csp_sfp_recv_fp(conn, dataout, datasize, timeout, NULL);
 }
+
+/**
+   @defgroup CSP_SFP_REORDER Out-of-order SFP reassembly.
+
+   Reassembles a transfer by fragment offset, tolerating reordered and duplicated fragments, which makes SFP usable over connections without RDP.
+   Received data is tracked as a list of byte ranges. When fragments are lost, the receiver requests the missing ranges with a NACK message,
+   and the sender retransmits only those, instead of restarting the transfer. A NACK without ranges acknowledges the complete transfer.
+
+   csp_sfp_send_selective() and csp_sfp_recv_selective() implement the complete exchange, the remaining functions are the building blocks.
+   @{
+*/
+
+#ifndef CSP_SFP_MAX_RANGES
+#define CSP_SFP_MAX_RANGES 16  //! Max. number of disjoint ranges tracked per transfer. Fragments that would exceed it are dropped, and requested again.
+#endif
+
+/**
+   Byte range of a transfer.
+*/
+typedef struct {
+    uint32_t offset;
+    uint32_t length;
+} csp_sfp_range_t;
+
+/**
+   Reassembly state of a transfer.
+*/
+typedef struct {
+    bool started;        //!< First fragment received, \a totalsize is valid.
+    uint32_t totalsize;  //!< Total size of the transfer.
+    uint32_t received;   //!< Number of unique bytes received.
+    unsigned int count;  //!< Number of received ranges.
+    csp_sfp_range_t ranges[CSP_SFP_MAX_RANGES];  //!< Received ranges, sorted by offset, disjoint and non-adjacent.
+} csp_sfp_reasm_t;
+
+/**
+   Initialize reassembly state for a new transfer.
+   @param[out] reasm reassembly state.
+*/
+void csp_sfp_reasm_init(csp_sfp_reasm_t * reasm);
+
+/**
+   Check if a transfer is complete.
+   @param[in] reasm reassembly state.
+   @return true if all data is received.
+*/
+bool csp_sfp_reasm_complete(const csp_sfp_reasm_t * reasm);
+
+/**
+   Get missing ranges of a transfer.
+   @param[in] reasm reassembly state.
+   @param[out] missing missing ranges, sorted by offset.
+   @param[in] max max. number of ranges to return.
+   @return number of ranges returned, 0 if the transfer is complete or not started.
+*/
+unsigned int csp_sfp_reasm_missing(const csp_sfp_reasm_t * reasm, csp_sfp_range_t * missing, unsigned int max);
+
+/**
+   Receive fragments of a transfer in any order.
+
+   New data is passed to \a writefnc as soon as it is received, in the order received, and only once. Duplicates are dropped.
+   Returns when the transfer is complete, or when no fragment has been received for \a timeout. The call can be repeated with the same
+   reassembly state, to continue the transfer.
+
+   @param[in] conn connection for receiving SFP packets.
+   @param[in] writefnc function called with new data.
+   @param[in] context user context, passed to \a writefnc.
+   @param[in,out] reasm reassembly state, initialized with csp_sfp_reasm_init() before the first call.
+   @param[in] timeout timeout in ms to wait for csp_read()
+   @param[in] first_packet First packet of a SFP transfer. Use NULL to receive first packet on the connection.
+   @return #CSP_ERR_NONE when the transfer is complete, #CSP_ERR_TIMEDOUT if data is missing, otherwise an error.
+*/
+int csp_sfp_recv_reorder(csp_conn_t * conn, csp_sfp_write_fnc_t writefnc, void * context, csp_sfp_reasm_t * reasm, uint32_t timeout, csp_packet_t * first_packet);
+
+/**
+   Send NACK, requesting the missing ranges of a transfer.
+
+   If there are more missing ranges than fit in a packet, the first are requested. If nothing is missing, the NACK acknowledges the transfer.
+
+   @param[in] conn connection the transfer is received on.
+   @param[in] reasm reassembly state.
+   @return #CSP_ERR_NONE on success, otherwise an error.
+*/
+int csp_sfp_send_nack(csp_conn_t * conn, const csp_sfp_reasm_t * reasm);
+
+/**
+   Retransmit the ranges requested by a NACK.
+
+   @param[in] conn connection the transfer is sent on.
+   @param[in] data data of the transfer.
+   @param[in] totalsize size of \a data.
+   @param[in] mtu maximum transfer unit (bytes), max data chunk to send.
+   @param[in] packet received NACK, always freed.
+   @param[in] memcpyfcn memory copy function.
+   @param[out] complete set to true if the NACK acknowledges the complete transfer.
+   @return #CSP_ERR_NONE on success, #CSP_ERR_SFP if \a packet is not a valid NACK for the transfer, otherwise an error.
+*/
+int csp_sfp_retransmit(csp_conn_t * conn, const void * data, unsigned int totalsize, unsigned int mtu, csp_packet_t * packet, csp_memcpy_fnc_t memcpyfcn, bool * complete);
+
+/**
+   Send data, and retransmit missing ranges until the receiver acknowledges the transfer.
+
+   Counterpart to csp_sfp_recv_selective().
+
+   The receiver acknowledges the transfer once, with an empty NACK, and is not waiting for the sender when doing so. If the
+   acknowledgement is lost, #CSP_ERR_TIMEDOUT is returned although the receiver may have the complete data. Confirm the
+   outcome at the application level where this matters, e.g. by a reply from the receiver.
+
+   @param[in] conn established connection for sending SFP packets.
+   @param[in] data data to send
+   @param[in] datasize size of \a data
+   @param[in] mtu maximum transfer unit (bytes), max data chunk to send.
+   @param[in] timeout timeout in ms to wait for a NACK.
+   @param[in] memcpyfcn memory copy function.
+   @return #CSP_ERR_NONE when acknowledged, #CSP_ERR_TIMEDOUT if the receiver went silent, otherwise an error.
+*/
+int csp_sfp_send_selective(csp_conn_t * conn, const void * data, unsigned int datasize, unsigned int mtu, uint32_t timeout, csp_memcpy_fnc_t memcpyfcn);
+
+/**
+   Receive data in any order, requesting missing ranges until the transfer is complete.
+
+   Counterpart to csp_sfp_send_selective(). When no fragment has been received for \a timeout, the missing ranges are requested with a NACK,
+   up to \a retries times. The complete transfer is acknowledged with an empty NACK, sent once, see csp_sfp_send_selective().
+
+   @param[in] conn established connection for receiving SFP packets.
+   @param[in] writefnc function called with new data, in the order received.
+   @param[in] context user context, passed to \a writefnc.
+   @param[out] datasize size of received data on success, may be NULL.
+   @param[in] timeout timeout in ms to wait for csp_read()
+   @param[in] retries max. number of NACKs sent.
+   @param[in] first_packet First packet of a SFP transfer. Use NULL to receive first packet on the connection.
+   @return #CSP_ERR_NONE on success, otherwise an error.
+*/
+int csp_sfp_recv_selective(csp_conn_t * conn, csp_sfp_write_fnc_t writefnc, void * context, uint32_t * datasize, uint32_t timeout, unsigned int retries, csp_packet_t * first_packet);
+
+/**@}*/
+
+#if (CSP_POSIX || __DOXYGEN__)
+/**
+   @defgroup CSP_SFP_FILE Resumable SFP file transfer.
+
+   Transfers a file between file descriptors. The sender maps the file (or reads it with pread() if it cannot be mapped) and copies
+   fragments straight into packets, the receiver writes each fragment with pwrite() as it arrives.
+
+   Each transfer carries a transfer ID chosen by the sender. The receiver keeps the progress in a #csp_sfp_file_state_t; if the connection
+   drops, the transfer is resumed from the received offset by calling csp_sfp_file_send() and csp_sfp_file_recv() again, on a new
+   connection, with the same transfer ID and state. When all data is received, the receiver reads the file back, and both sides compare the
+   checksum (CRC32) with that of the original file.
+
+   The in-order receive requires a reliable connection (RDP).
+   @{
+*/
+
+/**
+   Receiver progress of a file transfer.
+   Zero initialize before the first transfer. May be stored, to resume a transfer after restart.
+*/
+typedef struct {
+    uint32_t transfer_id;  //!< Transfer ID of the last offered transfer.
+    uint32_t totalsize;    //!< Size of the file.
+    uint32_t crc;          //!< Checksum of the file, as sent by the sender.
+    uint32_t offset;       //!< Bytes received and written, from the start of the file.
+} csp_sfp_file_state_t;
+
+/**
+   File transfer option: compress the data (see csp_compress.h), if the receiver accepts it.
+   Each fragment carries up to \a mtu - 1 bytes of file data, compressed if that makes it smaller.
+*/
+#define CSP_SFP_FILE_COMPRESS 0x01
+
+/**
+   Send file over a CSP connection, resuming from where the receiver left off.
+
+   Counterpart to csp_sfp_file_recv(). Options are offered to the receiver, and only used if it accepts them.
+
+   @param[in] conn established connection for sending SFP packets.
+   @param[in] transfer_id transfer ID, must be the same when resuming a transfer.
+   @param[in] fd file descriptor, open for reading. The file size must fit in 32 bits.
+   @param[in] mtu maximum transfer unit (bytes), max data chunk to send.
+   @param[in] options transfer options, e.g. #CSP_SFP_FILE_COMPRESS.
+   @param[in] timeout timeout in ms to wait for the receiver, this includes the time needed to checksum the received file.
+   @return #CSP_ERR_NONE when the receiver has confirmed the checksum, #CSP_ERR_CRC32 on checksum mismatch,
+           #CSP_ERR_DRIVER if reading \a fd failed, otherwise an error.
+*/
+int csp_sfp_file_send_opts(csp_conn_t * conn, uint32_t transfer_id, int fd, unsigned int mtu, unsigned int options, uint32_t timeout);
+
+/**
+   Send file over a CSP connection, resuming from where the receiver left off.
+
+   Uses csp_sfp_file_send_opts() without options.
+
+   @param[in] conn established connection for sending SFP packets.
+   @param[in] transfer_id transfer ID, must be the same when resuming a transfer.
+   @param[in] fd file descriptor, open for reading. The file size must fit in 32 bits.
+   @param[in] mtu maximum transfer unit (bytes), max data chunk to send.
+   @param[in] timeout timeout in ms to wait for the receiver, this includes the time needed to checksum the received file.
+   @return #CSP_ERR_NONE when the receiver has confirmed the checksum, #CSP_ERR_CRC32 on checksum mismatch,
+           #CSP_ERR_DRIVER if reading \a fd failed, otherwise an error.
+*/
+static inline int csp_sfp_file_send(csp_conn_t * conn, uint32_t transfer_id, int fd, unsigned int mtu, uint32_t timeout) {
+    return csp_sfp_file_send_opts(conn, transfer_id, fd, mtu, 0, timeout);
+}
+
+/**
+   Receive file over a CSP connection, resuming a previous transfer if possible.
+
+   The transfer is resumed if the offered transfer ID, size and checksum match \a state, otherwise it is received from the start.
+   A transfer received from the start first truncates (or extends) the file to the offered size.
+   Offered options are accepted if supported, e.g. #CSP_SFP_FILE_COMPRESS with #CSP_USE_COMPRESS.
+   On failure, \a state holds the progress, to resume from on the next call.
+
+   @param[in] conn established connection for receiving SFP packets.
+   @param[in] fd file descriptor, open for reading and writing. Must be the same file when resuming.
+   @param[in,out] state progress of the transfer.
+   @param[in] timeout timeout in ms to wait for csp_read()
+   @param[in] first_packet First packet (the offer) of a transfer. Use NULL to receive first packet on the connection.
+   @return #CSP_ERR_NONE when the file is complete and verified, #CSP_ERR_CRC32 on checksum mismatch (the progress is reset),
+           #CSP_ERR_DRIVER if writing \a fd failed, otherwise an error.
+*/
+int csp_sfp_file_recv(csp_conn_t * conn, int fd, csp_sfp_file_state_t * state, uint32_t timeout, csp_packet_t * first_packet);
+
+/**@}*/
+#endif
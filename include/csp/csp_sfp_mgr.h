@@ -0,0 +1,140 @@
+#pragma once
+
+/**
+   @file
+
+   SFP transfer manager.
+
+   Multiplexes many inbound and outbound SFP transfers on a single service task, instead of a blocking task per transfer.
+   Transfers are driven by connection events (see csp_conn_set_event_handler()), and the service task calls csp_sfp_mgr_work()
+   in a loop, in the same way as the router task calls csp_route_work().
+
+   The manager takes over the connection of a transfer, and closes it after the completion callback returns.
+   Outbound transfers over RDP use csp_send_nonblock(), and complete when all data is acknowledged.
+   Inbound transfers must be received in order, i.e. over RDP.
+
+   Inbound transfers received into memory are allocated from a global memory budget, so the total memory used for
+   reassembly is bounded. Transfers that would exceed the budget fail with #CSP_ERR_NOMEM.
+*/
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <csp/csp_sfp.h>
+
+#ifndef CSP_SFP_MGR_MAX_TRANSFERS
+#define CSP_SFP_MGR_MAX_TRANSFERS 8  //! Max. number of concurrent transfers.
+#endif
+
+#ifndef CSP_SFP_MGR_BURST
+#define CSP_SFP_MGR_BURST 4  //! Max. number of fragments handled per transfer, before serving the next transfer.
+#endif
+
+#ifndef CSP_SFP_MGR_POLL_MS
+#define CSP_SFP_MGR_POLL_MS 50  //! Interval for retrying transfers blocked on buffers, and checking idle timeouts.
+#endif
+
+#ifndef CSP_SFP_MGR_MAX_RETRIES
+#define CSP_SFP_MGR_MAX_RETRIES 100  //! Max. retries of a transfer blocked on buffers without progress, before it fails with #CSP_ERR_NOMEM.
+#endif
+
+/**
+   Transfer information, passed to the completion callback and returned by csp_sfp_mgr_progress().
+*/
+typedef struct {
+    int id;                //!< Transfer ID, as returned by csp_sfp_mgr_send() or csp_sfp_mgr_recv().
+    bool outbound;         //!< True for transfers sent, false for transfers received.
+    uint32_t totalsize;    //!< Size of the transfer, for inbound transfers 0 until the first fragment is received.
+    uint32_t transferred;  //!< Bytes sent or received.
+    uint32_t elapsed_ms;   //!< Time since the transfer was started.
+    uint32_t throughput;   //!< Average throughput in bytes/s.
+    const void * data;     //!< Received data, for inbound transfers into memory. Only valid during the completion callback.
+} csp_sfp_mgr_transfer_t;
+
+/**
+   Transfer completion callback.
+   Called from the task calling csp_sfp_mgr_work(). The connection is closed after the callback returns.
+   @param[in] transfer transfer information.
+   @param[in] error #CSP_ERR_NONE if the transfer completed, otherwise the reason it failed.
+   @param[in] context user context.
+*/
+typedef void (*csp_sfp_mgr_done_t)(const csp_sfp_mgr_transfer_t * transfer, int error, void * context);
+
+/**
+   Manager statistics.
+*/
+typedef struct {
+    unsigned int active;    //!< Transfers in progress.
+    uint32_t completed;     //!< Transfers completed.
+    uint32_t failed;        //!< Transfers failed or cancelled.
+    uint64_t tx_bytes;      //!< Bytes sent.
+    uint64_t rx_bytes;      //!< Bytes received.
+    size_t mem_used;        //!< Memory currently allocated for inbound transfers.
+    size_t mem_peak;        //!< Max. memory allocated for inbound transfers.
+    uint32_t mem_rejected;  //!< Inbound transfers rejected, because they exceeded the memory budget.
+} csp_sfp_mgr_stats_t;
+
+/**
+   Initialize the SFP transfer manager.
+   @param[in] mem_budget max. total memory allocated for inbound transfers into memory.
+   @param[in] idle_timeout fail transfers making no progress for this long (mS), 0 to disable.
+   @return #CSP_ERR_NONE on success, otherwise an error code.
+*/
+int csp_sfp_mgr_init(size_t mem_budget, uint32_t idle_timeout);
+
+/**
+   Start sending data.
+
+   The data must remain valid until the completion callback. The connection may still be connecting (csp_connect_nonblock()).
+
+   @param[in] conn connection to send on, owned by the manager from now on.
+   @param[in] data data to send
+   @param[in] datasize size of \a data
+   @param[in] mtu maximum transfer unit (bytes), max data chunk to send. Must fit in a buffer with the SFP header.
+   @param[in] done completion callback, may be NULL.
+   @param[in] context user context, passed to \a done.
+   @return transfer ID (> 0) on success, #CSP_ERR_INVAL if \a mtu is too large, otherwise an error code (the connection is not taken over).
+*/
+int csp_sfp_mgr_send(csp_conn_t * conn, const void * data, uint32_t datasize, unsigned int mtu, csp_sfp_mgr_done_t done, void * context);
+
+/**
+   Start receiving data.
+
+   @param[in] conn connection to receive on, e.g. from csp_accept(), owned by the manager from now on.
+   @param[in] writefnc function called with each fragment, NULL to receive into memory (from the memory budget).
+   @param[in] write_context user context, passed to \a writefnc.
+   @param[in] done completion callback, may be NULL.
+   @param[in] context user context, passed to \a done.
+   @return transfer ID (> 0) on success, otherwise an error code (the connection is not taken over).
+*/
+int csp_sfp_mgr_recv(csp_conn_t * conn, csp_sfp_write_fnc_t writefnc, void * write_context, csp_sfp_mgr_done_t done, void * context);
+
+/**
+   Cancel a transfer.
+   The completion callback is called with #CSP_ERR_RESET, from the service task.
+   @param[in] id transfer ID.
+   @return #CSP_ERR_NONE on success, #CSP_ERR_INVAL if no such transfer is active.
+*/
+int csp_sfp_mgr_cancel(int id);
+
+/**
+   Get progress of a transfer.
+   @param[in] id transfer ID.
+   @param[out] transfer transfer information.
+   @return #CSP_ERR_NONE on success, #CSP_ERR_INVAL if no such transfer is active.
+*/
+int csp_sfp_mgr_progress(int id, csp_sfp_mgr_transfer_t * transfer);
+
+/**
+   Get manager statistics.
+   @param[out] stats statistics.
+*/
+void csp_sfp_mgr_get_stats(csp_sfp_mgr_stats_t * stats);
+
+/**
+   Serve transfers.
+   Call in a loop from the service task. Waits up to \a timeout for connection events, then serves all transfers with pending work.
+   @param[in] timeout max. time to wait for events (mS).
+   @return #CSP_ERR_NONE if transfers were served, #CSP_ERR_TIMEDOUT if there were no events.
+*/
+int csp_sfp_mgr_work(uint32_t timeout);
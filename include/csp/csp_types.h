@@ -65,6 +65,7 @@ typedef struct  __attribute__((packed)) {
 #define CSP_FRES3			0x20 //!< Reserved for future use
 #define CSP_FFRAG			0x10 //!< Use fragmentation
 #define CSP_FHMAC			0x08 //!< Use HMAC verification
+#define CSP_FCOMP			0x04 //!< Payload compressed (see csp_compress.h), XTEA in CSP 1.x
 #define CSP_FRDP			0x02 //!< Use RDP protocol
 #define CSP_FCRC32			0x01 //!< Use CRC32 checksum
 /**@}*/
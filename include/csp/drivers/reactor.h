@@ -0,0 +1,146 @@
+#pragma once
+
+/**
+   @file
+
+   I/O reactor for Linux drivers (io_uring).
+
+   A few reactor tasks serve the file descriptors of all drivers registered with them, instead of a receive thread
+   per driver. Datagrams are received directly into CSP buffers, using the CSP buffer pool registered as io_uring
+   fixed buffers (no copy), and sends queued by several tasks at the same time are submitted to the kernel together.
+
+   Drivers use the reactor if it was started with csp_reactor_init() before they are opened, otherwise their own
+   threads: the UDP interface (csp_if_udp_init()) and the USART driver (csp_usart_open()).
+*/
+
+#include <csp/csp.h>
+
+#include <netinet/in.h>
+
+#ifndef CSP_REACTOR_ENTRIES
+#define CSP_REACTOR_ENTRIES 256  //! Submission queue entries per reactor task, max. number of sends in flight.
+#endif
+
+#ifndef CSP_REACTOR_THREADS
+#define CSP_REACTOR_THREADS 4  //! Max. number of reactor tasks.
+#endif
+
+#ifndef CSP_REACTOR_DEPTH
+#define CSP_REACTOR_DEPTH 32  //! Max. number of receives in flight per datagram file descriptor.
+#endif
+
+/**
+   File descriptor served by the reactor.
+*/
+typedef struct csp_reactor_fd_s csp_reactor_fd_t;
+
+/**
+   Callback for data read from a stream, e.g. a serial port.
+
+   @param[in] user_data reference given to csp_reactor_add_stream().
+   @param[in] data data read.
+   @param[in] length number of bytes read, 0 at end of file, or a negative errno. The file descriptor is no longer read
+   after an error or end of file.
+*/
+typedef void (*csp_reactor_read_t)(void * user_data, uint8_t * data, int length);
+
+/**
+   Callback for a datagram received into a CSP buffer.
+
+   The frame is received at packet->frame_begin, setup by csp_id_setup_rx(). The callback takes over the packet.
+
+   @param[in] user_data reference given to csp_reactor_add_frames().
+   @param[in] packet packet received, NULL on error.
+   @param[in] length frame length, or a negative errno if packet is NULL.
+   @param[in] from source address, if requested.
+*/
+typedef void (*csp_reactor_frame_t)(void * user_data, csp_packet_t * packet, int length, const struct sockaddr_in * from);
+
+/**
+   Reactor counters.
+*/
+typedef struct {
+    uint32_t enter;         //!< io_uring_enter() system calls.
+    uint32_t submitted;     //!< Operations submitted.
+    uint32_t completed;     //!< Operations completed.
+    uint32_t rx;            //!< Datagrams and reads completed.
+    uint32_t tx;            //!< Sends completed.
+    uint32_t tx_error;      //!< Sends failed.
+    uint32_t no_buffer;     //!< Receives delayed, no CSP buffer free.
+} csp_reactor_stats_t;
+
+/**
+   Start the reactor.
+
+   Call after csp_init(), and before opening the drivers using it. The CSP buffer pool is registered once, if the
+   kernel refuses, frames are still received directly into CSP buffers.
+
+   @param[in] threads number of reactor tasks, max. #CSP_REACTOR_THREADS.
+   @return #CSP_ERR_NONE on success, #CSP_ERR_NOTSUP if io_uring is not available, otherwise an error code.
+*/
+int csp_reactor_init(unsigned int threads);
+
+/**
+   Check if the reactor is running.
+   @return true if started with csp_reactor_init().
+*/
+bool csp_reactor_running(void);
+
+/**
+   Read a stream.
+
+   The reactor reads into a buffer of its own, and calls \a callback with the data read.
+
+   @param[in] fd file descriptor.
+   @param[in] size buffer size.
+   @param[in] callback called for the data read, from a reactor task.
+   @param[in] user_data reference forwarded to \a callback.
+   @return the reactor file descriptor, or NULL on failure.
+*/
+csp_reactor_fd_t * csp_reactor_add_stream(int fd, size_t size, csp_reactor_read_t callback, void * user_data);
+
+/**
+   Receive datagrams into CSP buffers.
+
+   Up to \a depth receives are in flight, each in a CSP buffer. Buffers beyond the first are only held while more than
+   \a depth buffers are free, so a small pool is not used up.
+
+   @param[in] fd socket.
+   @param[in] iface interface, sends failing are counted in its tx_error.
+   @param[in] depth max. number of receives in flight, max. #CSP_REACTOR_DEPTH.
+   @param[in] source true to get the source address of each datagram.
+   @param[in] callback called for each datagram, from a reactor task.
+   @param[in] user_data reference forwarded to \a callback.
+   @return the reactor file descriptor, or NULL on failure.
+*/
+csp_reactor_fd_t * csp_reactor_add_frames(int fd, csp_iface_t * iface, unsigned int depth, bool source, csp_reactor_frame_t callback, void * user_data);
+
+/**
+   Stop serving a file descriptor.
+
+   Cancels the receives in flight, waits for them and the sends queued to complete, and frees \a rfd and the receives
+   it reserved. The callbacks are not called for the receives cancelled. The file descriptor is left open. Do not call
+   from a callback, which runs in the reactor task, nor while another task sends on \a rfd.
+
+   @param[in] rfd reactor file descriptor, may be NULL.
+*/
+void csp_reactor_remove(csp_reactor_fd_t * rfd);
+
+/**
+   Send a frame.
+
+   Sends packet->frame_begin, packet->frame_length bytes. The send is submitted together with the others queued at the
+   same time, and the packet is freed when it completes. Waits while #CSP_REACTOR_ENTRIES sends are in flight.
+
+   @param[in] rfd reactor file descriptor.
+   @param[in] packet packet to send, freed by the reactor.
+   @param[in] to destination, or NULL for a connected socket.
+   @return #CSP_ERR_NONE if queued, the packet is then freed by the reactor.
+*/
+int csp_reactor_send(csp_reactor_fd_t * rfd, csp_packet_t * packet, const struct sockaddr_in * to);
+
+/**
+   Get the reactor counters, summed over the reactor tasks.
+   @param[out] stats counters.
+*/
+void csp_reactor_get_stats(csp_reactor_stats_t * stats);
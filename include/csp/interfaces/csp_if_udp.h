@@ -5,6 +5,45 @@
 #include <pthread.h>
 #include <netinet/in.h>
 
+#ifndef CSP_IF_UDP_BATCH
+#define CSP_IF_UDP_BATCH 32  //! Max. number of packets sent or received per system call.
+#endif
+
+#ifndef CSP_IF_UDP_RX_RESERVE
+#define CSP_IF_UDP_RX_RESERVE (CSP_BUFFER_COUNT / 2)  //! Free buffers left to the rest of the system, by a receive task holding more than one.
+#endif
+
+#ifndef CSP_IF_UDP_RX_THREADS
+#define CSP_IF_UDP_RX_THREADS 8  //! Max. number of receive tasks per interface.
+#endif
+
+#ifndef CSP_IF_UDP_PEERS
+#define CSP_IF_UDP_PEERS 32  //! Max. number of peers per interface, configured and allowed to be learned.
+#endif
+
+/**
+ * UDP endpoint of a CSP address
+ */
+typedef struct {
+	uint16_t addr;                  //!< CSP address, the via address of a route or the destination.
+	bool learned;                   //!< Learned from received frames, see csp_if_udp_peer_learn().
+	struct sockaddr_in sockaddr;    //!< UDP endpoint, sin_family AF_UNSPEC until learned.
+} csp_if_udp_peer_t;
+
+/**
+ * Receive task, with a socket and counters of its own
+ */
+typedef struct {
+	csp_iface_t * iface;
+	pthread_t handle;
+	int sockfd;
+	struct csp_reactor_fd_s * reactor;  //!< Reactor serving the socket instead of the task, see csp_reactor_init().
+	uint32_t frames;                //!< Frames received.
+	uint32_t bursts;                //!< System calls receiving frames.
+	uint32_t rx_error;              //!< Invalid frames and receive errors, also counted by the interface.
+	uint32_t drop;                  //!< Times no buffer was free, also counted by the interface.
+} csp_if_udp_rx_t;
+
 typedef struct {
 
 	/* Should be set before calling if_udp_init */
@@ -12,9 +51,27 @@ typedef struct {
 	int lport;
 	int rport;
 
+	/* Optional, 0 for the default */
+	int rcvbuf;                 //!< Socket receive buffer size in bytes (SO_RCVBUF).
+	int sndbuf;                 //!< Socket send buffer size in bytes (SO_SNDBUF).
+	unsigned int rx_batch;      //!< Max. number of packets received per system call, default and max. #CSP_IF_UDP_BATCH.
+	unsigned int rx_threads;    //!< Number of receive tasks, default 1, max. #CSP_IF_UDP_RX_THREADS.
+
 	/* Internal parameters */
-	pthread_t server_handle;
 	struct sockaddr_in peer_addr;
+	int sockfd;
+	pthread_mutex_t rx_lock;
+	csp_if_udp_rx_t rx[CSP_IF_UDP_RX_THREADS];
+	pthread_mutex_t tx_lock;
+	pthread_cond_t tx_cond;
+	bool tx_flushing;
+	unsigned int tx_taken;
+	unsigned int tx_count;
+	csp_packet_t * tx_batch[CSP_IF_UDP_BATCH];
+	struct sockaddr_in tx_addr[CSP_IF_UDP_BATCH];
+	unsigned int peer_count;
+	bool peer_learn;            //!< An address may be learned, accessed atomically.
+	csp_if_udp_peer_t peers[CSP_IF_UDP_PEERS];
 
 } csp_if_udp_conf_t;
 
@@ -25,8 +82,86 @@ typedef struct {
  *   A server task will attempt at binding to ip 0.0.0.0 port 9600
  *   If this fails, it is because another udp server is already running.
  *   The server task will continue attemting the bind and will not exit before the application is closed.
+ *   Packets are received in bursts of up to rx_batch per system call, into CSP buffers allocated in advance. Buffers
+ *   beyond the first are only held while more than #CSP_IF_UDP_RX_RESERVE buffers are free, so a small pool is not
+ *   used up.
+ *
+ * RX tasks:
+ *   With rx_threads > 1, each task has a socket bound to the listen port with SO_REUSEPORT, its own buffers and
+ *   counters (ifconf->rx[]). The kernel spreads the frames by a hash of the source and destination IP address and
+ *   port, so all frames from one peer endpoint are received by the same task, and are passed to the router in the
+ *   order they were received. Frames from different peers may be reordered, and one peer only uses one task. If a
+ *   socket could not be bound at init, the frames of a peer may move to another task when it is bound later.
+ *   Routing in several tasks (csp_route_work()) may reorder the frames of a peer again.
+ *   With SO_REUSEPORT, another process of the same user can bind the port too, and take part of the frames.
+ *   If the reactor was started (csp_reactor_init()), the sockets bound at init are served by the reactor tasks
+ *   instead, frames are received directly into CSP buffers, and packets are sent through the reactor as well.
  *
  * TX peer:
- *   Outgoing CSP packets will be transferred to the peer specified by the host argument
+ *   Outgoing CSP packets will be transferred to the peer of their via address, or their destination if sent without
+ *   one, see csp_if_udp_peer_add(). Packets to other addresses are transferred to the peer specified by the host
+ *   argument, or dropped if host is NULL.
+ *   Packets are sent from the socket bound to the listen port if it was free at init, so peers can learn it.
+ *   Packets sent by several tasks at the same time are sent together. A task sending while another one sends, waits
+ *   until its packet is taken into a batch, and sends the packets queued meanwhile if none was. So each task sends at
+ *   most one batch, of up to #CSP_IF_UDP_BATCH packets, and a task waits while as many are queued already.
+ *   Packets the system fails to send are counted in tx_error, after they were accepted (and counted in tx).
+ *
+ * All peers share the interface, so packets received from one peer are not routed to another (split horizon).
  */
 void csp_if_udp_init(csp_iface_t * iface, csp_if_udp_conf_t * ifconf);
+
+/**
+ * Add or change the peer of a CSP address
+ *
+ * The endpoint is no longer learned, if it was.
+ *
+ * @param[in] iface UDP interface, initialized
+ * @param[in] addr CSP address, the via address of routes or a destination
+ * @param[in] host IPv4 address of the peer
+ * @param[in] port UDP port of the peer
+ * @return #CSP_ERR_NONE on success, #CSP_ERR_INVAL for an invalid host, #CSP_ERR_NOMEM if the table is full
+ */
+int csp_if_udp_peer_add(csp_iface_t * iface, uint16_t addr, const char * host, int port);
+
+/**
+ * Add peers from a string
+ *
+ * Format: \<address\> \<host\>[:port][, next entry], the port defaults to the remote port of the interface.
+ * An entry \<address\> learn allows learning the endpoint of the address, see csp_if_udp_peer_learn().
+ * Example: "10 192.168.1.10, 11 192.168.1.11:9700, 12 learn"
+ *
+ * @param[in] iface UDP interface, initialized
+ * @param[in] peers peers
+ * @return number of peers added, or an error code (the entries before the one failing are added)
+ */
+int csp_if_udp_peer_load(csp_iface_t * iface, const char * peers);
+
+/**
+ * Allow learning the endpoint of a CSP address
+ *
+ * The endpoint is then set from the source of the frames received from the address, so replies reach a peer behind
+ * NAT, or with a dynamic IP address or port. Until the first frame, packets to the address are sent to the default
+ * peer (the host argument). Only the addresses allowed are learned, and a configured endpoint is kept until this is
+ * called for it.
+ *
+ * The source of a frame is not authenticated: the endpoint is learned when the frame is received, before the router
+ * checks its CRC or HMAC. So any host able to send to the listen port can redirect the packets to a learned address,
+ * by sending a frame with that source address. Only allow learning on trusted networks, or for addresses whose
+ * traffic is authenticated end to end.
+ *
+ * @param[in] iface UDP interface, initialized
+ * @param[in] addr CSP address
+ * @return #CSP_ERR_NONE on success, #CSP_ERR_NOMEM if the table is full
+ */
+int csp_if_udp_peer_learn(csp_iface_t * iface, uint16_t addr);
+
+/**
+ * Find the peer of a CSP address
+ *
+ * @param[in] iface UDP interface, initialized
+ * @param[in] addr CSP address
+ * @param[out] peer copy of the peer
+ * @return true if found
+ */
+bool csp_if_udp_peer_get(csp_iface_t * iface, uint16_t addr, csp_if_udp_peer_t * peer);
@@ -9,19 +9,25 @@
 #include <csp/csp_buffer.h>
 #include <csp/crypto/csp_sha1.h>
 
-#define HMAC_KEY_LENGTH 16
+#include "../csp_mutex.h"
 
-/* HMAC key */
-static uint8_t csp_hmac_key[HMAC_KEY_LENGTH];
+#define HMAC_KEY_LENGTH 16
 
 /* HMAC state structure */
 typedef struct {
 	csp_sha1_state_t md;
-	uint8_t key[CSP_SHA1_BLOCKSIZE];
+	/* Outer hash with the key block already processed */
+	csp_sha1_state_t outer;
 } hmac_state;
 
-static int csp_hmac_init(hmac_state * hmac, const uint8_t * key, uint32_t keylen) {
+/* State after the key blocks for the key set by csp_hmac_set_key(), so each packet only costs the message blocks
+ * and the two finalisations. Copied by the pipeline workers, and replaced by csp_hmac_set_key(), under the lock. */
+static hmac_state csp_hmac_keyed;
+static csp_mutex_t csp_hmac_keyed_lock;
+
+static int csp_hmac_state_init(hmac_state * hmac, const uint8_t * key, uint32_t keylen) {
 	uint32_t i;
+	uint8_t hkey[CSP_SHA1_BLOCKSIZE];
 	uint8_t buf[CSP_SHA1_BLOCKSIZE];
 
 	/* NULL pointer and key check */
@@ -30,24 +36,31 @@ static int csp_hmac_init(hmac_state * hmac, const uint8_t * key, uint32_t keylen
 
 	/* Make sure we have a large enough key */
 	if (keylen > CSP_SHA1_BLOCKSIZE) {
-		csp_sha1_memory(key, keylen, hmac->key);
+		csp_sha1_memory(key, keylen, hkey);
 		if (CSP_SHA1_DIGESTSIZE < CSP_SHA1_BLOCKSIZE)
-			memset((hmac->key) + CSP_SHA1_DIGESTSIZE, 0, (CSP_SHA1_BLOCKSIZE - CSP_SHA1_DIGESTSIZE));
+			memset(hkey + CSP_SHA1_DIGESTSIZE, 0, (CSP_SHA1_BLOCKSIZE - CSP_SHA1_DIGESTSIZE));
 	} else {
-		memcpy(hmac->key, key, keylen);
+		memcpy(hkey, key, keylen);
 		if (keylen < CSP_SHA1_BLOCKSIZE)
-			memset((hmac->key) + keylen, 0, (CSP_SHA1_BLOCKSIZE - keylen));
+			memset(hkey + keylen, 0, (CSP_SHA1_BLOCKSIZE - keylen));
 	}
 
 	/* Create the initial vector */
 	for (i = 0; i < CSP_SHA1_BLOCKSIZE; i++) {
-		buf[i] = hmac->key[i] ^ 0x36;
+		buf[i] = hkey[i] ^ 0x36;
 	}
 
 	/* Prepend to the hash data */
 	csp_sha1_init(&hmac->md);
 	csp_sha1_process(&hmac->md, buf, CSP_SHA1_BLOCKSIZE);
 
+	/* Create the second HMAC vector, and start the outer hash */
+	for (i = 0; i < CSP_SHA1_BLOCKSIZE; i++) {
+		buf[i] = hkey[i] ^ 0x5C;
+	}
+	csp_sha1_init(&hmac->outer);
+	csp_sha1_process(&hmac->outer, buf, CSP_SHA1_BLOCKSIZE);
+
 	return CSP_ERR_NONE;
 }
 
@@ -72,20 +85,9 @@ static int csp_hmac_done(hmac_state * hmac, uint8_t * out) {
 	uint8_t isha[CSP_SHA1_DIGESTSIZE];
 	csp_sha1_done(&hmac->md, isha);
 
-	/* Create the second HMAC vector vector */
-	uint8_t buf[CSP_SHA1_BLOCKSIZE];
-	for (unsigned int i = 0; i < sizeof(buf); i++) {
-		buf[i] = hmac->key[i] ^ 0x5C;
-	}
-
 	/* Now calculate the outer hash */
-	csp_sha1_init(&hmac->md);
-	csp_sha1_process(&hmac->md, buf, sizeof(buf));
-	csp_sha1_process(&hmac->md, isha, sizeof(isha));
-	csp_sha1_done(&hmac->md, buf);
-
-	/* Copy to output  */
-	memcpy(out, buf, CSP_SHA1_DIGESTSIZE);
+	csp_sha1_process(&hmac->outer, isha, sizeof(isha));
+	csp_sha1_done(&hmac->outer, out);
 
 	return CSP_ERR_NONE;
 }
@@ -98,7 +100,7 @@ int csp_hmac_memory(const void * key, uint32_t keylen, const void * data, uint32
 		return CSP_ERR_INVAL;
 
 	/* Init HMAC state */
-	if (csp_hmac_init(&state, key, keylen) != 0)
+	if (csp_hmac_state_init(&state, key, keylen) != 0)
 		return CSP_ERR_INVAL;
 
 	/* Process data */
@@ -112,18 +114,42 @@ int csp_hmac_memory(const void * key, uint32_t keylen, const void * data, uint32
 	return CSP_ERR_NONE;
 }
 
+void csp_hmac_init(void) {
+
+	/* Until a key is set, use all zero key */
+	static const uint8_t zero_key[HMAC_KEY_LENGTH];
+	csp_hmac_state_init(&csp_hmac_keyed, zero_key, sizeof(zero_key));
+	csp_mutex_init(&csp_hmac_keyed_lock);
+}
+
 int csp_hmac_set_key(const void * key, uint32_t keylen) {
 
 	/* Use SHA1 as KDF */
 	uint8_t hash[CSP_SHA1_DIGESTSIZE];
 	csp_sha1_memory(key, keylen, hash);
 
-	/* Copy key */
-	memcpy(csp_hmac_key, hash, sizeof(csp_hmac_key));
+	/* Precompute key blocks, then publish them */
+	hmac_state keyed;
+	csp_hmac_state_init(&keyed, hash, HMAC_KEY_LENGTH);
+
+	csp_mutex_lock(&csp_hmac_keyed_lock);
+	csp_hmac_keyed = keyed;
+	csp_mutex_unlock(&csp_hmac_keyed_lock);
 
 	return CSP_ERR_NONE;
 }
 
+/* HMAC with the key set by csp_hmac_set_key() */
+static void csp_hmac_keyed_memory(const void * data, uint32_t datalen, uint8_t * hmac) {
+
+	csp_mutex_lock(&csp_hmac_keyed_lock);
+	hmac_state state = csp_hmac_keyed;
+	csp_mutex_unlock(&csp_hmac_keyed_lock);
+
+	csp_hmac_process(&state, data, datalen);
+	csp_hmac_done(&state, hmac);
+}
+
 int csp_hmac_append(csp_packet_t * packet, bool include_header) {
 
 	if ((packet->length + (unsigned int)CSP_HMAC_LENGTH) > csp_buffer_data_size()) {
@@ -136,13 +162,13 @@ int csp_hmac_append(csp_packet_t * packet, bool include_header) {
 	if (include_header) {
 
 		/* If header is included, csp_id_prepend() must be called beforehand */
-		csp_hmac_memory(csp_hmac_key, sizeof(csp_hmac_key), packet->frame_begin, packet->frame_length, hmac);
+		csp_hmac_keyed_memory(packet->frame_begin, packet->frame_length, hmac);
 		memcpy(&packet->frame_begin[packet->frame_length], hmac, CSP_HMAC_LENGTH);
 		packet->frame_length += CSP_HMAC_LENGTH;
 
 	} else {
 
-		csp_hmac_memory(csp_hmac_key, sizeof(csp_hmac_key), packet->data, packet->length, hmac);
+		csp_hmac_keyed_memory(packet->data, packet->length, hmac);
 		memcpy(&packet->data[packet->length], hmac, CSP_HMAC_LENGTH);
 		packet->length += CSP_HMAC_LENGTH;
 	}
@@ -161,7 +187,7 @@ int csp_hmac_verify(csp_packet_t * packet, bool include_header) {
 	/* Calculate HMAC */
 	if (include_header) {
 
-		csp_hmac_memory(csp_hmac_key, sizeof(csp_hmac_key), packet->frame_begin, packet->frame_length - CSP_HMAC_LENGTH, hmac);
+		csp_hmac_keyed_memory(packet->frame_begin, packet->frame_length - CSP_HMAC_LENGTH, hmac);
 
 		/* Compare calculated HMAC with packet header */
 		if (memcmp(&packet->frame_begin[packet->frame_length] - CSP_HMAC_LENGTH, hmac, CSP_HMAC_LENGTH) != 0) {
@@ -173,7 +199,7 @@ int csp_hmac_verify(csp_packet_t * packet, bool include_header) {
 		packet->frame_length -= CSP_HMAC_LENGTH;
 
 	} else {
-		csp_hmac_memory(csp_hmac_key, sizeof(csp_hmac_key), packet->data, packet->length - CSP_HMAC_LENGTH, hmac);
+		csp_hmac_keyed_memory(packet->data, packet->length - CSP_HMAC_LENGTH, hmac);
 
 		/* Compare calculated HMAC with packet header */
 		if (memcmp(&packet->data[packet->length] - CSP_HMAC_LENGTH, hmac, CSP_HMAC_LENGTH) != 0) {
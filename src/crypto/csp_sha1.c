@@ -6,6 +6,31 @@
 
 #include <string.h>
 
+/* SHA1 instructions, used if the CPU supports them */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define CSP_SHA1_SHANI 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && (defined(__ARM_FEATURE_SHA2) || (defined(__linux__) && (defined(__clang__) || (__GNUC__ >= 10))))
+#define CSP_SHA1_ARMV8 1
+#include <arm_neon.h>
+#if defined(__ARM_FEATURE_SHA2)
+#define CSP_SHA1_ARMV8_TARGET
+#else
+#include <sys/auxv.h>
+#ifndef HWCAP_SHA1
+#define HWCAP_SHA1 (1 << 5)
+#endif
+#if defined(__clang__)
+#define CSP_SHA1_ARMV8_TARGET __attribute__((target("sha2")))
+#else
+#define CSP_SHA1_ARMV8_TARGET __attribute__((target("+sha2")))
+#endif
+#endif
+#endif
+
 /* Rotate left macro */
 #define ROL(x, y) (((x) << (y)) | ((x) >> (32 - y)))
 
@@ -69,7 +94,7 @@
 		b = ROL(b, 30);                                          \
 	} while (0)
 
-static void csp_sha1_compress(csp_sha1_state_t * sha1, const uint8_t * buf) {
+static void csp_sha1_compress_block(uint32_t * state, const uint8_t * buf) {
 
 	uint32_t a, b, c, d, e, W[80], i;
 
@@ -78,11 +103,11 @@ static void csp_sha1_compress(csp_sha1_state_t * sha1, const uint8_t * buf) {
 		LOAD32H(W[i], buf + (4 * i));
 
 	/* Copy state */
-	a = sha1->state[0];
-	b = sha1->state[1];
-	c = sha1->state[2];
-	d = sha1->state[3];
-	e = sha1->state[4];
+	a = state[0];
+	b = state[1];
+	c = state[2];
+	d = state[3];
+	e = state[4];
 
 	/* Expand it */
 	for (i = 16; i < 80; i++)
@@ -128,11 +153,212 @@ static void csp_sha1_compress(csp_sha1_state_t * sha1, const uint8_t * buf) {
 	}
 
 	/* Store */
-	sha1->state[0] += a;
-	sha1->state[1] += b;
-	sha1->state[2] += c;
-	sha1->state[3] += d;
-	sha1->state[4] += e;
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+static void csp_sha1_compress_portable(uint32_t * state, const uint8_t * buf, uint32_t blocks) {
+
+	for (; blocks > 0; blocks--, buf += CSP_SHA1_BLOCKSIZE) {
+		csp_sha1_compress_block(state, buf);
+	}
+}
+
+#if (CSP_SHA1_SHANI)
+/* Process one group of 4 rounds, and compute the message words for group i + 4 */
+#define SHANI_GROUP(i, f)                                                                                  \
+	do {                                                                                                   \
+		E1 = _mm_sha1nexte_epu32(E0, W[(i) % 4]);                                                          \
+		E0 = ABCD;                                                                                         \
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E1, f);                                                           \
+		if ((i) < 16) {                                                                                    \
+			W[(i) % 4] = _mm_sha1msg2_epu32(_mm_xor_si128(_mm_sha1msg1_epu32(W[(i) % 4], W[((i) + 1) % 4]), \
+														  W[((i) + 2) % 4]),                               \
+											W[((i) + 3) % 4]);                                             \
+		}                                                                                                  \
+	} while (0)
+
+__attribute__((target("sha,sse4.1"))) static void csp_sha1_compress_shani(uint32_t * state, const uint8_t * buf, uint32_t blocks) {
+
+	/* Byte swap 32-bit words, and reverse word order */
+	const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+
+	__m128i ABCD = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0x1B);
+	__m128i E0 = _mm_set_epi32(state[4], 0, 0, 0);
+
+	for (; blocks > 0; blocks--, buf += CSP_SHA1_BLOCKSIZE) {
+
+		const __m128i ABCD_SAVE = ABCD;
+		const __m128i E0_SAVE = E0;
+		__m128i W[4], E1;
+
+		for (int i = 0; i < 4; i++) {
+			W[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(buf + 16 * i)), mask);
+		}
+
+		/* Rounds 0-3, E is added directly */
+		E1 = _mm_add_epi32(E0, W[0]);
+		E0 = ABCD;
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 0);
+		W[0] = _mm_sha1msg2_epu32(_mm_xor_si128(_mm_sha1msg1_epu32(W[0], W[1]), W[2]), W[3]);
+
+		SHANI_GROUP(1, 0);
+		SHANI_GROUP(2, 0);
+		SHANI_GROUP(3, 0);
+		SHANI_GROUP(4, 0);
+		SHANI_GROUP(5, 1);
+		SHANI_GROUP(6, 1);
+		SHANI_GROUP(7, 1);
+		SHANI_GROUP(8, 1);
+		SHANI_GROUP(9, 1);
+		SHANI_GROUP(10, 2);
+		SHANI_GROUP(11, 2);
+		SHANI_GROUP(12, 2);
+		SHANI_GROUP(13, 2);
+		SHANI_GROUP(14, 2);
+		SHANI_GROUP(15, 3);
+		SHANI_GROUP(16, 3);
+		SHANI_GROUP(17, 3);
+		SHANI_GROUP(18, 3);
+		SHANI_GROUP(19, 3);
+
+		/* E from the A of 4 rounds ago */
+		E0 = _mm_sha1nexte_epu32(E0, E0_SAVE);
+		ABCD = _mm_add_epi32(ABCD, ABCD_SAVE);
+	}
+
+	_mm_storeu_si128((__m128i *)state, _mm_shuffle_epi32(ABCD, 0x1B));
+	state[4] = _mm_extract_epi32(E0, 3);
+}
+
+static bool csp_sha1_shani_supported(void) {
+	unsigned int eax, ebx, ecx, edx;
+	__builtin_cpu_init();
+	if (!__builtin_cpu_supports("sse4.1") || !__builtin_cpu_supports("ssse3")) {
+		return false;
+	}
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+		return false;
+	}
+	return (ebx & (1 << 29)) != 0;
+}
+#endif
+
+#if (CSP_SHA1_ARMV8)
+CSP_SHA1_ARMV8_TARGET static void csp_sha1_compress_armv8(uint32_t * state, const uint8_t * buf, uint32_t blocks) {
+
+	static const uint32_t K[4] = {0x5a827999UL, 0x6ed9eba1UL, 0x8f1bbcdcUL, 0xca62c1d6UL};
+
+	uint32x4_t ABCD = vld1q_u32(state);
+	uint32_t E0 = state[4];
+
+	for (; blocks > 0; blocks--, buf += CSP_SHA1_BLOCKSIZE) {
+
+		const uint32x4_t ABCD_SAVE = ABCD;
+		const uint32_t E0_SAVE = E0;
+		uint32x4_t W[4];
+
+		for (int i = 0; i < 4; i++) {
+			W[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(buf + 16 * i)));
+		}
+
+		for (int i = 0; i < 20; i++) {
+			if (i >= 4) {
+				W[i % 4] = vsha1su1q_u32(vsha1su0q_u32(W[i % 4], W[(i + 1) % 4], W[(i + 2) % 4]), W[(i + 3) % 4]);
+			}
+			const uint32x4_t WK = vaddq_u32(W[i % 4], vdupq_n_u32(K[i / 5]));
+			const uint32_t E1 = vsha1h_u32(vgetq_lane_u32(ABCD, 0));
+			if (i < 5) {
+				ABCD = vsha1cq_u32(ABCD, E0, WK);
+			} else if (i >= 10 && i < 15) {
+				ABCD = vsha1mq_u32(ABCD, E0, WK);
+			} else {
+				ABCD = vsha1pq_u32(ABCD, E0, WK);
+			}
+			E0 = E1;
+		}
+
+		ABCD = vaddq_u32(ABCD, ABCD_SAVE);
+		E0 += E0_SAVE;
+	}
+
+	vst1q_u32(state, ABCD);
+	state[4] = E0;
+}
+
+static bool csp_sha1_armv8_supported(void) {
+#if defined(__ARM_FEATURE_SHA2)
+	return true;
+#else
+	return (getauxval(AT_HWCAP) & HWCAP_SHA1) != 0;
+#endif
+}
+#endif
+
+static void (*csp_sha1_compress)(uint32_t * state, const uint8_t * buf, uint32_t blocks) = csp_sha1_compress_portable;
+static csp_sha1_impl_t csp_sha1_impl = CSP_SHA1_IMPL_PORTABLE;
+
+int csp_sha1_set_impl(csp_sha1_impl_t impl) {
+
+	switch (impl) {
+		case CSP_SHA1_IMPL_PORTABLE:
+			csp_sha1_compress = csp_sha1_compress_portable;
+			break;
+#if (CSP_SHA1_SHANI)
+		case CSP_SHA1_IMPL_SHANI:
+			if (!csp_sha1_shani_supported()) {
+				return CSP_ERR_NOTSUP;
+			}
+			csp_sha1_compress = csp_sha1_compress_shani;
+			break;
+#endif
+#if (CSP_SHA1_ARMV8)
+		case CSP_SHA1_IMPL_ARMV8:
+			if (!csp_sha1_armv8_supported()) {
+				return CSP_ERR_NOTSUP;
+			}
+			csp_sha1_compress = csp_sha1_compress_armv8;
+			break;
+#endif
+		default:
+			return CSP_ERR_NOTSUP;
+	}
+
+	csp_sha1_impl = impl;
+	return CSP_ERR_NONE;
+}
+
+csp_sha1_impl_t csp_sha1_get_impl(void) {
+	return csp_sha1_impl;
+}
+
+const char * csp_sha1_impl_name(csp_sha1_impl_t impl) {
+
+	switch (impl) {
+		case CSP_SHA1_IMPL_PORTABLE:
+			return "portable";
+		case CSP_SHA1_IMPL_SHANI:
+			return "sha-ni";
+		case CSP_SHA1_IMPL_ARMV8:
+			return "armv8";
+	}
+
+	return "unknown";
+}
+
+void csp_sha1_select_impl(void) {
+
+	/* Fastest first */
+	if (csp_sha1_set_impl(CSP_SHA1_IMPL_SHANI) == CSP_ERR_NONE) {
+		return;
+	}
+	if (csp_sha1_set_impl(CSP_SHA1_IMPL_ARMV8) == CSP_ERR_NONE) {
+		return;
+	}
+	csp_sha1_set_impl(CSP_SHA1_IMPL_PORTABLE);
 }
 
 void csp_sha1_init(csp_sha1_state_t * sha1) {
@@ -152,10 +378,12 @@ void csp_sha1_process(csp_sha1_state_t * sha1, const void * data, uint32_t inlen
 	uint32_t n;
 	while (inlen > 0) {
 		if (sha1->curlen == 0 && inlen >= CSP_SHA1_BLOCKSIZE) {
-			csp_sha1_compress(sha1, in);
-			sha1->length += (CSP_SHA1_BLOCKSIZE * 8);
-			in += CSP_SHA1_BLOCKSIZE;
-			inlen -= CSP_SHA1_BLOCKSIZE;
+			/* Compress all complete blocks directly from input */
+			n = inlen / CSP_SHA1_BLOCKSIZE;
+			csp_sha1_compress(sha1->state, in, n);
+			sha1->length += ((uint64_t)n * CSP_SHA1_BLOCKSIZE * 8);
+			in += n * CSP_SHA1_BLOCKSIZE;
+			inlen -= n * CSP_SHA1_BLOCKSIZE;
 		} else {
 			n = MIN(inlen, (CSP_SHA1_BLOCKSIZE - sha1->curlen));
 			memcpy(sha1->buf + sha1->curlen, in, (size_t)n);
@@ -163,7 +391,7 @@ void csp_sha1_process(csp_sha1_state_t * sha1, const void * data, uint32_t inlen
 			in += n;
 			inlen -= n;
 			if (sha1->curlen == CSP_SHA1_BLOCKSIZE) {
-				csp_sha1_compress(sha1, sha1->buf);
+				csp_sha1_compress(sha1->state, sha1->buf, 1);
 				sha1->length += (CSP_SHA1_BLOCKSIZE * 8);
 				sha1->curlen = 0;
 			}
@@ -188,7 +416,7 @@ void csp_sha1_done(csp_sha1_state_t * sha1, uint8_t * out) {
 	if (sha1->curlen > 56) {
 		while (sha1->curlen < 64)
 			sha1->buf[sha1->curlen++] = 0;
-		csp_sha1_compress(sha1, sha1->buf);
+		csp_sha1_compress(sha1->state, sha1->buf, 1);
 		sha1->curlen = 0;
 	}
 
@@ -198,7 +426,7 @@ void csp_sha1_done(csp_sha1_state_t * sha1, uint8_t * out) {
 
 	/* Store length */
 	STORE64H(sha1->length, sha1->buf + 56);
-	csp_sha1_compress(sha1, sha1->buf);
+	csp_sha1_compress(sha1->state, sha1->buf, 1);
 
 	/* Copy output */
 	for (i = 0; i < 5; i++)
@@ -22,7 +22,7 @@ void csp_bridge_work(void) {
 
 	/* Get next packet to route */
 	csp_qfifo_t input;
-	if (csp_qfifo_read(&input) != CSP_ERR_NONE) {
+	if (csp_qfifo_read(&input, CSP_MAX_TIMEOUT) != CSP_ERR_NONE) {
 		return;
 	}
 
@@ -31,7 +31,7 @@ void csp_bridge_work(void) {
 		return;
 	}
 
-	if (csp_dedup_is_duplicate(packet)) {
+	if (csp_dedup_is_duplicate(input.iface, packet)) {
 		csp_buffer_free(packet);
 		return;
 	}
@@ -21,20 +21,24 @@ typedef struct csp_skbf_s {
 // Queue of free CSP buffers
 static csp_queue_handle_t csp_buffers;
 
+// Memory of all CSP buffers
+static char * csp_buffer_pool_start;
+
 void csp_buffer_init(void) {
 
 	/**
 	 * Chunk of memory allocated for CSP buffers:
 	 * This is marked as .noinit, because csp buffers can never be assumed zeroed out
 	 * Putting this section in a separate non .bss area, saves some boot time */
-	static char csp_buffer_pool[SKBUF_SIZE * CSP_BUFFER_COUNT] __attribute__((section(".noinit")));
+	static char csp_buffer_mem[SKBUF_SIZE * CSP_BUFFER_COUNT] __attribute__((section(".noinit")));
 	static csp_static_queue_t csp_buffers_queue __attribute__((section(".noinit")));
 	static char csp_buffer_queue_data[CSP_BUFFER_COUNT * sizeof(csp_skbf_t *)] __attribute__((section(".noinit")));
 
 	csp_buffers = csp_queue_create_static(CSP_BUFFER_COUNT, sizeof(csp_skbf_t *), csp_buffer_queue_data, &csp_buffers_queue);
+	csp_buffer_pool_start = csp_buffer_mem;
 
 	for (unsigned int i = 0; i < CSP_BUFFER_COUNT; i++) {
-		csp_skbf_t * buf = (void *)&csp_buffer_pool[i * SKBUF_SIZE];
+		csp_skbf_t * buf = (void *)&csp_buffer_mem[i * SKBUF_SIZE];
 		buf->skbf_addr = buf;
 		csp_queue_enqueue(csp_buffers, &buf, 0);
 	}
@@ -177,3 +181,8 @@ size_t csp_buffer_size(void) {
 size_t csp_buffer_data_size(void) {
 	return CSP_BUFFER_SIZE;
 }
+
+void * csp_buffer_pool(size_t * size) {
+	*size = SKBUF_SIZE * CSP_BUFFER_COUNT;
+	return csp_buffer_pool_start;
+}
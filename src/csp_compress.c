@@ -0,0 +1,334 @@
+#include <csp/csp_compress.h>
+
+#include <string.h>
+
+#include <csp/csp_buffer.h>
+
+#include "csp_mutex.h"
+#if (CSP_POSIX)
+#include <time.h>
+#endif
+
+/**
+ * LZ4 block format:
+ * A sequence is a token, literals and a match. The token holds the number of literals in the high nibble, and the match
+ * length - 4 in the low nibble, a nibble of 15 is continued in the following bytes of 255 until a byte below 255.
+ * The literals are followed by the little endian offset of the match (2 bytes), and the continued match length.
+ * The last sequence only has literals, and ends the block.
+ */
+#define LZ_MINMATCH 4
+#define LZ_LASTLITERALS 5   // The last bytes are always literals
+#define LZ_MFLIMIT 12       // The last match must start this far from the end
+#define LZ_MAX_OFFSET 65535
+
+/* Statistics of all interfaces and tasks compressing, updated under the lock */
+static csp_compress_stats_t csp_compress_stats;
+static csp_mutex_t csp_compress_stats_lock;
+
+#if (CSP_POSIX)
+static uint64_t csp_compress_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+#else
+static uint64_t csp_compress_now(void) {
+	return 0;
+}
+#endif
+
+static inline uint32_t csp_lz_read32(const uint8_t * p) {
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline uint32_t csp_lz_hash(uint32_t sequence) {
+	return (sequence * 2654435761U) >> (32 - CSP_COMPRESS_HASH_BITS);
+}
+
+/* Write a length continuation, returns the new output position or 0 if it does not fit */
+static uint32_t csp_lz_put_length(uint8_t * dst, uint32_t op, uint32_t dstmax, uint32_t length) {
+
+	for (; length >= 255; length -= 255) {
+		if (op >= dstmax) {
+			return 0;
+		}
+		dst[op++] = 255;
+	}
+
+	if (op >= dstmax) {
+		return 0;
+	}
+	dst[op++] = length;
+
+	return op;
+}
+
+/* Write a sequence, a match length of 0 writes the last sequence. Returns the new output position or 0 if it does not fit */
+static uint32_t csp_lz_put_sequence(uint8_t * dst, uint32_t op, uint32_t dstmax, const uint8_t * literals, uint32_t literal_length, uint32_t offset, uint32_t match_length) {
+
+	if (op >= dstmax) {
+		return 0;
+	}
+
+	const uint32_t match_code = (match_length > 0) ? match_length - LZ_MINMATCH : 0;
+	uint8_t * token = &dst[op++];
+	*token = ((literal_length < 15) ? literal_length : 15) << 4;
+	*token |= (match_code < 15) ? match_code : 15;
+
+	if ((literal_length >= 15) && ((op = csp_lz_put_length(dst, op, dstmax, literal_length - 15)) == 0)) {
+		return 0;
+	}
+
+	if (literal_length > dstmax - op) {
+		return 0;
+	}
+	memcpy(&dst[op], literals, literal_length);
+	op += literal_length;
+
+	if (match_length == 0) {
+		return op;
+	}
+
+	if (dstmax - op < 2) {
+		return 0;
+	}
+	dst[op++] = offset & 0xFF;
+	dst[op++] = offset >> 8;
+
+	if ((match_code >= 15) && ((op = csp_lz_put_length(dst, op, dstmax, match_code - 15)) == 0)) {
+		return 0;
+	}
+
+	return op;
+}
+
+static uint32_t csp_lz_compress(const uint8_t * src, uint32_t srclen, uint8_t * dst, uint32_t dstmax) {
+
+	uint16_t table[1 << CSP_COMPRESS_HASH_BITS];
+	memset(table, 0, sizeof(table));
+
+	uint32_t op = 0;
+	uint32_t anchor = 0;
+	uint32_t ip = 1;
+
+	if (srclen > LZ_MFLIMIT) {
+
+		const uint32_t mflimit = srclen - LZ_MFLIMIT;
+		const uint32_t matchlimit = srclen - LZ_LASTLITERALS;
+
+		while (ip < mflimit) {
+
+			const uint32_t sequence = csp_lz_read32(&src[ip]);
+			const uint32_t hash = csp_lz_hash(sequence);
+			uint32_t ref = table[hash];
+			table[hash] = ip;
+
+			if ((ref >= ip) || ((ip - ref) > LZ_MAX_OFFSET) || (csp_lz_read32(&src[ref]) != sequence)) {
+				/* Skip faster through data that does not compress */
+				ip += 1 + ((ip - anchor) >> 6);
+				continue;
+			}
+
+			/* Extend the match backwards over the pending literals, and forwards */
+			while ((ip > anchor) && (ref > 0) && (src[ip - 1] == src[ref - 1])) {
+				ip--;
+				ref--;
+			}
+			uint32_t length = LZ_MINMATCH;
+			while ((ip + length < matchlimit) && (src[ip + length] == src[ref + length])) {
+				length++;
+			}
+
+			op = csp_lz_put_sequence(dst, op, dstmax, &src[anchor], ip - anchor, ip - ref, length);
+			if (op == 0) {
+				return 0;
+			}
+
+			ip += length;
+			anchor = ip;
+
+			/* Index a position inside the match, improving the ratio on repetitive data */
+			if (ip < mflimit) {
+				table[csp_lz_hash(csp_lz_read32(&src[ip - 2]))] = ip - 2;
+			}
+		}
+	}
+
+	return csp_lz_put_sequence(dst, op, dstmax, &src[anchor], srclen - anchor, 0, 0);
+}
+
+uint32_t csp_compress(const void * src, uint32_t srclen, void * dst, uint32_t dstmax) {
+
+	if (srclen > CSP_COMPRESS_MAX_SIZE) {
+		return 0;
+	}
+
+	const uint64_t start = csp_compress_now();
+	const uint32_t length = csp_lz_compress(src, srclen, dst, dstmax);
+	const uint64_t elapsed = csp_compress_now() - start;
+
+	csp_mutex_lock(&csp_compress_stats_lock);
+	csp_compress_stats.compress_ns += elapsed;
+	csp_compress_stats.in_bytes += srclen;
+	if (length > 0) {
+		csp_compress_stats.compressed++;
+		csp_compress_stats.out_bytes += length;
+	} else {
+		csp_compress_stats.incompressible++;
+		csp_compress_stats.out_bytes += srclen;
+	}
+	csp_mutex_unlock(&csp_compress_stats_lock);
+
+	return length;
+}
+
+/* Read a length continuation, returns false on truncated input */
+static bool csp_lz_get_length(const uint8_t * src, uint32_t srclen, uint32_t * ip, uint32_t * length) {
+
+	uint8_t byte;
+	do {
+		if (*ip >= srclen) {
+			return false;
+		}
+		byte = src[(*ip)++];
+		*length += byte;
+	} while (byte == 255);
+
+	return true;
+}
+
+static int csp_lz_decompress(const uint8_t * src, uint32_t srclen, uint8_t * dst, uint32_t dstmax) {
+
+	uint32_t ip = 0;
+	uint32_t op = 0;
+
+	while (ip < srclen) {
+
+		const uint8_t token = src[ip++];
+
+		uint32_t literal_length = token >> 4;
+		if ((literal_length == 15) && !csp_lz_get_length(src, srclen, &ip, &literal_length)) {
+			return CSP_ERR_INVAL;
+		}
+		if ((literal_length > srclen - ip) || (literal_length > dstmax - op)) {
+			return CSP_ERR_INVAL;
+		}
+		memcpy(&dst[op], &src[ip], literal_length);
+		ip += literal_length;
+		op += literal_length;
+
+		/* Last sequence */
+		if (ip == srclen) {
+			return op;
+		}
+
+		if (srclen - ip < 2) {
+			return CSP_ERR_INVAL;
+		}
+		const uint32_t offset = src[ip] | (src[ip + 1] << 8);
+		ip += 2;
+		if ((offset == 0) || (offset > op)) {
+			return CSP_ERR_INVAL;
+		}
+
+		uint32_t match_length = token & 0x0F;
+		if ((match_length == 15) && !csp_lz_get_length(src, srclen, &ip, &match_length)) {
+			return CSP_ERR_INVAL;
+		}
+		match_length += LZ_MINMATCH;
+		if (match_length > dstmax - op) {
+			return CSP_ERR_INVAL;
+		}
+
+		/* The match may overlap the output, repeating the last offset bytes */
+		const uint8_t * match = &dst[op - offset];
+		if (offset >= match_length) {
+			memcpy(&dst[op], match, match_length);
+		} else {
+			for (uint32_t i = 0; i < match_length; i++) {
+				dst[op + i] = match[i];
+			}
+		}
+		op += match_length;
+	}
+
+	/* An empty block has a token */
+	return CSP_ERR_INVAL;
+}
+
+int csp_decompress(const void * src, uint32_t srclen, void * dst, uint32_t dstmax) {
+
+	const uint64_t start = csp_compress_now();
+	const int length = csp_lz_decompress(src, srclen, dst, dstmax);
+	const uint64_t elapsed = csp_compress_now() - start;
+
+	csp_mutex_lock(&csp_compress_stats_lock);
+	csp_compress_stats.decompress_ns += elapsed;
+	if (length >= 0) {
+		csp_compress_stats.decompressed++;
+	} else {
+		csp_compress_stats.errors++;
+	}
+	csp_mutex_unlock(&csp_compress_stats_lock);
+
+	return length;
+}
+
+bool csp_compress_packet(csp_packet_t * packet) {
+
+	if ((packet->id.flags & CSP_FCOMP) || (packet->length <= LZ_MFLIMIT)) {
+		return false;
+	}
+
+	csp_packet_t * scratch = csp_buffer_get(packet->length);
+	if (scratch == NULL) {
+		return false;
+	}
+
+	/* Only worth it, if smaller */
+	const uint32_t length = csp_compress(packet->data, packet->length, scratch->data, packet->length - 1);
+	if (length > 0) {
+		memcpy(packet->data, scratch->data, length);
+		packet->length = length;
+		packet->id.flags |= CSP_FCOMP;
+	}
+
+	csp_buffer_free(scratch);
+	return (length > 0);
+}
+
+int csp_decompress_packet(csp_packet_t * packet) {
+
+	csp_packet_t * scratch = csp_buffer_get(csp_buffer_data_size());
+	if (scratch == NULL) {
+		return CSP_ERR_NOBUFS;
+	}
+
+	const int length = csp_decompress(packet->data, packet->length, scratch->data, csp_buffer_data_size());
+	if (length >= 0) {
+		memcpy(packet->data, scratch->data, length);
+		packet->length = length;
+		packet->id.flags &= ~CSP_FCOMP;
+	}
+
+	csp_buffer_free(scratch);
+	return (length >= 0) ? CSP_ERR_NONE : CSP_ERR_INVAL;
+}
+
+void csp_compress_init(void) {
+	csp_mutex_init(&csp_compress_stats_lock);
+}
+
+void csp_compress_get_stats(csp_compress_stats_t * stats) {
+	csp_mutex_lock(&csp_compress_stats_lock);
+	*stats = csp_compress_stats;
+	csp_mutex_unlock(&csp_compress_stats_lock);
+}
+
+void csp_compress_reset_stats(void) {
+	csp_mutex_lock(&csp_compress_stats_lock);
+	memset(&csp_compress_stats, 0, sizeof(csp_compress_stats));
+	csp_mutex_unlock(&csp_compress_stats_lock);
+}
@@ -5,6 +5,7 @@
 #include "csp_conn.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <stdatomic.h>
 
 #include <csp/arch/csp_queue.h>
@@ -22,29 +23,33 @@
 /* Connection pool */
 static csp_conn_t arr_conn[CSP_CONN_MAX] __attribute__((section(".noinit")));
 
-void csp_conn_check_timeouts(void) {
-#if (CSP_USE_RDP)
-	for (int i = 0; i < CSP_CONN_MAX; i++) {
-		if (arr_conn[i].state == CONN_OPEN) {
-			if (arr_conn[i].idin.flags & CSP_FRDP) {
-				csp_rdp_check_timeouts(&arr_conn[i]);
-			}
-		}
-	}
-#endif
-}
-
 int csp_conn_enqueue_packet(csp_conn_t * conn, csp_packet_t * packet) {
 
 	if (!conn)
 		return CSP_ERR_INVAL;
 
+	int ret = CSP_ERR_NONE;
 	if (csp_queue_enqueue(conn->rx_queue, &packet, 0) != CSP_QUEUE_OK) {
 		csp_dbg_conn_ovf++;
-		return CSP_ERR_NOMEM;
+		ret = CSP_ERR_NOMEM;
 	}
 
-	return CSP_ERR_NONE;
+	/* A NULL packet tells userspace that the connection was closed */
+	if (packet == NULL) {
+		csp_conn_notify(conn, CSP_CONN_EV_CLOSED);
+	} else if (ret == CSP_ERR_NONE) {
+		csp_conn_notify(conn, CSP_CONN_EV_READABLE);
+	}
+
+	return ret;
+}
+
+void csp_conn_notify(csp_conn_t * conn, unsigned int events) {
+
+	csp_conn_event_t handler = conn->event_handler;
+	if (handler) {
+		handler(conn, events, conn->event_context);
+	}
 }
 
 void csp_conn_init(void) {
@@ -184,6 +189,15 @@ csp_conn_t * csp_conn_allocate(csp_conn_type_t type) {
 	conn->type = type;
 	conn->idin.flags = 0;
 	conn->idout.flags = 0;
+	conn->event_handler = NULL;
+	conn->event_context = NULL;
+#if (CSP_USE_RDP)
+	conn->rdp.nonblocking = false;
+	atomic_store(&conn->rdp.writable_pending, false);
+	atomic_store(&conn->rdp.rx_flush_pending, false);
+	conn->rdp.rtt_pending = false;
+	memset(&conn->rdp.stats, 0, sizeof(conn->rdp.stats));
+#endif
 	return conn;
 }
 
@@ -239,6 +253,9 @@ int csp_conn_close(csp_conn_t * conn, uint8_t closed_by) {
 	if (conn->idin.flags & CSP_FRDP) {
 		csp_rdp_queue_flush(conn);
 	}
+	if ((conn->idin.flags | conn->idout.flags) & CSP_FRDP) {
+		csp_timer_cancel(&conn->rdp.timer);
+	}
 #endif
 
 	/* Set to closed */
@@ -247,7 +264,8 @@ int csp_conn_close(csp_conn_t * conn, uint8_t closed_by) {
 	return CSP_ERR_NONE;
 }
 
-csp_conn_t * csp_connect(uint8_t prio, uint16_t dest, uint8_t dport, uint32_t timeout, uint32_t opts) {
+static csp_conn_t * csp_connect_internal(uint8_t prio, uint16_t dest, uint8_t dport, uint32_t opts,
+											csp_conn_event_t handler, void * context, bool nonblocking) {
 
 	/* Force options on all connections */
 	opts |= csp_conf.conn_dfl_so;
@@ -316,12 +334,18 @@ csp_conn_t * csp_connect(uint8_t prio, uint16_t dest, uint8_t dport, uint32_t ti
 	/* Set connection options */
 	conn->opts = opts;
 
+	/* Set before the handshake starts, so no events are missed */
+	conn->event_context = context;
+	conn->event_handler = handler;
+
 #if (CSP_USE_RDP)
 	/* Call Transport Layer connect */
 	if (outgoing_id.flags & CSP_FRDP) {
 		/* If the transport layer has failed to connect
 		 * deallocate connection structure again and return NULL */
-		if (csp_rdp_connect(conn) != CSP_ERR_NONE) {
+		int ret = nonblocking ? csp_rdp_connect_nonblock(conn) : csp_rdp_connect(conn);
+		if (ret != CSP_ERR_NONE) {
+			conn->event_handler = NULL;
 			csp_close(conn);
 			return NULL;
 		}
@@ -332,6 +356,41 @@ csp_conn_t * csp_connect(uint8_t prio, uint16_t dest, uint8_t dport, uint32_t ti
 	return conn;
 }
 
+csp_conn_t * csp_connect(uint8_t prio, uint16_t dest, uint8_t dport, uint32_t timeout, uint32_t opts) {
+	return csp_connect_internal(prio, dest, dport, opts, NULL, NULL, false);
+}
+
+csp_conn_t * csp_connect_nonblock(uint8_t prio, uint16_t dest, uint8_t dport, uint32_t opts,
+								  csp_conn_event_t handler, void * context) {
+	return csp_connect_internal(prio, dest, dport, opts, handler, context, true);
+}
+
+void csp_conn_set_event_handler(csp_conn_t * conn, csp_conn_event_t handler, void * context) {
+	conn->event_handler = NULL;
+	conn->event_context = context;
+	conn->event_handler = handler;
+}
+
+unsigned int csp_conn_events(csp_conn_t * conn) {
+
+	if ((conn == NULL) || (conn->state != CONN_OPEN)) {
+		return CSP_CONN_EV_CLOSED;
+	}
+
+	unsigned int events = CSP_CONN_EV_CONNECTED | CSP_CONN_EV_WRITABLE;
+#if (CSP_USE_RDP)
+	if ((conn->idin.flags | conn->idout.flags) & CSP_FRDP) {
+		events = csp_rdp_conn_events(conn);
+	}
+#endif
+
+	if (csp_queue_size(conn->rx_queue) > 0) {
+		events |= CSP_CONN_EV_READABLE;
+	}
+
+	return events;
+}
+
 int csp_conn_dport(csp_conn_t * conn) {
 
 	return conn->idin.dport;
@@ -370,6 +429,12 @@ void csp_conn_print_table(void) {
 		if (conn->idin.flags & CSP_FRDP) {
 			csp_print("\tRDP: S:%d (closed by 0x%x), rcv %u, snd %u, win %" PRIu32 "\n", 
 			          conn->rdp.state, conn->rdp.closed_by, conn->rdp.rcv_cur, conn->rdp.snd_una, conn->rdp.window_size);
+			const csp_rdp_stats_t * stats = &conn->rdp.stats;
+			csp_print("\t     tx %" PRIu32 " (%" PRIu32 "B) rx %" PRIu32 " (%" PRIu32 "B) rtx %" PRIu32 " dup %" PRIu32 " ooo %" PRIu32 " eack tx/rx %" PRIu32 "/%" PRIu32 "\n",
+			          stats->tx_segments, stats->tx_bytes, stats->rx_segments, stats->rx_bytes, stats->retransmits,
+			          stats->rx_duplicates, stats->rx_out_of_order, stats->eacks_tx, stats->eacks_rx);
+			csp_print("\t     stalls %" PRIu32 " (%" PRIu32 " ms) rtt last/min/max %" PRIu32 "/%" PRIu32 "/%" PRIu32 " ms\n",
+			          stats->window_stalls, stats->tx_wait_ms, stats->rtt_last_ms, stats->rtt_min_ms, stats->rtt_max_ms);
 		}
 #endif
 	}
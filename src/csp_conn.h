@@ -5,6 +5,7 @@
 #include <csp/csp.h>
 #include <csp/arch/csp_queue.h>
 #include "csp_semaphore.h"
+#include "csp_timer.h"
 
 /** Connection states */
 typedef enum {
@@ -52,6 +53,14 @@ typedef struct {
 	uint32_t ack_delay_count;
 	uint32_t ack_timestamp;
 	csp_bin_sem_t tx_wait;
+	bool rtt_pending;      /**< A round trip time measurement is in progress */
+	uint16_t rtt_seq;      /**< Sequence number being timed */
+	uint32_t rtt_timestamp; /**< Time the timed segment was sent */
+	csp_rdp_stats_t stats; /**< Connection statistics */
+	csp_timer_t timer;     /**< Armed for the earliest timeout, retransmission or delayed ACK */
+	bool nonblocking;      /**< Opened by csp_connect_nonblock() */
+	atomic_bool writable_pending; /**< csp_send_nonblock() returned CSP_ERR_AGAIN, notify when writable */
+	atomic_bool rx_flush_pending; /**< Segments wait in the RDP RX queue for room in the RX queue */
 
 } csp_rdp_t;
 
@@ -72,6 +81,8 @@ struct csp_conn_s {
 	csp_socket_t * dest_socket; /* incoming connections destination socket */
 	uint32_t timestamp;         /* Time the connection was opened */
 	uint32_t opts;              /* Connection or socket options */
+	csp_conn_event_t event_handler; /* Readiness notification, see csp_connect_nonblock() */
+	void * event_context;
 #if (CSP_USE_RDP)
 	csp_rdp_t rdp; /* RDP state */
 #endif
@@ -80,6 +91,7 @@ struct csp_conn_s {
 
 
 int csp_conn_enqueue_packet(csp_conn_t * conn, csp_packet_t * packet);
+void csp_conn_notify(csp_conn_t * conn, unsigned int events);
 void csp_conn_init(void);
 csp_conn_t * csp_conn_allocate(csp_conn_type_t type);
 
@@ -87,7 +99,6 @@ csp_conn_t * csp_conn_find_existing(csp_id_t * id);
 csp_conn_t * csp_conn_find_dport(unsigned int dport);
 
 csp_conn_t * csp_conn_new(csp_id_t idin, csp_id_t idout, csp_conn_type_t type);
-void csp_conn_check_timeouts(void);
 int csp_conn_get_rxq(int prio);
 int csp_conn_close(csp_conn_t * conn, uint8_t closed_by);
 const csp_conn_t * csp_conn_get_array(size_t * size);  // for test purposes only!
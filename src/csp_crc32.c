@@ -4,6 +4,36 @@
 #include <csp/csp_id.h>
 
 #include <endian.h>
+#include <string.h>
+
+/* CRC32C instructions, used if the CPU supports them */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define CSP_CRC32_SSE42 1
+#include <nmmintrin.h>
+#endif
+
+#if defined(__aarch64__) && (defined(__ARM_FEATURE_CRC32) || (defined(__linux__) && (defined(__clang__) || (__GNUC__ >= 10))))
+#define CSP_CRC32_ARMV8 1
+#include <arm_acle.h>
+#if defined(__ARM_FEATURE_CRC32)
+#define CSP_CRC32_ARMV8_TARGET
+#else
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#if defined(__clang__)
+#define CSP_CRC32_ARMV8_TARGET __attribute__((target("crc")))
+#else
+#define CSP_CRC32_ARMV8_TARGET __attribute__((target("+crc")))
+#endif
+#endif
+#endif
+
+/* Slicing-by-8 builds its tables in RAM from crc_tab, which AVR keeps in program memory */
+#if (CSP_USE_CRC32_SLICE8) && !defined(__AVR__)
+#define CSP_CRC32_SLICE8 1
+#endif
 
 #ifdef __AVR__
 #include <avr/pgmspace.h>
@@ -44,10 +74,8 @@ static const uint32_t crc_tab[256] = {
 	0xF36E6F75, 0x0105EC76, 0x12551F82, 0xE03E9C81, 0x34F4F86A, 0xC69F7B69, 0xD5CF889D, 0x27A40B9E,
 	0x79B737BA, 0x8BDCB4B9, 0x988C474D, 0x6AE7C44E, 0xBE2DA0A5, 0x4C4623A6, 0x5F16D052, 0xAD7D5351};
 
-uint32_t csp_crc32_memory(const uint8_t * data, uint32_t length) {
-	uint32_t crc;
+static uint32_t csp_crc32_byte(uint32_t crc, const uint8_t * data, uint32_t length) {
 
-	crc = 0xFFFFFFFF;
 	while (length--)
 #ifdef __AVR__
 		crc = pgm_read_dword(&crc_tab[(crc ^ *data++) & 0xFFL]) ^ (crc >> 8);
@@ -55,7 +83,186 @@ uint32_t csp_crc32_memory(const uint8_t * data, uint32_t length) {
 		crc = crc_tab[(crc ^ *data++) & 0xFFL] ^ (crc >> 8);
 #endif
 
-	return (crc ^ 0xFFFFFFFF);
+	return crc;
+}
+
+#if (CSP_CRC32_SLICE8)
+/**
+ * Slicing-by-8:
+ * Table n holds the CRC of a byte followed by n zero bytes, so 8 bytes are
+ * folded into the CRC with 8 independent lookups instead of a chain of 8.
+ * Table 0 is crc_tab, the others are calculated by csp_crc32_init().
+ */
+static uint32_t crc_tab8[7][256];
+static bool crc_tab8_ready;
+
+static void csp_crc32_slice8_init(void) {
+
+	if (crc_tab8_ready) {
+		return;
+	}
+
+	for (unsigned int i = 0; i < 256; i++) {
+		uint32_t crc = crc_tab[i];
+		for (unsigned int n = 0; n < 7; n++) {
+			crc = crc_tab[crc & 0xFF] ^ (crc >> 8);
+			crc_tab8[n][i] = crc;
+		}
+	}
+
+	crc_tab8_ready = true;
+}
+
+static inline uint32_t csp_crc32_read32le(const uint8_t * data) {
+	return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static uint32_t csp_crc32_slice8(uint32_t crc, const uint8_t * data, uint32_t length) {
+
+	for (; length >= 8; length -= 8, data += 8) {
+		const uint32_t lo = csp_crc32_read32le(data) ^ crc;
+		const uint32_t hi = csp_crc32_read32le(data + 4);
+		crc = crc_tab8[6][lo & 0xFF] ^ crc_tab8[5][(lo >> 8) & 0xFF] ^ crc_tab8[4][(lo >> 16) & 0xFF] ^ crc_tab8[3][lo >> 24] ^
+			  crc_tab8[2][hi & 0xFF] ^ crc_tab8[1][(hi >> 8) & 0xFF] ^ crc_tab8[0][(hi >> 16) & 0xFF] ^ crc_tab[hi >> 24];
+	}
+
+	return csp_crc32_byte(crc, data, length);
+}
+#endif
+
+#if (CSP_CRC32_SSE42)
+__attribute__((target("sse4.2"))) static uint32_t csp_crc32_sse42(uint32_t crc, const uint8_t * data, uint32_t length) {
+
+#if defined(__x86_64__)
+	uint64_t crc64 = crc;
+	for (; length >= 8; length -= 8, data += 8) {
+		uint64_t value;
+		memcpy(&value, data, sizeof(value));
+		crc64 = _mm_crc32_u64(crc64, value);
+	}
+	crc = crc64;
+#endif
+	for (; length >= 4; length -= 4, data += 4) {
+		uint32_t value;
+		memcpy(&value, data, sizeof(value));
+		crc = _mm_crc32_u32(crc, value);
+	}
+	while (length--) {
+		crc = _mm_crc32_u8(crc, *data++);
+	}
+
+	return crc;
+}
+
+static bool csp_crc32_sse42_supported(void) {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse4.2");
+}
+#endif
+
+#if (CSP_CRC32_ARMV8)
+CSP_CRC32_ARMV8_TARGET static uint32_t csp_crc32_armv8(uint32_t crc, const uint8_t * data, uint32_t length) {
+
+	for (; length >= 8; length -= 8, data += 8) {
+		uint64_t value;
+		memcpy(&value, data, sizeof(value));
+		crc = __crc32cd(crc, value);
+	}
+	while (length--) {
+		crc = __crc32cb(crc, *data++);
+	}
+
+	return crc;
+}
+
+static bool csp_crc32_armv8_supported(void) {
+#if defined(__ARM_FEATURE_CRC32)
+	return true;
+#else
+	return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#endif
+}
+#endif
+
+static uint32_t (*csp_crc32_fnc)(uint32_t crc, const uint8_t * data, uint32_t length) = csp_crc32_byte;
+static csp_crc32_impl_t csp_crc32_impl = CSP_CRC32_IMPL_BYTE;
+
+int csp_crc32_set_impl(csp_crc32_impl_t impl) {
+
+	switch (impl) {
+		case CSP_CRC32_IMPL_BYTE:
+			csp_crc32_fnc = csp_crc32_byte;
+			break;
+#if (CSP_CRC32_SLICE8)
+		case CSP_CRC32_IMPL_SLICE8:
+			csp_crc32_slice8_init();
+			csp_crc32_fnc = csp_crc32_slice8;
+			break;
+#endif
+#if (CSP_CRC32_SSE42)
+		case CSP_CRC32_IMPL_SSE42:
+			if (!csp_crc32_sse42_supported()) {
+				return CSP_ERR_NOTSUP;
+			}
+			csp_crc32_fnc = csp_crc32_sse42;
+			break;
+#endif
+#if (CSP_CRC32_ARMV8)
+		case CSP_CRC32_IMPL_ARMV8:
+			if (!csp_crc32_armv8_supported()) {
+				return CSP_ERR_NOTSUP;
+			}
+			csp_crc32_fnc = csp_crc32_armv8;
+			break;
+#endif
+		default:
+			return CSP_ERR_NOTSUP;
+	}
+
+	csp_crc32_impl = impl;
+	return CSP_ERR_NONE;
+}
+
+csp_crc32_impl_t csp_crc32_get_impl(void) {
+	return csp_crc32_impl;
+}
+
+const char * csp_crc32_impl_name(csp_crc32_impl_t impl) {
+
+	switch (impl) {
+		case CSP_CRC32_IMPL_BYTE:
+			return "byte";
+		case CSP_CRC32_IMPL_SLICE8:
+			return "slice8";
+		case CSP_CRC32_IMPL_SSE42:
+			return "sse4.2";
+		case CSP_CRC32_IMPL_ARMV8:
+			return "armv8";
+	}
+
+	return "unknown";
+}
+
+void csp_crc32_init(void) {
+
+	/* Fastest first */
+	static const csp_crc32_impl_t impls[] = {CSP_CRC32_IMPL_SSE42, CSP_CRC32_IMPL_ARMV8, CSP_CRC32_IMPL_SLICE8};
+
+	for (unsigned int i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+		if (csp_crc32_set_impl(impls[i]) == CSP_ERR_NONE) {
+			return;
+		}
+	}
+
+	csp_crc32_set_impl(CSP_CRC32_IMPL_BYTE);
+}
+
+uint32_t csp_crc32_update(uint32_t crc, const uint8_t * data, uint32_t length) {
+	return csp_crc32_fnc(crc, data, length);
+}
+
+uint32_t csp_crc32_memory(const uint8_t * data, uint32_t length) {
+	return csp_crc32_final(csp_crc32_update(CSP_CRC32_INIT, data, length));
 }
 
 int csp_crc32_append(csp_packet_t * packet) {
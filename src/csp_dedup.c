@@ -2,45 +2,139 @@
 
 #include "csp_dedup.h"
 
-#include <stdlib.h>
+#include <string.h>
 
 #include <csp/arch/csp_time.h>
-#include <csp/csp_crc32.h>
-#include <csp/csp_id.h>
+#include <csp_autoconfig.h>
 
-/* Check the last CSP_DEDUP_COUNT packets for duplicates */
-#define CSP_DEDUP_COUNT 16
+#include "csp_mutex.h"
 
-/* Only consider packet a duplicate if received under CSP_DEDUP_WINDOW_MS ago */
-#define CSP_DEDUP_WINDOW_MS 100
+/* Entries expire after this many time buckets */
+#define CSP_DEDUP_BUCKETS 4
 
-/* Store packet CRC's in a ringbuffer */
-static uint32_t csp_dedup_array[CSP_DEDUP_COUNT] = {};
-static uint32_t csp_dedup_timestamp[CSP_DEDUP_COUNT] = {};
-static int csp_dedup_in = 0;
+typedef struct {
+	uint32_t hash;    // Upper half of packet hash, the lower half selects the slot
+	uint32_t bucket;  // Time bucket when seen, 0 for unused
+} csp_dedup_entry_t;
 
-bool csp_dedup_is_duplicate(csp_packet_t * packet) {
-	/* Calculate CRC32 for packet */
-	csp_id_prepend(packet);
-	uint32_t crc = csp_crc32_memory(packet->frame_begin, packet->frame_length);
+static csp_dedup_entry_t csp_dedup_table[CSP_DEDUP_COUNT];
+static uint32_t csp_dedup_bucket_ms = CSP_DEDUP_WINDOW_MS / CSP_DEDUP_BUCKETS;
+static csp_dedup_scope_t csp_dedup_scope = CSP_DEDUP_SCOPE_GLOBAL;
+static csp_dedup_stats_t csp_dedup_stats;
 
-	/* Check if we have received this packet before */
-	for (int i = 0; i < CSP_DEDUP_COUNT; i++) {
+/* The table is used by the router and bridge tasks, and configured by the application */
+static csp_mutex_t csp_dedup_lock;
 
-		/* Check for match */
-		if (crc == csp_dedup_array[i]) {
+void csp_dedup_init(void) {
+	csp_mutex_init(&csp_dedup_lock);
+}
+
+int csp_dedup_configure(uint32_t window_ms, csp_dedup_scope_t scope) {
+
+	if ((window_ms < CSP_DEDUP_BUCKETS) || (scope > CSP_DEDUP_SCOPE_FLOW)) {
+		return CSP_ERR_INVAL;
+	}
+
+	csp_mutex_lock(&csp_dedup_lock);
+	memset(csp_dedup_table, 0, sizeof(csp_dedup_table));
+	csp_dedup_bucket_ms = window_ms / CSP_DEDUP_BUCKETS;
+	csp_dedup_scope = scope;
+	csp_mutex_unlock(&csp_dedup_lock);
+
+	return CSP_ERR_NONE;
+}
+
+void csp_dedup_get_stats(csp_dedup_stats_t * stats) {
+	csp_mutex_lock(&csp_dedup_lock);
+	*stats = csp_dedup_stats;
+	csp_mutex_unlock(&csp_dedup_lock);
+}
+
+static inline uint64_t csp_dedup_mix(uint64_t hash, uint64_t value) {
+	hash = (hash ^ value) * 0x9E3779B97F4A7C15ULL;
+	return hash ^ (hash >> 29);
+}
+
+/* Multiply-xorshift over 8 bytes at a time, much cheaper than a CRC32 table lookup per byte */
+static uint64_t csp_dedup_hash(csp_iface_t * iface, const csp_packet_t * packet) {
+
+	uint64_t hash = ((uint64_t)packet->id.src << 48) | ((uint64_t)packet->id.dst << 32) |
+					((uint32_t)packet->id.sport << 24) | ((uint32_t)packet->id.dport << 16) | packet->length;
+
+	if (csp_dedup_scope != CSP_DEDUP_SCOPE_FLOW) {
+		hash = csp_dedup_mix(hash, ((uint32_t)packet->id.pri << 8) | packet->id.flags);
+	}
+	if (csp_dedup_scope == CSP_DEDUP_SCOPE_IFACE) {
+		hash = csp_dedup_mix(hash, (uintptr_t)iface);
+	}
 
-			/* Check the timestamp */
-			if (csp_get_ms() < csp_dedup_timestamp[i] + CSP_DEDUP_WINDOW_MS) {
-				return true;
+	const uint8_t * data = packet->data;
+	uint32_t length = packet->length;
+	for (; length >= 8; length -= 8, data += 8) {
+		uint64_t value;
+		memcpy(&value, data, sizeof(value));
+		hash = csp_dedup_mix(hash, value);
+	}
+	if (length > 0) {
+		uint64_t value = 0;
+		memcpy(&value, data, length);
+		hash = csp_dedup_mix(hash, value);
+	}
+
+	return csp_dedup_mix(hash, 0);
+}
+
+bool csp_dedup_is_duplicate(csp_iface_t * iface, csp_packet_t * packet) {
+
+	bool duplicate = false;
+
+	csp_mutex_lock(&csp_dedup_lock);
+
+	const uint64_t hash = csp_dedup_hash(iface, packet);
+	const uint32_t tag = hash >> 32;
+
+	/* Time bucket, starting from 1 so 0 marks unused entries */
+	const uint32_t bucket = (csp_get_ms() / csp_dedup_bucket_ms) + 1;
+
+	/* Probe from the slot selected by the lower half of the hash, remembering the best slot to insert into:
+	 * the first expired or unused one, otherwise the oldest */
+	uint32_t slot = ((uint64_t)(uint32_t)hash * CSP_DEDUP_COUNT) >> 32;
+	csp_dedup_entry_t * insert = NULL;
+	uint32_t insert_age = 0;
+
+	for (unsigned int i = 0; i < CSP_DEDUP_PROBE; i++) {
+
+		csp_dedup_entry_t * entry = &csp_dedup_table[slot];
+		const uint32_t age = bucket - entry->bucket;
+
+		if ((entry->bucket == 0) || (age >= CSP_DEDUP_BUCKETS)) {
+			/* Expired, keep looking for a match, live entries may follow */
+			if ((insert == NULL) || (insert_age < CSP_DEDUP_BUCKETS)) {
+				insert = entry;
+				insert_age = CSP_DEDUP_BUCKETS;
 			}
+		} else if (entry->hash == tag) {
+			csp_dedup_stats.hits++;
+			duplicate = true;
+			goto out;
+		} else if ((insert == NULL) || (age > insert_age)) {
+			insert = entry;
+			insert_age = age;
+		}
+
+		if (++slot == CSP_DEDUP_COUNT) {
+			slot = 0;
 		}
 	}
 
-	/* If not, insert packet into duplicate list */
-	csp_dedup_array[csp_dedup_in] = crc;
-	csp_dedup_timestamp[csp_dedup_in] = csp_get_ms();
-	csp_dedup_in = (csp_dedup_in + 1) % CSP_DEDUP_COUNT;
+	if (insert_age < CSP_DEDUP_BUCKETS) {
+		csp_dedup_stats.evictions++;
+	}
+	insert->hash = tag;
+	insert->bucket = bucket;
+	csp_dedup_stats.misses++;
 
-	return false;
+out:
+	csp_mutex_unlock(&csp_dedup_lock);
+	return duplicate;
 }
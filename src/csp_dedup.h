@@ -1,11 +1,17 @@
 #pragma once
 
-#include <csp/csp_types.h>
+#include <csp/csp_dedup.h>
+#include <csp/csp_interface.h>
+
+/**
+ * Initialize the lock of the deduplication table, called by csp_init()
+ */
+void csp_dedup_init(void);
 
 /**
  * Check for a duplicate packet
+ * @param iface incoming interface
  * @param packet pointer to packet
  * @return false if not a duplicate, true if duplicate
  */
-bool csp_dedup_is_duplicate(csp_packet_t * packet);
-
+bool csp_dedup_is_duplicate(csp_iface_t * iface, csp_packet_t * packet);
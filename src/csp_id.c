@@ -235,3 +235,12 @@ int csp_id_is_broadcast(uint16_t addr, uint16_t netmask) {
 	}
 	return 0;
 }
+
+uint32_t csp_id_flow_hash(const csp_id_t * id) {
+
+	uint32_t hash = ((uint32_t)id->src << 16) ^ id->dst;
+	hash = (hash ^ ((uint32_t)id->sport << 8) ^ id->dport) * 0x9E3779B1;
+	hash ^= hash >> 16;
+
+	return hash;
+}
@@ -3,34 +3,279 @@
 #include <csp/csp_iflist.h>
 #include <csp/csp_id.h>
 
+#include <stdatomic.h>
 #include <string.h>
 
 #include <csp_autoconfig.h>
 #include <csp/csp_debug.h>
 
+#include "csp_iflist.h"
+#include "csp_mutex.h"
+#include "csp_rtable.h"
+
 /* Interfaces are stored in a linked list */
 static csp_iface_t * interfaces = NULL;
 
+#ifndef CSP_IFLIST_INDEX_MAX
+#define CSP_IFLIST_INDEX_MAX 32  //! Max. number of interfaces indexed, more are found by scanning the list.
+#endif
+
+/* Open addressed hash tables, at most half full */
+#define CSP_IFLIST_INDEX_SLOTS (2 * CSP_IFLIST_INDEX_MAX)
+
+typedef struct {
+	uint32_t ifaces;            // Interfaces on the subnet, bit n for ifaces[n], 0 if the slot is empty
+	uint16_t network;
+	uint8_t netmask;
+} csp_iflist_subnet_t;
+
+/* Lookup index, rebuilt when an interface is added or updated, or a lookup finds an address or netmask changed */
+static struct {
+	bool valid;                 // All interfaces indexed
+	unsigned int count;
+	uint16_t netmasks;          // Bit n set, if a subnet has netmask n
+	uint16_t masks[16];         // Mask of each netmask
+	csp_iface_t * ifaces[CSP_IFLIST_INDEX_MAX];  // In list order
+	uint16_t addr[CSP_IFLIST_INDEX_MAX];         // Address and netmask of each interface when indexed
+	uint16_t netmask[CSP_IFLIST_INDEX_MAX];
+	csp_iflist_subnet_t subnets[CSP_IFLIST_INDEX_SLOTS];
+	csp_iface_t * by_addr[CSP_IFLIST_INDEX_SLOTS];
+	csp_iface_t * by_name[CSP_IFLIST_INDEX_SLOTS];
+} csp_iflist_index;
+
+/* Sequence lock of the index, odd while it is rebuilt */
+static atomic_uint csp_iflist_index_seq;
+static csp_mutex_t csp_iflist_index_writer;
+
+/* Bumped each time the index is rebuilt */
+static atomic_uint csp_iflist_generation;
+
+static unsigned int csp_iflist_slot(uint32_t key) {
+	return ((key * 0x9E3779B1) >> 16) & (CSP_IFLIST_INDEX_SLOTS - 1);
+}
+
+static unsigned int csp_iflist_name_slot(const char * name) {
+	uint32_t hash = 2166136261;
+	for (unsigned int i = 0; (i < CSP_IFLIST_NAME_MAX) && name[i]; i++) {
+		hash = (hash ^ (uint8_t)name[i]) * 16777619;
+	}
+	return csp_iflist_slot(hash);
+}
+
+static unsigned int csp_iflist_subnet_slot(uint8_t netmask, uint16_t network) {
+	return csp_iflist_slot(((uint32_t)netmask << 16) | network);
+}
+
+/* Mask of the subnet of an interface */
+static uint16_t csp_iflist_mask(const csp_iface_t * ifc) {
+	const unsigned int host_bits = csp_id_get_host_bits();
+	const unsigned int netmask = (ifc->netmask < host_bits) ? ifc->netmask : host_bits;
+	return ((1 << netmask) - 1) << (host_bits - netmask);
+}
+
+/* Compute the network and mask of the subnet */
+static void csp_iflist_subnet_update(csp_iface_t * ifc) {
+	ifc->mask = csp_iflist_mask(ifc);
+	ifc->network = ifc->addr & ifc->mask;
+}
+
+static void csp_iflist_index_add(csp_iface_t * ifc) {
+
+	const unsigned int n = csp_iflist_index.count++;
+	csp_iflist_index.ifaces[n] = ifc;
+	csp_iflist_index.addr[n] = ifc->addr;
+	csp_iflist_index.netmask[n] = ifc->netmask;
+
+	/* First interface with an address or name wins, as in a scan of the list */
+	unsigned int slot = csp_iflist_slot(ifc->addr);
+	while ((csp_iflist_index.by_addr[slot] != NULL) && (csp_iflist_index.by_addr[slot]->addr != ifc->addr)) {
+		slot = (slot + 1) & (CSP_IFLIST_INDEX_SLOTS - 1);
+	}
+	if (csp_iflist_index.by_addr[slot] == NULL) {
+		csp_iflist_index.by_addr[slot] = ifc;
+	}
+
+	if (ifc->name != NULL) {
+		slot = csp_iflist_name_slot(ifc->name);
+		while ((csp_iflist_index.by_name[slot] != NULL) && (strncmp(csp_iflist_index.by_name[slot]->name, ifc->name, CSP_IFLIST_NAME_MAX) != 0)) {
+			slot = (slot + 1) & (CSP_IFLIST_INDEX_SLOTS - 1);
+		}
+		if (csp_iflist_index.by_name[slot] == NULL) {
+			csp_iflist_index.by_name[slot] = ifc;
+		}
+	}
+
+	/* Interfaces without a valid netmask take no part in subnet searches */
+	if ((ifc->netmask == 0) || (ifc->netmask > csp_id_get_host_bits())) {
+		return;
+	}
+
+	slot = csp_iflist_subnet_slot(ifc->netmask, ifc->network);
+	csp_iflist_subnet_t * subnet;
+	while (true) {
+		subnet = &csp_iflist_index.subnets[slot];
+		if ((subnet->ifaces == 0) || ((subnet->netmask == ifc->netmask) && (subnet->network == ifc->network))) {
+			break;
+		}
+		slot = (slot + 1) & (CSP_IFLIST_INDEX_SLOTS - 1);
+	}
+	subnet->netmask = ifc->netmask;
+	subnet->network = ifc->network;
+	subnet->ifaces |= 1UL << n;
+	csp_iflist_index.netmasks |= 1 << ifc->netmask;
+	csp_iflist_index.masks[ifc->netmask] = ifc->mask;
+}
+
+void csp_iflist_init(void) {
+	csp_mutex_init(&csp_iflist_index_writer);
+}
+
+/* Rebuild the index, with the writer mutex held */
+static void csp_iflist_index_build_locked(void) {
+
+	/* Interfaces may have changed since the index was built, without csp_iflist_update() */
+	for (csp_iface_t * ifc = interfaces; ifc != NULL; ifc = ifc->next) {
+		csp_iflist_subnet_update(ifc);
+	}
+
+	atomic_fetch_add_explicit(&csp_iflist_index_seq, 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	memset(&csp_iflist_index, 0, sizeof(csp_iflist_index));
+	csp_iflist_index.valid = true;
+	for (csp_iface_t * ifc = interfaces; ifc != NULL; ifc = ifc->next) {
+		if (csp_iflist_index.count == CSP_IFLIST_INDEX_MAX) {
+			csp_iflist_index.valid = false;
+			break;
+		}
+		csp_iflist_index_add(ifc);
+	}
+
+	atomic_fetch_add_explicit(&csp_iflist_index_seq, 1, memory_order_release);
+	atomic_fetch_add_explicit(&csp_iflist_generation, 1, memory_order_release);
+
+	/* Also after a change found by a lookup, without csp_iflist_update() */
+	csp_rtable_invalidate();
+}
+
+static void csp_iflist_index_build(void) {
+	csp_mutex_lock(&csp_iflist_index_writer);
+	csp_iflist_index_build_locked();
+	csp_mutex_unlock(&csp_iflist_index_writer);
+}
+
+/* The application may change an address or netmask without csp_iflist_update(), this is the one place that finds it */
+static bool csp_iflist_index_changed(void) {
+	for (unsigned int i = 0; i < csp_iflist_index.count; i++) {
+		const csp_iface_t * ifc = csp_iflist_index.ifaces[i];
+		if ((ifc->addr != csp_iflist_index.addr[i]) || (ifc->netmask != csp_iflist_index.netmask[i])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Rebuild the index after a change, unless another task is writing it. Returns false if the index is out of date */
+static bool csp_iflist_index_check(void) {
+
+	if (!csp_iflist_index_changed()) {
+		return true;
+	}
+
+	/* Lookups do not wait for the writer, the change is found again by the next lookup */
+	if (!csp_mutex_trylock(&csp_iflist_index_writer)) {
+		return false;
+	}
+	if (csp_iflist_index_changed()) {
+		csp_iflist_index_build_locked();
+	}
+	csp_mutex_unlock(&csp_iflist_index_writer);
+
+	return true;
+}
+
+unsigned int csp_iflist_get_generation(void) {
+	csp_iflist_index_check();
+	return atomic_load_explicit(&csp_iflist_generation, memory_order_acquire);
+}
+
+/* Start reading the index, returns false if it can not be used, so the caller scans the list instead of waiting */
+static bool csp_iflist_read_begin(unsigned int * seq) {
+
+	if (!csp_iflist_index_check()) {
+		return false;
+	}
+
+	*seq = atomic_load_explicit(&csp_iflist_index_seq, memory_order_acquire);
+	if (*seq & 1) {
+		return false;
+	}
+
+	return csp_iflist_index.valid;
+}
+
+static bool csp_iflist_read_retry(unsigned int seq) {
+	atomic_thread_fence(memory_order_acquire);
+	return atomic_load_explicit(&csp_iflist_index_seq, memory_order_relaxed) != seq;
+}
+
 int csp_iflist_is_within_subnet(uint16_t addr, csp_iface_t * ifc) {
 
 	if (ifc == NULL) {
 		return 0;
 	}
-	
-	uint16_t netmask = ((1 << ifc->netmask) - 1) << (csp_id_get_host_bits() - ifc->netmask);
-	uint16_t network_a = ifc->addr & netmask;
-	uint16_t network_b = addr & netmask;
 
-	if (network_a == network_b) {
-		return 1;
-	} else {
-		return 0;
+	/* From the current address and netmask, which may have changed since the interface was indexed */
+	const uint16_t mask = csp_iflist_mask(ifc);
+	return ((addr & mask) == (ifc->addr & mask));
+}
+
+/* Interfaces with addr on their subnet, bit n for csp_iflist_index.ifaces[n] */
+static uint32_t csp_iflist_subnet_lookup(uint16_t addr) {
+
+	uint32_t ifaces = 0;
+	for (unsigned int netmasks = csp_iflist_index.netmasks; netmasks != 0; netmasks &= netmasks - 1) {
+		const unsigned int netmask = __builtin_ctz(netmasks);
+		const uint16_t network = addr & csp_iflist_index.masks[netmask];
+		unsigned int slot = csp_iflist_subnet_slot(netmask, network);
+		for (unsigned int i = 0; i < CSP_IFLIST_INDEX_SLOTS; i++) {
+			const csp_iflist_subnet_t * subnet = &csp_iflist_index.subnets[slot];
+			if (subnet->ifaces == 0) {
+				break;
+			}
+			if ((subnet->netmask == netmask) && (subnet->network == network)) {
+				ifaces |= subnet->ifaces;
+				break;
+			}
+			slot = (slot + 1) & (CSP_IFLIST_INDEX_SLOTS - 1);
+		}
 	}
 
+	return ifaces;
 }
 
 csp_iface_t * csp_iflist_get_by_subnet(uint16_t addr, csp_iface_t * ifc) {
 
+	unsigned int seq;
+	while (csp_iflist_read_begin(&seq)) {
+
+		/* Next interface on the subnet after ifc, in list order */
+		csp_iface_t * found = NULL;
+		bool after = (ifc == NULL);
+		for (uint32_t ifaces = csp_iflist_subnet_lookup(addr); ifaces != 0; ifaces &= ifaces - 1) {
+			csp_iface_t * i = csp_iflist_index.ifaces[__builtin_ctz(ifaces)];
+			if (after) {
+				found = i;
+				break;
+			}
+			after = (i == ifc);
+		}
+
+		if (!csp_iflist_read_retry(seq)) {
+			return found;
+		}
+	}
+
 	/* Head of list */
 	if (ifc == NULL) {
 		ifc = interfaces;
@@ -61,6 +306,25 @@ csp_iface_t * csp_iflist_get_by_subnet(uint16_t addr, csp_iface_t * ifc) {
 
 csp_iface_t * csp_iflist_get_by_addr(uint16_t addr) {
 
+	unsigned int seq;
+	while (csp_iflist_read_begin(&seq)) {
+
+		csp_iface_t * found = NULL;
+		unsigned int slot = csp_iflist_slot(addr);
+		for (unsigned int i = 0; i < CSP_IFLIST_INDEX_SLOTS; i++) {
+			csp_iface_t * ifc = csp_iflist_index.by_addr[slot];
+			if ((ifc == NULL) || (ifc->addr == addr)) {
+				found = ifc;
+				break;
+			}
+			slot = (slot + 1) & (CSP_IFLIST_INDEX_SLOTS - 1);
+		}
+
+		if (!csp_iflist_read_retry(seq)) {
+			return found;
+		}
+	}
+
 	csp_iface_t * ifc = interfaces;
 	while (ifc) {
 		if (ifc->addr == addr) {
@@ -74,6 +338,26 @@ csp_iface_t * csp_iflist_get_by_addr(uint16_t addr) {
 }
 
 csp_iface_t * csp_iflist_get_by_name(const char * name) {
+
+	unsigned int seq;
+	while (csp_iflist_read_begin(&seq)) {
+
+		csp_iface_t * found = NULL;
+		unsigned int slot = csp_iflist_name_slot(name);
+		for (unsigned int i = 0; i < CSP_IFLIST_INDEX_SLOTS; i++) {
+			csp_iface_t * ifc = csp_iflist_index.by_name[slot];
+			if ((ifc == NULL) || (strncmp(ifc->name, name, CSP_IFLIST_NAME_MAX) == 0)) {
+				found = ifc;
+				break;
+			}
+			slot = (slot + 1) & (CSP_IFLIST_INDEX_SLOTS - 1);
+		}
+
+		if (!csp_iflist_read_retry(seq)) {
+			return found;
+		}
+	}
+
 	csp_iface_t * ifc = interfaces;
 	while (ifc) {
 		if (strncmp(ifc->name, name, CSP_IFLIST_NAME_MAX) == 0) {
@@ -105,6 +389,25 @@ int csp_iflist_add(csp_iface_t * ifc) {
 		last->next = ifc;
 	}
 
+	csp_iflist_index_build();
+	csp_rtable_refresh();
+
+	return CSP_ERR_NONE;
+}
+
+int csp_iflist_update(csp_iface_t * ifc) {
+
+	csp_iface_t * i = interfaces;
+	while ((i != NULL) && (i != ifc)) {
+		i = i->next;
+	}
+	if (i == NULL) {
+		return CSP_ERR_INVAL;
+	}
+
+	csp_iflist_index_build();
+	csp_rtable_refresh();
+
 	return CSP_ERR_NONE;
 }
 
@@ -143,9 +446,14 @@ void csp_iflist_print(void) {
 		csp_print("%-10s addr: %"PRIu16" netmask: %"PRIu16" mtu: %"PRIu16"\r\n"
 				  "           tx: %05" PRIu32 " rx: %05" PRIu32 " txe: %05" PRIu32 " rxe: %05" PRIu32 "\r\n"
 				  "           drop: %05" PRIu32 " autherr: %05" PRIu32 " frame: %05" PRIu32 "\r\n"
-				  "           txb: %" PRIu32 " (%" PRIu32 "%c) rxb: %" PRIu32 " (%" PRIu32 "%c) \r\n\r\n",
+				  "           txb: %" PRIu32 " (%" PRIu32 "%c) rxb: %" PRIu32 " (%" PRIu32 "%c) \r\n",
 				  i->name, i->addr, i->netmask, i->mtu, i->tx, i->rx, i->tx_error, i->rx_error, i->drop,
 				  i->autherr, i->frame, i->txbytes, tx, tx_postfix, i->rxbytes, rx, rx_postfix);
+		if (i->comp_threshold > 0) {
+			csp_print("           compress: >= %" PRIu16 " in: %" PRIu32 " out: %" PRIu32 " (%" PRIu32 "%%)\r\n",
+					  i->comp_threshold, i->comp_in, i->comp_out, (i->comp_in > 0) ? (uint32_t)(((uint64_t)i->comp_out * 100) / i->comp_in) : 100);
+		}
+		csp_print("\r\n");
 		i = i->next;
 	}
 }
@@ -153,7 +461,8 @@ void csp_iflist_print(void) {
 void csp_iflist_reset(void) {
 	csp_iface_t * i = interfaces;
 	while (i) {
-		i->tx = i->rx = i->tx_error = i->rx_error = i-> drop = i->autherr = i->txbytes = i->rxbytes = 0;
+		i->tx = i->rx = i->tx_error = i->rx_error = i-> drop = i->autherr = i->txbytes = i->rxbytes = i->comp_in = i->comp_out = 0;
+		i->tx_error_seen = i->monitor_tx = i->monitor_tx_error = 0;
 		i = i->next;
 	}
 }
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <csp/csp_iflist.h>
+
+/**
+ * Get generation of the interface list
+ * Changes when an interface is added or updated, or a lookup finds that an interface address or netmask was changed
+ * without csp_iflist_update(). This is the only place such changes are detected, so tables built from the interfaces
+ * compare the generation instead of the interfaces.
+ * @return generation
+ */
+unsigned int csp_iflist_get_generation(void);
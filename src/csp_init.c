@@ -2,12 +2,20 @@
 
 #include <csp/interfaces/csp_if_lo.h>
 #include <csp/arch/csp_time.h>
+#include <csp/csp_crc32.h>
+#include <csp/csp_compress.h>
+#include <csp/crypto/csp_sha1.h>
+#include <csp/crypto/csp_hmac.h>
 #include <csp/csp_id.h>
 #include <csp_autoconfig.h>
 #include "csp_conn.h"
+#include "csp_dedup.h"
 #include "csp_qfifo.h"
 #include "csp_port.h"
+#include "csp_rdp.h"
 #include "csp_rdp_queue.h"
+#include "csp_rtable.h"
+#include "csp_timer.h"
 
 csp_conf_t csp_conf = {
 	.version = 1,
@@ -28,10 +36,19 @@ uint16_t csp_get_address(void) {
 void csp_init(void) {
 
 	csp_buffer_init();
+	csp_crc32_init();
+	csp_compress_init();
+	csp_sha1_select_impl();
+	csp_hmac_init();
+	csp_timer_init();
 	csp_conn_init();
 	csp_qfifo_init();
+	csp_dedup_init();
+	csp_rtable_init();
+	csp_iflist_init();
 #if (CSP_USE_RDP)
 	csp_rdp_queue_init();
+	csp_rdp_stats_init();
 #endif
 
 	/* Loopback */
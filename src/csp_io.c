@@ -8,6 +8,7 @@
 #include <csp/csp.h>
 #include <csp/csp_debug.h>
 #include <endian.h>
+#include <csp/csp_compress.h>
 #include <csp/csp_crc32.h>
 #include <csp/csp_rtable.h>
 #include <csp/interfaces/csp_if_lo.h>
@@ -17,9 +18,11 @@
 
 #include "csp_port.h"
 #include "csp_conn.h"
+#include "csp_pipeline.h"
 #include "csp_promisc.h"
 #include "csp_qfifo.h"
 #include "csp_rdp.h"
+#include "csp_rtable.h"
 
 #if (CSP_USE_PROMISC)
 extern csp_queue_handle_t csp_promisc_queue;
@@ -60,9 +63,9 @@ csp_packet_t * csp_read(csp_conn_t * conn, uint32_t timeout) {
 	}
 
 #if (CSP_USE_RDP)
-	/* Packet read could trigger ACK transmission */
-	if ((conn->idin.flags & CSP_FRDP) && conn->rdp.delayed_acks) {
-		csp_rdp_check_ack(conn);
+	/* Packet read could trigger ACK transmission, or make room for queued segments */
+	if (conn->idin.flags & CSP_FRDP) {
+		csp_rdp_read_done(conn);
 	}
 #endif
 
@@ -79,58 +82,86 @@ void csp_id_copy(csp_id_t * target, csp_id_t * source) {
 	target->flags = source->flags;
 }
 
-void csp_send_direct(csp_id_t idout, csp_packet_t * packet, csp_iface_t * routed_from) {
+/* Do not send back to the incoming interface, or one with a similar subnet (split horizon) */
+static bool csp_send_direct_split_horizon(csp_iface_t * iface, csp_iface_t * routed_from) {
+	/* The first check is similar to the second, but faster */
+	return (iface == routed_from) || csp_iflist_is_within_subnet(iface->addr, routed_from);
+}
 
-	int from_me = (routed_from == NULL ? 1 : 0);
+/* Send on an interface with the destination on its subnet */
+static void csp_send_direct_local(csp_id_t idout, csp_packet_t * packet, csp_iface_t * iface, int from_me) {
 
-	/* Try to find the destination on any local subnets */
-	int via = CSP_NO_VIA_ADDRESS;
-	csp_iface_t * iface = NULL;
-	csp_packet_t * copy = NULL;
-	int local_found = 0;
-
-	while ((iface = csp_iflist_get_by_subnet(idout.dst, iface)) != NULL) {
-		
-		/* Do not send back to same inteface (split horizon) 
-		 * This check is is similar to that below, but faster */
-		if (iface == routed_from) {
-			continue;
-		}
+	/* Apply outgoing interface address to packet */
+	idout.src = iface->addr;
 
-		/* Do not send to interface with similar subnet (split horizon) */
-		if (csp_iflist_is_within_subnet(iface->addr, routed_from)) {
-			continue;
-		}
+	if (csp_dbg_packet_print >= 2)	{
+		csp_print("cspSendDirect Packet: Src %u, Dst %u, Dport %u, Sport %u, Pri %u, Flags 0x%02X, Size %" PRIu16 "\n",
+			packet->id.src, packet->id.dst, packet->id.dport,
+			packet->id.sport, packet->id.pri, packet->id.flags, packet->length);
+	}
 
-		/* Apply outgoing interface address to packet */
-		idout.src = iface->addr;
+	csp_send_direct_iface(idout, packet, iface, CSP_NO_VIA_ADDRESS, from_me);
+}
 
-		if (csp_dbg_packet_print >= 2)	{
-			csp_print("cspSendDirect Packet: Src %u, Dst %u, Dport %u, Sport %u, Pri %u, Flags 0x%02X, Size %" PRIu16 "\n",
-				packet->id.src, packet->id.dst, packet->id.dport,
-				packet->id.sport, packet->id.pri, packet->id.flags, packet->length);
+/* Add an interface with the destination on its subnet. The previous one gets a copy of the packet, so only the last
+ * one gets the packet itself, and a single interface needs no copy. */
+static void csp_send_direct_local_add(csp_id_t idout, csp_packet_t * packet, csp_iface_t * iface, csp_iface_t * routed_from, int from_me,
+									  csp_iface_t ** last, unsigned int * count) {
+
+	if (csp_send_direct_split_horizon(iface, routed_from)) {
+		return;
+	}
+
+	if (*last != NULL) {
+		csp_packet_t * copy = csp_buffer_clone(packet);
+		if (copy != NULL) {
+			csp_send_direct_local(idout, copy, *last, from_me);
 		}
+	}
 
+	*last = iface;
+	(*count)++;
+}
 
-		/* Todo: Find an elegant way to avoid making a copy when only a single destination interface
-		 * is found. But without looping the list twice. And without using stack memory.
-		 * Is this even possible? */
-		copy = csp_buffer_clone(packet);
-		csp_send_direct_iface(idout, copy, iface, via, from_me);
+void csp_send_direct_hop(csp_id_t idout, csp_packet_t * packet, csp_iface_t * routed_from, csp_send_direct_hop_t * hop) {
 
-		local_found = 1;
+	int from_me = (routed_from == NULL ? 1 : 0);
 
+	/* Try to find the destination on any local subnets */
+	csp_iface_t * last = NULL;
+	unsigned int local_count = 0;
+
+	/* The forwarding table gives the local subnets with the route, otherwise scan the interfaces */
+	csp_rtable_fib_result_t fib;
+	if (csp_rtable_lookup(&idout, &fib)) {
+		for (unsigned int i = 0; i < fib.local_count; i++) {
+			csp_send_direct_local_add(idout, packet, fib.local[i], routed_from, from_me, &last, &local_count);
+		}
+	} else {
+		csp_iface_t * iface = NULL;
+		while ((iface = csp_iflist_get_by_subnet(idout.dst, iface)) != NULL) {
+			csp_send_direct_local_add(idout, packet, iface, routed_from, from_me, &last, &local_count);
+		}
 	}
 
 	/* If the above worked, we don't want to look at the routing table */
-	if (local_found == 1) {
-		csp_buffer_free(packet);
+	if (last != NULL) {
+		csp_send_direct_local(idout, packet, last, from_me);
+		hop->iface = last;
+		hop->via = CSP_NO_VIA_ADDRESS;
+		hop->local = true;
+		hop->cacheable = (local_count == 1);
 		return;
 	}
 
-	/* Try to send via routing table */
-	csp_route_t * route = csp_rtable_find_route(idout.dst);
-	if (route != NULL) {
+	/* Try to send via routing table, the next hop of a multipath route depends on the flow */
+	const csp_route_t * route = &fib.hop;
+	hop->iface = NULL;
+	hop->via = CSP_NO_VIA_ADDRESS;
+	hop->local = false;
+	hop->cacheable = !fib.multipath;
+
+	if (route->iface != NULL) {
 		/* another split horizon test */
 		if(route->iface == routed_from) {
 			if (csp_dbg_packet_print >= 2)	{
@@ -140,6 +171,8 @@ void csp_send_direct(csp_id_t idout, csp_packet_t * packet, csp_iface_t * routed
 			return;
 		}
 
+		hop->iface = route->iface;
+		hop->via = route->via;
 		csp_send_direct_iface(idout, packet, route->iface, route->via, from_me);
 		if (csp_dbg_packet_print >= 2)	{
 			csp_print("cspSendDirect2 Packet: Src %u, Dst %u, Dport %u, Sport %u, Pri %u, Flags 0x%02X, Size %" PRIu16 "\n",
@@ -154,6 +187,11 @@ void csp_send_direct(csp_id_t idout, csp_packet_t * packet, csp_iface_t * routed
 	
 }
 
+void csp_send_direct(csp_id_t idout, csp_packet_t * packet, csp_iface_t * routed_from) {
+	csp_send_direct_hop_t hop;
+	csp_send_direct_hop(idout, packet, routed_from, &hop);
+}
+
 __attribute__((weak)) void csp_output_hook(csp_id_t idout, csp_packet_t * packet, csp_iface_t * iface, uint16_t via, int from_me) {
 	csp_print_packet("OUT: S %u, D %u, Dp %u, Sp %u, Pr %u, Fl 0x%02X, Sz %u VIA: %s (%u)\n",
 				idout.src, idout.dst, idout.dport, idout.sport, idout.pri, idout.flags, packet->length, iface->name, (via != CSP_NO_VIA_ADDRESS) ? via : idout.dst);
@@ -186,11 +224,23 @@ void csp_send_direct_iface(csp_id_t idout, csp_packet_t * packet, csp_iface_t *
 	}
 #endif
 
+#if (CSP_USE_PIPELINE)
+	/* Leave CRC32/HMAC and expensive interfaces to the pipeline workers */
+	if (csp_pipeline_tx(packet, iface, via, from_me)) {
+		return;
+	}
+#endif
+
+	csp_send_direct_iface_tx(packet, iface, via, from_me);
+}
+
+void csp_send_direct_iface_tx(csp_packet_t * packet, csp_iface_t * iface, uint16_t via, int from_me) {
+
 	/* Only encrypt packets from the current node */
 	if (from_me) {
 
 		/* Append HMAC */
-		if (idout.flags & CSP_FHMAC) {
+		if (packet->id.flags & CSP_FHMAC) {
 #if (CSP_USE_HMAC)
 			/* Calculate and add HMAC (does not include header for backwards compatability with csp1.x) */
 			if (csp_hmac_append(packet, false) != CSP_ERR_NONE) {
@@ -204,7 +254,7 @@ void csp_send_direct_iface(csp_id_t idout, csp_packet_t * packet, csp_iface_t *
 		}
 
 		/* Append CRC32 */
-		if (idout.flags & CSP_FCRC32) {
+		if (packet->id.flags & CSP_FCRC32) {
 			/* Calculate and add CRC32 (does not include header for backwards compatability with csp1.x) */
 			if (csp_crc32_append(packet) != CSP_ERR_NONE) {
 				/* CRC32 append failed */
@@ -214,6 +264,17 @@ void csp_send_direct_iface(csp_id_t idout, csp_packet_t * packet, csp_iface_t *
 
 	}
 
+#if (CSP_USE_COMPRESS)
+	/* Compress for this link only, the next hop decompresses on reception */
+	if (iface->comp_threshold && (packet->length >= iface->comp_threshold)) {
+		const uint16_t length = packet->length;
+		if (csp_compress_packet(packet)) {
+			iface->comp_in += length;
+			iface->comp_out += packet->length;
+		}
+	}
+#endif
+
 	/* Store length before passing to interface */
 	uint16_t bytes = packet->length;
 	uint16_t mtu = iface->mtu;
@@ -259,6 +320,29 @@ void csp_send(csp_conn_t * conn, csp_packet_t * packet) {
 
 }
 
+int csp_send_nonblock(csp_conn_t * conn, csp_packet_t * packet) {
+
+	if ((conn == NULL) || (packet == NULL)) {
+		return CSP_ERR_INVAL;
+	}
+
+	if (conn->state != CONN_OPEN) {
+		return CSP_ERR_RESET;
+	}
+
+#if (CSP_USE_RDP)
+	if (conn->idout.flags & CSP_FRDP) {
+		int ret = csp_rdp_send_nonblock(conn, packet);
+		if (ret != CSP_ERR_NONE) {
+			return ret;
+		}
+	}
+#endif
+
+	csp_send_direct(conn->idout, packet, NULL);
+	return CSP_ERR_NONE;
+}
+
 void csp_send_prio(uint8_t prio, csp_conn_t * conn, csp_packet_t * packet) {
 	conn->idout.pri = prio;
 	csp_send(conn, packet);
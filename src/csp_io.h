@@ -13,4 +13,33 @@
  */
 
 void csp_send_direct(csp_id_t idout, csp_packet_t * packet, csp_iface_t * routed_from);
+
+/**
+ * Next hop taken by csp_send_direct_hop()
+ */
+typedef struct {
+	csp_iface_t * iface;  // Interface sent on, NULL if dropped
+	uint16_t via;         // Via address
+	bool local;           // Destination on the subnet of iface, the source is set to the address of iface
+	bool cacheable;       // Same next hop for all packets to the destination from routed_from, until the routing table generation changes
+} csp_send_direct_hop_t;
+
+/**
+ * Send packet as csp_send_direct(), and tell the next hop taken
+ * @param idout packet identifier
+ * @param packet packet to send, always consumed
+ * @param routed_from incoming interface, NULL if from me
+ * @param hop next hop taken
+ */
+void csp_send_direct_hop(csp_id_t idout, csp_packet_t * packet, csp_iface_t * routed_from, csp_send_direct_hop_t * hop);
 void csp_send_direct_iface(csp_id_t idout, csp_packet_t * packet, csp_iface_t * iface, uint16_t via, int from_me);
+
+/**
+ * Append CRC32/HMAC, compress and transmit on interface
+ * Second half of csp_send_direct_iface(), called from pipeline workers. The packet ID must be set.
+ * @param packet packet to send, always consumed
+ * @param iface outgoing interface
+ * @param via next hop address
+ * @param from_me 1 if from me, 0 if routed message
+ */
+void csp_send_direct_iface_tx(csp_packet_t * packet, csp_iface_t * iface, uint16_t via, int from_me);
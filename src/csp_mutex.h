@@ -0,0 +1,37 @@
+#pragma once
+
+#include <csp/arch/csp_queue.h>
+#include <csp/csp.h>
+
+/**
+ * Mutex, a queue holding a single token.
+ * Built on the queue of the OS layer, so a task waiting for it blocks instead of spinning, on every supported OS.
+ * Initialize with csp_mutex_init() before use, from csp_init().
+ */
+typedef struct {
+	csp_queue_handle_t handle;
+	csp_static_queue_t queue;
+	char token[1];
+} csp_mutex_t;
+
+static inline void csp_mutex_init(csp_mutex_t * mutex) {
+	const uint8_t token = 0;
+	mutex->handle = csp_queue_create_static(1, sizeof(token), mutex->token, &mutex->queue);
+	csp_queue_enqueue(mutex->handle, &token, 0);
+}
+
+static inline void csp_mutex_lock(csp_mutex_t * mutex) {
+	uint8_t token;
+	csp_queue_dequeue(mutex->handle, &token, CSP_MAX_TIMEOUT);
+}
+
+/* Take the mutex if it is free, returns true if taken */
+static inline bool csp_mutex_trylock(csp_mutex_t * mutex) {
+	uint8_t token;
+	return (csp_queue_dequeue(mutex->handle, &token, 0) == CSP_QUEUE_OK);
+}
+
+static inline void csp_mutex_unlock(csp_mutex_t * mutex) {
+	const uint8_t token = 0;
+	csp_queue_enqueue(mutex->handle, &token, 0);
+}
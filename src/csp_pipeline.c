@@ -0,0 +1,176 @@
+#include "csp_pipeline.h"
+
+#include <string.h>
+
+#include <csp/csp_buffer.h>
+#include <csp/csp_crc32.h>
+#include <csp/csp_id.h>
+#include <csp/arch/csp_queue.h>
+#include <csp/crypto/csp_hmac.h>
+
+#include "csp_io.h"
+#include "csp_qfifo.h"
+
+#if (CSP_USE_PIPELINE)
+
+typedef struct {
+	csp_packet_t * packet;
+	csp_iface_t * iface;
+	uint16_t via;
+	uint8_t tx;       // Outgoing packet, else incoming packet to verify
+	uint8_t from_me;  // Outgoing packet from this node
+} csp_pipeline_job_t;
+
+/* Worker queues */
+static csp_queue_handle_t csp_pipeline_queue_handles[CSP_PIPELINE_MAX_WORKERS];
+static csp_static_queue_t csp_pipeline_queues[CSP_PIPELINE_MAX_WORKERS];
+static char csp_pipeline_queue_buffers[CSP_PIPELINE_MAX_WORKERS][sizeof(csp_pipeline_job_t) * CSP_PIPELINE_QUEUE_LEN];
+
+/* Statistics per worker, so workers do not share counters */
+static csp_pipeline_stats_t csp_pipeline_stats[CSP_PIPELINE_MAX_WORKERS];
+
+/* Number of workers, 0 until started */
+static unsigned int csp_pipeline_workers;
+
+int csp_pipeline_init(unsigned int workers) {
+
+	if ((workers == 0) || (workers > CSP_PIPELINE_MAX_WORKERS) || (csp_pipeline_workers != 0)) {
+		return CSP_ERR_INVAL;
+	}
+
+	for (unsigned int i = 0; i < workers; i++) {
+		csp_pipeline_queue_handles[i] = csp_queue_create_static(CSP_PIPELINE_QUEUE_LEN, sizeof(csp_pipeline_job_t), csp_pipeline_queue_buffers[i], &csp_pipeline_queues[i]);
+		if (csp_pipeline_queue_handles[i] == NULL) {
+			return CSP_ERR_NOMEM;
+		}
+	}
+
+	memset(csp_pipeline_stats, 0, sizeof(csp_pipeline_stats));
+	csp_pipeline_workers = workers;
+
+	return CSP_ERR_NONE;
+}
+
+/* All packets of a connection (in one direction) go to the same worker, to keep their order */
+static unsigned int csp_pipeline_worker(const csp_id_t * id) {
+
+	return csp_id_flow_hash(id) % csp_pipeline_workers;
+}
+
+static bool csp_pipeline_submit(const csp_pipeline_job_t * job) {
+
+	const unsigned int worker = csp_pipeline_worker(&job->packet->id);
+
+	/* Wait for room, workers never wait for the router, so this cannot deadlock */
+	return (csp_queue_enqueue(csp_pipeline_queue_handles[worker], job, CSP_MAX_TIMEOUT) == CSP_QUEUE_OK);
+}
+
+bool csp_pipeline_rx(csp_packet_t * packet, csp_iface_t * iface) {
+
+	if ((csp_pipeline_workers == 0) || !(packet->id.flags & (CSP_FCRC32 | CSP_FHMAC))) {
+		return false;
+	}
+
+	const csp_pipeline_job_t job = {.packet = packet, .iface = iface, .tx = 0};
+	return csp_pipeline_submit(&job);
+}
+
+bool csp_pipeline_tx(csp_packet_t * packet, csp_iface_t * iface, uint16_t via, int from_me) {
+
+	if (csp_pipeline_workers == 0) {
+		return false;
+	}
+
+	/* Only packets from this node get CRC32/HMAC appended */
+	if (!iface->pipeline_tx && !(from_me && (packet->id.flags & (CSP_FCRC32 | CSP_FHMAC)))) {
+		return false;
+	}
+
+	const csp_pipeline_job_t job = {.packet = packet, .iface = iface, .via = via, .tx = 1, .from_me = from_me};
+	return csp_pipeline_submit(&job);
+}
+
+/* Verify as csp_route_security_check() would, CRC32 first. Workers share the interface counters, so these are added atomically */
+static void csp_pipeline_verify(csp_pipeline_stats_t * stats, csp_packet_t * packet, csp_iface_t * iface) {
+
+	stats->rx++;
+
+	if (packet->id.flags & CSP_FCRC32) {
+		if (csp_crc32_verify(packet) != CSP_ERR_NONE) {
+			__atomic_fetch_add(&iface->rx_error, 1, __ATOMIC_RELAXED);
+			stats->rx_failed++;
+			csp_buffer_free(packet);
+			return;
+		}
+	}
+
+#if (CSP_USE_HMAC)
+	if (packet->id.flags & CSP_FHMAC) {
+		if (csp_hmac_verify(packet, false) != CSP_ERR_NONE) {
+			__atomic_fetch_add(&iface->autherr, 1, __ATOMIC_RELAXED);
+			stats->rx_failed++;
+			csp_buffer_free(packet);
+			return;
+		}
+	}
+#endif
+
+	if (csp_qfifo_write_verified(packet, iface) != CSP_ERR_NONE) {
+		stats->rx_dropped++;
+	}
+}
+
+int csp_pipeline_work(unsigned int worker, uint32_t timeout) {
+
+	if (worker >= csp_pipeline_workers) {
+		return CSP_ERR_INVAL;
+	}
+
+	csp_pipeline_job_t job;
+	if (csp_queue_dequeue(csp_pipeline_queue_handles[worker], &job, timeout) != CSP_QUEUE_OK) {
+		return CSP_ERR_TIMEDOUT;
+	}
+
+	csp_pipeline_stats_t * stats = &csp_pipeline_stats[worker];
+	stats->batches++;
+
+	unsigned int count = 0;
+	do {
+		if (job.tx) {
+			stats->tx++;
+			csp_send_direct_iface_tx(job.packet, job.iface, job.via, job.from_me);
+		} else {
+			csp_pipeline_verify(stats, job.packet, job.iface);
+		}
+	} while ((++count < CSP_PIPELINE_BATCH) && (csp_queue_dequeue(csp_pipeline_queue_handles[worker], &job, 0) == CSP_QUEUE_OK));
+
+	return CSP_ERR_NONE;
+}
+
+void csp_pipeline_get_stats(csp_pipeline_stats_t * stats) {
+
+	memset(stats, 0, sizeof(*stats));
+	for (unsigned int i = 0; i < csp_pipeline_workers; i++) {
+		stats->rx += csp_pipeline_stats[i].rx;
+		stats->rx_failed += csp_pipeline_stats[i].rx_failed;
+		stats->rx_dropped += csp_pipeline_stats[i].rx_dropped;
+		stats->tx += csp_pipeline_stats[i].tx;
+		stats->batches += csp_pipeline_stats[i].batches;
+	}
+}
+
+#else
+
+int csp_pipeline_init(unsigned int workers) {
+	return CSP_ERR_NOTSUP;
+}
+
+int csp_pipeline_work(unsigned int worker, uint32_t timeout) {
+	return CSP_ERR_NOTSUP;
+}
+
+void csp_pipeline_get_stats(csp_pipeline_stats_t * stats) {
+	memset(stats, 0, sizeof(*stats));
+}
+
+#endif
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <csp/csp_pipeline.h>
+#include <csp/csp_interface.h>
+
+/**
+ * Pass an incoming packet with CRC32 or HMAC to the pipeline for verification
+ * Once verified, the packet re-enters the router queue marked as verified.
+ * @param packet packet, with security options supported by the build
+ * @param iface incoming interface
+ * @return true if the pipeline took the packet, false if it must be verified inline
+ */
+bool csp_pipeline_rx(csp_packet_t * packet, csp_iface_t * iface);
+
+/**
+ * Pass an outgoing packet to the pipeline, to append CRC32/HMAC and transmit
+ * @param packet packet, with packet->id set
+ * @param iface outgoing interface
+ * @param via next hop address
+ * @param from_me 1 if from me, 0 if routed message
+ * @return true if the pipeline took the packet, false if it must be sent inline
+ */
+bool csp_pipeline_tx(csp_packet_t * packet, csp_iface_t * iface, uint16_t via, int from_me);
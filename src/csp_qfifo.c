@@ -15,9 +15,9 @@ void csp_qfifo_init(void) {
 	qfifo_queue_handle = csp_queue_create_static(CSP_QFIFO_LEN, sizeof(csp_qfifo_t), qfifo_queue_buffer, &qfifo_queue);
 }
 
-int csp_qfifo_read(csp_qfifo_t * input) {
+int csp_qfifo_read(csp_qfifo_t * input, uint32_t timeout) {
 
-	if (csp_queue_dequeue(qfifo_queue_handle, input, FIFO_TIMEOUT) != CSP_QUEUE_OK)
+	if (csp_queue_dequeue(qfifo_queue_handle, input, timeout) != CSP_QUEUE_OK)
 		return CSP_ERR_TIMEDOUT;
 
 	return CSP_ERR_NONE;
@@ -44,6 +44,7 @@ void csp_qfifo_write(csp_packet_t * packet, csp_iface_t * iface, void * pxTaskWo
 	csp_qfifo_t queue_element;
 	queue_element.iface = iface;
 	queue_element.packet = packet;
+	queue_element.verified = false;
 
 	if (pxTaskWoken == NULL)
 		result = csp_queue_enqueue(qfifo_queue_handle, &queue_element, 1);
@@ -60,6 +61,20 @@ void csp_qfifo_write(csp_packet_t * packet, csp_iface_t * iface, void * pxTaskWo
 	}
 }
 
+int csp_qfifo_write_verified(csp_packet_t * packet, csp_iface_t * iface) {
+
+	const csp_qfifo_t queue_element = {.iface = iface, .packet = packet, .verified = true};
+
+	if (csp_queue_enqueue(qfifo_queue_handle, &queue_element, 1) != CSP_QUEUE_OK) {
+		csp_dbg_conn_ovf++;
+		iface->drop++;
+		csp_buffer_free(packet);
+		return CSP_ERR_NOBUFS;
+	}
+
+	return CSP_ERR_NONE;
+}
+
 void csp_qfifo_wake_up(void) {
 	const csp_qfifo_t queue_element = {.iface = NULL, .packet = NULL};
 	csp_queue_enqueue(qfifo_queue_handle, &queue_element, 0);
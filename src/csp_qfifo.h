@@ -3,12 +3,6 @@
 #include <csp/csp.h>
 #include <csp/csp_interface.h>
 
-#if (CSP_USE_RDP)
-#define FIFO_TIMEOUT 100  //! If RDP is enabled, the router needs to awake some times to check timeouts
-#else
-#define FIFO_TIMEOUT CSP_MAX_TIMEOUT  //! If no RDP, the router can sleep untill data arrives
-#endif
-
 /**
  * Init FIFO/QOS queues
  * @return CSP_ERR type
@@ -18,17 +12,29 @@ void csp_qfifo_init(void);
 typedef struct {
 	csp_iface_t * iface;
 	csp_packet_t * packet;
+	bool verified;  // CRC32/HMAC verified and stripped by the pipeline, see csp_qfifo_write_verified()
 } csp_qfifo_t;
 
 /**
  * Read next packet from router input queue
  * @param input pointer to router queue item element
+ * @param timeout timeout in mS, the router passes the time until the next timer expires
  * @return CSP_ERR type
  */
-int csp_qfifo_read(csp_qfifo_t * input);
+int csp_qfifo_read(csp_qfifo_t * input, uint32_t timeout);
+
+/**
+ * Re-enter a packet verified by the pipeline into the router queue
+ * The router delivers it without counting, deduplicating or verifying it again.
+ * Does not wait more than a tick for room, so pipeline workers never wait for the router.
+ * @param packet verified packet, freed if the queue is full
+ * @param iface incoming interface
+ * @return #CSP_ERR_NONE on success, #CSP_ERR_NOBUFS if the queue was full
+ */
+int csp_qfifo_write_verified(csp_packet_t * packet, csp_iface_t * iface);
 
 /**
  * Wake up any task (e.g. router) waiting on messages.
- * For testing.
+ * Used when a timer is armed to expire before the router would wake up.
  */
 void csp_qfifo_wake_up(void);
@@ -22,6 +22,8 @@
 #include "csp_conn.h"
 #include "csp_io.h"
 #include "csp_semaphore.h"
+#include "csp_timer.h"
+#include "csp_mutex.h"
 
 #define RDP_SYN 0x08
 #define RDP_ACK 0x04
@@ -42,6 +44,18 @@ static uint32_t csp_rdp_delayed_acks = 1;
 static uint32_t csp_rdp_ack_timeout = 1000 / 4;
 static uint32_t csp_rdp_ack_delay_count = 4 / 2;
 
+/* Statistics accumulated across all connections, updated by the router and the user tasks. Counters are updated
+ * atomically, the round trip times under the lock */
+static csp_rdp_stats_t csp_rdp_stats_total;
+static csp_mutex_t csp_rdp_stats_lock;
+
+/* Update a counter on both the connection and the totals */
+#define csp_rdp_stat_add(conn, field, value)                                       \
+	do {                                                                           \
+		(conn)->rdp.stats.field += (value);                                        \
+		__atomic_fetch_add(&csp_rdp_stats_total.field, (value), __ATOMIC_RELAXED); \
+	} while (0)
+
 typedef struct __attribute__((__packed__)) {
 	uint8_t flags;
 	uint16_t seq_nr;
@@ -49,6 +63,7 @@ typedef struct __attribute__((__packed__)) {
 } rdp_header_t;
 
 static int csp_rdp_close_internal(csp_conn_t * conn, uint8_t closed_by, bool send_rst);
+static int csp_rdp_send_segment(csp_conn_t * conn, csp_packet_t * packet);
 
 /**
  * RDP Headers:
@@ -109,6 +124,37 @@ static inline int csp_rdp_time_after(uint32_t time, uint32_t cmp) {
 	return csp_rdp_time_before(cmp, time);
 }
 
+static void csp_rdp_stats_rtt_sample(csp_rdp_stats_t * stats, uint32_t rtt) {
+	if ((stats->rtt_samples == 0) || (rtt < stats->rtt_min_ms)) {
+		stats->rtt_min_ms = rtt;
+	}
+	if (rtt > stats->rtt_max_ms) {
+		stats->rtt_max_ms = rtt;
+	}
+	stats->rtt_last_ms = rtt;
+	stats->rtt_sum_ms += rtt;
+	stats->rtt_samples++;
+}
+
+/**
+ * ROUND TRIP TIME:
+ * One segment at a time is timed, from transmission until it is acknowledged.
+ * Retransmitted segments are never sampled (Karn's algorithm).
+ */
+static void csp_rdp_rtt_update(csp_conn_t * conn) {
+
+	if (!conn->rdp.rtt_pending || !csp_rdp_seq_after(conn->rdp.snd_una, conn->rdp.rtt_seq)) {
+		return;
+	}
+
+	uint32_t rtt = csp_get_ms() - conn->rdp.rtt_timestamp;
+	conn->rdp.rtt_pending = false;
+	csp_rdp_stats_rtt_sample(&conn->rdp.stats, rtt);
+	csp_mutex_lock(&csp_rdp_stats_lock);
+	csp_rdp_stats_rtt_sample(&csp_rdp_stats_total, rtt);
+	csp_mutex_unlock(&csp_rdp_stats_lock);
+}
+
 /**
  * CONTROL MESSAGES
  * The following function is used to send empty messages,
@@ -145,6 +191,7 @@ static int csp_rdp_send_cmp(csp_conn_t * conn, csp_packet_t * packet, int flags,
 		if (rdp_packet == NULL) return CSP_ERR_NOMEM;
 		rdp_packet->timestamp_tx = csp_get_ms();
 		csp_rdp_queue_tx_add(conn, rdp_packet);
+		csp_timer_schedule(&conn->rdp.timer, rdp_packet->timestamp_tx + conn->rdp.packet_timeout + 1);
 	}
 
 	/* Send control messages with high priority */
@@ -163,6 +210,11 @@ static int csp_rdp_send_cmp(csp_conn_t * conn, csp_packet_t * packet, int flags,
 	if (flags & RDP_ACK) {
 		conn->rdp.rcv_lsa = ack_nr;
 		conn->rdp.ack_timestamp = csp_get_ms();
+		if (flags & RDP_EAK) {
+			csp_rdp_stat_add(conn, eacks_tx, 1);
+		} else {
+			csp_rdp_stat_add(conn, acks_tx, 1);
+		}
 	}
 
 	return CSP_ERR_NONE;
@@ -237,6 +289,9 @@ static inline int csp_rdp_receive_data(csp_conn_t * conn, csp_packet_t * packet)
 	/* Remove RDP header before passing to userspace */
 	csp_rdp_header_remove(packet);
 
+	/* Store length, packet belongs to userspace once queued */
+	uint16_t length = packet->length;
+
 	/* Enqueue data */
 	if (csp_conn_enqueue_packet(conn, packet) < 0) {
 		csp_dbg_conn_ovf++;
@@ -244,6 +299,9 @@ static inline int csp_rdp_receive_data(csp_conn_t * conn, csp_packet_t * packet)
 		return CSP_ERR_NOBUFS;
 	}
 
+	csp_rdp_stat_add(conn, rx_segments, 1);
+	csp_rdp_stat_add(conn, rx_bytes, length);
+
 	return CSP_ERR_NONE;
 }
 
@@ -259,9 +317,12 @@ front:
 
 		/* Check there is room in the RX queue:
 		 * We don't hold a lock on the queue, so we require at least two spaces to be free
-		 * to hopefully avoid posting packets on a full queue */
-		if (csp_queue_free(conn->rx_queue) <= 2)
+		 * to hopefully avoid posting packets on a full queue.
+		 * csp_read() arms the connection timer to retry, once userspace has made room. */
+		if (csp_queue_free(conn->rx_queue) <= 2) {
+			atomic_store(&conn->rdp.rx_flush_pending, true);
 			return;
+		}
 
 		packet = csp_rdp_queue_rx_get(conn);
 		if (packet == NULL) {
@@ -274,11 +335,11 @@ front:
 		/* If the matching packet was found: */
 		if (header->seq_nr == (uint16_t)(conn->rdp.rcv_cur + 1)) {
 			csp_rdp_protocol("RDP %p: Deliver seq %u", conn, header->seq_nr);
+			conn->rdp.rcv_cur++;
 			if (csp_rdp_receive_data(conn, packet) != CSP_ERR_NONE) {
 				csp_rdp_error("RDP lost packet internally, stream corrupted!\n");
 				csp_buffer_free(packet);
 			}
-			conn->rdp.rcv_cur++;
 
 			/* Loop from first element again */
 			goto front;
@@ -354,6 +415,7 @@ static void csp_rdp_flush_eack(csp_conn_t * conn, csp_packet_t * eack_packet) {
 				if (csp_rdp_time_after(time_now, packet->rdp_quarantine)) {
 					packet->timestamp_tx = time_now - conn->rdp.packet_timeout - 1;
 					packet->rdp_quarantine = time_now + conn->rdp.packet_timeout / 2;
+					csp_timer_schedule(&conn->rdp.timer, time_now);
 				}
 			}
 		}
@@ -412,14 +474,98 @@ static inline bool csp_rdp_is_conn_ready_for_tx(csp_conn_t * conn) {
 }
 
 /**
- * This function must be called with regular intervals for the
- * RDP protocol to work as expected. This takes care of closing
- * stale connections and retransmitting traffic. A good place to
- * call this function is from the CSP router task.
+ * TIMERS:
+ * Each connection has a single timer, armed for the earliest of its deadlines:
+ * connection timeout, close-wait, delayed ACK and segment retransmission.
+ * The timer is only ever moved earlier, so a deadline armed by a user task is
+ * never lost. Expiring early is harmless, the deadlines are simply re-evaluated.
+ */
+static void csp_rdp_timer_schedule(csp_conn_t * conn, uint32_t time_now) {
+
+	if ((conn->state != CONN_OPEN) || (conn->rdp.state == RDP_CLOSED)) {
+		return;
+	}
+
+	/* Connections not yet accepted by userspace, non-blocking connects and connections in CLOSE-WAIT, time out.
+	 * Once a CLOSE-WAIT connection has timed out, it only waits for userspace to close it. */
+	if ((conn->dest_socket != NULL) || (conn->rdp.state == RDP_CLOSE_WAIT) ||
+		((conn->rdp.state == RDP_SYN_SENT) && conn->rdp.nonblocking)) {
+		const uint32_t deadline = conn->timestamp + conn->rdp.conn_timeout + 1;
+		if (csp_rdp_time_after(deadline, time_now)) {
+			csp_timer_schedule(&conn->rdp.timer, deadline);
+		}
+	}
+
+	if (conn->rdp.state != RDP_OPEN) {
+		return;
+	}
+
+	/* Delayed ACK. If the ACK is overdue, the RX queue is too full to ACK, and csp_read() sends it once there is room */
+	if (conn->rdp.delayed_acks && (conn->rdp.rcv_cur != conn->rdp.rcv_lsa)) {
+		const uint32_t deadline = conn->rdp.ack_timestamp + conn->rdp.ack_timeout + 1;
+		if (csp_rdp_time_after(deadline, time_now)) {
+			csp_timer_schedule(&conn->rdp.timer, deadline);
+		}
+	}
+}
+
+void csp_rdp_read_done(csp_conn_t * conn) {
+
+	/* Packet read could trigger ACK transmission */
+	if (conn->rdp.delayed_acks) {
+		csp_rdp_check_ack(conn);
+	}
+
+	/* Segments held in the RDP RX queue for lack of room, are delivered by the router */
+	if (atomic_exchange(&conn->rdp.rx_flush_pending, false)) {
+		csp_timer_schedule(&conn->rdp.timer, csp_get_ms());
+	}
+}
+
+/* Wake the user task blocked on a full window, and notify a non-blocking sender that got CSP_ERR_AGAIN */
+static void csp_rdp_wake_tx(csp_conn_t * conn) {
+
+	csp_bin_sem_post(&conn->rdp.tx_wait);
+
+	if (atomic_exchange(&conn->rdp.writable_pending, false)) {
+		csp_conn_notify(conn, CSP_CONN_EV_WRITABLE);
+	}
+}
+
+/* Free acknowledged segments from the TX queue and wake the user task if the window opened */
+static void csp_rdp_ack_received(csp_conn_t * conn) {
+
+	int count = csp_rdp_queue_tx_size();
+	for (int i = 0; i < count; i++) {
+
+		csp_packet_t * packet = csp_rdp_queue_tx_get(conn);
+		if (packet == NULL) {
+			break;
+		}
+
+		rdp_header_t * header = csp_rdp_header_ref(packet);
+		if (csp_rdp_seq_before(be16toh(header->seq_nr), conn->rdp.snd_una)) {
+			csp_rdp_protocol("RDP %p: TX Element Free, time %" PRIu32 ", seq %u, una %u\n", conn, packet->timestamp_tx, be16toh(header->seq_nr), conn->rdp.snd_una);
+			csp_buffer_free(packet);
+			continue;
+		}
+
+		csp_rdp_queue_tx_add(conn, packet);
+	}
+
+	if ((conn->rdp.state == RDP_OPEN) && csp_rdp_is_conn_ready_for_tx(conn)) {
+		csp_rdp_wake_tx(conn);
+	}
+}
+
+/**
+ * Called from the router task, when the connection timer expires.
+ * This takes care of closing stale connections, retransmitting traffic
+ * and sending delayed ACKs, and re-arms the timer for the next deadline.
  */
 void csp_rdp_check_timeouts(csp_conn_t * conn) {
 
-	const uint32_t time_now = csp_get_ms();
+	const uint32_t time_now = csp_timer_now();
 
 	/**
 	 * CONNECTION TIMEOUT:
@@ -434,6 +580,20 @@ void csp_rdp_check_timeouts(csp_conn_t * conn) {
 		}
 	}
 
+	/**
+	 * CONNECT TIMEOUT:
+	 * A non-blocking connect gives up, when no SYN/ACK has been received within the connection timeout.
+	 * Userspace is notified by the NULL packet, as for a reset connection.
+	 */
+	if ((conn->rdp.state == RDP_SYN_SENT) && conn->rdp.nonblocking) {
+		if (csp_rdp_time_after(time_now, conn->timestamp + conn->rdp.conn_timeout)) {
+			csp_rdp_error("RDP %p: Non-blocking connect timed out\n", conn);
+			csp_conn_close(conn, CSP_RDP_CLOSED_BY_PROTOCOL);
+			csp_conn_enqueue_packet(conn, NULL);
+			return;
+		}
+	}
+
 	/**
 	 * CLOSE-WAIT TIMEOUT:
 	 * After waiting a while in CLOSE-WAIT, the connection should be closed.
@@ -442,6 +602,7 @@ void csp_rdp_check_timeouts(csp_conn_t * conn) {
 		if (csp_rdp_time_after(time_now, conn->timestamp + conn->rdp.conn_timeout)) {
 			csp_conn_close(conn, CSP_RDP_CLOSED_BY_PROTOCOL | CSP_RDP_CLOSED_BY_TIMEOUT);
 		}
+		csp_rdp_timer_schedule(conn, time_now);
 		return;
 	}
 
@@ -475,8 +636,12 @@ void csp_rdp_check_timeouts(csp_conn_t * conn) {
 			/* Update to latest outgoing ACK */
 			header->ack_nr = htobe16(conn->rdp.rcv_cur);
 
+			/* Never sample round trip time from retransmitted segments */
+			conn->rdp.rtt_pending = false;
+			csp_rdp_stat_add(conn, retransmits, 1);
+
 			/* Send copy to tx_queue */
-			packet->timestamp_tx = csp_get_ms();
+			packet->timestamp_tx = time_now;
 			csp_packet_t * new_packet = csp_buffer_clone(packet);
 			csp_send_direct(conn->idout, new_packet, NULL);
 		}
@@ -484,6 +649,8 @@ void csp_rdp_check_timeouts(csp_conn_t * conn) {
 		/* Requeue the TX element */
 		csp_rdp_queue_tx_add(conn, packet);
 
+		/* Arm the retransmission timer for the element */
+		csp_timer_schedule(&conn->rdp.timer, packet->timestamp_tx + conn->rdp.packet_timeout + 1);
 	}
 
 	if (conn->rdp.state == RDP_OPEN) {
@@ -496,12 +663,13 @@ void csp_rdp_check_timeouts(csp_conn_t * conn) {
 		/* Wake user task if additional Tx can be done */
 		if (csp_rdp_is_conn_ready_for_tx(conn)) {
 			//csp_rdp_protocol("RDP %p: Wake Tx task (check timeouts)\n", conn);
-			csp_bin_sem_post(&conn->rdp.tx_wait);
+			csp_rdp_wake_tx(conn);
 		}
 	}
 
 	csp_rdp_rx_queue_flush(conn);
 
+	csp_rdp_timer_schedule(conn, time_now);
 }
 
 bool csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
@@ -633,6 +801,10 @@ bool csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 				csp_rdp_protocol("RDP %p: Wake Tx task (ack)\n", conn);
 				csp_bin_sem_post(&conn->rdp.tx_wait);
 
+				/* Notify non-blocking connect */
+				atomic_store(&conn->rdp.writable_pending, false);
+				csp_conn_notify(conn, CSP_CONN_EV_CONNECTED | CSP_CONN_EV_WRITABLE);
+
 				goto discard_open;
 			}
 
@@ -646,6 +818,11 @@ bool csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 				csp_rdp_send_cmp(conn, NULL, RDP_RST, conn->rdp.snd_nxt, conn->rdp.rcv_cur);
 				csp_bin_sem_post(&conn->rdp.tx_wait);
 
+				/* Nobody is waiting to retry a non-blocking connect, so fail it */
+				if (conn->rdp.nonblocking) {
+					goto discard_close;
+				}
+
 				goto discard_open;
 			}
 
@@ -683,8 +860,10 @@ bool csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 				if (conn->rdp.state == RDP_SYN_RCVD)
 					csp_rdp_send_cmp(conn, NULL, RDP_ACK | RDP_SYN, conn->rdp.snd_iss, conn->rdp.rcv_irs);
 				/* If duplicate data packet received, send EACK back */
-				if (conn->rdp.state == RDP_OPEN)
+				if (conn->rdp.state == RDP_OPEN) {
+					csp_rdp_stat_add(conn, rx_duplicates, 1);
 					csp_rdp_send_eack(conn);
+				}
 
 				goto discard_open;
 			}
@@ -723,10 +902,16 @@ bool csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 			}
 
 			/* Store current ack'ed sequence number */
+			const uint16_t snd_una = conn->rdp.snd_una;
 			conn->rdp.snd_una = rx_header->ack_nr + 1;
+			csp_rdp_rtt_update(conn);
+			if (conn->rdp.snd_una != snd_una) {
+				csp_rdp_ack_received(conn);
+			}
 
 			/* We have an EACK */
 			if ((rx_header->flags & RDP_EAK)) {
+				csp_rdp_stat_add(conn, eacks_rx, 1);
 				if (packet->length > sizeof(rdp_header_t))
 					csp_rdp_flush_eack(conn, packet);
 				goto discard_open;
@@ -740,26 +925,29 @@ bool csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 			if (rx_header->seq_nr != (uint16_t)(conn->rdp.rcv_cur + 1)) {
 				if (csp_rdp_rx_queue_add(conn, packet, rx_header->seq_nr) != 0) {
 					csp_rdp_protocol("RDP %p: Duplicate sequence number\n", conn);
+					csp_rdp_stat_add(conn, rx_duplicates, 1);
 					csp_rdp_check_ack(conn);
 					goto discard_open;
 				}
+				csp_rdp_stat_add(conn, rx_out_of_order, 1);
 				csp_rdp_send_eack(conn);
 				goto accepted_open;
 			}
 
-			/* Store sequence number before stripping RDP header */
-			uint16_t seq_nr = rx_header->seq_nr;
+			/* Update last received packet before queueing it, as the user may read it and close
+			 * the connection right away, acknowledging everything received with the RST */
+			const uint16_t rcv_cur = conn->rdp.rcv_cur;
+			conn->rdp.rcv_cur = rx_header->seq_nr;
 
 			/* Receive data */
-			if (csp_rdp_receive_data(conn, packet) != CSP_ERR_NONE)
+			if (csp_rdp_receive_data(conn, packet) != CSP_ERR_NONE) {
+				conn->rdp.rcv_cur = rcv_cur;
 				goto discard_open;
-
-			/* Update last received packet */
-			conn->rdp.rcv_cur = seq_nr;
+			}
 
 			/* Only ACK the message if there is room for a full window in the RX buffer.
-			 * Unacknowledged segments are ACKed by csp_rdp_check_timeouts when the buffer is
-			 * no longer full. */
+			 * Unacknowledged segments are ACKed by csp_read or the connection timer when
+			 * the buffer is no longer full. */
 			csp_rdp_check_ack(conn);
 
 			/* Flush RX queue */
@@ -811,12 +999,11 @@ discard_close:
 discard_open:
 	csp_buffer_free(packet);
 accepted_open:
+	csp_rdp_timer_schedule(conn, csp_get_ms());
 	return close_connection;
 }
 
-int csp_rdp_connect(csp_conn_t * conn) {
-
-	int retry = 1;
+static void csp_rdp_connect_setup(csp_conn_t * conn) {
 
 	conn->rdp.window_size = csp_rdp_window_size;
 	conn->rdp.conn_timeout = csp_rdp_conn_timeout;
@@ -825,8 +1012,10 @@ int csp_rdp_connect(csp_conn_t * conn) {
 	conn->rdp.ack_timeout = csp_rdp_ack_timeout;
 	conn->rdp.ack_delay_count = csp_rdp_ack_delay_count;
 	conn->rdp.ack_timestamp = csp_get_ms();
+}
+
+static int csp_rdp_connect_start(csp_conn_t * conn) {
 
-retry:
 	csp_rdp_protocol("RDP %p: Active connect, conn state %u\n", conn, conn->rdp.state);
 
 	if (conn->rdp.state == RDP_OPEN) {
@@ -847,8 +1036,24 @@ retry:
 
 	/* Send SYN message */
 	conn->rdp.state = RDP_SYN_SENT;
-	if (csp_rdp_send_syn(conn) != CSP_ERR_NONE)
-		goto error;
+	return csp_rdp_send_syn(conn);
+}
+
+int csp_rdp_connect(csp_conn_t * conn) {
+
+	int retry = 1;
+
+	csp_rdp_connect_setup(conn);
+
+retry:
+	switch (csp_rdp_connect_start(conn)) {
+		case CSP_ERR_NONE:
+			break;
+		case CSP_ERR_ALREADY:
+			return CSP_ERR_ALREADY;
+		default:
+			goto error;
+	}
 
 	/* Wait for router task to release semaphore */
 	csp_rdp_protocol("RDP %p: AC: Waiting for SYN/ACK reply...\n", conn);
@@ -877,6 +1082,23 @@ error:
 	return CSP_ERR_TIMEDOUT;
 }
 
+int csp_rdp_connect_nonblock(csp_conn_t * conn) {
+
+	csp_rdp_connect_setup(conn);
+	conn->rdp.nonblocking = true;
+
+	int ret = csp_rdp_connect_start(conn);
+	if (ret != CSP_ERR_NONE) {
+		csp_rdp_close_internal(conn, CSP_RDP_CLOSED_BY_PROTOCOL, false);
+		return ret;
+	}
+
+	/* The router completes the handshake, arm the connect timeout */
+	csp_timer_schedule(&conn->rdp.timer, conn->timestamp + conn->rdp.conn_timeout + 1);
+
+	return CSP_ERR_NONE;
+}
+
 int csp_rdp_send(csp_conn_t * conn, csp_packet_t * packet) {
 
 	if (conn->rdp.state != RDP_OPEN) {
@@ -884,12 +1106,21 @@ int csp_rdp_send(csp_conn_t * conn, csp_packet_t * packet) {
 		return CSP_ERR_RESET;
 	}
 
-	while ((conn->rdp.state == RDP_OPEN) && (csp_rdp_is_conn_ready_for_tx(conn) == false)) {
-		csp_rdp_protocol("RDP %p: Waiting for window update before sending seq %u\n", conn, conn->rdp.snd_nxt);
-		if ((csp_bin_sem_wait(&conn->rdp.tx_wait, conn->rdp.conn_timeout)) != CSP_SEMAPHORE_OK) {
-			csp_rdp_error("RDP %p: Timeout during send", conn);
-			return CSP_ERR_TIMEDOUT;
+	if ((conn->rdp.state == RDP_OPEN) && (csp_rdp_is_conn_ready_for_tx(conn) == false)) {
+
+		const uint32_t wait_start = csp_get_ms();
+		csp_rdp_stat_add(conn, window_stalls, 1);
+
+		while ((conn->rdp.state == RDP_OPEN) && (csp_rdp_is_conn_ready_for_tx(conn) == false)) {
+			csp_rdp_protocol("RDP %p: Waiting for window update before sending seq %u\n", conn, conn->rdp.snd_nxt);
+			if ((csp_bin_sem_wait(&conn->rdp.tx_wait, conn->rdp.conn_timeout)) != CSP_SEMAPHORE_OK) {
+				csp_rdp_error("RDP %p: Timeout during send", conn);
+				csp_rdp_stat_add(conn, tx_wait_ms, csp_get_ms() - wait_start);
+				return CSP_ERR_TIMEDOUT;
+			}
 		}
+
+		csp_rdp_stat_add(conn, tx_wait_ms, csp_get_ms() - wait_start);
 	}
 
 	if (conn->rdp.state != RDP_OPEN) {
@@ -897,6 +1128,76 @@ int csp_rdp_send(csp_conn_t * conn, csp_packet_t * packet) {
 		return CSP_ERR_RESET;
 	}
 
+	return csp_rdp_send_segment(conn, packet);
+}
+
+int csp_rdp_send_nonblock(csp_conn_t * conn, csp_packet_t * packet) {
+
+	/* Handshake of a non-blocking connect still in progress */
+	if (conn->rdp.state == RDP_SYN_SENT) {
+		atomic_store(&conn->rdp.writable_pending, true);
+		return CSP_ERR_AGAIN;
+	}
+
+	if (conn->rdp.state != RDP_OPEN) {
+		csp_rdp_error("RDP %p: ERROR cannot send, connection not open (%d)\n", conn, conn->rdp.state);
+		return CSP_ERR_RESET;
+	}
+
+	if (csp_rdp_is_conn_ready_for_tx(conn) == false) {
+
+		/* Request notification, then check again in case the router opened the window meanwhile.
+		 * The fence orders the request before the check, the router orders the ACK before taking the request. */
+		atomic_store(&conn->rdp.writable_pending, true);
+		atomic_thread_fence(memory_order_seq_cst);
+		if (csp_rdp_is_conn_ready_for_tx(conn) == false) {
+			csp_rdp_stat_add(conn, window_stalls, 1);
+			return CSP_ERR_AGAIN;
+		}
+		atomic_store(&conn->rdp.writable_pending, false);
+	}
+
+	return csp_rdp_send_segment(conn, packet);
+}
+
+int csp_rdp_flush_nonblock(csp_conn_t * conn) {
+
+	/* Checked first, as the other end may acknowledge the last data with its RST */
+	if (conn->rdp.snd_una == conn->rdp.snd_nxt) {
+		return CSP_ERR_NONE;
+	}
+
+	if (conn->rdp.state != RDP_OPEN) {
+		return CSP_ERR_RESET;
+	}
+
+	/* Request notification on the next ACK, then check again in case it was just received */
+	atomic_store(&conn->rdp.writable_pending, true);
+	atomic_thread_fence(memory_order_seq_cst);
+	if (conn->rdp.snd_una == conn->rdp.snd_nxt) {
+		atomic_store(&conn->rdp.writable_pending, false);
+		return CSP_ERR_NONE;
+	}
+
+	return CSP_ERR_AGAIN;
+}
+
+unsigned int csp_rdp_conn_events(csp_conn_t * conn) {
+
+	switch (conn->rdp.state) {
+		case RDP_SYN_SENT:
+		case RDP_SYN_RCVD:
+			return 0;
+		case RDP_OPEN:
+			return CSP_CONN_EV_CONNECTED | (csp_rdp_is_conn_ready_for_tx(conn) ? CSP_CONN_EV_WRITABLE : 0);
+		default:
+			return CSP_CONN_EV_CLOSED;
+	}
+}
+
+/* Transmit a data segment on an open connection with room in the window */
+static int csp_rdp_send_segment(csp_conn_t * conn, csp_packet_t * packet) {
+
 	/* Add RDP header */
 	rdp_header_t * tx_header = csp_rdp_header_add(packet);
 	if (tx_header == NULL) {
@@ -911,12 +1212,24 @@ int csp_rdp_send(csp_conn_t * conn, csp_packet_t * packet) {
 	csp_packet_t * rdp_packet = csp_buffer_clone(packet);
 	if (rdp_packet == NULL) {
 		csp_rdp_error("RDP %p: Failed to allocate packet buffer\n", conn);
+		csp_rdp_header_remove(packet);
 		return CSP_ERR_NOMEM;
 	}
 
 	rdp_packet->timestamp_tx = csp_get_ms();
 	rdp_packet->rdp_quarantine = 0;
 	csp_rdp_queue_tx_add(conn, rdp_packet);
+	csp_timer_schedule(&conn->rdp.timer, rdp_packet->timestamp_tx + conn->rdp.packet_timeout + 1);
+
+	/* Start timing this segment, unless another one is already being timed */
+	if (!conn->rdp.rtt_pending) {
+		conn->rdp.rtt_pending = true;
+		conn->rdp.rtt_seq = conn->rdp.snd_nxt;
+		conn->rdp.rtt_timestamp = rdp_packet->timestamp_tx;
+	}
+
+	csp_rdp_stat_add(conn, tx_segments, 1);
+	csp_rdp_stat_add(conn, tx_bytes, packet->length - sizeof(rdp_header_t));
 
 	csp_rdp_protocol(
 		"RDP %p: Sending  in S %u: syn %u, ack %u, eack %u, "
@@ -929,6 +1242,14 @@ int csp_rdp_send(csp_conn_t * conn, csp_packet_t * packet) {
 	return CSP_ERR_NONE;
 }
 
+static void csp_rdp_timer_expired(void * arg) {
+
+	csp_conn_t * conn = arg;
+	if ((conn->state == CONN_OPEN) && (conn->idin.flags & CSP_FRDP)) {
+		csp_rdp_check_timeouts(conn);
+	}
+}
+
 void csp_rdp_init(csp_conn_t * conn) {
 
 	/* Set initial state */
@@ -940,6 +1261,8 @@ void csp_rdp_init(csp_conn_t * conn) {
 	/* Create a binary semaphore to wait on for tasks */
 	csp_bin_sem_init(&conn->rdp.tx_wait);
 
+	csp_timer_setup(&conn->rdp.timer, csp_rdp_timer_expired, conn);
+
 }
 
 /**
@@ -967,6 +1290,7 @@ static int csp_rdp_close_internal(csp_conn_t * conn, uint8_t closed_by, bool sen
 		}
 		csp_rdp_protocol("RDP %p: csp_rdp_close(0x%x)%s -> CLOSE_WAIT\n", conn, closed_by, send_rst ? ", sent RST" : "");
 		csp_bin_sem_post(&conn->rdp.tx_wait);  // wake up any pendng Tx
+		csp_timer_schedule(&conn->rdp.timer, conn->timestamp + conn->rdp.conn_timeout + 1);
 	}
 
 	if (conn->rdp.closed_by != CSP_RDP_CLOSED_BY_ALL) {
@@ -1019,5 +1343,82 @@ void csp_rdp_get_opt(unsigned int * window_size, unsigned int * conn_timeout_ms,
 		*ack_delay_count = csp_rdp_ack_delay_count;
 }
 
+int csp_rdp_get_stats(const csp_conn_t * conn, csp_rdp_stats_t * stats) {
+
+	if ((conn == NULL) || (stats == NULL) || !((conn->idin.flags | conn->idout.flags) & CSP_FRDP)) {
+		return CSP_ERR_INVAL;
+	}
+
+	*stats = conn->rdp.stats;
+	return CSP_ERR_NONE;
+}
+
+void csp_rdp_stats_init(void) {
+	csp_mutex_init(&csp_rdp_stats_lock);
+}
+
+/* Read a counter of the totals, and clear it if reset */
+#define csp_rdp_stat_read(stats, field, reset)                                                 \
+	(stats)->field = (reset) ? __atomic_exchange_n(&csp_rdp_stats_total.field, 0, __ATOMIC_RELAXED) \
+	                         : __atomic_load_n(&csp_rdp_stats_total.field, __ATOMIC_RELAXED)
+
+static void csp_rdp_stats_read(csp_rdp_stats_t * stats, bool reset) {
+
+	csp_rdp_stat_read(stats, tx_segments, reset);
+	csp_rdp_stat_read(stats, tx_bytes, reset);
+	csp_rdp_stat_read(stats, rx_segments, reset);
+	csp_rdp_stat_read(stats, rx_bytes, reset);
+	csp_rdp_stat_read(stats, retransmits, reset);
+	csp_rdp_stat_read(stats, rx_duplicates, reset);
+	csp_rdp_stat_read(stats, rx_out_of_order, reset);
+	csp_rdp_stat_read(stats, acks_tx, reset);
+	csp_rdp_stat_read(stats, eacks_tx, reset);
+	csp_rdp_stat_read(stats, eacks_rx, reset);
+	csp_rdp_stat_read(stats, window_stalls, reset);
+	csp_rdp_stat_read(stats, tx_wait_ms, reset);
+
+	csp_mutex_lock(&csp_rdp_stats_lock);
+	stats->rtt_samples = csp_rdp_stats_total.rtt_samples;
+	stats->rtt_last_ms = csp_rdp_stats_total.rtt_last_ms;
+	stats->rtt_min_ms = csp_rdp_stats_total.rtt_min_ms;
+	stats->rtt_max_ms = csp_rdp_stats_total.rtt_max_ms;
+	stats->rtt_sum_ms = csp_rdp_stats_total.rtt_sum_ms;
+	if (reset) {
+		csp_rdp_stats_total.rtt_samples = 0;
+		csp_rdp_stats_total.rtt_last_ms = 0;
+		csp_rdp_stats_total.rtt_min_ms = 0;
+		csp_rdp_stats_total.rtt_max_ms = 0;
+		csp_rdp_stats_total.rtt_sum_ms = 0;
+	}
+	csp_mutex_unlock(&csp_rdp_stats_lock);
+}
+
+void csp_rdp_get_stats_total(csp_rdp_stats_t * stats) {
+	csp_rdp_stats_read(stats, false);
+}
+
+void csp_rdp_reset_stats_total(void) {
+	csp_rdp_stats_t stats;
+	csp_rdp_stats_read(&stats, true);
+}
+
+#if (CSP_ENABLE_CSP_PRINT)
+
+void csp_rdp_print_stats(void) {
+	csp_rdp_stats_t stats;
+	csp_rdp_get_stats_total(&stats);
+	uint32_t rtt_avg = (stats.rtt_samples > 0) ? (uint32_t)(stats.rtt_sum_ms / stats.rtt_samples) : 0;
+
+	csp_print("\nRDP totals:\n");
+	csp_print("  tx: %" PRIu32 " (%" PRIu32 "B) rx: %" PRIu32 " (%" PRIu32 "B) retransmits: %" PRIu32 "\n",
+	          stats.tx_segments, stats.tx_bytes, stats.rx_segments, stats.rx_bytes, stats.retransmits);
+	csp_print("  dup: %" PRIu32 " ooo: %" PRIu32 " ack tx: %" PRIu32 " eack tx: %" PRIu32 " eack rx: %" PRIu32 "\n",
+	          stats.rx_duplicates, stats.rx_out_of_order, stats.acks_tx, stats.eacks_tx, stats.eacks_rx);
+	csp_print("  window stalls: %" PRIu32 " (%" PRIu32 " ms blocked)\n", stats.window_stalls, stats.tx_wait_ms);
+	csp_print("  rtt: %" PRIu32 " samples, min/avg/max %" PRIu32 "/%" PRIu32 "/%" PRIu32 " ms\n",
+	          stats.rtt_samples, stats.rtt_min_ms, rtt_avg, stats.rtt_max_ms);
+}
+
+#endif
 
 #endif  // CSP_USE_RDP
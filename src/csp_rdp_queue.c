@@ -2,6 +2,8 @@
 #include <csp/csp_types.h>
 #include <csp/csp.h>
 
+#include "csp_rdp_queue.h"
+
 static csp_queue_handle_t tx_queue;
 static csp_static_queue_t tx_queue_static; /* Static storage for rx queue */
 static char tx_queue_static_data[sizeof(csp_packet_t *) * CSP_RDP_MAX_WINDOW * 2];
@@ -25,24 +27,30 @@ void csp_rdp_queue_flush(csp_conn_t * conn) {
    	csp_packet_t * packet;
 
     /* Empty TX queue */
-    while (csp_queue_dequeue(tx_queue, &packet, 0) == CSP_QUEUE_OK) {
+    int tx_count = csp_queue_size(tx_queue);
+    while ((tx_count-- > 0) && (csp_queue_dequeue(tx_queue, &packet, 0) == CSP_QUEUE_OK)) {
         if (packet == NULL) {
             continue;
         }
 
         if ((conn == NULL) || (conn == packet->conn)) {
             csp_buffer_free(packet);
+        } else {
+            csp_rdp_queue_tx_add(packet->conn, packet);
         }
     }
 
     /* Empty RX queue */
-    while (csp_queue_dequeue(rx_queue, &packet, 0) == CSP_QUEUE_OK) {
+    int rx_count = csp_queue_size(rx_queue);
+    while ((rx_count-- > 0) && (csp_queue_dequeue(rx_queue, &packet, 0) == CSP_QUEUE_OK)) {
         if (packet == NULL) {
             continue;
         }
 
         if ((conn == NULL) || (conn == packet->conn)) {
             csp_buffer_free(packet);
+        } else {
+            csp_rdp_queue_rx_add(packet->conn, packet);
         }
     }
 
@@ -70,7 +78,8 @@ csp_packet_t * csp_rdp_queue_tx_get(csp_conn_t * conn) {
         if (packet->conn == conn) {    
             return packet;
         } else {
-            csp_rdp_queue_tx_add(conn, packet);
+            /* Requeue, keeping the owner of the packet */
+            csp_rdp_queue_tx_add(packet->conn, packet);
         }
     }
     return NULL;    
@@ -98,7 +107,8 @@ csp_packet_t * csp_rdp_queue_rx_get(csp_conn_t * conn) {
         if (packet->conn == conn) {
             return packet;
         } else {
-            csp_rdp_queue_rx_add(conn, packet);
+            /* Requeue, keeping the owner of the packet */
+            csp_rdp_queue_rx_add(packet->conn, packet);
         }
     }
     return NULL;
@@ -2,8 +2,10 @@
 
 #include <csp/csp.h>
 
+#include <stdatomic.h>
 #include <stdlib.h>
 
+#include <csp/csp_compress.h>
 #include <csp/csp_crc32.h>
 #include <endian.h>
 #include <csp/arch/csp_queue.h>
@@ -13,13 +15,111 @@
 #include "csp_port.h"
 #include "csp_conn.h"
 #include "csp_io.h"
+#include "csp_pipeline.h"
 #include "csp_promisc.h"
 #include "csp_qfifo.h"
 #include "csp_dedup.h"
 #include "csp_rdp.h"
+#include "csp_rtable.h"
+#include "csp_timer.h"
 #include <csp/csp_debug.h>
 #include <csp/csp_iflist.h>
 
+#ifndef CSP_ROUTE_CACHE_SIZE
+#define CSP_ROUTE_CACHE_SIZE 64  //! Number of cached next hops of forwarded packets, power of 2.
+#endif
+
+/* Next hop to a destination from an incoming interface */
+typedef struct {
+	atomic_uint seq;            // Odd while written
+	unsigned int generation;    // Routing table generation, 0 if unused
+	uint16_t dst;
+	csp_iface_t * routed_from;
+	csp_send_direct_hop_t hop;
+} csp_route_cache_entry_t;
+
+static csp_route_cache_entry_t csp_route_cache[CSP_ROUTE_CACHE_SIZE];
+
+/* Counted by all router tasks */
+static struct {
+	atomic_uint fast;
+	atomic_uint slow;
+} csp_route_stats;
+
+static csp_route_cache_entry_t * csp_route_cache_slot(uint16_t dst, csp_iface_t * routed_from) {
+	const uint32_t hash = (dst ^ ((uintptr_t)routed_from >> 4)) * 0x9E3779B1;
+	return &csp_route_cache[hash >> 16 & (CSP_ROUTE_CACHE_SIZE - 1)];
+}
+
+static bool csp_route_cache_get(uint16_t dst, csp_iface_t * routed_from, unsigned int generation, csp_send_direct_hop_t * hop) {
+
+	csp_route_cache_entry_t * entry = csp_route_cache_slot(dst, routed_from);
+
+	/* Copy, and check that it was not written meanwhile */
+	const unsigned int seq = atomic_load(&entry->seq);
+	const bool found = (entry->generation == generation) && (entry->dst == dst) && (entry->routed_from == routed_from);
+	*hop = entry->hop;
+	atomic_thread_fence(memory_order_acquire);
+
+	return found && !(seq & 1) && (atomic_load(&entry->seq) == seq);
+}
+
+static void csp_route_cache_put(uint16_t dst, csp_iface_t * routed_from, unsigned int generation, const csp_send_direct_hop_t * hop) {
+
+	csp_route_cache_entry_t * entry = csp_route_cache_slot(dst, routed_from);
+
+	/* Leave the entry to another router task writing it */
+	unsigned int seq = atomic_load(&entry->seq);
+	if ((seq & 1) || !atomic_compare_exchange_strong(&entry->seq, &seq, seq + 1)) {
+		return;
+	}
+
+	entry->generation = generation;
+	entry->dst = dst;
+	entry->routed_from = routed_from;
+	entry->hop = *hop;
+
+	atomic_store(&entry->seq, seq + 2);
+}
+
+void csp_route_get_stats(csp_route_stats_t * stats) {
+	stats->fast = atomic_load_explicit(&csp_route_stats.fast, memory_order_relaxed);
+	stats->slow = atomic_load_explicit(&csp_route_stats.slow, memory_order_relaxed);
+}
+
+/**
+ * Forward a packet not addressed to this node, to the cached next hop if possible
+ * @param iface pointer to incoming interface
+ * @param packet pointer to packet
+ */
+static void csp_route_forward(csp_iface_t * iface, csp_packet_t * packet) {
+
+	const uint16_t dst = packet->id.dst;
+	const unsigned int generation = csp_rtable_get_generation();
+	csp_send_direct_hop_t hop;
+
+	/* The lookup prints debug output */
+	if ((csp_dbg_packet_print < 2) && csp_route_cache_get(dst, iface, generation, &hop)) {
+		atomic_fetch_add_explicit(&csp_route_stats.fast, 1, memory_order_relaxed);
+		if (hop.iface == NULL) {
+			csp_buffer_free(packet);
+			return;
+		}
+		csp_id_t idout = packet->id;
+		if (hop.local) {
+			idout.src = hop.iface->addr;
+		}
+		csp_send_direct_iface(idout, packet, hop.iface, hop.via, 0);
+		return;
+	}
+
+	atomic_fetch_add_explicit(&csp_route_stats.slow, 1, memory_order_relaxed);
+	csp_send_direct_hop(packet->id, packet, iface, &hop);
+	if (hop.cacheable) {
+		csp_route_cache_put(dst, iface, generation, &hop);
+	}
+}
+
 /**
  * Check supported packet options
  * @param iface pointer to incoming interface
@@ -54,15 +154,16 @@ static int csp_route_check_options(csp_iface_t * iface, csp_packet_t * packet) {
  * @param security_opts either socket_opts or conn_opts
  * @param iface pointer to incoming interface
  * @param packet pointer to packet
+ * @param verified CRC32 and HMAC already verified and stripped by the pipeline
  * @return #CSP_ERR_NONE on success, otherwise an error code.
  */
-static int csp_route_security_check(uint32_t security_opts, csp_iface_t * iface, csp_packet_t * packet) {
+static int csp_route_security_check(uint32_t security_opts, csp_iface_t * iface, csp_packet_t * packet, bool verified) {
 
 
 	/* CRC32 verified packet */
 	if (packet->id.flags & CSP_FCRC32) {
 		/* Verify CRC32 (does not include header for backwards compatability with csp1.x) */
-		if (csp_crc32_verify(packet) != CSP_ERR_NONE) {
+		if (!verified && (csp_crc32_verify(packet) != CSP_ERR_NONE)) {
 			iface->rx_error++;
 			return CSP_ERR_CRC32;
 		}
@@ -75,7 +176,7 @@ static int csp_route_security_check(uint32_t security_opts, csp_iface_t * iface,
 	/* HMAC authenticated packet */
 	if (packet->id.flags & CSP_FHMAC) {
 		/* Verify HMAC (does not include header for backwards compatability with csp1.x) */
-		if (csp_hmac_verify(packet, false) != CSP_ERR_NONE) {
+		if (!verified && (csp_hmac_verify(packet, false) != CSP_ERR_NONE)) {
 			/* HMAC failed */
 			iface->autherr++;
 			return CSP_ERR_HMAC;
@@ -105,69 +206,30 @@ __attribute__((weak)) void csp_input_hook(csp_iface_t * iface, csp_packet_t * pa
 				   packet->id.sport, packet->id.pri, packet->id.flags, packet->length, iface->name);
 }
 
-int csp_route_work(void) {
+/**
+ * Deliver a packet to this node, to a callback, socket or connection
+ * @param iface pointer to incoming interface
+ * @param packet pointer to packet
+ * @param verified CRC32 and HMAC already verified and stripped by the pipeline
+ * @return #CSP_ERR_NONE
+ */
+static int csp_route_deliver(csp_iface_t * iface, csp_packet_t * packet, bool verified) {
 
-	csp_qfifo_t input;
-	csp_packet_t * packet;
 	csp_conn_t * conn;
 	csp_socket_t * socket;
 
-#if (CSP_USE_RDP)
-	/* Check connection timeouts (currently only for RDP) */
-	csp_conn_check_timeouts();
-#endif
-
-	/* Get next packet to route */
-	if (csp_qfifo_read(&input) != CSP_ERR_NONE) {
-		return CSP_ERR_TIMEDOUT;
-	}
-
-	packet = input.packet;
-	if (packet == NULL) {
-		return CSP_ERR_TIMEDOUT;
-	}
-
-	csp_input_hook(input.iface, packet);
-
-	/* Here there be promiscuous mode */
-#if (CSP_USE_PROMISC)
-	csp_promisc_add(packet);
-#endif
-
-	/* Count the message */
-	input.iface->rx++;
-	input.iface->rxbytes += packet->length;
-
-	/* The packet is to me, if the address matches that of the incoming interface,
-	 * or the address matches the broadcast address of the incoming interface */
-	int is_to_me = ((input.iface->addr == packet->id.dst) || (csp_id_is_broadcast(packet->id.dst, input.iface->netmask)));
-
-	/* Deduplication */
-	if ((csp_conf.dedup == CSP_DEDUP_ALL) ||
-		((is_to_me) && (csp_conf.dedup == CSP_DEDUP_INCOMING)) ||
-		((!is_to_me) && (csp_conf.dedup == CSP_DEDUP_FWD))) {
-		if (csp_dedup_is_duplicate(packet)) {
-			/* Discard packet */
-			input.iface->drop++;
-			csp_buffer_free(packet);
-			return CSP_ERR_NONE;
-		}
-	}
-
-	/* If the message is not to me, route the message to the correct interface */
-	if (!is_to_me) {
-
-		/* Otherwise, actually send the message */
-		csp_send_direct(packet->id, packet, input.iface);
+	/* Discard packets with unsupported options */
+	if (csp_route_check_options(iface, packet) != CSP_ERR_NONE) {
+		csp_buffer_free(packet);
 		return CSP_ERR_NONE;
-
 	}
 
-	/* Discard packets with unsupported options */
-	if (csp_route_check_options(input.iface, packet) != CSP_ERR_NONE) {
-		csp_buffer_free(packet);
+#if (CSP_USE_PIPELINE)
+	/* Verify on the pipeline workers, the packet comes back verified */
+	if (!verified && csp_pipeline_rx(packet, iface)) {
 		return CSP_ERR_NONE;
 	}
+#endif
 
 	/**
 	 * Callbacks 
@@ -175,7 +237,7 @@ int csp_route_work(void) {
 	csp_callback_t callback = csp_port_get_callback(packet->id.dport);
 	if (callback) {
 
-		if (csp_route_security_check(CSP_SO_NONE, input.iface, packet) < 0) {
+		if (csp_route_security_check(CSP_SO_NONE, iface, packet, verified) < 0) {
 			csp_buffer_free(packet);
 			return CSP_ERR_NONE;
 		}
@@ -194,7 +256,7 @@ int csp_route_work(void) {
 	/* If the socket is connection-less, deliver now */
 	if (socket && (socket->opts & CSP_SO_CONN_LESS)) {
 
-		if (csp_route_security_check(socket->opts, input.iface, packet) < 0) {
+		if (csp_route_security_check(socket->opts, iface, packet, verified) < 0) {
 			csp_buffer_free(packet);
 			return CSP_ERR_NONE;
 		}
@@ -221,7 +283,7 @@ int csp_route_work(void) {
 		}
 
 		/* Run security check on incoming packet */
-		if (csp_route_security_check(socket->opts, input.iface, packet) < 0) {
+		if (csp_route_security_check(socket->opts, iface, packet, verified) < 0) {
 			csp_buffer_free(packet);
 			return CSP_ERR_NONE;
 		}
@@ -252,7 +314,7 @@ int csp_route_work(void) {
 	} else {
 
 		/* Run security check on incoming packet */
-		if (csp_route_security_check(conn->opts, input.iface, packet) < 0) {
+		if (csp_route_security_check(conn->opts, iface, packet, verified) < 0) {
 			csp_buffer_free(packet);
 			return CSP_ERR_NONE;
 		}
@@ -290,3 +352,83 @@ int csp_route_work(void) {
 
 	return CSP_ERR_NONE;
 }
+
+int csp_route_work(void) {
+
+	csp_qfifo_t input;
+	csp_packet_t * packet;
+
+	/* Get next packet to route, sleeping no longer than until the next timer expires */
+	int ret = csp_qfifo_read(&input, csp_timer_next_timeout());
+
+	/* Expire due timers (currently only RDP connection timeouts, retransmissions and ACKs) */
+	csp_timer_run();
+
+	if (ret != CSP_ERR_NONE) {
+		return CSP_ERR_TIMEDOUT;
+	}
+
+	packet = input.packet;
+	if (packet == NULL) {
+		return CSP_ERR_TIMEDOUT;
+	}
+
+	/* Verified by the pipeline, has been through the steps below already */
+	if (input.verified) {
+		return csp_route_deliver(input.iface, packet, true);
+	}
+
+	csp_input_hook(input.iface, packet);
+
+	/* Count the message */
+	input.iface->rx++;
+	input.iface->rxbytes += packet->length;
+
+	/* Packets are compressed for a single link, so decompress before anything else */
+	if (packet->id.flags & CSP_FCOMP) {
+#if (CSP_USE_COMPRESS)
+		if (csp_decompress_packet(packet) != CSP_ERR_NONE) {
+			input.iface->rx_error++;
+			csp_buffer_free(packet);
+			return CSP_ERR_NONE;
+		}
+#else
+		csp_dbg_errno = CSP_DBG_ERR_UNSUPPORTED;
+		input.iface->rx_error++;
+		csp_buffer_free(packet);
+		return CSP_ERR_NONE;
+#endif
+	}
+
+	/* Here there be promiscuous mode */
+#if (CSP_USE_PROMISC)
+	csp_promisc_add(packet);
+#endif
+
+	/* The packet is to me, if the address matches that of the incoming interface,
+	 * or the address matches the broadcast address of the incoming interface */
+	int is_to_me = ((input.iface->addr == packet->id.dst) || (csp_id_is_broadcast(packet->id.dst, input.iface->netmask)));
+
+	/* Deduplication */
+	if ((csp_conf.dedup == CSP_DEDUP_ALL) ||
+		((is_to_me) && (csp_conf.dedup == CSP_DEDUP_INCOMING)) ||
+		((!is_to_me) && (csp_conf.dedup == CSP_DEDUP_FWD))) {
+		if (csp_dedup_is_duplicate(input.iface, packet)) {
+			/* Discard packet */
+			input.iface->drop++;
+			csp_buffer_free(packet);
+			return CSP_ERR_NONE;
+		}
+	}
+
+	/* If the message is not to me, route the message to the correct interface */
+	if (!is_to_me) {
+
+		/* Otherwise, actually send the message */
+		csp_route_forward(input.iface, packet);
+		return CSP_ERR_NONE;
+
+	}
+
+	return csp_route_deliver(input.iface, packet, false);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <csp/csp_rtable.h>
+
+#include "csp_rtable_fib.h"
+
+#ifndef CSP_RTABLE_SNAPSHOTS
+#define CSP_RTABLE_SNAPSHOTS 2  //! Number of routing table snapshots, the current one and those still being read.
+#endif
+
+/**
+ * Initialize the routing table
+ * Called from csp_init(), before any interface is added.
+ */
+void csp_rtable_init(void);
+
+/**
+ * Look up the next hop and local interfaces for a packet
+ * The next hop is always looked up, and selected by flow for multipath routes. The local interfaces are only looked
+ * up, if the forwarding table is in use.
+ * @param id packet id, the destination and the flow
+ * @param result result->hop and local interfaces
+ * @return true if local interfaces were looked up, false if the caller must scan the interface list
+ */
+bool csp_rtable_lookup(const csp_id_t * id, csp_rtable_fib_result_t * result);
+
+/**
+ * Append route to a bulk change, without looking for an existing route
+ * Next hops of a route must be appended one after the other.
+ * @param batch batch
+ * @param route route
+ * @return #CSP_ERR_NONE on success, #CSP_ERR_NOMEM if the table is full
+ */
+int csp_rtable_batch_append(csp_rtable_batch_t * batch, const csp_route_t * route);
+
+/**
+ * Rebuild the forwarding table
+ * Called when an interface is added or updated. Until then, lookups after a change of interface address or netmask
+ * scan the routing table.
+ */
+void csp_rtable_refresh(void);
+
+/**
+ * Invalidate cached lookups
+ * Called when the interface list is indexed again, so cached next hops of an old address or subnet are not used.
+ */
+void csp_rtable_invalidate(void);
+
+/**
+ * Get generation of the routing table
+ * Changes on every change of the routing table, and refresh, so results of lookups can be cached.
+ * @return generation, never 0
+ */
+unsigned int csp_rtable_get_generation(void);
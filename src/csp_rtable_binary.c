@@ -0,0 +1,245 @@
+
+
+#include "csp_rtable.h"
+
+#include <string.h>
+
+#include <csp/csp_crc32.h>
+#include <csp/csp_debug.h>
+#include <csp/csp_id.h>
+#include <csp/csp_iflist.h>
+
+/*
+ * Snapshot layout, all fields little endian:
+ *
+ * Header (16 bytes): "CSPR", version, host bits, interface count (16 bit), route count (32 bit),
+ *                    CRC32 of the interface and route records (32 bit)
+ * Interfaces (16 bytes each): name (12 bytes, zero padded), address (16 bit), netmask (16 bit)
+ * Routes (8 bytes each): address (16 bit), via (16 bit), netmask, interface index, weight, metric
+ *
+ * The interfaces are those of the interface list when saved, in order. Only the interfaces used by routes
+ * must exist when loaded.
+ */
+#define CSP_RTABLE_BINARY_VERSION 1
+#define CSP_RTABLE_BINARY_HEADER 16
+#define CSP_RTABLE_BINARY_IFACE 16
+#define CSP_RTABLE_BINARY_IFACE_NAME 12
+#define CSP_RTABLE_BINARY_ROUTE 8
+#define CSP_RTABLE_BINARY_IFACES_MAX 255
+
+static const uint8_t csp_rtable_binary_magic[4] = {'C', 'S', 'P', 'R'};
+
+static void csp_rtable_binary_put16(uint8_t * p, uint16_t value) {
+	p[0] = value;
+	p[1] = value >> 8;
+}
+
+static void csp_rtable_binary_put32(uint8_t * p, uint32_t value) {
+	p[0] = value;
+	p[1] = value >> 8;
+	p[2] = value >> 16;
+	p[3] = value >> 24;
+}
+
+static uint16_t csp_rtable_binary_get16(const uint8_t * p) {
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t csp_rtable_binary_get32(const uint8_t * p) {
+	return p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+typedef struct {
+	uint8_t * buffer;       // Route records, or NULL when counting
+	size_t size;            // Room for route records
+	uint32_t count;
+	csp_iface_t * iface;    // Interface of the last route, and its index
+	unsigned int index;
+	int error;
+} csp_rtable_binary_save_ctx_t;
+
+static bool csp_rtable_binary_save_route(void * vctx, csp_route_t * route) {
+
+	csp_rtable_binary_save_ctx_t * ctx = vctx;
+
+	if (ctx->buffer == NULL) {
+		ctx->count++;
+		return true;
+	}
+
+	if ((size_t)(ctx->count + 1) * CSP_RTABLE_BINARY_ROUTE > ctx->size) {
+		ctx->error = CSP_ERR_NOMEM;
+		return false;
+	}
+
+	/* Index in the interface list, consecutive routes often share the interface */
+	if (route->iface != ctx->iface) {
+		ctx->index = 0;
+		csp_iface_t * ifc = csp_iflist_get();
+		while ((ifc != NULL) && (ifc != route->iface)) {
+			ifc = ifc->next;
+			ctx->index++;
+		}
+		if ((ifc == NULL) || (ctx->index >= CSP_RTABLE_BINARY_IFACES_MAX)) {
+			ctx->error = CSP_ERR_INVAL;
+			return false;
+		}
+		ctx->iface = route->iface;
+	}
+
+	uint8_t * p = ctx->buffer + (size_t)ctx->count * CSP_RTABLE_BINARY_ROUTE;
+	csp_rtable_binary_put16(&p[0], route->address);
+	csp_rtable_binary_put16(&p[2], route->via);
+	p[4] = route->netmask;
+	p[5] = ctx->index;
+	p[6] = route->weight;
+	p[7] = route->metric;
+	ctx->count++;
+
+	return true;
+}
+
+int csp_rtable_save_binary(void * buffer, size_t buffer_size) {
+
+	unsigned int iface_count = 0;
+	for (csp_iface_t * ifc = csp_iflist_get(); ifc != NULL; ifc = ifc->next) {
+		iface_count++;
+	}
+	if (iface_count > CSP_RTABLE_BINARY_IFACES_MAX) {
+		iface_count = CSP_RTABLE_BINARY_IFACES_MAX;
+	}
+	const size_t routes_offset = CSP_RTABLE_BINARY_HEADER + iface_count * CSP_RTABLE_BINARY_IFACE;
+
+	if (buffer == NULL) {
+		csp_rtable_binary_save_ctx_t ctx = {.buffer = NULL};
+		csp_rtable_iterate(csp_rtable_binary_save_route, &ctx);
+		return routes_offset + (size_t)ctx.count * CSP_RTABLE_BINARY_ROUTE;
+	}
+
+	if (buffer_size < routes_offset) {
+		return CSP_ERR_NOMEM;
+	}
+
+	uint8_t * p = buffer;
+	memset(p, 0, routes_offset);
+
+	unsigned int index = 0;
+	for (csp_iface_t * ifc = csp_iflist_get(); (ifc != NULL) && (index < iface_count); ifc = ifc->next, index++) {
+		uint8_t * record = &p[CSP_RTABLE_BINARY_HEADER + index * CSP_RTABLE_BINARY_IFACE];
+		strncpy((char *)record, ifc->name, CSP_RTABLE_BINARY_IFACE_NAME - 1);
+		csp_rtable_binary_put16(&record[CSP_RTABLE_BINARY_IFACE_NAME], ifc->addr);
+		csp_rtable_binary_put16(&record[CSP_RTABLE_BINARY_IFACE_NAME + 2], ifc->netmask);
+	}
+
+	csp_rtable_binary_save_ctx_t ctx = {
+		.buffer = &p[routes_offset],
+		.size = buffer_size - routes_offset,
+		.error = CSP_ERR_NONE,
+	};
+	csp_rtable_iterate(csp_rtable_binary_save_route, &ctx);
+	if (ctx.error != CSP_ERR_NONE) {
+		return ctx.error;
+	}
+
+	const size_t size = routes_offset + (size_t)ctx.count * CSP_RTABLE_BINARY_ROUTE;
+	memcpy(p, csp_rtable_binary_magic, sizeof(csp_rtable_binary_magic));
+	p[4] = CSP_RTABLE_BINARY_VERSION;
+	p[5] = csp_id_get_host_bits();
+	csp_rtable_binary_put16(&p[6], iface_count);
+	csp_rtable_binary_put32(&p[8], ctx.count);
+	csp_rtable_binary_put32(&p[12], csp_crc32_memory(&p[CSP_RTABLE_BINARY_HEADER], size - CSP_RTABLE_BINARY_HEADER));
+
+	return size;
+}
+
+/* Interface of a snapshot record, if it exists with the same address and netmask */
+static csp_iface_t * csp_rtable_binary_iface(const uint8_t * record) {
+
+	char name[CSP_RTABLE_BINARY_IFACE_NAME];
+	memcpy(name, record, sizeof(name));
+	if (name[sizeof(name) - 1] != 0) {
+		return NULL;
+	}
+
+	csp_iface_t * ifc = csp_iflist_get_by_name(name);
+	if ((ifc == NULL) ||
+		(ifc->addr != csp_rtable_binary_get16(&record[CSP_RTABLE_BINARY_IFACE_NAME])) ||
+		(ifc->netmask != csp_rtable_binary_get16(&record[CSP_RTABLE_BINARY_IFACE_NAME + 2]))) {
+		return NULL;
+	}
+
+	return ifc;
+}
+
+int csp_rtable_load_binary(const void * buffer, size_t buffer_size) {
+
+	const uint8_t * p = buffer;
+
+	if ((buffer == NULL) || (buffer_size < CSP_RTABLE_BINARY_HEADER) ||
+		(memcmp(p, csp_rtable_binary_magic, sizeof(csp_rtable_binary_magic)) != 0) ||
+		(p[4] != CSP_RTABLE_BINARY_VERSION)) {
+		csp_dbg_errno = CSP_DBG_ERR_INVALID_RTABLE_ENTRY;
+		return CSP_ERR_INVAL;
+	}
+
+	/* Addresses and netmasks only mean the same with the same address size */
+	const unsigned int host_bits = csp_id_get_host_bits();
+	const unsigned int iface_count = csp_rtable_binary_get16(&p[6]);
+	const uint32_t route_count = csp_rtable_binary_get32(&p[8]);
+	const size_t routes_offset = CSP_RTABLE_BINARY_HEADER + iface_count * CSP_RTABLE_BINARY_IFACE;
+	if ((p[5] != host_bits) ||
+		(buffer_size < routes_offset) || (buffer_size - routes_offset != (size_t)route_count * CSP_RTABLE_BINARY_ROUTE) ||
+		(csp_rtable_binary_get32(&p[12]) != csp_crc32_memory(&p[CSP_RTABLE_BINARY_HEADER], buffer_size - CSP_RTABLE_BINARY_HEADER))) {
+		csp_dbg_errno = CSP_DBG_ERR_INVALID_RTABLE_ENTRY;
+		return CSP_ERR_INVAL;
+	}
+
+	if (route_count > csp_rtable_get_size()) {
+		return CSP_ERR_NOMEM;
+	}
+
+	csp_rtable_batch_t * batch = csp_rtable_batch_begin(true);
+
+	unsigned int index = iface_count;
+	csp_iface_t * ifc = NULL;
+	unsigned int hops = 0;
+	csp_route_t route = {0};
+
+	for (uint32_t i = 0; i < route_count; i++) {
+		const uint8_t * record = &p[routes_offset + (size_t)i * CSP_RTABLE_BINARY_ROUTE];
+
+		/* Consecutive routes often share the interface */
+		if (record[5] != index) {
+			index = record[5];
+			ifc = (index < iface_count) ? csp_rtable_binary_iface(&p[CSP_RTABLE_BINARY_HEADER + index * CSP_RTABLE_BINARY_IFACE]) : NULL;
+		}
+
+		const csp_route_t prev = route;
+		route.address = csp_rtable_binary_get16(&record[0]);
+		route.via = csp_rtable_binary_get16(&record[2]);
+		route.netmask = record[4];
+		route.iface = ifc;
+		route.weight = record[6];
+		route.metric = record[7];
+
+		/* Next hops of a route follow each other */
+		hops = ((i > 0) && csp_rtable_same_prefix(&prev, &route)) ? hops + 1 : 1;
+
+		if ((ifc == NULL) || (route.netmask > host_bits) || (route.address > csp_id_get_max_nodeid()) ||
+			(hops > CSP_RTABLE_MULTIPATH_MAX)) {
+			csp_rtable_batch_abort(batch);
+			csp_dbg_errno = CSP_DBG_ERR_INVALID_RTABLE_ENTRY;
+			return CSP_ERR_INVAL;
+		}
+
+		const int res = csp_rtable_batch_append(batch, &route);
+		if (res != CSP_ERR_NONE) {
+			csp_rtable_batch_abort(batch);
+			return res;
+		}
+	}
+
+	csp_rtable_batch_commit(batch);
+
+	return route_count;
+}
@@ -1,71 +1,503 @@
 
 
+#include "csp_rtable.h"
+
 #include <inttypes.h>
+#include <stdatomic.h>
+#include <stdlib.h>
 #include <string.h>
 
-#include <csp/csp_rtable.h>
 #include <csp/csp_debug.h>
 #include <csp/csp_id.h>
+#include <csp/arch/csp_queue.h>
+#include <csp/arch/csp_time.h>
+
+#include "csp_mutex.h"
+
+/* Packet counters of a next hop, outside the snapshots, so routing never writes to a published snapshot */
+typedef struct {
+	atomic_uint tx;
+	atomic_uint tx_avoided;
+} csp_rtable_counters_t;
+
+/* Counters of all snapshots, each next hop gets its own while referred to by any snapshot */
+#define CSP_RTABLE_COUNTERS(size) (CSP_RTABLE_SNAPSHOTS * (size))
+#define CSP_RTABLE_COUNTERS_WORDS(size) ((CSP_RTABLE_COUNTERS(size) + 31) / 32)
+
+/* Routing table snapshot, never changed while it is the current table or being read. Snapshots are never freed, so a
+ * reader may count itself on a replaced one, only their storage is */
+typedef struct {
+	atomic_uint readers;
+	unsigned int count;
+	csp_route_t * routes;       // Storage for csp_rtable_size routes
+	csp_rtable_counters_t * counters;  // Shared by all snapshots
+#if (CSP_USE_RTABLE_FIB)
+	csp_rtable_fib_t fib;
+#endif
+} csp_rtable_snapshot_t;
+
+/* Storage of the snapshots, CSP_RTABLE_SIZE routes until resized */
+typedef struct {
+	csp_route_t * routes;
+	csp_rtable_counters_t * counters;
+	uint32_t * counters_used;
+#if (CSP_USE_RTABLE_FIB)
+	csp_rtable_fib_entry_t * entries;
+	const csp_route_t ** sorted;
+#endif
+} csp_rtable_storage_t;
+
+static csp_rtable_snapshot_t csp_rtable_snapshots[CSP_RTABLE_SNAPSHOTS];
+static csp_route_t csp_rtable_static_routes[CSP_RTABLE_SNAPSHOTS * CSP_RTABLE_SIZE];
+static csp_rtable_counters_t csp_rtable_static_counters[CSP_RTABLE_COUNTERS(CSP_RTABLE_SIZE)];
+static uint32_t csp_rtable_static_counters_used[CSP_RTABLE_COUNTERS_WORDS(CSP_RTABLE_SIZE)];
+#if (CSP_USE_RTABLE_FIB)
+static csp_rtable_fib_entry_t csp_rtable_static_entries[CSP_RTABLE_SNAPSHOTS * CSP_RTABLE_FIB_ENTRIES(CSP_RTABLE_SIZE)];
+static const csp_route_t * csp_rtable_static_sorted[CSP_RTABLE_SIZE];
+#endif
+
+static csp_rtable_storage_t csp_rtable_storage;
+static unsigned int csp_rtable_size;
+
+/* Word of csp_rtable_storage.counters_used to look for free counters first */
+static unsigned int csp_rtable_counters_next;
+
+static _Atomic(csp_rtable_snapshot_t *) csp_rtable_current = &csp_rtable_snapshots[0];
+
+/* Counts published snapshots and refreshes, skipping 0 */
+static atomic_uint csp_rtable_generation = 1;
+
+/* Held while a new snapshot is prepared */
+static csp_mutex_t csp_rtable_writer;
+
+/* Signalled by the last reader leaving a replaced snapshot, for the writer waiting to reuse it */
+static csp_queue_handle_t csp_rtable_released;
+static csp_static_queue_t csp_rtable_released_queue;
+static char csp_rtable_released_buffer[1];
+
+/* The bulk change in progress */
+struct csp_rtable_batch_s {
+	csp_rtable_snapshot_t * next;
+};
+static csp_rtable_batch_t csp_rtable_batch;
+
+/* Point a snapshot at its part of the storage, must be called with the writer lock, while it is neither current nor read */
+static void csp_rtable_snapshot_setup(csp_rtable_snapshot_t * snapshot, const csp_rtable_storage_t * storage, unsigned int size) {
+	const unsigned int i = snapshot - csp_rtable_snapshots;
+	snapshot->routes = &storage->routes[i * size];
+	snapshot->counters = storage->counters;
+#if (CSP_USE_RTABLE_FIB)
+	snapshot->fib.entries = &storage->entries[i * CSP_RTABLE_FIB_ENTRIES(size)];
+	snapshot->fib.max_entries = CSP_RTABLE_FIB_ENTRIES(size);
+#endif
+}
+
+void csp_rtable_init(void) {
+
+	csp_mutex_init(&csp_rtable_writer);
+	csp_rtable_released = csp_queue_create_static(1, sizeof(uint8_t), csp_rtable_released_buffer, &csp_rtable_released_queue);
+
+	csp_rtable_storage = (csp_rtable_storage_t){
+		.routes = csp_rtable_static_routes,
+		.counters = csp_rtable_static_counters,
+		.counters_used = csp_rtable_static_counters_used,
+#if (CSP_USE_RTABLE_FIB)
+		.entries = csp_rtable_static_entries,
+		.sorted = csp_rtable_static_sorted,
+#endif
+	};
+	csp_rtable_size = CSP_RTABLE_SIZE;
+	for (unsigned int i = 0; i < CSP_RTABLE_SNAPSHOTS; i++) {
+		csp_rtable_snapshot_setup(&csp_rtable_snapshots[i], &csp_rtable_storage, csp_rtable_size);
+	}
+}
+
+static void csp_rtable_read_unlock(csp_rtable_snapshot_t * snapshot) {
+	/* Wake the writer, if waiting for this snapshot */
+	if ((atomic_fetch_sub(&snapshot->readers, 1) == 1) && (atomic_load(&csp_rtable_current) != snapshot)) {
+		const uint8_t token = 0;
+		csp_queue_enqueue(csp_rtable_released, &token, 0);
+	}
+}
+
+static csp_rtable_snapshot_t * csp_rtable_read_lock(void) {
+
+	csp_rtable_snapshot_t * snapshot;
+	while (1) {
+		snapshot = atomic_load(&csp_rtable_current);
+		atomic_fetch_add(&snapshot->readers, 1);
+		/* If replaced meanwhile, the writer may not have seen this reader */
+		if (atomic_load(&csp_rtable_current) == snapshot) {
+			return snapshot;
+		}
+		csp_rtable_read_unlock(snapshot);
+	}
+}
+
+/* Mark the counters referred to by any snapshot in use, must be called with the writer lock */
+static void csp_rtable_counters_mark(void) {
+
+	const unsigned int words = CSP_RTABLE_COUNTERS_WORDS(csp_rtable_size);
+	uint32_t * used = csp_rtable_storage.counters_used;
+	memset(used, 0, words * sizeof(used[0]));
+
+	/* Beyond the last counter */
+	for (unsigned int i = CSP_RTABLE_COUNTERS(csp_rtable_size); i < words * 32; i++) {
+		used[i / 32] |= 1U << (i % 32);
+	}
 
-/* Definition of routing table */
-static csp_route_t rtable[CSP_RTABLE_SIZE] = {0};
+	for (unsigned int s = 0; s < CSP_RTABLE_SNAPSHOTS; s++) {
+		const csp_rtable_snapshot_t * snapshot = &csp_rtable_snapshots[s];
+		for (unsigned int i = 0; i < snapshot->count; i++) {
+			used[snapshot->routes[i].counters / 32] |= 1U << (snapshot->routes[i].counters % 32);
+		}
+	}
+}
+
+/* Give a new next hop cleared counters, not referred to by any snapshot, must be called with the writer lock.
+ * The snapshots hold at most CSP_RTABLE_SNAPSHOTS - 1 tables of other counters, so one is free for a route that fits. */
+static void csp_rtable_counters_alloc(csp_route_t * route) {
+
+	const unsigned int words = CSP_RTABLE_COUNTERS_WORDS(csp_rtable_size);
+	uint32_t * used = csp_rtable_storage.counters_used;
+
+	for (unsigned int n = 0; n < words; n++) {
+		const unsigned int word = (csp_rtable_counters_next + n) % words;
+		if (used[word] != UINT32_MAX) {
+			const unsigned int bit = __builtin_ctz(~used[word]);
+			used[word] |= 1U << bit;
+			csp_rtable_counters_next = word;
+			route->counters = (word * 32) + bit;
+			atomic_store(&csp_rtable_storage.counters[route->counters].tx, 0);
+			atomic_store(&csp_rtable_storage.counters[route->counters].tx_avoided, 0);
+			return;
+		}
+	}
+}
+
+/* Wait for a replaced snapshot to be released by its last reader, must be called with the writer lock */
+static void csp_rtable_wait_released(void) {
+	/* The last reader of a snapshot signals after leaving, so the wakeup is not missed */
+	uint8_t token;
+	csp_queue_dequeue(csp_rtable_released, &token, CSP_MAX_TIMEOUT);
+}
+
+/* Find a snapshot no longer read (end of its grace period), must be called with the writer lock */
+static csp_rtable_snapshot_t * csp_rtable_write_next(csp_rtable_snapshot_t * current) {
+	while (1) {
+		for (unsigned int i = 0; i < CSP_RTABLE_SNAPSHOTS; i++) {
+			csp_rtable_snapshot_t * snapshot = &csp_rtable_snapshots[i];
+			if ((snapshot != current) && (atomic_load(&snapshot->readers) == 0)) {
+				return snapshot;
+			}
+		}
+		csp_rtable_wait_released();
+	}
+}
+
+/* Copy the current table to a snapshot no longer read, must be called with the writer lock */
+static csp_rtable_snapshot_t * csp_rtable_write_begin(void) {
+
+	csp_rtable_snapshot_t * current = atomic_load(&csp_rtable_current);
+	csp_rtable_snapshot_t * next = csp_rtable_write_next(current);
 
-static int rtable_inptr = 0;
+	next->count = current->count;
+	if (current->count > 0) {
+		memcpy(next->routes, current->routes, current->count * sizeof(next->routes[0]));
+	}
+
+	csp_rtable_counters_mark();
+
+	return next;
+}
+
+void csp_rtable_invalidate(void) {
+	if (atomic_fetch_add(&csp_rtable_generation, 1) + 1 == 0) {
+		atomic_fetch_add(&csp_rtable_generation, 1);
+	}
+}
+
+unsigned int csp_rtable_get_generation(void) {
+	return atomic_load(&csp_rtable_generation);
+}
+
+/* Compile and publish the snapshot */
+static void csp_rtable_write_end(csp_rtable_snapshot_t * next) {
+#if (CSP_USE_RTABLE_FIB)
+	csp_rtable_fib_build(&next->fib, next->routes, next->count, csp_rtable_storage.sorted);
+#endif
+	atomic_store(&csp_rtable_current, next);
+	csp_rtable_invalidate();
+}
+
+static void csp_rtable_write_lock(void) {
+	csp_mutex_lock(&csp_rtable_writer);
+}
+
+static void csp_rtable_write_unlock(void) {
+	csp_mutex_unlock(&csp_rtable_writer);
+}
 
-static csp_route_t * csp_rtable_find_exact(uint16_t addr, uint16_t netmask) {
+/* Find the next hops of a route, returns the index of the first, or -1 */
+static int csp_rtable_find_exact(csp_rtable_snapshot_t * snapshot, uint16_t addr, uint16_t netmask, unsigned int * hops) {
 
 	/* Start search */
-	for (int i = 0; i < rtable_inptr; i++) {
-		if (rtable[i].address == addr && rtable[i].netmask == netmask) {
-			return &rtable[i];
+	for (unsigned int i = 0; i < snapshot->count; i++) {
+		if (snapshot->routes[i].address == addr && snapshot->routes[i].netmask == netmask) {
+			*hops = 1;
+			while ((i + *hops < snapshot->count) && csp_rtable_same_prefix(&snapshot->routes[i], &snapshot->routes[i + *hops])) {
+				(*hops)++;
+			}
+			return i;
 		}
 	}
 
-	return NULL;
+	return -1;
 }
 
-csp_route_t * csp_rtable_find_route(uint16_t addr) {
+static csp_route_t * csp_rtable_find_route_scan(csp_rtable_snapshot_t * snapshot, uint16_t addr) {
+
+#if (CSP_USE_RTABLE_FIB)
+	const csp_route_t * route;
+	if (!csp_rtable_fib_changed(&snapshot->fib) && csp_rtable_fib_find_route(&snapshot->fib, addr, &route)) {
+		return (csp_route_t *)route;
+	}
+#endif
 
 	/* Remember best result */
 	int best_result = -1;
 	uint16_t best_result_mask = 0;
 
 	/* Start search */
-	for (int i = 0; i < rtable_inptr; i++) {
+	for (unsigned int i = 0; i < snapshot->count; i++) {
+
+		/* The first next hop represents a multipath route */
+		if ((i > 0) && csp_rtable_same_prefix(&snapshot->routes[i - 1], &snapshot->routes[i])) {
+			continue;
+		}
 
-		uint16_t hostbits = (1 << (csp_id_get_host_bits() - rtable[i].netmask)) - 1;
+		uint16_t hostbits = (1 << (csp_id_get_host_bits() - snapshot->routes[i].netmask)) - 1;
 		uint16_t netbits = ~hostbits;
 
 		/* Match network addresses */
-		uint16_t net_a = rtable[i].address & netbits;
+		uint16_t net_a = snapshot->routes[i].address & netbits;
 		uint16_t net_b = addr & netbits;
 
 		/* We have a match */
 		if (net_a == net_b) {
-			if (rtable[i].netmask >= best_result_mask) {
+			if (snapshot->routes[i].netmask >= best_result_mask) {
 				best_result = i;
-				best_result_mask = rtable[i].netmask;
+				best_result_mask = snapshot->routes[i].netmask;
 			}
 		}
 	}
 
 	if (best_result > -1) {
-		return &rtable[best_result];
+		return &snapshot->routes[best_result];
 	}
 
 	return NULL;
 }
 
-int csp_rtable_set_internal(uint16_t address, uint16_t netmask, csp_iface_t * ifc, uint16_t via) {
+/* Transmit errors within the hold-down time, tracked on the interface for all routes using it */
+static bool csp_rtable_iface_failing(csp_iface_t * iface, uint32_t now) {
 
-	/* First see if the entry exists */
-	csp_route_t * entry = csp_rtable_find_exact(address, netmask);
+	/* Checked by all tasks routing packets, and reset by the route monitor, the one seeing the change starts the hold-down */
+	const uint32_t tx_error = __atomic_load_n(&iface->tx_error, __ATOMIC_RELAXED);
+	uint32_t seen = __atomic_load_n(&iface->tx_error_seen, __ATOMIC_ACQUIRE);
+	if ((tx_error != seen) && __atomic_compare_exchange_n(&iface->tx_error_seen, &seen, tx_error, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		__atomic_store_n(&iface->tx_error_ms, now ? now : 1, __ATOMIC_RELEASE);
+	}
+
+	const uint32_t tx_error_ms = __atomic_load_n(&iface->tx_error_ms, __ATOMIC_ACQUIRE);
+	return (tx_error_ms != 0) && (now - tx_error_ms < CSP_RTABLE_MULTIPATH_HOLDDOWN_MS);
+}
+
+/* Weighted choice of next hop by hash, among those in mask */
+static csp_route_t * csp_rtable_pick(csp_route_t * first, unsigned int hops, uint32_t hash, uint32_t mask) {
+
+	uint32_t total = 0;
+	for (unsigned int i = 0; i < hops; i++) {
+		if (mask & (1 << i)) {
+			total += first[i].weight ? first[i].weight : 1;
+		}
+	}
+
+	uint32_t point = ((uint64_t)hash * total) >> 32;
+	for (unsigned int i = 0; i < hops; i++) {
+		if (mask & (1 << i)) {
+			const uint32_t weight = first[i].weight ? first[i].weight : 1;
+			if (point < weight) {
+				return &first[i];
+			}
+			point -= weight;
+		}
+	}
+
+	return first;
+}
+
+/* Next hops in mask with the lowest metric among them */
+static uint32_t csp_rtable_best_metric(const csp_route_t * first, unsigned int hops, uint32_t mask) {
+
+	unsigned int best = UINT8_MAX + 1;
+	uint32_t best_mask = 0;
+	for (unsigned int i = 0; i < hops; i++) {
+		if (mask & (1 << i)) {
+			if (first[i].metric < best) {
+				best = first[i].metric;
+				best_mask = 0;
+			}
+			if (first[i].metric == best) {
+				best_mask |= 1 << i;
+			}
+		}
+	}
+
+	return best_mask;
+}
+
+/* Select the next hop for a flow, and count the packet */
+static csp_route_t * csp_rtable_select(csp_rtable_snapshot_t * snapshot, csp_route_t * first, const csp_id_t * id, bool * multipath) {
 
-	/* If not, create a new one */
-	if (!entry) {
-		entry = &rtable[rtable_inptr++];
-		if (rtable_inptr == CSP_RTABLE_SIZE)
-			rtable_inptr = CSP_RTABLE_SIZE;
+	unsigned int hops = 1;
+	while ((first + hops < &snapshot->routes[snapshot->count]) && csp_rtable_same_prefix(first, first + hops)) {
+		hops++;
+	}
+
+	*multipath = (hops > 1);
+	if (hops == 1) {
+		atomic_fetch_add_explicit(&snapshot->counters[first->counters].tx, 1, memory_order_relaxed);
+		return first;
+	}
+
+	/* All packets of a connection (in each direction) take the same next hop */
+	const uint32_t hash = csp_id_flow_hash(id);
+
+	/* Next hops up, and those not failing either */
+	const uint32_t now = csp_get_ms();
+	uint32_t up = 0;
+	uint32_t healthy = 0;
+	for (unsigned int i = 0; i < hops; i++) {
+		if (!first[i].iface->down) {
+			up |= 1 << i;
+			if (!csp_rtable_iface_failing(first[i].iface, now)) {
+				healthy |= 1 << i;
+			}
+		}
+	}
+
+	/* Use the lowest metric up, backup routes only take over when all next hops of lower metrics are down */
+	csp_route_t * hop = csp_rtable_pick(first, hops, hash, csp_rtable_best_metric(first, hops, up ? up : (1U << hops) - 1));
+
+	/* Only flows of failing next hops move, unless all fail */
+	if (!(healthy & (1 << (hop - first))) && (healthy != 0)) {
+		atomic_fetch_add_explicit(&snapshot->counters[hop->counters].tx_avoided, 1, memory_order_relaxed);
+		hop = csp_rtable_pick(first, hops, hash, csp_rtable_best_metric(first, hops, healthy));
+	}
+
+	atomic_fetch_add_explicit(&snapshot->counters[hop->counters].tx, 1, memory_order_relaxed);
+	return hop;
+}
+
+/* Copy a route, with its counters */
+static void csp_rtable_copy_route(const csp_rtable_snapshot_t * snapshot, const csp_route_t * route, csp_route_t * copy) {
+	*copy = *route;
+	copy->tx = atomic_load_explicit(&snapshot->counters[route->counters].tx, memory_order_relaxed);
+	copy->tx_avoided = atomic_load_explicit(&snapshot->counters[route->counters].tx_avoided, memory_order_relaxed);
+}
+
+bool csp_rtable_find_route_copy(uint16_t addr, csp_route_t * route) {
+
+	csp_rtable_snapshot_t * snapshot = csp_rtable_read_lock();
+	const csp_route_t * found = csp_rtable_find_route_scan(snapshot, addr);
+	/* Copy, as the snapshot may be reused once released */
+	if (found != NULL) {
+		csp_rtable_copy_route(snapshot, found, route);
+	}
+	csp_rtable_read_unlock(snapshot);
+
+	return (found != NULL);
+}
+
+csp_route_t * csp_rtable_find_route(uint16_t addr) {
+
+	static csp_route_t route;
+	return csp_rtable_find_route_copy(addr, &route) ? &route : NULL;
+}
+
+bool csp_rtable_lookup(const csp_id_t * id, csp_rtable_fib_result_t * result) {
+
+	csp_rtable_snapshot_t * snapshot = csp_rtable_read_lock();
+	bool indexed = false;
+	csp_route_t * route = NULL;
+
+#if (CSP_USE_RTABLE_FIB)
+	/* Interfaces changed, scan until csp_iflist_update() rebuilds the table */
+	if (!csp_rtable_fib_changed(&snapshot->fib)) {
+		indexed = csp_rtable_fib_lookup(&snapshot->fib, id->dst, result);
+		route = (csp_route_t *)result->route;
+	}
+#endif
+
+	if (!indexed) {
+		route = csp_rtable_find_route_scan(snapshot, id->dst);
+		result->route = route;
+		result->local_count = 0;
+	}
+
+	/* Copy, as the snapshot may be reused once released */
+	if (route != NULL) {
+		result->hop = *csp_rtable_select(snapshot, route, id, &result->multipath);
+	} else {
+		result->hop.iface = NULL;
+		result->multipath = false;
+	}
+
+	csp_rtable_read_unlock(snapshot);
+
+	return indexed;
+}
+
+void csp_rtable_refresh(void) {
+#if (CSP_USE_RTABLE_FIB)
+	csp_rtable_write_lock();
+	csp_rtable_write_end(csp_rtable_write_begin());
+	csp_rtable_write_unlock();
+#else
+	/* Interfaces changed */
+	csp_rtable_invalidate();
+#endif
+}
+
+static void csp_rtable_remove(csp_rtable_snapshot_t * snapshot, unsigned int index, unsigned int count) {
+	memmove(&snapshot->routes[index], &snapshot->routes[index + count], (snapshot->count - index - count) * sizeof(snapshot->routes[0]));
+	snapshot->count -= count;
+}
+
+/* Set a route in a snapshot, replacing all next hops */
+static int csp_rtable_set_in(csp_rtable_snapshot_t * next, uint16_t address, uint16_t netmask, csp_iface_t * ifc, uint16_t via) {
+
+	/* First see if the entry exists */
+	unsigned int hops;
+	const int index = csp_rtable_find_exact(next, address, netmask, &hops);
+	csp_route_t * entry;
+
+	if (index >= 0) {
+		/* Replace all next hops */
+		entry = &next->routes[index];
+		csp_rtable_remove(next, index + 1, hops - 1);
+		if ((entry->iface != ifc) || (entry->via != via)) {
+			csp_rtable_counters_alloc(entry);
+		}
+	} else {
+		/* If not, create a new one */
+		if (next->count == csp_rtable_size) {
+			return CSP_ERR_NOMEM;
+		}
+		entry = &next->routes[next->count++];
+		memset(entry, 0, sizeof(*entry));
+		csp_rtable_counters_alloc(entry);
 	}
 
 	/* Fill in the data */
@@ -73,47 +505,328 @@ int csp_rtable_set_internal(uint16_t address, uint16_t netmask, csp_iface_t * if
 	entry->netmask = netmask;
 	entry->iface = ifc;
 	entry->via = via;
+	entry->weight = 0;
+	entry->metric = 0;
 
 	return CSP_ERR_NONE;
 }
 
+/* Add or update a next hop in a snapshot, weight and metric < 0 keep the current value, or the default for a new next hop */
+static int csp_rtable_nexthop_in(csp_rtable_snapshot_t * next, uint16_t address, uint16_t netmask, csp_iface_t * ifc, uint16_t via, int weight, int metric) {
+
+	unsigned int hops = 0;
+	int index = csp_rtable_find_exact(next, address, netmask, &hops);
+	csp_route_t * entry = NULL;
+
+	if (index < 0) {
+		index = next->count;
+	} else {
+		for (unsigned int i = index; i < index + hops; i++) {
+			if ((next->routes[i].iface == ifc) && (next->routes[i].via == via)) {
+				entry = &next->routes[i];
+			}
+		}
+	}
+
+	if (entry == NULL) {
+		/* Insert after the other next hops */
+		if ((next->count == csp_rtable_size) || (hops == CSP_RTABLE_MULTIPATH_MAX)) {
+			return CSP_ERR_NOMEM;
+		}
+		entry = &next->routes[index + hops];
+		memmove(entry + 1, entry, (next->count - index - hops) * sizeof(*entry));
+		next->count++;
+		memset(entry, 0, sizeof(*entry));
+		entry->address = address;
+		entry->netmask = netmask;
+		entry->iface = ifc;
+		entry->via = via;
+		entry->weight = 1;
+		csp_rtable_counters_alloc(entry);
+	}
+	if (weight >= 0) {
+		entry->weight = weight;
+	}
+	if (metric >= 0) {
+		entry->metric = metric;
+	}
+
+	return CSP_ERR_NONE;
+}
+
+int csp_rtable_set_internal(uint16_t address, uint16_t netmask, csp_iface_t * ifc, uint16_t via) {
+
+	csp_rtable_write_lock();
+	csp_rtable_snapshot_t * next = csp_rtable_write_begin();
+
+	const int ret = csp_rtable_set_in(next, address, netmask, ifc, via);
+	if (ret == CSP_ERR_NONE) {
+		csp_rtable_write_end(next);
+	}
+
+	csp_rtable_write_unlock();
+
+	return ret;
+}
+
 void csp_rtable_free(void) {
-	memset(rtable, 0, sizeof(rtable));
+	csp_rtable_write_lock();
+	csp_rtable_snapshot_t * next = csp_rtable_write_begin();
+	next->count = 0;
+	csp_rtable_write_end(next);
+	csp_rtable_write_unlock();
 }
 
 void csp_rtable_clear(void) {
 	csp_rtable_free();
 }
 
-int csp_rtable_set(uint16_t address, int netmask, csp_iface_t * ifc, uint16_t via) {
+static int csp_rtable_validate(int * netmask, csp_iface_t * ifc) {
 
-	if ((netmask < 0) || (netmask > (int)csp_id_get_host_bits())) {
-		netmask = csp_id_get_host_bits();
+	if ((*netmask < 0) || (*netmask > (int)csp_id_get_host_bits())) {
+		*netmask = csp_id_get_host_bits();
 	}
 
 	/* Validates options */
-	if ((ifc == NULL) || (netmask > (int)csp_id_get_host_bits())) {
+	if (ifc == NULL) {
 		csp_dbg_errno = CSP_DBG_ERR_INVALID_RTABLE_ENTRY; 
 		return CSP_ERR_INVAL;
 	}
 
+	return CSP_ERR_NONE;
+}
+
+int csp_rtable_set(uint16_t address, int netmask, csp_iface_t * ifc, uint16_t via) {
+
+	const int ret = csp_rtable_validate(&netmask, ifc);
+	if (ret != CSP_ERR_NONE) {
+		return ret;
+	}
+
 	return csp_rtable_set_internal(address, netmask, ifc, via);
 }
 
+static int csp_rtable_update_nexthop(uint16_t address, int netmask, csp_iface_t * ifc, uint16_t via, int weight, int metric) {
+
+	csp_rtable_write_lock();
+	csp_rtable_snapshot_t * next = csp_rtable_write_begin();
+
+	const int ret = csp_rtable_nexthop_in(next, address, netmask, ifc, via, weight, metric);
+	if (ret == CSP_ERR_NONE) {
+		csp_rtable_write_end(next);
+	}
+
+	csp_rtable_write_unlock();
+
+	return ret;
+}
+
+int csp_rtable_add_nexthop(uint16_t address, int netmask, csp_iface_t * ifc, uint16_t via, uint8_t weight) {
+
+	int ret = csp_rtable_validate(&netmask, ifc);
+	if ((ret != CSP_ERR_NONE) || (weight == 0)) {
+		return CSP_ERR_INVAL;
+	}
+
+	return csp_rtable_update_nexthop(address, netmask, ifc, via, weight, -1);
+}
+
+int csp_rtable_add_backup(uint16_t address, int netmask, csp_iface_t * ifc, uint16_t via, uint8_t metric) {
+
+	const int ret = csp_rtable_validate(&netmask, ifc);
+	if (ret != CSP_ERR_NONE) {
+		return ret;
+	}
+
+	return csp_rtable_update_nexthop(address, netmask, ifc, via, -1, metric);
+}
+
+int csp_rtable_remove_nexthop(uint16_t address, int netmask, csp_iface_t * ifc, uint16_t via) {
+
+	int ret = csp_rtable_validate(&netmask, ifc);
+	if (ret != CSP_ERR_NONE) {
+		return ret;
+	}
+
+	csp_rtable_write_lock();
+	csp_rtable_snapshot_t * next = csp_rtable_write_begin();
+
+	unsigned int hops;
+	const int index = csp_rtable_find_exact(next, address, netmask, &hops);
+	ret = CSP_ERR_INVAL;
+	for (int i = index; (index >= 0) && (i < index + (int)hops); i++) {
+		if ((next->routes[i].iface == ifc) && (next->routes[i].via == via)) {
+			csp_rtable_remove(next, i, 1);
+			csp_rtable_write_end(next);
+			ret = CSP_ERR_NONE;
+			break;
+		}
+	}
+
+	csp_rtable_write_unlock();
+
+	return ret;
+}
+
+csp_rtable_batch_t * csp_rtable_batch_begin(bool replace) {
+
+	csp_rtable_write_lock();
+	csp_rtable_batch.next = csp_rtable_write_begin();
+	if (replace) {
+		csp_rtable_batch.next->count = 0;
+	}
+
+	return &csp_rtable_batch;
+}
+
+int csp_rtable_batch_add(csp_rtable_batch_t * batch, uint16_t address, int netmask, csp_iface_t * ifc, uint16_t via, uint8_t weight, uint8_t metric) {
+
+	const int ret = csp_rtable_validate(&netmask, ifc);
+	if (ret != CSP_ERR_NONE) {
+		return ret;
+	}
+
+	if ((weight == 0) && (metric == 0)) {
+		return csp_rtable_set_in(batch->next, address, netmask, ifc, via);
+	}
+
+	return csp_rtable_nexthop_in(batch->next, address, netmask, ifc, via, weight ? weight : -1, metric);
+}
+
+int csp_rtable_batch_append(csp_rtable_batch_t * batch, const csp_route_t * route) {
+
+	csp_rtable_snapshot_t * next = batch->next;
+	if (next->count == csp_rtable_size) {
+		return CSP_ERR_NOMEM;
+	}
+
+	next->routes[next->count] = *route;
+	csp_rtable_counters_alloc(&next->routes[next->count++]);
+
+	return CSP_ERR_NONE;
+}
+
+void csp_rtable_batch_commit(csp_rtable_batch_t * batch) {
+	csp_rtable_write_end(batch->next);
+	batch->next = NULL;
+	csp_rtable_write_unlock();
+}
+
+void csp_rtable_batch_abort(csp_rtable_batch_t * batch) {
+	batch->next = NULL;
+	csp_rtable_write_unlock();
+}
+
+unsigned int csp_rtable_get_size(void) {
+	return csp_rtable_size ? csp_rtable_size : CSP_RTABLE_SIZE;
+}
+
+static void csp_rtable_storage_free(csp_rtable_storage_t * storage) {
+	free(storage->routes);
+	free(storage->counters);
+	free(storage->counters_used);
+#if (CSP_USE_RTABLE_FIB)
+	free(storage->entries);
+	free(storage->sorted);
+#endif
+}
+
+int csp_rtable_resize(unsigned int size) {
+
+	if (size == 0) {
+		return CSP_ERR_INVAL;
+	}
+
+	csp_rtable_storage_t storage = {
+		.routes = calloc((size_t)CSP_RTABLE_SNAPSHOTS * size, sizeof(*storage.routes)),
+		.counters = calloc(CSP_RTABLE_COUNTERS((size_t)size), sizeof(*storage.counters)),
+		.counters_used = calloc(CSP_RTABLE_COUNTERS_WORDS((size_t)size), sizeof(*storage.counters_used)),
+#if (CSP_USE_RTABLE_FIB)
+		.entries = calloc((size_t)CSP_RTABLE_SNAPSHOTS * CSP_RTABLE_FIB_ENTRIES(size), sizeof(*storage.entries)),
+		.sorted = calloc(size, sizeof(*storage.sorted)),
+#endif
+	};
+	if ((storage.routes == NULL) || (storage.counters == NULL) || (storage.counters_used == NULL)
+#if (CSP_USE_RTABLE_FIB)
+		|| (storage.entries == NULL) || (storage.sorted == NULL)
+#endif
+	) {
+		csp_rtable_storage_free(&storage);
+		return CSP_ERR_NOMEM;
+	}
+
+	csp_rtable_write_lock();
+
+	csp_rtable_snapshot_t * current = atomic_load(&csp_rtable_current);
+	if (current->count > size) {
+		csp_rtable_write_unlock();
+		csp_rtable_storage_free(&storage);
+		return CSP_ERR_NOMEM;
+	}
+
+	/* Publish a copy in the new storage, with the counters so far */
+	csp_rtable_storage_t old = csp_rtable_storage;
+	csp_rtable_snapshot_t * next = csp_rtable_write_next(current);
+	csp_rtable_snapshot_setup(next, &storage, size);
+	next->count = current->count;
+	for (unsigned int i = 0; i < current->count; i++) {
+		csp_rtable_copy_route(current, &current->routes[i], &next->routes[i]);
+		next->routes[i].counters = i;
+		atomic_store(&storage.counters[i].tx, next->routes[i].tx);
+		atomic_store(&storage.counters[i].tx_avoided, next->routes[i].tx_avoided);
+	}
+	csp_rtable_storage = storage;
+	csp_rtable_size = size;
+	csp_rtable_write_end(next);
+
+	/* Move the other snapshots to the new storage once released, readers still counted on them may use the old one */
+	for (unsigned int i = 0; i < CSP_RTABLE_SNAPSHOTS; i++) {
+		csp_rtable_snapshot_t * snapshot = &csp_rtable_snapshots[i];
+		if (snapshot == next) {
+			continue;
+		}
+		while (atomic_load(&snapshot->readers) != 0) {
+			csp_rtable_wait_released();
+		}
+		snapshot->count = 0;
+		csp_rtable_snapshot_setup(snapshot, &storage, size);
+	}
+
+	/* No snapshot refers to the old storage any more */
+	if (old.routes != csp_rtable_static_routes) {
+		csp_rtable_storage_free(&old);
+	}
+
+	csp_rtable_write_unlock();
+
+	return CSP_ERR_NONE;
+}
+
 void csp_rtable_iterate(csp_rtable_iterator_t iter, void * ctx) {
-	for (int i = 0; i < rtable_inptr; i++) {
-		iter(ctx, &rtable[i]);
+	csp_rtable_snapshot_t * snapshot = csp_rtable_read_lock();
+	for (unsigned int i = 0; i < snapshot->count; i++) {
+		csp_route_t route;
+		csp_rtable_copy_route(snapshot, &snapshot->routes[i], &route);
+		if (!iter(ctx, &route)) {
+			break;
+		}
 	}
+	csp_rtable_read_unlock(snapshot);
 }
 
 #if (CSP_ENABLE_CSP_PRINT)
 
 static bool csp_rtable_print_route(void * ctx, csp_route_t * route) {
 	if (route->via == CSP_NO_VIA_ADDRESS) {
-		csp_print("%u/%u %s\r\n", route->address, route->netmask, route->iface->name);
+		csp_print("%u/%u %s", route->address, route->netmask, route->iface->name);
 	} else {
-		csp_print("%u/%u %s %u\r\n", route->address, route->netmask, route->iface->name, route->via);
+		csp_print("%u/%u %s %u", route->address, route->netmask, route->iface->name, route->via);
+	}
+	if (route->weight != 0) {
+		csp_print(" weight %u metric %u tx %"PRIu32" avoided %"PRIu32"%s", route->weight, route->metric, route->tx, route->tx_avoided,
+				  route->iface->down ? " down" : "");
 	}
+	csp_print("\r\n");
 	return true;
 }
 
@@ -0,0 +1,144 @@
+
+
+#include "csp_rtable_fib.h"
+
+#include <stdlib.h>
+
+#include <csp/csp_id.h>
+#include <csp_autoconfig.h>
+
+#include "csp_iflist.h"
+
+#if (CSP_USE_RTABLE_FIB)
+
+/* Shorter prefixes first, and table order for equal prefixes, so the last route painted wins as in a table scan */
+static int csp_rtable_fib_compare(const void * a, const void * b) {
+	const csp_route_t * ra = *(const csp_route_t * const *)a;
+	const csp_route_t * rb = *(const csp_route_t * const *)b;
+	if (ra->netmask != rb->netmask) {
+		return (ra->netmask < rb->netmask) ? -1 : 1;
+	}
+	return (ra < rb) ? -1 : (ra > rb);
+}
+
+static bool csp_rtable_fib_build_index(csp_rtable_fib_t * fib, const csp_route_t * routes, unsigned int count, const csp_route_t ** sorted_routes) {
+
+	const unsigned int host_bits = fib->host_bits;
+	const uint32_t addresses = 1 << host_bits;
+	if (addresses > CSP_RTABLE_FIB_ADDRESSES) {
+		return false;
+	}
+
+	/* Interfaces */
+	for (csp_iface_t * ifc = csp_iflist_get(); ifc != NULL; ifc = ifc->next) {
+		if (fib->iface_count == CSP_RTABLE_FIB_MAX_IFACES) {
+			return false;
+		}
+		csp_rtable_fib_iface_t * fi = &fib->ifaces[fib->iface_count++];
+		fi->iface = ifc;
+		fi->netmask = ifc->netmask;
+		if (ifc->netmask > host_bits) {
+			return false;
+		}
+		/* Same subnet as csp_iflist_is_within_subnet(), interfaces without netmask take no part */
+		fi->mask = ((1 << ifc->netmask) - 1) << (host_bits - ifc->netmask);
+		fi->network = ifc->addr & fi->mask;
+	}
+
+	/* Paint each route over its address range, as index into the sorted routes + 1 */
+	unsigned int sorted = 0;
+	for (unsigned int i = 0; i < count; i++) {
+		/* The first next hop represents a multipath route */
+		if ((i == 0) || !csp_rtable_same_prefix(&routes[i - 1], &routes[i])) {
+			sorted_routes[sorted++] = &routes[i];
+		}
+	}
+	count = sorted;
+	qsort(sorted_routes, count, sizeof(sorted_routes[0]), csp_rtable_fib_compare);
+
+	for (uint32_t addr = 0; addr < addresses; addr++) {
+		fib->index[addr] = 0;
+	}
+	for (unsigned int i = 0; i < count; i++) {
+		const csp_route_t * route = sorted_routes[i];
+		if (route->netmask > host_bits) {
+			continue;
+		}
+		const uint16_t hostbits = (1 << (host_bits - route->netmask)) - 1;
+		const uint32_t first = route->address & (uint16_t)~hostbits;
+		if (first >= addresses) {
+			continue;
+		}
+		for (uint32_t addr = first; addr <= first + hostbits; addr++) {
+			fib->index[addr] = i + 1;
+		}
+	}
+
+	/* Replace with the index of the entry for route and local interfaces */
+	unsigned int entry_count = 0;
+	unsigned int last = 0;
+	for (uint32_t addr = 0; addr < addresses; addr++) {
+
+		const csp_route_t * route = fib->index[addr] ? sorted_routes[fib->index[addr] - 1] : NULL;
+		uint32_t local = 0;
+		for (unsigned int i = 0; i < fib->iface_count; i++) {
+			if ((fib->ifaces[i].netmask != 0) && ((addr & fib->ifaces[i].mask) == fib->ifaces[i].network)) {
+				local |= 1U << i;
+			}
+		}
+
+		/* An entry per range of neighbouring addresses, bounded by CSP_RTABLE_FIB_ENTRIES() and found without a search */
+		if ((entry_count == 0) || (fib->entries[last].route != route) || (fib->entries[last].local != local)) {
+			if (entry_count == fib->max_entries) {
+				return false;
+			}
+			last = entry_count++;
+			fib->entries[last].route = route;
+			fib->entries[last].local = local;
+		}
+		fib->index[addr] = last;
+	}
+
+	return true;
+}
+
+void csp_rtable_fib_build(csp_rtable_fib_t * fib, const csp_route_t * routes, unsigned int count, const csp_route_t ** sorted) {
+	fib->host_bits = csp_id_get_host_bits();
+	/* Before reading the interfaces, so a change while building is seen as one */
+	fib->iflist_generation = csp_iflist_get_generation();
+	fib->iface_count = 0;
+	fib->valid = csp_rtable_fib_build_index(fib, routes, count, sorted);
+}
+
+/* The interface list detects changes of interface addresses made without csp_iflist_update() */
+bool csp_rtable_fib_changed(const csp_rtable_fib_t * fib) {
+	return (fib->host_bits != csp_id_get_host_bits()) || (fib->iflist_generation != csp_iflist_get_generation());
+}
+
+bool csp_rtable_fib_find_route(const csp_rtable_fib_t * fib, uint16_t addr, const csp_route_t ** route) {
+
+	if (!fib->valid || (addr >= (1 << fib->host_bits))) {
+		return false;
+	}
+
+	*route = fib->entries[fib->index[addr]].route;
+	return true;
+}
+
+bool csp_rtable_fib_lookup(const csp_rtable_fib_t * fib, uint16_t addr, csp_rtable_fib_result_t * result) {
+
+	if (!fib->valid || (addr >= (1 << fib->host_bits))) {
+		return false;
+	}
+
+	const csp_rtable_fib_entry_t * entry = &fib->entries[fib->index[addr]];
+	result->route = entry->route;
+	result->local_count = 0;
+	for (uint32_t local = entry->local; local != 0; local &= local - 1) {
+		result->local[result->local_count++] = fib->ifaces[__builtin_ctz(local)].iface;
+	}
+
+	return true;
+}
+
+#endif
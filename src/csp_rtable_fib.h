@@ -0,0 +1,96 @@
+#pragma once
+
+#include <csp/csp_rtable.h>
+#include <csp_autoconfig.h>
+
+#ifndef CSP_RTABLE_FIB_MAX_IFACES
+#define CSP_RTABLE_FIB_MAX_IFACES 16  //! Max. number of interfaces, more disables the forwarding table, at most 32.
+#endif
+
+_Static_assert(CSP_RTABLE_FIB_MAX_IFACES <= 32, "CSP_RTABLE_FIB_MAX_IFACES must fit the interface bitmask of a table entry");
+
+/* Max. number of distinct lookup results for a table of routes, each route or subnet splits the address space in at
+ * most two more ranges */
+#define CSP_RTABLE_FIB_ENTRIES(routes) (2 * ((routes) + CSP_RTABLE_FIB_MAX_IFACES) + 1)
+
+/* Next hops of a multipath route are adjacent in the routing table */
+static inline bool csp_rtable_same_prefix(const csp_route_t * a, const csp_route_t * b) {
+	return (a->address == b->address) && (a->netmask == b->netmask);
+}
+
+#ifndef CSP_RTABLE_FIB_ADDRESSES
+#define CSP_RTABLE_FIB_ADDRESSES (1 << 14)  //! Addresses in the forwarding table, 2 bytes each per snapshot. 1 << 5 for CSP 1.x only, larger address spaces are scanned.
+#endif
+
+/**
+ * Result of a routing lookup
+ */
+typedef struct {
+	const csp_route_t * route;                           // Longest prefix match (first next hop), NULL if none, only valid while the snapshot is read
+	csp_route_t hop;                                     // Copy of the selected next hop, iface NULL if none
+	bool multipath;                                      // Route has several next hops, so the next hop depends on the flow
+	unsigned int local_count;                            // Number of interfaces in local
+	csp_iface_t * local[CSP_RTABLE_FIB_MAX_IFACES];      // Interfaces with the address on their subnet, in list order
+} csp_rtable_fib_result_t;
+
+typedef struct {
+	const csp_route_t * route;  // Longest prefix match, NULL if none
+	uint32_t local;             // Interfaces with the address on their subnet, bit n for ifaces[n]
+} csp_rtable_fib_entry_t;
+
+typedef struct {
+	csp_iface_t * iface;
+	uint16_t netmask;           // Netmask when built
+	uint16_t network;           // Network and mask of the subnet
+	uint16_t mask;
+} csp_rtable_fib_iface_t;
+
+/**
+ * Forwarding table
+ * Compiled from an array of routes and the interface list, with an entry per address. The table refers to the routes,
+ * so both are kept together in a routing table snapshot.
+ */
+typedef struct {
+	bool valid;                 // Built and within limits
+	unsigned int host_bits;     // When built, 0 if never built
+	unsigned int iflist_generation;  // Generation of the interface list when built
+	unsigned int iface_count;
+	csp_rtable_fib_iface_t ifaces[CSP_RTABLE_FIB_MAX_IFACES];
+	csp_rtable_fib_entry_t * entries;  // Storage for max_entries, more disables the forwarding table
+	unsigned int max_entries;
+	uint16_t index[CSP_RTABLE_FIB_ADDRESSES];
+} csp_rtable_fib_t;
+
+/**
+ * Build forwarding table
+ * @param fib forwarding table, with entries set
+ * @param routes routes, in table order
+ * @param count number of routes
+ * @param sorted work area for count route pointers
+ */
+void csp_rtable_fib_build(csp_rtable_fib_t * fib, const csp_route_t * routes, unsigned int count, const csp_route_t ** sorted);
+
+/**
+ * Check if interfaces changed since the table was built, see csp_iflist_get_generation()
+ * @param fib forwarding table
+ * @return true if the table must be rebuilt
+ */
+bool csp_rtable_fib_changed(const csp_rtable_fib_t * fib);
+
+/**
+ * Find route to an address in the forwarding table
+ * @param fib forwarding table
+ * @param addr destination address
+ * @param route longest prefix match, NULL if none
+ * @return true if found, false if the table is not valid
+ */
+bool csp_rtable_fib_find_route(const csp_rtable_fib_t * fib, uint16_t addr, const csp_route_t ** route);
+
+/**
+ * Look up an address in the forwarding table
+ * @param fib forwarding table
+ * @param addr destination address
+ * @param result lookup result
+ * @return true if found, false if the table is not valid
+ */
+bool csp_rtable_fib_lookup(const csp_rtable_fib_t * fib, uint16_t addr, csp_rtable_fib_result_t * result);
@@ -0,0 +1,181 @@
+#include "csp_rtable.h"
+
+#include <csp/csp_id.h>
+#include <csp/arch/csp_time.h>
+#include <csp/interfaces/csp_if_lo.h>
+
+#include "csp_io.h"
+#include "csp_timer.h"
+
+#ifndef CSP_RTABLE_MONITOR_MAX_PROBES
+#define CSP_RTABLE_MONITOR_MAX_PROBES 16  //! Max. number of next hops probed per interval.
+#endif
+
+typedef struct {
+	csp_iface_t * iface;
+	uint16_t via;
+	uint16_t dst;
+} csp_rtable_monitor_probe_t;
+
+typedef struct {
+	unsigned int count;
+	csp_rtable_monitor_probe_t probes[CSP_RTABLE_MONITOR_MAX_PROBES];
+} csp_rtable_monitor_probes_t;
+
+static csp_rtable_monitor_conf_t csp_rtable_monitor_conf;
+static csp_timer_t csp_rtable_monitor_timer;
+static volatile bool csp_rtable_monitor_running;
+
+/* Collect the distinct next hops of routes, with an address to probe */
+static bool csp_rtable_monitor_collect(void * ctx, csp_route_t * route) {
+
+	csp_rtable_monitor_probes_t * probes = ctx;
+
+	if (route->iface == &csp_if_lo) {
+		return true;
+	}
+
+	/* Only host routes have a destination to probe without a via address */
+	uint16_t dst = route->via;
+	if (dst == CSP_NO_VIA_ADDRESS) {
+		if (route->netmask != csp_id_get_host_bits()) {
+			return true;
+		}
+		dst = route->address;
+	}
+
+	for (unsigned int i = 0; i < probes->count; i++) {
+		if ((probes->probes[i].iface == route->iface) && (probes->probes[i].dst == dst)) {
+			return true;
+		}
+	}
+
+	probes->probes[probes->count].iface = route->iface;
+	probes->probes[probes->count].via = route->via;
+	probes->probes[probes->count].dst = dst;
+	probes->count++;
+
+	return (probes->count < CSP_RTABLE_MONITOR_MAX_PROBES);
+}
+
+/* Ping without a connection, straight to the interface of the next hop. The reply goes to an unused port. */
+static void csp_rtable_monitor_probe(const csp_rtable_monitor_probe_t * probe) {
+
+	csp_packet_t * packet = csp_buffer_get(1);
+	if (packet == NULL) {
+		return;
+	}
+
+	packet->data[0] = 0x55;
+	packet->length = 1;
+
+	csp_id_t idout = {
+		.pri = CSP_PRIO_NORM,
+		.dst = probe->dst,
+		.dport = CSP_PING,
+		.sport = csp_id_get_max_port(),
+	};
+	csp_send_direct_iface(idout, packet, probe->iface, probe->via, 1);
+}
+
+/* Update the state of an interface from the transmissions since the last check */
+static void csp_rtable_monitor_check(csp_iface_t * iface) {
+
+	const uint32_t tx = iface->tx;
+	const uint32_t tx_error = iface->tx_error;
+
+	/* Counters may have been reset */
+	const uint32_t sent = (tx >= iface->monitor_tx) ? (tx - iface->monitor_tx) : 0;
+	const uint32_t failed = (tx_error >= iface->monitor_tx_error) ? (tx_error - iface->monitor_tx_error) : 0;
+	iface->monitor_tx = tx;
+	iface->monitor_tx_error = tx_error;
+
+	/* Without probes, routes avoid a down interface, so idle intervals count as working, to try it again */
+	bool failing = (failed >= sent);
+	if ((sent == 0) && (failed == 0)) {
+		if (!iface->down || csp_rtable_monitor_conf.probe) {
+			return;
+		}
+		failing = false;
+	}
+
+	if (failing == iface->down) {
+		iface->monitor_count = 0;
+		return;
+	}
+
+	const uint8_t count = iface->down ? csp_rtable_monitor_conf.up_count : csp_rtable_monitor_conf.down_count;
+	if (++iface->monitor_count < count) {
+		return;
+	}
+
+	iface->monitor_count = 0;
+	iface->down = !iface->down;
+
+	/* Working again, so end the hold-down of multipath routing as well */
+	if (!iface->down) {
+		__atomic_store_n(&iface->tx_error_seen, tx_error, __ATOMIC_RELEASE);
+		__atomic_store_n(&iface->tx_error_ms, 0, __ATOMIC_RELEASE);
+	}
+	if (csp_rtable_monitor_conf.event) {
+		csp_rtable_monitor_conf.event(csp_rtable_monitor_conf.ctx, iface, iface->down);
+	}
+}
+
+static void csp_rtable_monitor_expired(void * arg) {
+
+	if (!csp_rtable_monitor_running) {
+		return;
+	}
+
+	for (csp_iface_t * iface = csp_iflist_get(); iface != NULL; iface = iface->next) {
+		csp_rtable_monitor_check(iface);
+	}
+
+	if (csp_rtable_monitor_conf.probe) {
+		csp_rtable_monitor_probes_t probes = {.count = 0};
+		csp_rtable_iterate(csp_rtable_monitor_collect, &probes);
+		for (unsigned int i = 0; i < probes.count; i++) {
+			csp_rtable_monitor_probe(&probes.probes[i]);
+		}
+	}
+
+	csp_timer_set(&csp_rtable_monitor_timer, csp_timer_now() + csp_rtable_monitor_conf.interval);
+}
+
+int csp_rtable_monitor_start(const csp_rtable_monitor_conf_t * conf) {
+
+	if ((conf == NULL) || (conf->interval == 0)) {
+		return CSP_ERR_INVAL;
+	}
+
+	csp_rtable_monitor_stop();
+
+	csp_rtable_monitor_conf = *conf;
+	if (csp_rtable_monitor_conf.down_count == 0) {
+		csp_rtable_monitor_conf.down_count = 1;
+	}
+	if (csp_rtable_monitor_conf.up_count == 0) {
+		csp_rtable_monitor_conf.up_count = 1;
+	}
+
+	/* Count from now */
+	for (csp_iface_t * iface = csp_iflist_get(); iface != NULL; iface = iface->next) {
+		iface->monitor_tx = iface->tx;
+		iface->monitor_tx_error = iface->tx_error;
+		iface->monitor_count = 0;
+	}
+
+	csp_rtable_monitor_running = true;
+	csp_timer_setup(&csp_rtable_monitor_timer, csp_rtable_monitor_expired, NULL);
+	csp_timer_set(&csp_rtable_monitor_timer, csp_timer_now() + csp_rtable_monitor_conf.interval);
+
+	return CSP_ERR_NONE;
+}
+
+void csp_rtable_monitor_stop(void) {
+	if (csp_rtable_monitor_running) {
+		csp_rtable_monitor_running = false;
+		csp_timer_cancel(&csp_rtable_monitor_timer);
+	}
+}
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <inttypes.h>
+#include <string.h>
 
 #include <csp/csp.h>
 #include <csp/csp_debug.h>
@@ -8,52 +9,104 @@
 #include <csp/interfaces/csp_if_lo.h>
 #include <csp_autoconfig.h>
 
-static int csp_rtable_parse(const char * rtable, int dry_run) {
+/* Parse one entry, "<address>[/mask] <interface> [via] [*weight] [+metric]" */
+static int csp_rtable_parse_entry(char * str, csp_rtable_batch_t * batch) {
 
-	int valid_entries = 0;
+	unsigned int address, via;
+	int netmask;
+	char name[15];
 
-	/* Copy string before running strtok */
-	const size_t str_len = strnlen(rtable, 100);
-	char rtable_copy[str_len + 1];
-	strncpy(rtable_copy, rtable, str_len);
-	rtable_copy[str_len] = 0;
-
-	/* Get first token */
-	char * saveptr;
-	char * str = strtok_r(rtable_copy, ",", &saveptr);
-	while ((str) && (strlen(str) > 1)) {
-		unsigned int address, via;
-		int netmask;
-		char name[15];
-		if (sscanf(str, "%u/%d %14s %u", &address, &netmask, name, &via) == 4) {
-		} else if (sscanf(str, "%u/%d %14s", &address, &netmask, name) == 3) {
-			via = CSP_NO_VIA_ADDRESS;
-		} else if (sscanf(str, "%u %14s %u", &address, name, &via) == 3) {
-			netmask = csp_id_get_host_bits();
-		} else if (sscanf(str, "%u %14s", &address, name) == 2) {
-			netmask = csp_id_get_host_bits();
-			via = CSP_NO_VIA_ADDRESS;
-		} else {
-			// invalid entry
-			name[0] = 0;
+	/* Optional metric of a backup next hop, "+<metric>" at the end */
+	unsigned int metric = 0;
+	char * metric_str = strchr(str, '+');
+	if (metric_str != NULL) {
+		if ((sscanf(metric_str + 1, "%u", &metric) != 1) || (metric > UINT8_MAX)) {
+			return CSP_ERR_INVAL;
 		}
-		name[sizeof(name) - 1] = 0;
+		*metric_str = 0;
+	}
 
-		csp_iface_t * ifc = csp_iflist_get_by_name(name);
-		if ((address > csp_id_get_max_nodeid()) || (netmask > (int)csp_id_get_host_bits()) || (ifc == NULL)) {
-			csp_dbg_errno = CSP_DBG_ERR_INVALID_RTABLE_ENTRY; 
+	/* Optional weight of a multipath next hop, "*<weight>" before the metric */
+	unsigned int weight = 0;
+	char * weight_str = strchr(str, '*');
+	if (weight_str != NULL) {
+		if ((sscanf(weight_str + 1, "%u", &weight) != 1) || (weight == 0) || (weight > UINT8_MAX)) {
 			return CSP_ERR_INVAL;
 		}
+		*weight_str = 0;
+	}
+
+	if (sscanf(str, "%u/%d %14s %u", &address, &netmask, name, &via) == 4) {
+	} else if (sscanf(str, "%u/%d %14s", &address, &netmask, name) == 3) {
+		via = CSP_NO_VIA_ADDRESS;
+	} else if (sscanf(str, "%u %14s %u", &address, name, &via) == 3) {
+		netmask = csp_id_get_host_bits();
+	} else if (sscanf(str, "%u %14s", &address, name) == 2) {
+		netmask = csp_id_get_host_bits();
+		via = CSP_NO_VIA_ADDRESS;
+	} else {
+		// invalid entry
+		name[0] = 0;
+	}
+	name[sizeof(name) - 1] = 0;
+
+	csp_iface_t * ifc = csp_iflist_get_by_name(name);
+	if ((address > csp_id_get_max_nodeid()) || (netmask > (int)csp_id_get_host_bits()) || (ifc == NULL)) {
+		return CSP_ERR_INVAL;
+	}
+
+	if (batch == NULL) {
+		return CSP_ERR_NONE;
+	}
+
+	/* A metric of 0 with a weight is the default, a metric of 0 alone makes a next hop */
+	if ((metric_str != NULL) && (metric == 0) && (weight == 0)) {
+		weight = 1;
+	}
+
+	return csp_rtable_batch_add(batch, address, netmask, ifc, via, weight, metric);
+}
+
+static int csp_rtable_parse(const char * rtable, int dry_run) {
+
+	int valid_entries = 0;
+
+	/* All entries or none take effect */
+	csp_rtable_batch_t * batch = dry_run ? NULL : csp_rtable_batch_begin(false);
+
+	/* Entries are copied one at a time, so the table has no length limit */
+	const char * str = rtable;
+	while (1) {
+		const char * end = strchr(str, ',');
+		const size_t len = end ? (size_t)(end - str) : strlen(str);
+		if (len <= 1) {
+			break;
+		}
 
-		if (dry_run == 0) {
-			int res = csp_rtable_set(address, netmask, ifc, via);
-			if (res != CSP_ERR_NONE) {
-				csp_dbg_errno = CSP_DBG_ERR_INVALID_RTABLE_ENTRY;
-				return res;
+		int res = CSP_ERR_INVAL;
+		char entry[64];
+		if (len < sizeof(entry)) {
+			memcpy(entry, str, len);
+			entry[len] = 0;
+			res = csp_rtable_parse_entry(entry, batch);
+		}
+		if (res != CSP_ERR_NONE) {
+			if (batch) {
+				csp_rtable_batch_abort(batch);
 			}
+			csp_dbg_errno = CSP_DBG_ERR_INVALID_RTABLE_ENTRY;
+			return res;
 		}
+
 		valid_entries++;
-		str = strtok_r(NULL, ",", &saveptr);
+		if (end == NULL) {
+			break;
+		}
+		str = end + 1;
+	}
+
+	if (batch) {
+		csp_rtable_batch_commit(batch);
 	}
 
 	return valid_entries;
@@ -98,9 +151,17 @@ static bool csp_rtable_save_route(void * vctx, csp_route_t * route) {
 	} else {
 		via_str[0] = 0;
 	}
+	char weight_str[20];
+	weight_str[0] = 0;
+	if (route->weight != 0) {
+		snprintf(weight_str, sizeof(weight_str), " *%u", route->weight);
+	}
+	if (route->metric != 0) {
+		snprintf(weight_str + strlen(weight_str), sizeof(weight_str) - strlen(weight_str), " +%u", route->metric);
+	}
 	size_t remain_buf_size = ctx->maxlen - ctx->len;
 	int res = snprintf(ctx->buffer + ctx->len, remain_buf_size,
-					   "%s%u%s %s%s", sep, route->address, mask_str, route->iface->name, via_str);
+					   "%s%u%s %s%s%s", sep, route->address, mask_str, route->iface->name, via_str, weight_str);
 	if ((res < 0) || (res >= (int)(remain_buf_size))) {
 		ctx->error = CSP_ERR_NOMEM;
 		return false;
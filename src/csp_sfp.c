@@ -3,82 +3,152 @@
 #include <csp/csp_sfp.h>
 
 #include <malloc.h>
+#include <stdbool.h>
+#include <string.h>
 
 #include <csp/csp_buffer.h>
+#include <csp/csp_compress.h>
+#include <csp/csp_crc32.h>
 #include <csp/csp_debug.h>
 #include <endian.h>
+#if (CSP_POSIX)
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "csp_conn.h"
+#include "csp_sfp_header.h"
 
-typedef struct __attribute__((__packed__)) {
-	uint32_t offset;
-	uint32_t totalsize;
-} sfp_header_t;
+/* Copy length bytes at offset of the transfer to dst */
+typedef int (*csp_sfp_read_fnc_t)(void * dst, uint32_t offset, uint32_t length, void * context);
+
+typedef struct {
+	const uint8_t * data;
+	csp_memcpy_fnc_t memcpyfcn;
+} csp_sfp_mem_source_t;
+
+static int csp_sfp_mem_read(void * dst, uint32_t offset, uint32_t length, void * context) {
+
+	csp_sfp_mem_source_t * source = context;
+	(source->memcpyfcn)((csp_memptr_t)(uintptr_t)dst, (csp_memptr_t)(uintptr_t)(source->data + offset), length);
+	return CSP_ERR_NONE;
+}
 
 /**
- * SFP Headers:
- * The following functions are helper functions that handles the extra SFP
- * information that needs to be appended to all data packets.
+ * Negotiated compression:
+ * Each fragment starts with the encoding of its data, compressed or raw if
+ * compression did not make it smaller. The SFP header holds the offset of
+ * the uncompressed data.
  */
-static inline sfp_header_t * csp_sfp_header_add(csp_packet_t * packet) {
+#define SFP_CHUNK_RAW 0x00
+#define SFP_CHUNK_LZ 0x01
+
+/* Read size bytes at offset, and encode them as the fragment data. Sent raw if compression does not pay off, or no scratch buffer is free */
+static int csp_sfp_deflate(csp_packet_t * packet, unsigned int offset, unsigned int size, csp_sfp_read_fnc_t readfnc, void * context) {
+
+	/* The scratch buffer is only held while encoding, to not starve the connection of buffers */
+	csp_packet_t * scratch = csp_buffer_get(size);
+	if (scratch == NULL) {
+		packet->data[0] = SFP_CHUNK_RAW;
+		packet->length = size + 1;
+		return readfnc(&packet->data[1], offset, size, context);
+	}
+
+	int error = readfnc(scratch->data, offset, size, context);
+	if (error == CSP_ERR_NONE) {
+		uint32_t length = csp_compress(scratch->data, size, &packet->data[1], size - 1);
+		if (length > 0) {
+			packet->data[0] = SFP_CHUNK_LZ;
+		} else {
+			packet->data[0] = SFP_CHUNK_RAW;
+			memcpy(&packet->data[1], scratch->data, size);
+			length = size;
+		}
+		packet->length = length + 1;
+	}
 
-	sfp_header_t * header = (sfp_header_t *)&packet->data[packet->length];
-	packet->length += sizeof(*header);
-	return header;
+	csp_buffer_free(scratch);
+	return error;
 }
 
-static inline sfp_header_t * csp_sfp_header_remove(csp_packet_t * packet) {
+/* Replace the encoded data of a fragment (without SFP header) with the uncompressed data, expanded in scratch */
+static int csp_sfp_inflate(csp_packet_t * packet, csp_packet_t * scratch) {
 
-	if ((packet->id.flags & CSP_FFRAG) == 0) {
-		return NULL;
+	if (packet->length < 1) {
+		return CSP_ERR_SFP;
 	}
-	sfp_header_t * header;
-	if (packet->length < sizeof(*header)) {
-		return NULL;
-	}
-	header = (sfp_header_t *)&packet->data[packet->length - sizeof(*header)];
-	packet->length -= sizeof(*header);
 
-	header->offset = be32toh(header->offset);
-	header->totalsize = be32toh(header->totalsize);
+	if (packet->data[0] == SFP_CHUNK_RAW) {
+		packet->length -= 1;
+		memmove(packet->data, &packet->data[1], packet->length);
+		return CSP_ERR_NONE;
+	}
 
-	if (header->offset > header->totalsize) {
-		return NULL;
+	if (packet->data[0] == SFP_CHUNK_LZ) {
+		int length = csp_decompress(&packet->data[1], packet->length - 1, scratch->data, csp_buffer_data_size());
+		if (length < 0) {
+			return CSP_ERR_SFP;
+		}
+		memcpy(packet->data, scratch->data, length);
+		packet->length = length;
+		return CSP_ERR_NONE;
 	}
 
-	return header;
+	return CSP_ERR_SFP;
 }
 
-int csp_sfp_send_own_memcpy(csp_conn_t * conn, const void * data, unsigned int totalsize, unsigned int mtu, uint32_t timeout, csp_memcpy_fnc_t memcpyfcn) {
-	if (mtu == 0) {
-		return CSP_ERR_INVAL;
+/* Send the data from offset up to end, in chunks of mtu bytes. With compress, chunks are one byte smaller, for the encoding */
+static int csp_sfp_send_range(csp_conn_t * conn, unsigned int totalsize, unsigned int offset, unsigned int end, unsigned int mtu, bool compress, csp_sfp_read_fnc_t readfnc, void * context) {
+
+	unsigned int chunk = mtu;
+	if (compress) {
+#if (CSP_USE_COMPRESS)
+		if (mtu < 2) {
+			return CSP_ERR_INVAL;
+		}
+		chunk = mtu - 1;
+#else
+		return CSP_ERR_NOTSUP;
+#endif
 	}
 
-	unsigned int count = 0;
-	while (count < totalsize) {
+	int error = CSP_ERR_NONE;
+	unsigned int count = offset;
+	while (count < end) {
 
 		sfp_header_t * sfp_header;
 
 		/* Allocate packet */
 		csp_packet_t * packet = csp_buffer_get(mtu + sizeof(*sfp_header));
 		if (packet == NULL) {
-			return CSP_ERR_NOMEM;
+			error = CSP_ERR_NOMEM;
+			break;
 		}
 
 		/* Calculate sending size */
-		unsigned int size = totalsize - count;
-		if (size > mtu) {
-			size = mtu;
+		unsigned int size = end - count;
+		if (size > chunk) {
+			size = chunk;
 		}
 
 		/* Print debug */
 		if (csp_dbg_packet_print >= 3) {
-			csp_print("%s: %d:%d, sending at %p size %u\n", __FUNCTION__, csp_conn_src(conn), csp_conn_sport(conn), ((uint8_t *)data) + count, size);
+			csp_print("%s: %d:%d, sending at offset %u size %u\n", __FUNCTION__, csp_conn_src(conn), csp_conn_sport(conn), count, size);
 		}
 		
 		/* Copy data */
-		(memcpyfcn)((csp_memptr_t)(uintptr_t)packet->data, (csp_memptr_t)(uintptr_t)(((uint8_t *)data) + count), size);
-		packet->length = size;
+		if (compress) {
+			error = csp_sfp_deflate(packet, count, size, readfnc, context);
+		} else {
+			error = readfnc(packet->data, count, size, context);
+			packet->length = size;
+		}
+		if (error != CSP_ERR_NONE) {
+			csp_buffer_free(packet);
+			break;
+		}
 
 		/* Set fragment flag */
 		conn->idout.flags |= CSP_FFRAG;
@@ -95,13 +165,24 @@ int csp_sfp_send_own_memcpy(csp_conn_t * conn, const void * data, unsigned int t
 		count += size;
 	}
 
-	return CSP_ERR_NONE;
+	return error;
 }
 
-int csp_sfp_recv_fp(csp_conn_t * conn, void ** return_data, int * return_datasize, uint32_t timeout, csp_packet_t * first_packet) {
+int csp_sfp_send_own_memcpy(csp_conn_t * conn, const void * data, unsigned int totalsize, unsigned int mtu, uint32_t timeout, csp_memcpy_fnc_t memcpyfcn) {
+	if (mtu == 0) {
+		return CSP_ERR_INVAL;
+	}
 
-	*return_data = NULL; /* Allow caller to assume csp_free() can always be called when dataout is non-NULL */
-	*return_datasize = 0;
+	csp_sfp_mem_source_t source = {.data = data, .memcpyfcn = memcpyfcn};
+	return csp_sfp_send_range(conn, totalsize, 0, totalsize, mtu, false, csp_sfp_mem_read, &source);
+}
+
+/* Receive fragments in order, starting at offset, until the transfer is complete. With scratch, fragments are encoded and expanded in scratch */
+static int csp_sfp_recv_from(csp_conn_t * conn, uint32_t offset, csp_packet_t * scratch, csp_sfp_write_fnc_t writefnc, void * context, uint32_t * return_datasize, uint32_t timeout, csp_packet_t * first_packet) {
+
+	if (return_datasize) {
+		*return_datasize = 0;
+	}
 
 	/* Get first packet from user, or from connection */
 	csp_packet_t * packet;
@@ -114,93 +195,797 @@ int csp_sfp_recv_fp(csp_conn_t * conn, void ** return_data, int * return_datasiz
 		packet = first_packet;
 	}
 
-	uint8_t * data = NULL;
+	bool first = true;
 	uint32_t datasize = 0;
-	uint32_t data_offset = 0;
-	int error = CSP_ERR_TIMEDOUT;
+	uint32_t data_offset = offset;
 	do {
-		/* Read SFP header */
-		sfp_header_t * sfp_header = csp_sfp_header_remove(packet);
-		if (sfp_header == NULL) {
+		/* Read SFP header, copied as it is overwritten when expanding compressed data */
+		sfp_header_t sfp_header;
+		const sfp_header_t * header = csp_sfp_header_remove(packet);
+		if (header != NULL) {
+			sfp_header = *header;
+		}
+		if ((header == NULL) || (scratch && (csp_sfp_inflate(packet, scratch) != CSP_ERR_NONE))) {
 			if (csp_dbg_packet_print >= 1) {
 				csp_print("%s: %u:%u, invalid message, id.flags: 0x%x, length: %u\n", __FUNCTION__, packet->id.src, packet->id.sport, packet->id.flags, packet->length);
 			}
 			csp_buffer_free(packet);
-			error = CSP_ERR_SFP;
-			goto error;
+			return CSP_ERR_SFP;
 		}
 
-		//csp_print("%s: %u:%u, fragment %" PRIu32 "/%" PRIu32 "\n",  __FUNCTION__, packet->id.src, packet->id.sport, sfp_header->offset + packet->length, sfp_header->totalsize);
-
 		/* Consistency check */
-		if (sfp_header->offset != data_offset) {
-            if (csp_dbg_packet_print >= 1) {
-				csp_print("%s: %u:%u, invalid message, offset %" PRIu32 " (expected %" PRIu32 "), length: %u, totalsize %" PRIu32 "\n", __FUNCTION__, packet->id.src, packet->id.sport, sfp_header->offset, data_offset, packet->length, sfp_header->totalsize);
+		if (sfp_header.offset != data_offset) {
+			if (csp_dbg_packet_print >= 1) {
+				csp_print("%s: %u:%u, invalid message, offset %" PRIu32 " (expected %" PRIu32 "), length: %u, totalsize %" PRIu32 "\n", __FUNCTION__, packet->id.src, packet->id.sport, sfp_header.offset, data_offset, packet->length, sfp_header.totalsize);
 			}
 			csp_buffer_free(packet);
-
-			error = CSP_ERR_SFP;
-			goto error;
+			return CSP_ERR_SFP;
 		}
 
-		/* Allocate memory */
-		if (data == NULL) {
-			datasize = sfp_header->totalsize;
-			data = malloc(datasize);
-			if (data == NULL) {
-            	if (csp_dbg_packet_print >= 1) {
-					csp_print("%s: %u:%u, malloc(%" PRIu32 ") failed\n", __FUNCTION__, packet->id.src, packet->id.sport, datasize);
-				}
-				csp_buffer_free(packet);
-
-				error = CSP_ERR_NOMEM;
-				goto error;
-			}
+		if (first) {
+			datasize = sfp_header.totalsize;
+			first = false;
 		}
 
 		/* Consistency check */
-		if (((data_offset + packet->length) > datasize) || (datasize != sfp_header->totalsize)) {
-            if (csp_dbg_packet_print >= 1) {
-				csp_print("%s: %u:%u, invalid size, sfp.offset: %" PRIu32 ", length: %u, total: %" PRIu32 " / %" PRIu32 "\n", __FUNCTION__, packet->id.src, packet->id.sport, sfp_header->offset, packet->length, datasize, sfp_header->totalsize);
+		if (((data_offset + packet->length) > datasize) || (datasize != sfp_header.totalsize)) {
+			if (csp_dbg_packet_print >= 1) {
+				csp_print("%s: %u:%u, invalid size, sfp.offset: %" PRIu32 ", length: %u, total: %" PRIu32 " / %" PRIu32 "\n", __FUNCTION__, packet->id.src, packet->id.sport, sfp_header.offset, packet->length, datasize, sfp_header.totalsize);
 			}
 			csp_buffer_free(packet);
+			return CSP_ERR_SFP;
+		}
 
-			error = CSP_ERR_SFP;
-			goto error;
+		/* A fragment must carry data, unless the whole transfer is empty */
+		if ((packet->length == 0) && (datasize > 0)) {
+			if (csp_dbg_packet_print >= 1) {
+				csp_print("%s: %u:%u, invalid size, sfp.offset: %" PRIu32 ", length: %u, total: %" PRIu32 " / %" PRIu32 "\n", __FUNCTION__, packet->id.src, packet->id.sport, sfp_header.offset, packet->length, datasize, sfp_header.totalsize);
+			}
+			csp_buffer_free(packet);
+			return CSP_ERR_SFP;
 		}
 
-		/* Copy data to output */
+		/* Hand data to the sink */
 		if (csp_dbg_packet_print >= 3) {
-				csp_print("%s: %u:%u, SFP Frag recvd for offset: %" PRIu32 ", length: %u, total: %" PRIu32 " / %" PRIu32 "\n", __FUNCTION__, packet->id.src, packet->id.sport, sfp_header->offset, packet->length, datasize, sfp_header->totalsize);
+			csp_print("%s: %u:%u, SFP Frag recvd for offset: %" PRIu32 ", length: %u, total: %" PRIu32 " / %" PRIu32 "\n", __FUNCTION__, packet->id.src, packet->id.sport, sfp_header.offset, packet->length, datasize, sfp_header.totalsize);
+		}
+		const uint32_t length = packet->length;
+		int error = writefnc(data_offset, packet->data, length, datasize, context);
+		csp_buffer_free(packet);
+		if (error != CSP_ERR_NONE) {
+			return error;
 		}
-		memcpy(data + data_offset, packet->data, packet->length);
-		data_offset += packet->length;
+		data_offset += length;
 
 		if (data_offset >= datasize) {
 			// transfer complete
-			csp_buffer_free(packet);
-
-			*return_data = data;  // must be freed by csp_free()
-			*return_datasize = datasize;
+			if (return_datasize) {
+				*return_datasize = datasize;
+			}
 			return CSP_ERR_NONE;
 		}
 
-		/* Consistency check */
-		if (packet->length == 0) {
-            if (csp_dbg_packet_print >= 1) {
-				csp_print("%s: %u:%u, invalid size, sfp.offset: %" PRIu32 ", length: %u, total: %" PRIu32 " / %" PRIu32 "\n", __FUNCTION__, packet->id.src, packet->id.sport, sfp_header->offset, packet->length, datasize, sfp_header->totalsize);
+	} while ((packet = csp_read(conn, timeout)) != NULL);
+
+	return CSP_ERR_TIMEDOUT;
+}
+
+int csp_sfp_recv_stream(csp_conn_t * conn, csp_sfp_write_fnc_t writefnc, void * context, uint32_t * datasize, uint32_t timeout, csp_packet_t * first_packet) {
+	return csp_sfp_recv_from(conn, 0, NULL, writefnc, context, datasize, timeout, first_packet);
+}
+
+typedef struct {
+	uint8_t * data;
+	uint32_t size;
+} csp_sfp_mem_sink_t;
+
+/* Sink allocating the whole transfer on the first fragment */
+static int csp_sfp_malloc_write(uint32_t offset, const void * data, uint32_t length, uint32_t totalsize, void * context) {
+
+	csp_sfp_mem_sink_t * sink = context;
+
+	if (sink->data == NULL) {
+		/* Allocate at least one byte, so an empty transfer is distinguishable from failure */
+		sink->data = malloc(totalsize ? totalsize : 1);
+		if (sink->data == NULL) {
+			if (csp_dbg_packet_print >= 1) {
+				csp_print("%s: malloc(%" PRIu32 ") failed\n", __FUNCTION__, totalsize);
+			}
+			return CSP_ERR_NOMEM;
+		}
+		sink->size = totalsize;
+	}
+
+	memcpy(sink->data + offset, data, length);
+	return CSP_ERR_NONE;
+}
+
+int csp_sfp_recv_fp(csp_conn_t * conn, void ** return_data, int * return_datasize, uint32_t timeout, csp_packet_t * first_packet) {
+
+	*return_data = NULL; /* Allow caller to assume csp_free() can always be called when dataout is non-NULL */
+	*return_datasize = 0;
+
+	csp_sfp_mem_sink_t sink = {.data = NULL, .size = 0};
+	int error = csp_sfp_recv_stream(conn, csp_sfp_malloc_write, &sink, NULL, timeout, first_packet);
+	if (error != CSP_ERR_NONE) {
+		free(sink.data);
+		return error;
+	}
+
+	*return_data = sink.data;  // must be freed by csp_free()
+	*return_datasize = sink.size;
+	return CSP_ERR_NONE;
+}
+
+/* Sink writing into a caller provided buffer */
+static int csp_sfp_buffer_write(uint32_t offset, const void * data, uint32_t length, uint32_t totalsize, void * context) {
+
+	csp_sfp_mem_sink_t * sink = context;
+
+	if (totalsize > sink->size) {
+		if (csp_dbg_packet_print >= 1) {
+			csp_print("%s: transfer of %" PRIu32 " bytes exceeds buffer of %" PRIu32 " bytes\n", __FUNCTION__, totalsize, sink->size);
+		}
+		return CSP_ERR_NOBUFS;
+	}
+
+	memcpy(sink->data + offset, data, length);
+	return CSP_ERR_NONE;
+}
+
+int csp_sfp_recv_buf(csp_conn_t * conn, void * buf, uint32_t bufsize, uint32_t * datasize, uint32_t timeout, csp_packet_t * first_packet) {
+
+	csp_sfp_mem_sink_t sink = {.data = buf, .size = bufsize};
+	return csp_sfp_recv_stream(conn, csp_sfp_buffer_write, &sink, datasize, timeout, first_packet);
+}
+
+#if (CSP_POSIX)
+
+typedef struct {
+	int fd;
+	off_t base;
+} csp_sfp_fd_sink_t;
+
+/* Sink writing at the fragment offset in a file */
+static int csp_sfp_fd_write(uint32_t offset, const void * data, uint32_t length, uint32_t totalsize, void * context) {
+
+	csp_sfp_fd_sink_t * sink = context;
+
+	while (length > 0) {
+		ssize_t written = pwrite(sink->fd, data, length, sink->base + offset);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (csp_dbg_packet_print >= 1) {
+				csp_print("%s: pwrite at offset %" PRIu32 " failed, error: %d\n", __FUNCTION__, offset, errno);
+			}
+			return CSP_ERR_DRIVER;
+		}
+		data = (const uint8_t *)data + written;
+		length -= written;
+		offset += written;
+	}
+
+	return CSP_ERR_NONE;
+}
+
+int csp_sfp_recv_fd(csp_conn_t * conn, int fd, off_t base, uint32_t * datasize, uint32_t timeout, csp_packet_t * first_packet) {
+
+	csp_sfp_fd_sink_t sink = {.fd = fd, .base = base};
+	return csp_sfp_recv_stream(conn, csp_sfp_fd_write, &sink, datasize, timeout, first_packet);
+}
+
+#endif
+
+void csp_sfp_reasm_init(csp_sfp_reasm_t * reasm) {
+	reasm->started = false;
+	reasm->totalsize = 0;
+	reasm->received = 0;
+	reasm->count = 0;
+}
+
+bool csp_sfp_reasm_complete(const csp_sfp_reasm_t * reasm) {
+	return reasm->started && (reasm->received >= reasm->totalsize);
+}
+
+unsigned int csp_sfp_reasm_missing(const csp_sfp_reasm_t * reasm, csp_sfp_range_t * missing, unsigned int max) {
+
+	if (!reasm->started) {
+		return 0;
+	}
+
+	unsigned int found = 0;
+	uint32_t cursor = 0;
+	for (unsigned int i = 0; i <= reasm->count; i++) {
+		uint32_t gap_end = (i < reasm->count) ? reasm->ranges[i].offset : reasm->totalsize;
+		if (gap_end > cursor) {
+			if (found == max) {
+				break;
+			}
+			missing[found].offset = cursor;
+			missing[found].length = gap_end - cursor;
+			found++;
+		}
+		if (i < reasm->count) {
+			cursor = reasm->ranges[i].offset + reasm->ranges[i].length;
+		}
+	}
+
+	return found;
+}
+
+/**
+ * Add a fragment to the reassembly, passing the parts not already received to the write function.
+ * Returns CSP_ERR_NONE if the fragment was added or dropped, otherwise the error from the write function.
+ */
+static int csp_sfp_reasm_add(csp_sfp_reasm_t * reasm, uint32_t offset, const uint8_t * data, uint32_t length, csp_sfp_write_fnc_t writefnc, void * context) {
+
+	if (length == 0) {
+		return CSP_ERR_NONE;
+	}
+
+	const uint32_t end = offset + length;
+
+	/* Ranges touching the fragment, from first up to last (exclusive) */
+	unsigned int first = 0;
+	while ((first < reasm->count) && ((reasm->ranges[first].offset + reasm->ranges[first].length) < offset)) {
+		first++;
+	}
+	unsigned int last = first;
+	while ((last < reasm->count) && (reasm->ranges[last].offset <= end)) {
+		last++;
+	}
+
+	/* The touched ranges are merged into one, so there must be room for that */
+	const unsigned int count = reasm->count - (last - first) + 1;
+	if (count > CSP_SFP_MAX_RANGES) {
+		if (csp_dbg_packet_print >= 2) {
+			csp_print("%s: range table full, dropping offset %" PRIu32 ", length %" PRIu32 "\n", __FUNCTION__, offset, length);
+		}
+		return CSP_ERR_NONE;
+	}
+
+	/* Write the gaps between the touched ranges */
+	uint32_t cursor = offset;
+	for (unsigned int i = first; i <= last; i++) {
+		uint32_t gap_end = (i < last) ? reasm->ranges[i].offset : end;
+		if (gap_end > end) {
+			gap_end = end;
+		}
+		if (gap_end > cursor) {
+			int error = writefnc(cursor, data + (cursor - offset), gap_end - cursor, reasm->totalsize, context);
+			if (error != CSP_ERR_NONE) {
+				return error;
+			}
+			reasm->received += gap_end - cursor;
+		}
+		if (i < last) {
+			uint32_t range_end = reasm->ranges[i].offset + reasm->ranges[i].length;
+			if (range_end > cursor) {
+				cursor = range_end;
+			}
+		}
+	}
+
+	/* Merge */
+	csp_sfp_range_t merged = {.offset = offset, .length = length};
+	if (first < last) {
+		uint32_t merged_end = reasm->ranges[last - 1].offset + reasm->ranges[last - 1].length;
+		if (merged_end < end) {
+			merged_end = end;
+		}
+		if (reasm->ranges[first].offset < merged.offset) {
+			merged.offset = reasm->ranges[first].offset;
+		}
+		merged.length = merged_end - merged.offset;
+	}
+	memmove(&reasm->ranges[first + 1], &reasm->ranges[last], (reasm->count - last) * sizeof(reasm->ranges[0]));
+	reasm->ranges[first] = merged;
+	reasm->count = count;
+
+	return CSP_ERR_NONE;
+}
+
+int csp_sfp_recv_reorder(csp_conn_t * conn, csp_sfp_write_fnc_t writefnc, void * context, csp_sfp_reasm_t * reasm, uint32_t timeout, csp_packet_t * first_packet) {
+
+	csp_packet_t * packet = first_packet;
+	if (packet == NULL) {
+		packet = csp_read(conn, timeout);
+	}
+
+	while (packet != NULL) {
+
+		/* Invalid and stray packets are dropped, the data is requested again if needed */
+		sfp_header_t * sfp_header = csp_sfp_header_remove(packet);
+		if ((sfp_header == NULL) ||
+			(sfp_header->offset > sfp_header->totalsize) ||
+			(packet->length > (sfp_header->totalsize - sfp_header->offset)) ||
+			(reasm->started && (sfp_header->totalsize != reasm->totalsize))) {
+			if (csp_dbg_packet_print >= 1) {
+				csp_print("%s: %u:%u, dropping invalid message, id.flags: 0x%x, length: %u\n", __FUNCTION__, packet->id.src, packet->id.sport, packet->id.flags, packet->length);
 			}
 			csp_buffer_free(packet);
+			packet = csp_read(conn, timeout);
+			continue;
+		}
+
+		if (!reasm->started) {
+			reasm->totalsize = sfp_header->totalsize;
+			reasm->started = true;
+		}
+
+		if (csp_dbg_packet_print >= 3) {
+			csp_print("%s: %u:%u, SFP Frag recvd for offset: %" PRIu32 ", length: %u, total: %" PRIu32 "\n", __FUNCTION__, packet->id.src, packet->id.sport, sfp_header->offset, packet->length, sfp_header->totalsize);
+		}
+
+		int error = csp_sfp_reasm_add(reasm, sfp_header->offset, packet->data, packet->length, writefnc, context);
+		csp_buffer_free(packet);
+		if (error != CSP_ERR_NONE) {
+			return error;
+		}
+
+		if (csp_sfp_reasm_complete(reasm)) {
+			return CSP_ERR_NONE;
+		}
+
+		packet = csp_read(conn, timeout);
+	}
+
+	return CSP_ERR_TIMEDOUT;
+}
 
+/**
+ * SFP NACK:
+ * Sent by the receiver, to request the listed ranges again.
+ * A NACK without ranges acknowledges the complete transfer.
+ */
+#define SFP_TYPE_NACK 0x01
+
+typedef struct __attribute__((__packed__)) {
+	uint8_t type;
+	uint8_t count;
+	uint32_t totalsize;
+	struct __attribute__((__packed__)) {
+		uint32_t offset;
+		uint32_t length;
+	} ranges[];
+} sfp_nack_t;
+
+int csp_sfp_send_nack(csp_conn_t * conn, const csp_sfp_reasm_t * reasm) {
+
+	csp_packet_t * packet = csp_buffer_get(0);
+	if (packet == NULL) {
+		return CSP_ERR_NOMEM;
+	}
+
+	sfp_nack_t * nack = (sfp_nack_t *)packet->data;
+	unsigned int max = (csp_buffer_data_size() - sizeof(*nack)) / sizeof(nack->ranges[0]);
+	if (max > UINT8_MAX) {
+		max = UINT8_MAX;
+	}
+
+	/* There is at most one gap more than received ranges */
+	csp_sfp_range_t missing[CSP_SFP_MAX_RANGES + 1];
+	if (max > CSP_SFP_MAX_RANGES + 1) {
+		max = CSP_SFP_MAX_RANGES + 1;
+	}
+	unsigned int count = csp_sfp_reasm_missing(reasm, missing, max);
+	for (unsigned int i = 0; i < count; i++) {
+		nack->ranges[i].offset = htobe32(missing[i].offset);
+		nack->ranges[i].length = htobe32(missing[i].length);
+	}
+
+	nack->type = SFP_TYPE_NACK;
+	nack->count = count;
+	nack->totalsize = htobe32(reasm->totalsize);
+	packet->length = sizeof(*nack) + count * sizeof(nack->ranges[0]);
+
+	if (csp_dbg_packet_print >= 2) {
+		csp_print("%s: %d:%d, NACK %u ranges, received %" PRIu32 " / %" PRIu32 "\n", __FUNCTION__, csp_conn_src(conn), csp_conn_sport(conn), count, reasm->received, reasm->totalsize);
+	}
+
+	/* NACKs are not fragments */
+	conn->idout.flags &= ~CSP_FFRAG;
+	csp_send(conn, packet);
+
+	return CSP_ERR_NONE;
+}
+
+int csp_sfp_retransmit(csp_conn_t * conn, const void * data, unsigned int totalsize, unsigned int mtu, csp_packet_t * packet, csp_memcpy_fnc_t memcpyfcn, bool * complete) {
+
+	*complete = false;
+
+	sfp_nack_t * nack = (sfp_nack_t *)packet->data;
+	if ((mtu == 0) ||
+		(packet->id.flags & CSP_FFRAG) ||
+		(packet->length < sizeof(*nack)) ||
+		(nack->type != SFP_TYPE_NACK) ||
+		(packet->length != sizeof(*nack) + nack->count * sizeof(nack->ranges[0])) ||
+		(be32toh(nack->totalsize) != totalsize)) {
+		if (csp_dbg_packet_print >= 1) {
+			csp_print("%s: %u:%u, invalid NACK, length: %u\n", __FUNCTION__, packet->id.src, packet->id.sport, packet->length);
+		}
+		csp_buffer_free(packet);
+		return CSP_ERR_SFP;
+	}
+
+	if (nack->count == 0) {
+		csp_buffer_free(packet);
+		*complete = true;
+		return CSP_ERR_NONE;
+	}
+
+	csp_sfp_mem_source_t source = {.data = data, .memcpyfcn = memcpyfcn};
+	int error = CSP_ERR_NONE;
+	for (unsigned int i = 0; (i < nack->count) && (error == CSP_ERR_NONE); i++) {
+		const uint32_t offset = be32toh(nack->ranges[i].offset);
+		const uint32_t length = be32toh(nack->ranges[i].length);
+		if ((offset > totalsize) || (length > (totalsize - offset))) {
 			error = CSP_ERR_SFP;
-			goto error;
+			break;
+		}
+		error = csp_sfp_send_range(conn, totalsize, offset, offset + length, mtu, false, csp_sfp_mem_read, &source);
+	}
+
+	csp_buffer_free(packet);
+	return error;
+}
+
+int csp_sfp_send_selective(csp_conn_t * conn, const void * data, unsigned int totalsize, unsigned int mtu, uint32_t timeout, csp_memcpy_fnc_t memcpyfcn) {
+
+	int error = csp_sfp_send_own_memcpy(conn, data, totalsize, mtu, timeout, memcpyfcn);
+	if (error != CSP_ERR_NONE) {
+		return error;
+	}
+
+	/* Serve NACKs, until the receiver acknowledges the transfer */
+	csp_packet_t * packet;
+	while ((packet = csp_read(conn, timeout)) != NULL) {
+		bool complete;
+		error = csp_sfp_retransmit(conn, data, totalsize, mtu, packet, memcpyfcn, &complete);
+		if (error != CSP_ERR_NONE) {
+			return error;
 		}
+		if (complete) {
+			return CSP_ERR_NONE;
+		}
+	}
+
+	return CSP_ERR_TIMEDOUT;
+}
 
+int csp_sfp_recv_selective(csp_conn_t * conn, csp_sfp_write_fnc_t writefnc, void * context, uint32_t * datasize, uint32_t timeout, unsigned int retries, csp_packet_t * first_packet) {
+
+	if (datasize) {
+		*datasize = 0;
+	}
+
+	csp_sfp_reasm_t reasm;
+	csp_sfp_reasm_init(&reasm);
+
+	for (unsigned int attempt = 0;; attempt++) {
+
+		int error = csp_sfp_recv_reorder(conn, writefnc, context, &reasm, timeout, first_packet);
+		first_packet = NULL;
+
+		if (error == CSP_ERR_NONE) {
+			/* Acknowledge, so the sender can stop serving NACKs */
+			csp_sfp_send_nack(conn, &reasm);
+			if (datasize) {
+				*datasize = reasm.totalsize;
+			}
+			return CSP_ERR_NONE;
+		}
+
+		/* Nothing can be requested before the size of the transfer is known */
+		if ((error != CSP_ERR_TIMEDOUT) || !reasm.started || (attempt >= retries)) {
+			return error;
+		}
+
+		error = csp_sfp_send_nack(conn, &reasm);
+		if (error != CSP_ERR_NONE) {
+			return error;
+		}
+	}
+}
+
+#if (CSP_POSIX)
+
+/**
+ * SFP file transfer:
+ * The sender offers the file, the receiver accepts it from the offset it has
+ * already received, the sender sends the rest, and the receiver confirms with
+ * the checksum of the complete file.
+ */
+#define SFP_TYPE_FILE_OFFER 0x02
+#define SFP_TYPE_FILE_ACCEPT 0x03
+#define SFP_TYPE_FILE_DONE 0x04
+
+/* Options this side can accept */
+#if (CSP_USE_COMPRESS)
+#define SFP_FILE_OPTIONS CSP_SFP_FILE_COMPRESS
+#else
+#define SFP_FILE_OPTIONS 0
+#endif
+
+typedef struct __attribute__((__packed__)) {
+	uint8_t type;
+	uint32_t transfer_id;
+	uint32_t totalsize;
+	uint32_t offset;  // ACCEPT: offset to resume from
+	uint32_t crc;     // OFFER: checksum of the file, DONE: checksum of the received file
+	uint8_t options;  // OFFER: options requested, ACCEPT: options accepted
+} sfp_file_t;
+
+static int csp_sfp_file_ctrl_send(csp_conn_t * conn, uint8_t type, uint32_t transfer_id, uint32_t totalsize, uint32_t offset, uint32_t crc, uint8_t options) {
+
+	csp_packet_t * packet = csp_buffer_get(sizeof(sfp_file_t));
+	if (packet == NULL) {
+		return CSP_ERR_NOMEM;
+	}
+
+	sfp_file_t * msg = (sfp_file_t *)packet->data;
+	msg->type = type;
+	msg->transfer_id = htobe32(transfer_id);
+	msg->totalsize = htobe32(totalsize);
+	msg->offset = htobe32(offset);
+	msg->crc = htobe32(crc);
+	msg->options = options;
+	packet->length = sizeof(*msg);
+
+	/* Control messages are not fragments */
+	conn->idout.flags &= ~CSP_FFRAG;
+	csp_send(conn, packet);
+
+	return CSP_ERR_NONE;
+}
+
+static int csp_sfp_file_ctrl_recv(csp_conn_t * conn, uint8_t type, sfp_file_t * msg, uint32_t timeout, csp_packet_t * first_packet) {
+
+	csp_packet_t * packet = first_packet;
+	if (packet == NULL) {
+		packet = csp_read(conn, timeout);
+		if (packet == NULL) {
+			return CSP_ERR_TIMEDOUT;
+		}
+	}
+
+	if ((packet->id.flags & CSP_FFRAG) || (packet->length != sizeof(*msg)) || (packet->data[0] != type)) {
+		if (csp_dbg_packet_print >= 1) {
+			csp_print("%s: %u:%u, unexpected message, id.flags: 0x%x, length: %u\n", __FUNCTION__, packet->id.src, packet->id.sport, packet->id.flags, packet->length);
+		}
 		csp_buffer_free(packet);
+		return CSP_ERR_SFP;
+	}
 
-	} while ((packet = csp_read(conn, timeout)) != NULL);
+	memcpy(msg, packet->data, sizeof(*msg));
+	csp_buffer_free(packet);
+
+	msg->transfer_id = be32toh(msg->transfer_id);
+	msg->totalsize = be32toh(msg->totalsize);
+	msg->offset = be32toh(msg->offset);
+	msg->crc = be32toh(msg->crc);
+
+	return CSP_ERR_NONE;
+}
+
+typedef struct {
+	int fd;
+	const uint8_t * map;
+} csp_sfp_file_source_t;
+
+/* Copy from the mapping, or read directly into the packet if the file could not be mapped */
+static int csp_sfp_file_read(void * dst, uint32_t offset, uint32_t length, void * context) {
+
+	csp_sfp_file_source_t * source = context;
+
+	if (source->map) {
+		memcpy(dst, source->map + offset, length);
+		return CSP_ERR_NONE;
+	}
+
+	while (length > 0) {
+		ssize_t count = pread(source->fd, dst, length, offset);
+		if (count < 0 && errno == EINTR) {
+			continue;
+		}
+		if (count <= 0) {
+			if (csp_dbg_packet_print >= 1) {
+				csp_print("%s: pread at offset %" PRIu32 " failed, error: %d\n", __FUNCTION__, offset, (count < 0) ? errno : 0);
+			}
+			return CSP_ERR_DRIVER;
+		}
+		dst = (uint8_t *)dst + count;
+		offset += count;
+		length -= count;
+	}
+
+	return CSP_ERR_NONE;
+}
+
+/* Checksum of the first totalsize bytes of the file */
+static int csp_sfp_file_crc(csp_sfp_file_source_t * source, uint32_t totalsize, uint32_t * crc) {
+
+	uint32_t running = CSP_CRC32_INIT;
+
+	if (source->map) {
+		running = csp_crc32_update(running, source->map, totalsize);
+	} else {
+		uint8_t chunk[512];
+		for (uint32_t offset = 0; offset < totalsize; offset += sizeof(chunk)) {
+			uint32_t length = totalsize - offset;
+			if (length > sizeof(chunk)) {
+				length = sizeof(chunk);
+			}
+			int error = csp_sfp_file_read(chunk, offset, length, source);
+			if (error != CSP_ERR_NONE) {
+				return error;
+			}
+			running = csp_crc32_update(running, chunk, length);
+		}
+	}
+
+	*crc = csp_crc32_final(running);
+	return CSP_ERR_NONE;
+}
+
+int csp_sfp_file_send_opts(csp_conn_t * conn, uint32_t transfer_id, int fd, unsigned int mtu, unsigned int options, uint32_t timeout) {
+
+	if (mtu == 0) {
+		return CSP_ERR_INVAL;
+	}
+
+	struct stat st;
+	if ((fstat(fd, &st) != 0) || (st.st_size < 0) || ((uint64_t)st.st_size > UINT32_MAX)) {
+		return CSP_ERR_INVAL;
+	}
+	const uint32_t totalsize = st.st_size;
+
+	/* Map the file, so fragments are copied straight from the page cache into packets */
+	csp_sfp_file_source_t source = {.fd = fd, .map = NULL};
+	if (totalsize > 0) {
+		void * map = mmap(NULL, totalsize, PROT_READ, MAP_SHARED, fd, 0);
+		if (map != MAP_FAILED) {
+			source.map = map;
+		}
+	}
+
+	uint32_t crc;
+	int error = csp_sfp_file_crc(&source, totalsize, &crc);
+	if (error != CSP_ERR_NONE) {
+		goto out;
+	}
+
+	error = csp_sfp_file_ctrl_send(conn, SFP_TYPE_FILE_OFFER, transfer_id, totalsize, 0, crc, options & SFP_FILE_OPTIONS);
+	if (error != CSP_ERR_NONE) {
+		goto out;
+	}
+
+	sfp_file_t msg;
+	error = csp_sfp_file_ctrl_recv(conn, SFP_TYPE_FILE_ACCEPT, &msg, timeout, NULL);
+	if (error != CSP_ERR_NONE) {
+		goto out;
+	}
+	if ((msg.transfer_id != transfer_id) || (msg.offset > totalsize) || (msg.options & ~options & SFP_FILE_OPTIONS)) {
+		error = CSP_ERR_SFP;
+		goto out;
+	}
+
+	/* Compress only if the receiver accepted it */
+	const bool compress = (msg.options & CSP_SFP_FILE_COMPRESS);
+
+	if (csp_dbg_packet_print >= 2) {
+		csp_print("%s: transfer %" PRIu32 ", sending %" PRIu32 " / %" PRIu32 " from offset %" PRIu32 "%s\n", __FUNCTION__, transfer_id, totalsize - msg.offset, totalsize, msg.offset, compress ? ", compressed" : "");
+	}
+
+	error = csp_sfp_send_range(conn, totalsize, msg.offset, totalsize, mtu, compress, csp_sfp_file_read, &source);
+	if (error != CSP_ERR_NONE) {
+		goto out;
+	}
+
+	error = csp_sfp_file_ctrl_recv(conn, SFP_TYPE_FILE_DONE, &msg, timeout, NULL);
+	if (error != CSP_ERR_NONE) {
+		goto out;
+	}
+	if ((msg.transfer_id != transfer_id) || (msg.crc != crc)) {
+		error = CSP_ERR_CRC32;
+	}
+
+out:
+	if (source.map) {
+		munmap((void *)source.map, totalsize);
+	}
+	return error;
+}
+
+typedef struct {
+	csp_sfp_fd_sink_t sink;
+	csp_sfp_file_state_t * state;
+} csp_sfp_file_sink_t;
+
+/* Sink writing at the fragment offset in a file, recording progress */
+static int csp_sfp_file_write(uint32_t offset, const void * data, uint32_t length, uint32_t totalsize, void * context) {
+
+	csp_sfp_file_sink_t * file = context;
+
+	int error = csp_sfp_fd_write(offset, data, length, totalsize, &file->sink);
+	if (error == CSP_ERR_NONE) {
+		file->state->offset = offset + length;
+	}
 
-error:
-	free(data);
 	return error;
 }
+
+int csp_sfp_file_recv(csp_conn_t * conn, int fd, csp_sfp_file_state_t * state, uint32_t timeout, csp_packet_t * first_packet) {
+
+	sfp_file_t offer;
+	int error = csp_sfp_file_ctrl_recv(conn, SFP_TYPE_FILE_OFFER, &offer, timeout, first_packet);
+	if (error != CSP_ERR_NONE) {
+		return error;
+	}
+
+	/* Resume only the same transfer of the same file */
+	if ((offer.transfer_id != state->transfer_id) || (offer.totalsize != state->totalsize) || (offer.crc != state->crc) || (state->offset > offer.totalsize)) {
+		state->transfer_id = offer.transfer_id;
+		state->totalsize = offer.totalsize;
+		state->crc = offer.crc;
+		state->offset = 0;
+	}
+
+	/* A transfer from the start sizes the file, so no stale data is left beyond the end */
+	if ((state->offset == 0) && (ftruncate(fd, state->totalsize) != 0)) {
+		if (csp_dbg_packet_print >= 1) {
+			csp_print("%s: ftruncate to %" PRIu32 " failed, error: %d\n", __FUNCTION__, state->totalsize, errno);
+		}
+		return CSP_ERR_DRIVER;
+	}
+
+	if (csp_dbg_packet_print >= 2) {
+		csp_print("%s: transfer %" PRIu32 ", receiving %" PRIu32 " bytes from offset %" PRIu32 "\n", __FUNCTION__, state->transfer_id, state->totalsize, state->offset);
+	}
+
+	/* Accept the requested options this side supports */
+	uint8_t options = offer.options & SFP_FILE_OPTIONS;
+
+	/* Decompression needs a scratch buffer for one fragment, taken before the data fills up the pool */
+	csp_packet_t * scratch = NULL;
+	if (options & CSP_SFP_FILE_COMPRESS) {
+		scratch = csp_buffer_get(csp_buffer_data_size());
+		if (scratch == NULL) {
+			options &= ~CSP_SFP_FILE_COMPRESS;
+		}
+	}
+
+	error = csp_sfp_file_ctrl_send(conn, SFP_TYPE_FILE_ACCEPT, state->transfer_id, state->totalsize, state->offset, 0, options);
+	if ((error == CSP_ERR_NONE) && (state->offset < state->totalsize)) {
+		csp_sfp_file_sink_t file = {.sink = {.fd = fd, .base = 0}, .state = state};
+		error = csp_sfp_recv_from(conn, state->offset, scratch, csp_sfp_file_write, &file, NULL, timeout, NULL);
+	}
+	if (scratch) {
+		csp_buffer_free(scratch);
+	}
+	if (error != CSP_ERR_NONE) {
+		return error;
+	}
+
+	/* Verify what was written, including data received before a resume */
+	csp_sfp_file_source_t source = {.fd = fd, .map = NULL};
+	uint32_t crc;
+	error = csp_sfp_file_crc(&source, state->totalsize, &crc);
+	if (error != CSP_ERR_NONE) {
+		return error;
+	}
+
+	csp_sfp_file_ctrl_send(conn, SFP_TYPE_FILE_DONE, state->transfer_id, state->totalsize, state->offset, crc, 0);
+
+	if (crc != state->crc) {
+		/* Corrupt file, start over on the next attempt */
+		state->offset = 0;
+		return CSP_ERR_CRC32;
+	}
+
+	return CSP_ERR_NONE;
+}
+
+#endif
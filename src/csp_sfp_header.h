@@ -0,0 +1,44 @@
+#pragma once
+
+#include <endian.h>
+
+#include <csp/csp_types.h>
+
+typedef struct __attribute__((__packed__)) {
+	uint32_t offset;
+	uint32_t totalsize;
+} sfp_header_t;
+
+/**
+ * SFP Headers:
+ * The following functions are helper functions that handles the extra SFP
+ * information that needs to be appended to all data packets.
+ */
+static inline sfp_header_t * csp_sfp_header_add(csp_packet_t * packet) {
+
+	sfp_header_t * header = (sfp_header_t *)&packet->data[packet->length];
+	packet->length += sizeof(*header);
+	return header;
+}
+
+static inline sfp_header_t * csp_sfp_header_remove(csp_packet_t * packet) {
+
+	if ((packet->id.flags & CSP_FFRAG) == 0) {
+		return NULL;
+	}
+	sfp_header_t * header;
+	if (packet->length < sizeof(*header)) {
+		return NULL;
+	}
+	header = (sfp_header_t *)&packet->data[packet->length - sizeof(*header)];
+	packet->length -= sizeof(*header);
+
+	header->offset = be32toh(header->offset);
+	header->totalsize = be32toh(header->totalsize);
+
+	if (header->offset > header->totalsize) {
+		return NULL;
+	}
+
+	return header;
+}
@@ -0,0 +1,564 @@
+#include <csp/csp_sfp_mgr.h>
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <csp/csp_buffer.h>
+#include <csp/csp_debug.h>
+#include <csp/arch/csp_queue.h>
+#include <csp/arch/csp_time.h>
+
+#include "csp_conn.h"
+#include "csp_mutex.h"
+#include "csp_rdp.h"
+#include "csp_sfp_header.h"
+
+typedef struct {
+	bool active;
+	int id;
+	bool outbound;
+	csp_conn_t * conn;
+
+	/* Events from the connection, consumed by the service task */
+	atomic_uint events;
+
+	/* Set by csp_sfp_mgr_cancel() */
+	bool cancel;
+
+	/* More work can be done right away, or when buffers are available again */
+	bool again;
+	bool retry;
+	unsigned int retries;  // Retries since the last progress
+
+	/* Progress */
+	uint32_t totalsize;
+	uint32_t offset;
+	uint32_t start_ms;
+	uint32_t last_ms;
+
+	/* Outbound */
+	const uint8_t * data;
+	unsigned int mtu;
+	csp_packet_t * pending;  // Fragment not accepted by the connection yet
+
+	/* Inbound */
+	bool started;
+	csp_sfp_write_fnc_t writefnc;
+	void * write_context;
+	uint8_t * buf;
+
+	csp_sfp_mgr_done_t done;
+	void * context;
+} csp_sfp_mgr_slot_t;
+
+static csp_sfp_mgr_slot_t csp_sfp_mgr_slots[CSP_SFP_MGR_MAX_TRANSFERS];
+static csp_sfp_mgr_stats_t csp_sfp_mgr_stats;
+static size_t csp_sfp_mgr_mem_budget;
+static uint32_t csp_sfp_mgr_idle_timeout;
+static int csp_sfp_mgr_next_id;
+static bool csp_sfp_mgr_again;
+
+/* Wakes the service task, a single token is enough */
+static csp_queue_handle_t csp_sfp_mgr_wake_handle;
+static csp_static_queue_t csp_sfp_mgr_wake_queue;
+static char csp_sfp_mgr_wake_buffer[sizeof(uint8_t)];
+
+/* Protects slot allocation and progress, shared between the service task and user tasks */
+static csp_mutex_t csp_sfp_mgr_lock;
+
+static void csp_sfp_mgr_wake(void) {
+	const uint8_t token = 0;
+	csp_queue_enqueue(csp_sfp_mgr_wake_handle, &token, 0);
+}
+
+static void csp_sfp_mgr_post(csp_sfp_mgr_slot_t * slot, unsigned int events) {
+	if (atomic_fetch_or(&slot->events, events) == 0) {
+		csp_sfp_mgr_wake();
+	}
+}
+
+/* Called from the router task */
+static void csp_sfp_mgr_event(csp_conn_t * conn, unsigned int events, void * context) {
+	csp_sfp_mgr_post(context, events);
+}
+
+static void csp_sfp_mgr_fill(const csp_sfp_mgr_slot_t * slot, csp_sfp_mgr_transfer_t * transfer) {
+
+	transfer->id = slot->id;
+	transfer->outbound = slot->outbound;
+	transfer->totalsize = slot->totalsize;
+	transfer->transferred = slot->offset;
+	transfer->elapsed_ms = csp_get_ms() - slot->start_ms;
+	transfer->throughput = (transfer->elapsed_ms > 0) ? (uint32_t)(((uint64_t)slot->offset * 1000) / transfer->elapsed_ms) : 0;
+	transfer->data = slot->buf;
+}
+
+int csp_sfp_mgr_init(size_t mem_budget, uint32_t idle_timeout) {
+
+	csp_mutex_init(&csp_sfp_mgr_lock);
+	csp_sfp_mgr_wake_handle = csp_queue_create_static(1, sizeof(uint8_t), csp_sfp_mgr_wake_buffer, &csp_sfp_mgr_wake_queue);
+	if ((csp_sfp_mgr_lock.handle == NULL) || (csp_sfp_mgr_wake_handle == NULL)) {
+		return CSP_ERR_NOMEM;
+	}
+
+	memset(csp_sfp_mgr_slots, 0, sizeof(csp_sfp_mgr_slots));
+	memset(&csp_sfp_mgr_stats, 0, sizeof(csp_sfp_mgr_stats));
+	csp_sfp_mgr_mem_budget = mem_budget;
+	csp_sfp_mgr_idle_timeout = idle_timeout;
+	csp_sfp_mgr_next_id = 1;
+	csp_sfp_mgr_again = false;
+
+	return CSP_ERR_NONE;
+}
+
+/* Allocate a slot, returns with the lock held until csp_sfp_mgr_activate(), after the caller filled in the direction specific fields */
+static csp_sfp_mgr_slot_t * csp_sfp_mgr_start(csp_conn_t * conn, bool outbound, csp_sfp_mgr_done_t done, void * context) {
+
+	csp_mutex_lock(&csp_sfp_mgr_lock);
+
+	csp_sfp_mgr_slot_t * slot = NULL;
+	for (int i = 0; i < CSP_SFP_MGR_MAX_TRANSFERS; i++) {
+		if (!csp_sfp_mgr_slots[i].active) {
+			slot = &csp_sfp_mgr_slots[i];
+			break;
+		}
+	}
+
+	if (slot == NULL) {
+		csp_mutex_unlock(&csp_sfp_mgr_lock);
+		return NULL;
+	}
+
+	slot->id = csp_sfp_mgr_next_id;
+	csp_sfp_mgr_next_id = (csp_sfp_mgr_next_id == INT32_MAX) ? 1 : csp_sfp_mgr_next_id + 1;
+	slot->outbound = outbound;
+	slot->conn = conn;
+	atomic_store(&slot->events, 0);
+	slot->cancel = false;
+	slot->again = false;
+	slot->retry = false;
+	slot->retries = 0;
+	slot->totalsize = 0;
+	slot->offset = 0;
+	slot->start_ms = csp_get_ms();
+	slot->last_ms = slot->start_ms;
+	slot->data = NULL;
+	slot->mtu = 0;
+	slot->pending = NULL;
+	slot->started = false;
+	slot->writefnc = NULL;
+	slot->write_context = NULL;
+	slot->buf = NULL;
+	slot->done = done;
+	slot->context = context;
+
+	return slot;
+}
+
+/* Publish a slot filled in by the caller, and start serving it */
+static int csp_sfp_mgr_activate(csp_sfp_mgr_slot_t * slot) {
+
+	slot->active = true;
+	csp_sfp_mgr_stats.active++;
+	const int id = slot->id;
+	csp_mutex_unlock(&csp_sfp_mgr_lock);
+
+	/* Events before the handler was set are not reported, so start with the current state */
+	csp_conn_set_event_handler(slot->conn, csp_sfp_mgr_event, slot);
+	csp_sfp_mgr_post(slot, csp_conn_events(slot->conn) | CSP_CONN_EV_WRITABLE);
+
+	return id;
+}
+
+int csp_sfp_mgr_send(csp_conn_t * conn, const void * data, uint32_t datasize, unsigned int mtu, csp_sfp_mgr_done_t done, void * context) {
+
+	if ((conn == NULL) || (mtu == 0) || ((data == NULL) && (datasize > 0))) {
+		return CSP_ERR_INVAL;
+	}
+
+	/* Each fragment must fit in a single buffer */
+	if (mtu > (csp_buffer_data_size() - sizeof(sfp_header_t))) {
+		return CSP_ERR_INVAL;
+	}
+
+	csp_sfp_mgr_slot_t * slot = csp_sfp_mgr_start(conn, true, done, context);
+	if (slot == NULL) {
+		return CSP_ERR_NOBUFS;
+	}
+
+	slot->data = data;
+	slot->totalsize = datasize;
+	slot->mtu = mtu;
+
+	return csp_sfp_mgr_activate(slot);
+}
+
+int csp_sfp_mgr_recv(csp_conn_t * conn, csp_sfp_write_fnc_t writefnc, void * write_context, csp_sfp_mgr_done_t done, void * context) {
+
+	if (conn == NULL) {
+		return CSP_ERR_INVAL;
+	}
+
+	csp_sfp_mgr_slot_t * slot = csp_sfp_mgr_start(conn, false, done, context);
+	if (slot == NULL) {
+		return CSP_ERR_NOBUFS;
+	}
+
+	slot->writefnc = writefnc;
+	slot->write_context = write_context;
+
+	return csp_sfp_mgr_activate(slot);
+}
+
+/* Find active slot by ID, must be called with the lock held */
+static csp_sfp_mgr_slot_t * csp_sfp_mgr_find(int id) {
+
+	for (int i = 0; i < CSP_SFP_MGR_MAX_TRANSFERS; i++) {
+		if (csp_sfp_mgr_slots[i].active && (csp_sfp_mgr_slots[i].id == id)) {
+			return &csp_sfp_mgr_slots[i];
+		}
+	}
+
+	return NULL;
+}
+
+int csp_sfp_mgr_cancel(int id) {
+
+	csp_mutex_lock(&csp_sfp_mgr_lock);
+	csp_sfp_mgr_slot_t * slot = csp_sfp_mgr_find(id);
+	if (slot) {
+		slot->cancel = true;
+	}
+	csp_mutex_unlock(&csp_sfp_mgr_lock);
+
+	if (slot == NULL) {
+		return CSP_ERR_INVAL;
+	}
+
+	csp_sfp_mgr_wake();
+	return CSP_ERR_NONE;
+}
+
+int csp_sfp_mgr_progress(int id, csp_sfp_mgr_transfer_t * transfer) {
+
+	csp_mutex_lock(&csp_sfp_mgr_lock);
+	csp_sfp_mgr_slot_t * slot = csp_sfp_mgr_find(id);
+	if (slot) {
+		csp_sfp_mgr_fill(slot, transfer);
+		transfer->data = NULL;
+	}
+	csp_mutex_unlock(&csp_sfp_mgr_lock);
+
+	return (slot != NULL) ? CSP_ERR_NONE : CSP_ERR_INVAL;
+}
+
+void csp_sfp_mgr_get_stats(csp_sfp_mgr_stats_t * stats) {
+
+	csp_mutex_lock(&csp_sfp_mgr_lock);
+	*stats = csp_sfp_mgr_stats;
+	csp_mutex_unlock(&csp_sfp_mgr_lock);
+}
+
+/* Record progress of a transfer */
+static void csp_sfp_mgr_advance(csp_sfp_mgr_slot_t * slot, uint32_t length) {
+
+	csp_mutex_lock(&csp_sfp_mgr_lock);
+	slot->offset += length;
+	slot->last_ms = csp_get_ms();
+	slot->retries = 0;
+	if (slot->outbound) {
+		csp_sfp_mgr_stats.tx_bytes += length;
+	} else {
+		csp_sfp_mgr_stats.rx_bytes += length;
+	}
+	csp_mutex_unlock(&csp_sfp_mgr_lock);
+}
+
+/* End a transfer: report it, close the connection and release the slot */
+static void csp_sfp_mgr_finish(csp_sfp_mgr_slot_t * slot, int error) {
+
+	csp_conn_set_event_handler(slot->conn, NULL, NULL);
+
+	if (slot->pending) {
+		csp_buffer_free(slot->pending);
+		slot->pending = NULL;
+	}
+
+	if (csp_dbg_packet_print >= 2) {
+		csp_print("%s: transfer %d %s, %" PRIu32 " / %" PRIu32 " bytes, error %d\n", __FUNCTION__, slot->id, slot->outbound ? "sent" : "received", slot->offset, slot->totalsize, error);
+	}
+
+	if (slot->done) {
+		csp_sfp_mgr_transfer_t transfer;
+		csp_sfp_mgr_fill(slot, &transfer);
+		slot->done(&transfer, error, slot->context);
+	}
+
+	csp_close(slot->conn);
+
+	csp_mutex_lock(&csp_sfp_mgr_lock);
+	if (slot->buf) {
+		free(slot->buf);
+		slot->buf = NULL;
+		csp_sfp_mgr_stats.mem_used -= slot->totalsize;
+	}
+	if (error == CSP_ERR_NONE) {
+		csp_sfp_mgr_stats.completed++;
+	} else {
+		csp_sfp_mgr_stats.failed++;
+	}
+	csp_sfp_mgr_stats.active--;
+	slot->active = false;
+	csp_mutex_unlock(&csp_sfp_mgr_lock);
+}
+
+/* Send fragments until the connection is full, returns true when the transfer ended */
+static bool csp_sfp_mgr_serve_send(csp_sfp_mgr_slot_t * slot, unsigned int events) {
+
+	/* Once all data is sent, a close is handled below, as the other end may have received all of it */
+	if ((slot->offset < slot->totalsize) && (events & CSP_CONN_EV_CLOSED) && (csp_conn_events(slot->conn) & CSP_CONN_EV_CLOSED)) {
+		csp_sfp_mgr_finish(slot, CSP_ERR_RESET);
+		return true;
+	}
+
+	for (int burst = 0; burst < CSP_SFP_MGR_BURST; burst++) {
+
+		if (slot->offset >= slot->totalsize) {
+			break;
+		}
+
+		unsigned int size = slot->totalsize - slot->offset;
+		if (size > slot->mtu) {
+			size = slot->mtu;
+		}
+
+		if (slot->pending == NULL) {
+			sfp_header_t * sfp_header;
+			csp_packet_t * packet = csp_buffer_get(slot->mtu + sizeof(*sfp_header));
+			if (packet == NULL) {
+				slot->retry = true;
+				return false;
+			}
+			memcpy(packet->data, slot->data + slot->offset, size);
+			packet->length = size;
+			sfp_header = csp_sfp_header_add(packet);
+			sfp_header->totalsize = htobe32(slot->totalsize);
+			sfp_header->offset = htobe32(slot->offset);
+			slot->pending = packet;
+		}
+
+		slot->conn->idout.flags |= CSP_FFRAG;
+		int error = csp_send_nonblock(slot->conn, slot->pending);
+		if (error == CSP_ERR_AGAIN) {
+			/* Resumed on the next writable event */
+			return false;
+		}
+		if (error == CSP_ERR_NOMEM) {
+			slot->retry = true;
+			return false;
+		}
+		if (error != CSP_ERR_NONE) {
+			csp_sfp_mgr_finish(slot, error);
+			return true;
+		}
+
+		slot->pending = NULL;
+		csp_sfp_mgr_advance(slot, size);
+	}
+
+	if (slot->offset < slot->totalsize) {
+		/* Burst used, continue after serving the other transfers */
+		slot->again = true;
+		return false;
+	}
+
+	/* All data is sent, wait until it is acknowledged */
+#if (CSP_USE_RDP)
+	if (slot->conn->idout.flags & CSP_FRDP) {
+		int error = csp_rdp_flush_nonblock(slot->conn);
+		if (error == CSP_ERR_AGAIN) {
+			return false;
+		}
+		csp_sfp_mgr_finish(slot, error);
+		return true;
+	}
+#endif
+
+	csp_sfp_mgr_finish(slot, CSP_ERR_NONE);
+	return true;
+}
+
+/* Receive the fragments queued on the connection, returns true when the transfer ended */
+static bool csp_sfp_mgr_serve_recv(csp_sfp_mgr_slot_t * slot, unsigned int events) {
+
+	for (int burst = 0; burst < CSP_SFP_MGR_BURST; burst++) {
+
+		csp_packet_t * packet = csp_read(slot->conn, 0);
+		if (packet == NULL) {
+			if (events & CSP_CONN_EV_CLOSED) {
+				csp_sfp_mgr_finish(slot, CSP_ERR_RESET);
+				return true;
+			}
+			return false;
+		}
+
+		sfp_header_t * sfp_header = csp_sfp_header_remove(packet);
+		if ((sfp_header == NULL) ||
+			(sfp_header->offset != slot->offset) ||
+			(slot->started && (sfp_header->totalsize != slot->totalsize)) ||
+			(sfp_header->offset > sfp_header->totalsize) ||
+			(packet->length > (sfp_header->totalsize - sfp_header->offset)) ||
+			((packet->length == 0) && (sfp_header->totalsize > 0))) {
+			if (csp_dbg_packet_print >= 1) {
+				csp_print("%s: transfer %d, invalid fragment, length: %u, expected offset %" PRIu32 "\n", __FUNCTION__, slot->id, packet->length, slot->offset);
+			}
+			csp_buffer_free(packet);
+			csp_sfp_mgr_finish(slot, CSP_ERR_SFP);
+			return true;
+		}
+
+		if (!slot->started) {
+			int error = CSP_ERR_NONE;
+
+			csp_mutex_lock(&csp_sfp_mgr_lock);
+			slot->totalsize = sfp_header->totalsize;
+			slot->started = true;
+			if (slot->writefnc == NULL) {
+				/* Receiving into memory, charged to the budget */
+				if (csp_sfp_mgr_stats.mem_used + slot->totalsize > csp_sfp_mgr_mem_budget) {
+					csp_sfp_mgr_stats.mem_rejected++;
+					error = CSP_ERR_NOMEM;
+				} else if ((slot->buf = malloc(slot->totalsize ? slot->totalsize : 1)) == NULL) {
+					error = CSP_ERR_NOMEM;
+				} else {
+					csp_sfp_mgr_stats.mem_used += slot->totalsize;
+					if (csp_sfp_mgr_stats.mem_used > csp_sfp_mgr_stats.mem_peak) {
+						csp_sfp_mgr_stats.mem_peak = csp_sfp_mgr_stats.mem_used;
+					}
+				}
+			}
+			csp_mutex_unlock(&csp_sfp_mgr_lock);
+
+			if (error != CSP_ERR_NONE) {
+				csp_buffer_free(packet);
+				csp_sfp_mgr_finish(slot, error);
+				return true;
+			}
+		}
+
+		int error = CSP_ERR_NONE;
+		if (slot->writefnc) {
+			error = slot->writefnc(slot->offset, packet->data, packet->length, slot->totalsize, slot->write_context);
+		} else {
+			memcpy(slot->buf + slot->offset, packet->data, packet->length);
+		}
+		const uint32_t length = packet->length;
+		csp_buffer_free(packet);
+
+		if (error != CSP_ERR_NONE) {
+			csp_sfp_mgr_finish(slot, error);
+			return true;
+		}
+
+		csp_sfp_mgr_advance(slot, length);
+
+		if (slot->offset >= slot->totalsize) {
+			csp_sfp_mgr_finish(slot, CSP_ERR_NONE);
+			return true;
+		}
+	}
+
+	/* Burst used, continue after serving the other transfers */
+	slot->again = true;
+	return false;
+}
+
+/* Serve all transfers with pending work, returns true if any can continue right away */
+static bool csp_sfp_mgr_serve(bool poll) {
+
+	bool again = false;
+	const uint32_t now = csp_get_ms();
+
+	for (int i = 0; i < CSP_SFP_MGR_MAX_TRANSFERS; i++) {
+
+		csp_sfp_mgr_slot_t * slot = &csp_sfp_mgr_slots[i];
+
+		/* Only the service task releases slots, so an active slot stays valid below */
+		csp_mutex_lock(&csp_sfp_mgr_lock);
+		bool active = slot->active;
+		bool cancel = slot->cancel;
+		csp_mutex_unlock(&csp_sfp_mgr_lock);
+		if (!active) {
+			continue;
+		}
+
+		if (cancel) {
+			csp_sfp_mgr_finish(slot, CSP_ERR_RESET);
+			continue;
+		}
+
+		unsigned int events = atomic_exchange(&slot->events, 0);
+		bool retry = poll && slot->retry;
+		if ((events == 0) && !slot->again && !retry) {
+			if (poll && csp_sfp_mgr_idle_timeout && ((now - slot->last_ms) > csp_sfp_mgr_idle_timeout)) {
+				csp_sfp_mgr_finish(slot, CSP_ERR_TIMEDOUT);
+			}
+			continue;
+		}
+
+		/* Buffers may never become available, also when the idle timeout is disabled */
+		if (retry && (++slot->retries > CSP_SFP_MGR_MAX_RETRIES)) {
+			csp_sfp_mgr_finish(slot, CSP_ERR_NOMEM);
+			continue;
+		}
+
+		slot->again = false;
+		slot->retry = false;
+
+		bool ended;
+		if (slot->outbound) {
+			ended = csp_sfp_mgr_serve_send(slot, events);
+		} else {
+			ended = csp_sfp_mgr_serve_recv(slot, events);
+		}
+
+		if (!ended && slot->again) {
+			again = true;
+		}
+	}
+
+	return again;
+}
+
+int csp_sfp_mgr_work(uint32_t timeout) {
+
+	static uint32_t last_poll;
+
+	int ret = CSP_ERR_NONE;
+
+	if (!csp_sfp_mgr_again) {
+		/* Wake up for polling, while transfers are active */
+		csp_mutex_lock(&csp_sfp_mgr_lock);
+		bool active = (csp_sfp_mgr_stats.active > 0);
+		csp_mutex_unlock(&csp_sfp_mgr_lock);
+		if (active && (timeout > CSP_SFP_MGR_POLL_MS)) {
+			timeout = CSP_SFP_MGR_POLL_MS;
+		}
+
+		uint8_t token;
+		if (csp_queue_dequeue(csp_sfp_mgr_wake_handle, &token, timeout) != CSP_QUEUE_OK) {
+			ret = CSP_ERR_TIMEDOUT;
+		}
+	}
+
+	const uint32_t now = csp_get_ms();
+	bool poll = (now - last_poll) >= CSP_SFP_MGR_POLL_MS;
+	if (poll) {
+		last_poll = now;
+	}
+
+	csp_sfp_mgr_again = csp_sfp_mgr_serve(poll);
+
+	return ret;
+}
@@ -0,0 +1,251 @@
+#include "csp_timer.h"
+
+#include <stddef.h>
+
+#include <csp/csp.h>
+#include <csp/arch/csp_time.h>
+
+#include "csp_mutex.h"
+#include "csp_qfifo.h"
+
+#define CSP_TIMER_SLOT(expires) (((expires) >> CSP_TIMER_TICK_SHIFT) & (CSP_TIMER_WHEEL_SLOTS - 1))
+
+#if (CSP_TIMER_WHEEL_SLOTS & (CSP_TIMER_WHEEL_SLOTS - 1)) != 0
+#error "CSP_TIMER_WHEEL_SLOTS must be a power of two"
+#endif
+
+static csp_timer_t * csp_timer_wheel[CSP_TIMER_WHEEL_SLOTS];
+static unsigned int csp_timer_count;
+
+/* Tick processed by the last run, all armed timers hash at or after this tick */
+static uint32_t csp_timer_tick;
+
+/* Clock cached by the last run */
+static uint32_t csp_timer_clock;
+
+/* Counts runs, timers armed during a run are tagged with it and left for the next run */
+static uint32_t csp_timer_run_seq;
+
+/* Router state, used to decide if the router must be woken when a timer is armed */
+static bool csp_timer_sleeping;
+static uint32_t csp_timer_wakeup;
+
+/* The wheel is shared between the router and user tasks */
+static csp_mutex_t csp_timer_lock;
+
+/* Return 1 if time is before cmp */
+static inline int csp_timer_before(uint32_t time, uint32_t cmp) {
+	return (int32_t)(time - cmp) < 0;
+}
+
+static void csp_timer_unlink(csp_timer_t * timer) {
+
+	if (timer->prev) {
+		timer->prev->next = timer->next;
+	} else {
+		csp_timer_wheel[CSP_TIMER_SLOT(timer->expires)] = timer->next;
+	}
+	if (timer->next) {
+		timer->next->prev = timer->prev;
+	}
+
+	timer->next = NULL;
+	timer->prev = NULL;
+	timer->armed = false;
+	csp_timer_count--;
+}
+
+/* Link timer into the wheel, return true if the router must be woken up */
+static bool csp_timer_link(csp_timer_t * timer, uint32_t expires) {
+
+	/* Timers already due are hashed into the current tick. Timers armed while a run is in
+	 * progress carry its sequence number, so the run skips them and the next run fires them */
+	if (csp_timer_before(expires, csp_timer_tick << CSP_TIMER_TICK_SHIFT)) {
+		expires = csp_timer_tick << CSP_TIMER_TICK_SHIFT;
+	}
+	timer->run_seq = csp_timer_run_seq;
+
+	csp_timer_t ** head = &csp_timer_wheel[CSP_TIMER_SLOT(expires)];
+	timer->expires = expires;
+	timer->prev = NULL;
+	timer->next = *head;
+	if (*head) {
+		(*head)->prev = timer;
+	}
+	*head = timer;
+	timer->armed = true;
+	csp_timer_count++;
+
+	if (csp_timer_sleeping && csp_timer_before(expires, csp_timer_wakeup)) {
+		csp_timer_sleeping = false;
+		return true;
+	}
+
+	return false;
+}
+
+void csp_timer_init(void) {
+
+	csp_mutex_init(&csp_timer_lock);
+
+	for (int i = 0; i < CSP_TIMER_WHEEL_SLOTS; i++) {
+		csp_timer_wheel[i] = NULL;
+	}
+	csp_timer_count = 0;
+	csp_timer_clock = csp_get_ms();
+	csp_timer_tick = csp_timer_clock >> CSP_TIMER_TICK_SHIFT;
+	csp_timer_sleeping = false;
+}
+
+void csp_timer_setup(csp_timer_t * timer, void (*callback)(void * arg), void * arg) {
+	timer->next = NULL;
+	timer->prev = NULL;
+	timer->armed = false;
+	timer->callback = callback;
+	timer->arg = arg;
+}
+
+void csp_timer_set(csp_timer_t * timer, uint32_t expires) {
+
+	csp_mutex_lock(&csp_timer_lock);
+	if (timer->armed) {
+		csp_timer_unlink(timer);
+	}
+	bool wake = csp_timer_link(timer, expires);
+	csp_mutex_unlock(&csp_timer_lock);
+
+	if (wake) {
+		csp_qfifo_wake_up();
+	}
+}
+
+void csp_timer_schedule(csp_timer_t * timer, uint32_t expires) {
+
+	bool wake = false;
+
+	csp_mutex_lock(&csp_timer_lock);
+	if (!timer->armed || csp_timer_before(expires, timer->expires)) {
+		if (timer->armed) {
+			csp_timer_unlink(timer);
+		}
+		wake = csp_timer_link(timer, expires);
+	}
+	csp_mutex_unlock(&csp_timer_lock);
+
+	if (wake) {
+		csp_qfifo_wake_up();
+	}
+}
+
+void csp_timer_cancel(csp_timer_t * timer) {
+
+	csp_mutex_lock(&csp_timer_lock);
+	if (timer->armed) {
+		csp_timer_unlink(timer);
+	}
+	csp_mutex_unlock(&csp_timer_lock);
+}
+
+/* Find and unlink one timer due at time now, in the ticks from first_tick up to now */
+static csp_timer_t * csp_timer_pop(uint32_t first_tick, uint32_t now) {
+
+	uint32_t ticks = (now >> CSP_TIMER_TICK_SHIFT) - first_tick + 1;
+	if (ticks > CSP_TIMER_WHEEL_SLOTS) {
+		ticks = CSP_TIMER_WHEEL_SLOTS;
+	}
+
+	for (uint32_t tick = first_tick; ticks > 0; tick++, ticks--) {
+		for (csp_timer_t * timer = csp_timer_wheel[tick & (CSP_TIMER_WHEEL_SLOTS - 1)]; timer != NULL; timer = timer->next) {
+			if ((timer->run_seq != csp_timer_run_seq) && !csp_timer_before(now, timer->expires)) {
+				csp_timer_unlink(timer);
+				return timer;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+void csp_timer_run(void) {
+
+	csp_mutex_lock(&csp_timer_lock);
+
+	const uint32_t now = csp_get_ms();
+	const uint32_t first_tick = csp_timer_tick;
+	csp_timer_clock = now;
+	csp_timer_tick = now >> CSP_TIMER_TICK_SHIFT;
+	csp_timer_sleeping = false;
+	csp_timer_run_seq++;
+
+	/* Each timer armed before the run fires at most once. Timers re-armed from a callback,
+	 * even to a time already passed, fire on the next run. */
+	for (;;) {
+		csp_timer_t * timer = csp_timer_pop(first_tick, now);
+		if (timer == NULL) {
+			break;
+		}
+
+		/* Callbacks may re-arm the timer, so call it without the lock */
+		csp_mutex_unlock(&csp_timer_lock);
+		timer->callback(timer->arg);
+		csp_mutex_lock(&csp_timer_lock);
+	}
+
+	csp_mutex_unlock(&csp_timer_lock);
+}
+
+uint32_t csp_timer_now(void) {
+	return csp_timer_clock;
+}
+
+uint32_t csp_timer_next_timeout(void) {
+
+	csp_mutex_lock(&csp_timer_lock);
+
+	if (csp_timer_count == 0) {
+		/* Sleeping forever, any timer armed must wake the router */
+		csp_timer_sleeping = true;
+		csp_timer_wakeup = csp_get_ms() + INT32_MAX;
+		csp_mutex_unlock(&csp_timer_lock);
+		return CSP_MAX_TIMEOUT;
+	}
+
+	/* The first bucket holding a timer of the current revolution has the earliest deadline */
+	bool found = false;
+	uint32_t next = 0;
+	for (uint32_t tick = csp_timer_tick; (tick - csp_timer_tick) < CSP_TIMER_WHEEL_SLOTS; tick++) {
+		const uint32_t tick_end = (tick + 1) << CSP_TIMER_TICK_SHIFT;
+		for (csp_timer_t * timer = csp_timer_wheel[tick & (CSP_TIMER_WHEEL_SLOTS - 1)]; timer != NULL; timer = timer->next) {
+			if (csp_timer_before(timer->expires, tick_end) && (!found || csp_timer_before(timer->expires, next))) {
+				next = timer->expires;
+				found = true;
+			}
+		}
+		if (found) {
+			break;
+		}
+	}
+
+	/* All timers are more than a revolution away, fall back to a full scan */
+	if (!found) {
+		for (int i = 0; i < CSP_TIMER_WHEEL_SLOTS; i++) {
+			for (csp_timer_t * timer = csp_timer_wheel[i]; timer != NULL; timer = timer->next) {
+				if (!found || csp_timer_before(timer->expires, next)) {
+					next = timer->expires;
+					found = true;
+				}
+			}
+		}
+	}
+
+	csp_timer_sleeping = true;
+	csp_timer_wakeup = next;
+	csp_mutex_unlock(&csp_timer_lock);
+
+	const uint32_t now = csp_get_ms();
+	if (!csp_timer_before(now, next)) {
+		return 0;
+	}
+
+	return next - now;
+}
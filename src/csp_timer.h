@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Hashed timer wheel.
+ *
+ * Timers are kept in a wheel of #CSP_TIMER_WHEEL_SLOTS buckets, hashed on
+ * their expiry tick (1 << #CSP_TIMER_TICK_SHIFT mS). Arming and cancelling
+ * is O(1), and expiring only visits the buckets passed since the last run,
+ * so idle timers cost nothing. Deadlines are kept with mS resolution, the
+ * tick only selects the bucket.
+ *
+ * The wheel is driven from the router task through csp_timer_run(). Timers
+ * may be armed from any task; if a timer is armed before the router is due
+ * to wake up, the router is woken through csp_qfifo_wake_up().
+ */
+
+#ifndef CSP_TIMER_WHEEL_SLOTS
+#define CSP_TIMER_WHEEL_SLOTS 64  //! Number of buckets, must be a power of two
+#endif
+
+#ifndef CSP_TIMER_TICK_SHIFT
+#define CSP_TIMER_TICK_SHIFT 4  //! Bucket width is (1 << shift) mS
+#endif
+
+typedef struct csp_timer_s {
+	struct csp_timer_s * next;
+	struct csp_timer_s * prev;
+	uint32_t expires;               /**< Absolute expiry time in mS */
+	bool armed;                     /**< Timer is linked into the wheel */
+	uint32_t run_seq;               /**< Run of csp_timer_run() in progress when armed */
+	void (*callback)(void * arg);   /**< Called from csp_timer_run() when expired */
+	void * arg;
+} csp_timer_t;
+
+/**
+ * Initialize the timer wheel.
+ */
+void csp_timer_init(void);
+
+/**
+ * Setup a timer, must be done once before it is armed.
+ * @param[in] timer timer to setup
+ * @param[in] callback function called when the timer expires
+ * @param[in] arg argument passed to callback
+ */
+void csp_timer_setup(csp_timer_t * timer, void (*callback)(void * arg), void * arg);
+
+/**
+ * Arm timer to expire at an absolute time, re-arming it if already armed.
+ * @param[in] timer timer
+ * @param[in] expires absolute expiry time in mS (csp_get_ms() clock)
+ */
+void csp_timer_set(csp_timer_t * timer, uint32_t expires);
+
+/**
+ * Arm timer to expire at an absolute time, unless it is already armed to expire earlier.
+ * @param[in] timer timer
+ * @param[in] expires absolute expiry time in mS (csp_get_ms() clock)
+ */
+void csp_timer_schedule(csp_timer_t * timer, uint32_t expires);
+
+/**
+ * Disarm timer.
+ * @param[in] timer timer
+ */
+void csp_timer_cancel(csp_timer_t * timer);
+
+/**
+ * Expire all due timers, calling their callbacks.
+ * Must only be called from the router task.
+ */
+void csp_timer_run(void);
+
+/**
+ * Return the clock cached by the last csp_timer_run().
+ * Timer callbacks should use this, instead of reading the clock again.
+ * @return time in mS
+ */
+uint32_t csp_timer_now(void);
+
+/**
+ * Return time until the next timer expires.
+ * Must only be called from the router task, right before it blocks.
+ * @return timeout in mS, #CSP_MAX_TIMEOUT if no timers are armed.
+ */
+uint32_t csp_timer_next_timeout(void);
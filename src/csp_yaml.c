@@ -45,6 +45,11 @@ struct data_s {
 	char * publisherTopic;
 	char * aes256IV;
 	char * aes256Key;
+	char * compress;
+	char * rcvbuf;
+	char * sndbuf;
+	char * peers;
+	char * rx_threads;
 };
 
 static int csp_yaml_getaddrinfo(char *fqdn, char *host, int hostsize) {
@@ -158,24 +163,39 @@ static void csp_yaml_end_if(struct data_s * data, unsigned int * dfl_addr) {
 #endif
 	else if (strcmp(data->driver, "udp") == 0) {
 
-		/* Check for valid options */
-		if (!data->server || !data->listen_port || !data->remote_port) {
+		/* Check for valid options, the server is optional with peers */
+		if (!data->listen_port || (!data->peers && (!data->server || !data->remote_port))) {
 			csp_print("server, listen_port or remote_port missing\n");
 			return;
 		}
 
 		iface = calloc(1,sizeof(csp_iface_t));
 		csp_if_udp_conf_t * udp_conf = calloc(1,sizeof(csp_if_udp_conf_t));
-		// udp_conf->host = data->server;
-		char addrBuffer[16]; // xxx.xxx.xxx.xxx\0
-		if((csp_yaml_getaddrinfo(data->server, addrBuffer, sizeof(addrBuffer))) != 0) {
-			csp_print("udp: unable to resolve server name\n");
-			exit(1);
+		if (data->server) {
+			char addrBuffer[16]; // xxx.xxx.xxx.xxx\0
+			if((csp_yaml_getaddrinfo(data->server, addrBuffer, sizeof(addrBuffer))) != 0) {
+				csp_print("udp: unable to resolve server name\n");
+				exit(1);
+			}
+			udp_conf->host = strdup(addrBuffer);
 		}
-		udp_conf->host = strdup(addrBuffer);
 		udp_conf->lport = atoi(data->listen_port);
-		udp_conf->rport = atoi(data->remote_port);
+		if (data->remote_port) {
+			udp_conf->rport = atoi(data->remote_port);
+		}
+		if (data->rcvbuf) {
+			udp_conf->rcvbuf = atoi(data->rcvbuf);
+		}
+		if (data->sndbuf) {
+			udp_conf->sndbuf = atoi(data->sndbuf);
+		}
+		if (data->rx_threads) {
+			udp_conf->rx_threads = atoi(data->rx_threads);
+		}
 		csp_if_udp_init(iface, udp_conf);
+		if (data->peers && (csp_if_udp_peer_load(iface, data->peers) < 0)) {
+			csp_print("udp: invalid peers %s\n", data->peers);
+		}
 
 	}
 
@@ -301,6 +321,12 @@ static void csp_yaml_end_if(struct data_s * data, unsigned int * dfl_addr) {
 	iface->addr = addr;
 	iface->netmask = atoi(data->netmask);
 	iface->name = strdup(data->name);
+	if (data->compress) {
+		iface->comp_threshold = atoi(data->compress);
+	}
+
+	/* Added by the driver, so index the address, netmask and name set here */
+	csp_iflist_update(iface);
 
 	// csp_print("csp_yaml -  %s addr: %u netmask %u\n", iface->name, iface->addr, iface->netmask);
 
@@ -352,6 +378,16 @@ static void csp_yaml_key_value(struct data_s * data, char * key, char * value) {
 		data->aes256IV = strdup(value);
 	} else if (strcmp(key, "aes256Key") == 0) {
 		data->aes256Key = strdup(value);
+	} else if (strcmp(key, "compress") == 0) {
+		data->compress = strdup(value);
+	} else if (strcmp(key, "rcvbuf") == 0) {
+		data->rcvbuf = strdup(value);
+	} else if (strcmp(key, "sndbuf") == 0) {
+		data->sndbuf = strdup(value);
+	} else if (strcmp(key, "peers") == 0) {
+		data->peers = strdup(value);
+	} else if (strcmp(key, "rx_threads") == 0) {
+		data->rx_threads = strdup(value);
 	} else {
 		csp_print("Unknown key %s\n", key);
 	}
@@ -458,5 +494,10 @@ void csp_yaml_init(char * filename, unsigned int * dfl_addr) {
 	free(data.publisherTopic);
 	free(data.aes256IV);
 	free(data.aes256Key);
+	free(data.compress);
+	free(data.rcvbuf);
+	free(data.sndbuf);
+	free(data.peers);
+	free(data.rx_threads);
 
 }
@@ -0,0 +1,716 @@
+#include <csp/drivers/reactor.h>
+
+#include <csp/csp_debug.h>
+#include <csp/csp_id.h>
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Retry receiving after 1 ms, when no buffer was free */
+#define CSP_REACTOR_RETRY_NS 1000000
+
+enum {
+	CSP_REACTOR_OP_FRAME,
+	CSP_REACTOR_OP_STREAM,
+	CSP_REACTOR_OP_SEND,
+	CSP_REACTOR_OP_RETRY,
+};
+
+/* Operation in flight, the address of its arguments must stay valid until it completes */
+typedef struct csp_reactor_op_s {
+	uint8_t type;
+	bool busy;
+	csp_reactor_fd_t * rfd;
+	csp_packet_t * packet;
+	struct msghdr msg;
+	struct iovec iov;
+	struct sockaddr_in addr;
+	struct __kernel_timespec ts;
+	struct csp_reactor_op_s * next;
+} csp_reactor_op_t;
+
+/* io_uring instance of a reactor task */
+typedef struct {
+	int fd;
+	bool fixed;
+
+	/* Submission queue, shared with the kernel */
+	unsigned * sq_head;
+	unsigned * sq_tail;
+	unsigned * sq_mask;
+	unsigned * sq_array;
+	unsigned sq_entries;
+	struct io_uring_sqe * sqes;
+
+	/* Completion queue, shared with the kernel */
+	unsigned * cq_head;
+	unsigned * cq_tail;
+	unsigned * cq_mask;
+	struct io_uring_cqe * cqes;
+
+	void * sq_ptr;
+	size_t sq_size;
+	void * cq_ptr;
+	size_t cq_size;
+	size_t sqes_size;
+
+	/* Protects the submission queue, the operations and the file descriptors served, counters are atomic */
+	pthread_mutex_t lock;
+	pthread_cond_t op_free;
+	pthread_cond_t op_done;
+	bool submitting;
+	unsigned int reserved;
+	csp_reactor_op_t * free_ops;
+	csp_reactor_op_t ops[CSP_REACTOR_ENTRIES];
+
+	pthread_t handle;
+	csp_reactor_stats_t stats;
+} csp_reactor_ring_t;
+
+struct csp_reactor_fd_s {
+	int fd;
+	csp_reactor_ring_t * ring;
+	csp_iface_t * iface;
+	csp_reactor_frame_t frame_callback;
+	csp_reactor_read_t read_callback;
+	void * user_data;
+	bool source;
+	bool stopped;
+	size_t mtu;
+	unsigned int depth;
+	unsigned int armed;
+	unsigned int sending;
+	uint8_t * data;
+	size_t size;
+	csp_reactor_op_t rx[];
+};
+
+static csp_reactor_ring_t * csp_reactor_rings;
+static unsigned int csp_reactor_count;
+static atomic_uint csp_reactor_next;
+
+static int csp_reactor_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags) {
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+/* Count in the reactor counters, read without the lock */
+static void csp_reactor_count_add(uint32_t * counter, uint32_t n) {
+	__atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+/* Field of a ring mapped from the kernel, aligned by the kernel */
+static void * csp_reactor_offset(void * ring, uint32_t offset) {
+	return (uint8_t *)ring + offset;
+}
+
+static void csp_reactor_ring_free(csp_reactor_ring_t * ring) {
+	if (ring->sqes != NULL) {
+		munmap(ring->sqes, ring->sqes_size);
+	}
+	if ((ring->cq_ptr != NULL) && (ring->cq_ptr != ring->sq_ptr)) {
+		munmap(ring->cq_ptr, ring->cq_size);
+	}
+	if (ring->sq_ptr != NULL) {
+		munmap(ring->sq_ptr, ring->sq_size);
+	}
+	close(ring->fd);
+}
+
+static int csp_reactor_ring_init(csp_reactor_ring_t * ring) {
+
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	ring->fd = syscall(__NR_io_uring_setup, CSP_REACTOR_ENTRIES, &params);
+	if (ring->fd < 0) {
+		return CSP_ERR_NOTSUP;
+	}
+
+	/* Sends and receives in flight must fit in the completion queue */
+	if ((params.sq_entries < CSP_REACTOR_ENTRIES) || (params.cq_entries < 2 * CSP_REACTOR_ENTRIES)) {
+		close(ring->fd);
+		return CSP_ERR_NOTSUP;
+	}
+
+	ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->sq_size = (ring->cq_size > ring->sq_size) ? ring->cq_size : ring->sq_size;
+		ring->cq_size = ring->sq_size;
+	}
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ptr == MAP_FAILED) {
+		ring->sq_ptr = NULL;
+		csp_reactor_ring_free(ring);
+		return CSP_ERR_NOMEM;
+	}
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ptr = ring->sq_ptr;
+	} else {
+		ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ptr == MAP_FAILED) {
+			ring->cq_ptr = NULL;
+			csp_reactor_ring_free(ring);
+			return CSP_ERR_NOMEM;
+		}
+	}
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		csp_reactor_ring_free(ring);
+		return CSP_ERR_NOMEM;
+	}
+
+	ring->sq_head = csp_reactor_offset(ring->sq_ptr, params.sq_off.head);
+	ring->sq_tail = csp_reactor_offset(ring->sq_ptr, params.sq_off.tail);
+	ring->sq_mask = csp_reactor_offset(ring->sq_ptr, params.sq_off.ring_mask);
+	ring->sq_array = csp_reactor_offset(ring->sq_ptr, params.sq_off.array);
+	ring->sq_entries = params.sq_entries;
+
+	ring->cq_head = csp_reactor_offset(ring->cq_ptr, params.cq_off.head);
+	ring->cq_tail = csp_reactor_offset(ring->cq_ptr, params.cq_off.tail);
+	ring->cq_mask = csp_reactor_offset(ring->cq_ptr, params.cq_off.ring_mask);
+	ring->cqes = csp_reactor_offset(ring->cq_ptr, params.cq_off.cqes);
+
+	/* Register the CSP buffers once, so receives into them need no mapping of their own */
+	size_t pool_size;
+	struct iovec pool;
+	pool.iov_base = csp_buffer_pool(&pool_size);
+	pool.iov_len = pool_size;
+	ring->fixed = (pool.iov_base != NULL) && (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, &pool, 1) == 0);
+
+	pthread_mutex_init(&ring->lock, NULL);
+	pthread_cond_init(&ring->op_free, NULL);
+	pthread_cond_init(&ring->op_done, NULL);
+	for (unsigned int i = 0; i < CSP_REACTOR_ENTRIES; i++) {
+		ring->ops[i].next = ring->free_ops;
+		ring->free_ops = &ring->ops[i];
+	}
+
+	return CSP_ERR_NONE;
+}
+
+/* Get a submission queue entry, called with the lock held */
+static struct io_uring_sqe * csp_reactor_sqe(csp_reactor_ring_t * ring) {
+
+	unsigned tail = *ring->sq_tail;
+	while (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+		/* Full, submit the entries queued, even if another task is submitting them too */
+		if ((csp_reactor_enter(ring->fd, ring->sq_entries, 0, 0) < 0) && (errno != EINTR)) {
+			return NULL;
+		}
+		csp_reactor_count_add(&ring->stats.enter, 1);
+	}
+
+	const unsigned index = tail & *ring->sq_mask;
+	struct io_uring_sqe * sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	ring->sq_array[index] = index;
+	return sqe;
+}
+
+/* Queue the entry from csp_reactor_sqe(), called with the lock held */
+static void csp_reactor_sqe_queue(csp_reactor_ring_t * ring) {
+	__atomic_store_n(ring->sq_tail, *ring->sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+/* Submit the entries queued, including those queued meanwhile by other tasks, called with the lock held */
+static void csp_reactor_flush(csp_reactor_ring_t * ring) {
+
+	if (ring->submitting) {
+		return;
+	}
+
+	ring->submitting = true;
+	unsigned pending;
+	while ((pending = *ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE)) > 0) {
+		pthread_mutex_unlock(&ring->lock);
+		int ret = csp_reactor_enter(ring->fd, pending, 0, 0);
+		pthread_mutex_lock(&ring->lock);
+		csp_reactor_count_add(&ring->stats.enter, 1);
+		if (ret > 0) {
+			csp_reactor_count_add(&ring->stats.submitted, ret);
+		} else if ((ret == 0) || (errno != EINTR)) {
+			/* Left to the reactor task */
+			break;
+		}
+	}
+	ring->submitting = false;
+}
+
+/* Receive datagrams in the slots free, called with the lock held */
+static void csp_reactor_arm_frames(csp_reactor_fd_t * rfd) {
+
+	csp_reactor_ring_t * ring = rfd->ring;
+
+	for (unsigned int i = 0; (i < rfd->depth) && !rfd->stopped; i++) {
+
+		csp_reactor_op_t * op = &rfd->rx[i];
+		if (op->busy) {
+			continue;
+		}
+
+		/* Only the first receive while few buffers are free */
+		if ((rfd->armed > 0) && (csp_buffer_remaining() <= (int)rfd->depth)) {
+			break;
+		}
+
+		struct io_uring_sqe * sqe = csp_reactor_sqe(ring);
+		if (sqe == NULL) {
+			break;
+		}
+
+		csp_packet_t * packet = csp_buffer_get(rfd->mtu);
+		if (packet == NULL) {
+			csp_reactor_count_add(&ring->stats.no_buffer, 1);
+			if (rfd->armed > 0) {
+				break;
+			}
+			/* Nothing in flight, retry later */
+			op->type = CSP_REACTOR_OP_RETRY;
+			op->ts.tv_sec = 0;
+			op->ts.tv_nsec = CSP_REACTOR_RETRY_NS;
+			sqe->opcode = IORING_OP_TIMEOUT;
+			sqe->addr = (uintptr_t)&op->ts;
+			sqe->len = 1;
+		} else {
+			const int header_size = csp_id_setup_rx(packet);
+			op->type = CSP_REACTOR_OP_FRAME;
+			op->packet = packet;
+			op->iov.iov_base = packet->frame_begin;
+			op->iov.iov_len = rfd->mtu + header_size;
+			sqe->fd = rfd->fd;
+			if (rfd->source) {
+				memset(&op->msg, 0, sizeof(op->msg));
+				op->msg.msg_name = &op->addr;
+				op->msg.msg_namelen = sizeof(op->addr);
+				op->msg.msg_iov = &op->iov;
+				op->msg.msg_iovlen = 1;
+				sqe->opcode = IORING_OP_RECVMSG;
+				sqe->addr = (uintptr_t)&op->msg;
+				sqe->len = 1;
+			} else {
+				sqe->opcode = ring->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+				sqe->addr = (uintptr_t)op->iov.iov_base;
+				sqe->len = op->iov.iov_len;
+				sqe->buf_index = 0;
+			}
+		}
+
+		sqe->user_data = (uintptr_t)op;
+		csp_reactor_sqe_queue(ring);
+		op->busy = true;
+		rfd->armed++;
+	}
+}
+
+/* Read the stream, called with the lock held */
+static void csp_reactor_arm_stream(csp_reactor_fd_t * rfd) {
+
+	csp_reactor_op_t * op = &rfd->rx[0];
+	struct io_uring_sqe * sqe = csp_reactor_sqe(rfd->ring);
+	if (sqe == NULL) {
+		return;
+	}
+
+	op->type = CSP_REACTOR_OP_STREAM;
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = rfd->fd;
+	sqe->addr = (uintptr_t)rfd->data;
+	sqe->len = rfd->size;
+	sqe->user_data = (uintptr_t)op;
+	csp_reactor_sqe_queue(rfd->ring);
+	op->busy = true;
+}
+
+/* Errors a socket or file does not recover from */
+static bool csp_reactor_fatal(int res) {
+	return (res == -EBADF) || (res == -EINVAL) || (res == -ENOTSOCK) || (res == -EFAULT) || (res == -EOPNOTSUPP);
+}
+
+/* Operation of a file descriptor done, called with the lock held */
+static void csp_reactor_done(csp_reactor_fd_t * rfd) {
+	if (rfd->stopped) {
+		/* Wake csp_reactor_remove() */
+		pthread_cond_broadcast(&rfd->ring->op_done);
+	}
+}
+
+static void csp_reactor_complete(csp_reactor_ring_t * ring, csp_reactor_op_t * op, int res) {
+
+	csp_reactor_fd_t * rfd = op->rfd;
+
+	switch (op->type) {
+
+		case CSP_REACTOR_OP_FRAME: {
+			csp_packet_t * packet = op->packet;
+			op->packet = NULL;
+			csp_reactor_count_add(&ring->stats.rx, 1);
+			if (res >= 0) {
+				rfd->frame_callback(rfd->user_data, packet, res, rfd->source ? &op->addr : NULL);
+			} else {
+				csp_buffer_free(packet);
+				/* Cancelled by csp_reactor_remove() */
+				if (res != -ECANCELED) {
+					rfd->frame_callback(rfd->user_data, NULL, res, NULL);
+				}
+			}
+			pthread_mutex_lock(&ring->lock);
+			op->busy = false;
+			rfd->armed--;
+			rfd->stopped |= csp_reactor_fatal(res);
+			csp_reactor_arm_frames(rfd);
+			csp_reactor_done(rfd);
+			pthread_mutex_unlock(&ring->lock);
+			break;
+		}
+
+		case CSP_REACTOR_OP_RETRY:
+			pthread_mutex_lock(&ring->lock);
+			op->busy = false;
+			rfd->armed--;
+			csp_reactor_arm_frames(rfd);
+			csp_reactor_done(rfd);
+			pthread_mutex_unlock(&ring->lock);
+			break;
+
+		case CSP_REACTOR_OP_STREAM: {
+			csp_reactor_count_add(&ring->stats.rx, 1);
+			const bool again = (res == -EINTR) || (res == -EAGAIN);
+			if (!again && (res != -ECANCELED)) {
+				rfd->read_callback(rfd->user_data, rfd->data, res);
+			}
+			pthread_mutex_lock(&ring->lock);
+			op->busy = false;
+			rfd->stopped |= !again && (res <= 0);
+			if (!rfd->stopped) {
+				csp_reactor_arm_stream(rfd);
+			}
+			csp_reactor_done(rfd);
+			pthread_mutex_unlock(&ring->lock);
+			break;
+		}
+
+		case CSP_REACTOR_OP_SEND:
+			if (res < 0) {
+				csp_reactor_count_add(&ring->stats.tx_error, 1);
+				if (rfd->iface != NULL) {
+					rfd->iface->tx_error++;
+				}
+			} else {
+				csp_reactor_count_add(&ring->stats.tx, 1);
+			}
+			csp_buffer_free(op->packet);
+			op->packet = NULL;
+			pthread_mutex_lock(&ring->lock);
+			rfd->sending--;
+			op->next = ring->free_ops;
+			ring->free_ops = op;
+			pthread_cond_signal(&ring->op_free);
+			csp_reactor_done(rfd);
+			pthread_mutex_unlock(&ring->lock);
+			break;
+	}
+}
+
+static void * csp_reactor_task(void * param) {
+
+	csp_reactor_ring_t * ring = param;
+
+	while (1) {
+
+		/* Submit the entries queued, and wait for a completion */
+		pthread_mutex_lock(&ring->lock);
+		const unsigned pending = *ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+		pthread_mutex_unlock(&ring->lock);
+
+		int ret = csp_reactor_enter(ring->fd, pending, 1, IORING_ENTER_GETEVENTS);
+
+		csp_reactor_count_add(&ring->stats.enter, 1);
+		if (ret > 0) {
+			csp_reactor_count_add(&ring->stats.submitted, ret);
+		}
+
+		if ((ret < 0) && (errno != EINTR) && (errno != EBUSY) && (errno != EAGAIN)) {
+			csp_print("%s: io_uring_enter() failed, error: %s\n", __FUNCTION__, strerror(errno));
+			sleep(1);
+			continue;
+		}
+
+		/* Only this task consumes completions */
+		unsigned head = *ring->cq_head;
+		const unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+		while (head != tail) {
+			const struct io_uring_cqe * cqe = &ring->cqes[head & *ring->cq_mask];
+			csp_reactor_op_t * op = (csp_reactor_op_t *)(uintptr_t)cqe->user_data;
+			const int res = cqe->res;
+			head++;
+			__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+			csp_reactor_count_add(&ring->stats.completed, 1);
+			/* Cancellations have no operation of their own */
+			if (op != NULL) {
+				csp_reactor_complete(ring, op, res);
+			}
+		}
+	}
+
+	return NULL;
+}
+
+int csp_reactor_init(unsigned int threads) {
+
+	if (csp_reactor_count > 0) {
+		return CSP_ERR_ALREADY;
+	}
+	if (threads == 0) {
+		threads = 1;
+	}
+	if (threads > CSP_REACTOR_THREADS) {
+		threads = CSP_REACTOR_THREADS;
+	}
+
+	csp_reactor_ring_t * rings = calloc(threads, sizeof(*rings));
+	if (rings == NULL) {
+		return CSP_ERR_NOMEM;
+	}
+
+	for (unsigned int i = 0; i < threads; i++) {
+		int ret = csp_reactor_ring_init(&rings[i]);
+		if (ret != CSP_ERR_NONE) {
+			csp_print("%s: io_uring setup failed, error: %d\n", __FUNCTION__, ret);
+			while (i-- > 0) {
+				csp_reactor_ring_free(&rings[i]);
+			}
+			free(rings);
+			return ret;
+		}
+	}
+
+	pthread_attr_t attributes;
+	pthread_attr_init(&attributes);
+	pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+	for (unsigned int i = 0; i < threads; i++) {
+		int ret = pthread_create(&rings[i].handle, &attributes, csp_reactor_task, &rings[i]);
+		if (ret != 0) {
+			csp_print("%s: pthread_create() failed, error: %s\n", __FUNCTION__, strerror(ret));
+			/* The tasks started keep running, serve the file descriptors with them */
+			threads = i;
+			break;
+		}
+	}
+	pthread_attr_destroy(&attributes);
+
+	csp_reactor_rings = rings;
+	csp_reactor_count = threads;
+
+	return (threads > 0) ? CSP_ERR_NONE : CSP_ERR_NOMEM;
+}
+
+bool csp_reactor_running(void) {
+	return (csp_reactor_count > 0);
+}
+
+/* Add a file descriptor to a reactor task with room for its receives in flight */
+static csp_reactor_fd_t * csp_reactor_add(int fd, unsigned int depth) {
+
+	if ((csp_reactor_count == 0) || (fd < 0)) {
+		return NULL;
+	}
+
+	csp_reactor_fd_t * rfd = calloc(1, sizeof(*rfd) + depth * sizeof(rfd->rx[0]));
+	if (rfd == NULL) {
+		return NULL;
+	}
+	rfd->fd = fd;
+	rfd->depth = depth;
+	for (unsigned int i = 0; i < depth; i++) {
+		rfd->rx[i].rfd = rfd;
+	}
+
+	const unsigned int first = atomic_fetch_add(&csp_reactor_next, 1);
+	for (unsigned int i = 0; i < csp_reactor_count; i++) {
+		csp_reactor_ring_t * ring = &csp_reactor_rings[(first + i) % csp_reactor_count];
+		pthread_mutex_lock(&ring->lock);
+		if (ring->reserved + depth <= CSP_REACTOR_ENTRIES) {
+			ring->reserved += depth;
+			rfd->ring = ring;
+		}
+		pthread_mutex_unlock(&ring->lock);
+		if (rfd->ring != NULL) {
+			return rfd;
+		}
+	}
+
+	free(rfd);
+	return NULL;
+}
+
+csp_reactor_fd_t * csp_reactor_add_stream(int fd, size_t size, csp_reactor_read_t callback, void * user_data) {
+
+	csp_reactor_fd_t * rfd = csp_reactor_add(fd, 1);
+	if (rfd == NULL) {
+		return NULL;
+	}
+
+	rfd->data = malloc(size);
+	if (rfd->data == NULL) {
+		csp_reactor_remove(rfd);
+		return NULL;
+	}
+	rfd->size = size;
+	rfd->read_callback = callback;
+	rfd->user_data = user_data;
+
+	pthread_mutex_lock(&rfd->ring->lock);
+	csp_reactor_arm_stream(rfd);
+	csp_reactor_flush(rfd->ring);
+	pthread_mutex_unlock(&rfd->ring->lock);
+
+	return rfd;
+}
+
+csp_reactor_fd_t * csp_reactor_add_frames(int fd, csp_iface_t * iface, unsigned int depth, bool source, csp_reactor_frame_t callback, void * user_data) {
+
+	if ((depth == 0) || (depth > CSP_REACTOR_DEPTH)) {
+		depth = CSP_REACTOR_DEPTH;
+	}
+
+	csp_reactor_fd_t * rfd = csp_reactor_add(fd, depth);
+	if (rfd == NULL) {
+		return NULL;
+	}
+
+	rfd->iface = iface;
+	rfd->mtu = ((iface != NULL) && (iface->mtu > 0)) ? iface->mtu : csp_buffer_data_size();
+	rfd->source = source;
+	rfd->frame_callback = callback;
+	rfd->user_data = user_data;
+
+	pthread_mutex_lock(&rfd->ring->lock);
+	csp_reactor_arm_frames(rfd);
+	csp_reactor_flush(rfd->ring);
+	pthread_mutex_unlock(&rfd->ring->lock);
+
+	return rfd;
+}
+
+/* Operations of a file descriptor in flight, called with the lock held */
+static bool csp_reactor_busy(const csp_reactor_fd_t * rfd) {
+	for (unsigned int i = 0; i < rfd->depth; i++) {
+		if (rfd->rx[i].busy) {
+			return true;
+		}
+	}
+	return (rfd->sending > 0);
+}
+
+void csp_reactor_remove(csp_reactor_fd_t * rfd) {
+
+	if (rfd == NULL) {
+		return;
+	}
+
+	csp_reactor_ring_t * ring = rfd->ring;
+
+	pthread_mutex_lock(&ring->lock);
+
+	/* Cancel the receives in flight, the sends complete */
+	rfd->stopped = true;
+	for (unsigned int i = 0; i < rfd->depth; i++) {
+		if (!rfd->rx[i].busy) {
+			continue;
+		}
+		struct io_uring_sqe * sqe = csp_reactor_sqe(ring);
+		if (sqe == NULL) {
+			break;
+		}
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->addr = (uintptr_t)&rfd->rx[i];
+		sqe->user_data = 0;
+		csp_reactor_sqe_queue(ring);
+	}
+	csp_reactor_flush(ring);
+
+	while (csp_reactor_busy(rfd)) {
+		pthread_cond_wait(&ring->op_done, &ring->lock);
+	}
+	ring->reserved -= rfd->depth;
+
+	pthread_mutex_unlock(&ring->lock);
+
+	free(rfd->data);
+	free(rfd);
+}
+
+int csp_reactor_send(csp_reactor_fd_t * rfd, csp_packet_t * packet, const struct sockaddr_in * to) {
+
+	csp_reactor_ring_t * ring = rfd->ring;
+
+	pthread_mutex_lock(&ring->lock);
+
+	/* Wait for a send to complete, like a blocking send */
+	while (ring->free_ops == NULL) {
+		pthread_cond_wait(&ring->op_free, &ring->lock);
+	}
+
+	struct io_uring_sqe * sqe = csp_reactor_sqe(ring);
+	if (sqe == NULL) {
+		pthread_mutex_unlock(&ring->lock);
+		return CSP_ERR_DRIVER;
+	}
+
+	csp_reactor_op_t * op = ring->free_ops;
+	ring->free_ops = op->next;
+	rfd->sending++;
+	op->type = CSP_REACTOR_OP_SEND;
+	op->rfd = rfd;
+	op->packet = packet;
+	op->iov.iov_base = packet->frame_begin;
+	op->iov.iov_len = packet->frame_length;
+	memset(&op->msg, 0, sizeof(op->msg));
+	if (to != NULL) {
+		op->addr = *to;
+		op->msg.msg_name = &op->addr;
+		op->msg.msg_namelen = sizeof(op->addr);
+	}
+	op->msg.msg_iov = &op->iov;
+	op->msg.msg_iovlen = 1;
+
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = rfd->fd;
+	sqe->addr = (uintptr_t)&op->msg;
+	sqe->len = 1;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = (uintptr_t)op;
+	csp_reactor_sqe_queue(ring);
+
+	/* The task submitting takes this send too, if another one is */
+	csp_reactor_flush(ring);
+
+	pthread_mutex_unlock(&ring->lock);
+
+	return CSP_ERR_NONE;
+}
+
+void csp_reactor_get_stats(csp_reactor_stats_t * stats) {
+
+	memset(stats, 0, sizeof(*stats));
+	for (unsigned int i = 0; i < csp_reactor_count; i++) {
+		const csp_reactor_stats_t * ring = &csp_reactor_rings[i].stats;
+		stats->enter += __atomic_load_n(&ring->enter, __ATOMIC_RELAXED);
+		stats->submitted += __atomic_load_n(&ring->submitted, __ATOMIC_RELAXED);
+		stats->completed += __atomic_load_n(&ring->completed, __ATOMIC_RELAXED);
+		stats->rx += __atomic_load_n(&ring->rx, __ATOMIC_RELAXED);
+		stats->tx += __atomic_load_n(&ring->tx, __ATOMIC_RELAXED);
+		stats->tx_error += __atomic_load_n(&ring->tx_error, __ATOMIC_RELAXED);
+		stats->no_buffer += __atomic_load_n(&ring->no_buffer, __ATOMIC_RELAXED);
+	}
+}
@@ -13,6 +13,11 @@
 
 #include <csp/csp.h>
 #include <pthread.h>
+#if (CSP_USE_IO_URING)
+#include <csp/drivers/reactor.h>
+#endif
+
+#define USART_CBUF_SIZE 400
 
 typedef struct {
 	csp_usart_callback_t rx_callback;
@@ -35,12 +40,11 @@ void csp_usart_unlock(void * driver_data) {
 static void * usart_rx_thread(void * arg) {
 
 	usart_context_t * ctx = arg;
-	const unsigned int CBUF_SIZE = 400;
-	uint8_t * cbuf = malloc(CBUF_SIZE);
+	uint8_t * cbuf = malloc(USART_CBUF_SIZE);
 
 	// Receive loop
 	while (1) {
-		int length = read(ctx->fd, cbuf, CBUF_SIZE);
+		int length = read(ctx->fd, cbuf, USART_CBUF_SIZE);
 		if (length <= 0) {
 			csp_print("%s: read() failed, returned: %d\n", __FUNCTION__, length);
 			exit(1);
@@ -50,6 +54,19 @@ static void * usart_rx_thread(void * arg) {
 	return NULL;
 }
 
+#if (CSP_USE_IO_URING)
+static void usart_reactor_rx(void * user_data, uint8_t * data, int length) {
+
+	usart_context_t * ctx = user_data;
+
+	if (length <= 0) {
+		csp_print("%s: read() failed, returned: %d\n", __FUNCTION__, length);
+		exit(1);
+	}
+	ctx->rx_callback(ctx->user_data, data, length, NULL);
+}
+#endif
+
 int csp_usart_write(csp_usart_fd_t fd, const void * data, size_t data_length) {
 
 	if (fd >= 0) {
@@ -172,6 +189,19 @@ int csp_usart_open(const csp_usart_conf_t * conf, csp_usart_callback_t rx_callba
 	ctx->user_data = user_data;
 	ctx->fd = fd;
 
+#if (CSP_USE_IO_URING)
+	/* Read by the reactor, instead of a thread of its own */
+	if (rx_callback && csp_reactor_running()) {
+		if (csp_reactor_add_stream(fd, USART_CBUF_SIZE, usart_reactor_rx, ctx) == NULL) {
+			csp_print("%s: failed to add device to reactor: [%s]\n", __FUNCTION__, conf->device);
+			free(ctx);
+			close(fd);
+			return CSP_ERR_NOMEM;
+		}
+		rx_callback = NULL;
+	}
+#endif
+
 	if (rx_callback) {
 		int ret;
 		pthread_attr_t attributes;
@@ -115,6 +115,9 @@ void csp_if_tun_init(csp_iface_t * iface, csp_if_tun_conf_t * ifconf) {
 	/* MTU is datasize */
 	iface->mtu = csp_buffer_data_size();
 
+	/* Encrypt and decrypt on the pipeline workers, if started */
+	iface->pipeline_tx = 1;
+
 	/* Regsiter interface */
 	iface->name = "TUN",
 	iface->nexthop = csp_if_tun_tx,
@@ -1,6 +1,11 @@
+#define _GNU_SOURCE
+
 #include <csp/interfaces/csp_if_udp.h>
 
 #include <csp/csp_debug.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
@@ -9,66 +14,314 @@
 #include <endian.h>
 #include <csp/csp_interface.h>
 #include <csp/csp_id.h>
+#include <csp/csp_rtable.h>
+#if (CSP_USE_IO_URING)
+#include <csp/drivers/reactor.h>
+#endif
 
 #ifndef MSG_CONFIRM
 #define MSG_CONFIRM (0)
 #endif
 
+/* Set socket buffer sizes from the configuration */
+static void csp_if_udp_set_buffers(int sockfd, const csp_if_udp_conf_t * ifconf) {
+	if ((ifconf->rcvbuf > 0) && (setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &ifconf->rcvbuf, sizeof(ifconf->rcvbuf)) < 0)) {
+		csp_print("UDP: failed to set receive buffer size %d: %s\n", ifconf->rcvbuf, strerror(errno));
+	}
+	if ((ifconf->sndbuf > 0) && (setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &ifconf->sndbuf, sizeof(ifconf->sndbuf)) < 0)) {
+		csp_print("UDP: failed to set send buffer size %d: %s\n", ifconf->sndbuf, strerror(errno));
+	}
+}
+
+/* Find the peer of an address, called with tx_lock held */
+static int csp_if_udp_peer_find(const csp_if_udp_conf_t * ifconf, uint16_t addr) {
+	for (unsigned int i = 0; i < ifconf->peer_count; i++) {
+		if (ifconf->peers[i].addr == addr) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* Find or add the entry of an address, called with tx_lock held */
+static int csp_if_udp_peer_entry(csp_if_udp_conf_t * ifconf, uint16_t addr) {
+
+	int i = csp_if_udp_peer_find(ifconf, addr);
+	if ((i < 0) && (ifconf->peer_count < CSP_IF_UDP_PEERS)) {
+		i = ifconf->peer_count++;
+		ifconf->peers[i].addr = addr;
+		ifconf->peers[i].learned = false;
+		memset(&ifconf->peers[i].sockaddr, 0, sizeof(ifconf->peers[i].sockaddr));
+	}
+	return i;
+}
+
+int csp_if_udp_peer_add(csp_iface_t * iface, uint16_t addr, const char * host, int port) {
+
+	csp_if_udp_conf_t * ifconf = iface->driver_data;
+
+	struct sockaddr_in sockaddr = {0};
+	if ((host == NULL) || (inet_aton(host, &sockaddr.sin_addr) == 0) || (port <= 0) || (port > 0xFFFF)) {
+		return CSP_ERR_INVAL;
+	}
+	sockaddr.sin_family = AF_INET;
+	sockaddr.sin_port = htons(port);
+
+	pthread_mutex_lock(&ifconf->tx_lock);
+	int i = csp_if_udp_peer_entry(ifconf, addr);
+	if (i >= 0) {
+		ifconf->peers[i].learned = false;
+		ifconf->peers[i].sockaddr = sockaddr;
+	}
+	pthread_mutex_unlock(&ifconf->tx_lock);
+
+	return (i >= 0) ? CSP_ERR_NONE : CSP_ERR_NOMEM;
+}
+
+int csp_if_udp_peer_learn(csp_iface_t * iface, uint16_t addr) {
+
+	csp_if_udp_conf_t * ifconf = iface->driver_data;
+
+	pthread_mutex_lock(&ifconf->tx_lock);
+	int i = csp_if_udp_peer_entry(ifconf, addr);
+	if (i >= 0) {
+		ifconf->peers[i].learned = true;
+		__atomic_store_n(&ifconf->peer_learn, true, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&ifconf->tx_lock);
+
+	return (i >= 0) ? CSP_ERR_NONE : CSP_ERR_NOMEM;
+}
+
+int csp_if_udp_peer_load(csp_iface_t * iface, const char * peers) {
+
+	csp_if_udp_conf_t * ifconf = iface->driver_data;
+	int count = 0;
+
+	while (*peers != '\0') {
+
+		/* Copy the entry, so it can be terminated */
+		const char * end = strchr(peers, ',');
+		const size_t len = (end != NULL) ? (size_t)(end - peers) : strlen(peers);
+		char entry[64];
+		if (len >= sizeof(entry)) {
+			return CSP_ERR_INVAL;
+		}
+		memcpy(entry, peers, len);
+		entry[len] = '\0';
+		peers += (end != NULL) ? len + 1 : len;
+
+		unsigned int addr;
+		char host[16];
+		int port = ifconf->rport;
+		const bool learn = (sscanf(entry, " %u %15s", &addr, host) == 2) && (strcmp(host, "learn") == 0);
+		if ((!learn && (sscanf(entry, " %u %15[0-9.]:%d", &addr, host, &port) < 2)) || (addr > csp_id_get_max_nodeid())) {
+			csp_print("%s: invalid peer [%s]\n", __func__, entry);
+			return CSP_ERR_INVAL;
+		}
+
+		int ret = learn ? csp_if_udp_peer_learn(iface, addr) : csp_if_udp_peer_add(iface, addr, host, port);
+		if (ret != CSP_ERR_NONE) {
+			csp_print("%s: failed to add peer [%s], error: %d\n", __func__, entry, ret);
+			return ret;
+		}
+		count++;
+	}
+
+	return count;
+}
+
+bool csp_if_udp_peer_get(csp_iface_t * iface, uint16_t addr, csp_if_udp_peer_t * peer) {
+
+	csp_if_udp_conf_t * ifconf = iface->driver_data;
+
+	pthread_mutex_lock(&ifconf->tx_lock);
+	int i = csp_if_udp_peer_find(ifconf, addr);
+	if (i >= 0) {
+		*peer = ifconf->peers[i];
+	}
+	pthread_mutex_unlock(&ifconf->tx_lock);
+
+	return (i >= 0);
+}
+
+/* Learn the endpoint of the source of a received frame, if allowed for the address */
+static void csp_if_udp_peer_update(csp_if_udp_conf_t * ifconf, uint16_t addr, const struct sockaddr_in * from) {
+
+	pthread_mutex_lock(&ifconf->tx_lock);
+	int i = csp_if_udp_peer_find(ifconf, addr);
+	if ((i >= 0) && ifconf->peers[i].learned) {
+		ifconf->peers[i].sockaddr = *from;
+	}
+	pthread_mutex_unlock(&ifconf->tx_lock);
+}
+
+/* Endpoint to send to, the peer of the address or the default peer, called with tx_lock held */
+static bool csp_if_udp_peer_lookup(const csp_if_udp_conf_t * ifconf, uint16_t addr, struct sockaddr_in * sockaddr) {
+	const int peer = csp_if_udp_peer_find(ifconf, addr);
+	if ((peer >= 0) && (ifconf->peers[peer].sockaddr.sin_family == AF_INET)) {
+		*sockaddr = ifconf->peers[peer].sockaddr;
+	} else if (ifconf->peer_addr.sin_family == AF_INET) {
+		*sockaddr = ifconf->peer_addr;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+/* Send a batch of packets, and free them */
+static void csp_if_udp_tx_batch(csp_iface_t * iface, csp_if_udp_conf_t * ifconf, csp_packet_t ** packets, struct sockaddr_in * addrs, unsigned int count) {
+
+	struct mmsghdr msgs[CSP_IF_UDP_BATCH];
+	struct iovec iov[CSP_IF_UDP_BATCH];
+	for (unsigned int i = 0; i < count; i++) {
+		iov[i].iov_base = packets[i]->frame_begin;
+		iov[i].iov_len = packets[i]->frame_length;
+		memset(&msgs[i], 0, sizeof(msgs[i]));
+		msgs[i].msg_hdr.msg_name = &addrs[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	unsigned int sent = 0;
+	while (sent < count) {
+		int ret = sendmmsg(ifconf->sockfd, &msgs[sent], count - sent, MSG_CONFIRM);
+		if (ret > 0) {
+			sent += ret;
+		} else if ((ret < 0) && (errno == EINTR)) {
+			continue;
+		} else {
+			/* Skip the packet failing, e.g. to an unreachable peer */
+			iface->tx_error++;
+			sent++;
+		}
+	}
+
+	for (unsigned int i = 0; i < count; i++) {
+		csp_buffer_free(packets[i]);
+	}
+}
+
 static int csp_if_udp_tx(csp_iface_t * iface, uint16_t via, csp_packet_t * packet) {
 
 	csp_if_udp_conf_t * ifconf = iface->driver_data;
 
-	int sockfd;
-	if ((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
-		iface->tx_error++;
+	if (ifconf->sockfd < 0) {
 		return CSP_ERR_BUSY;
 	}
 
+	/* Peer of the next hop, the destination itself if sent without via */
+	const uint16_t to = (via != CSP_NO_VIA_ADDRESS) ? via : packet->id.dst;
+
 	if(csp_dbg_packet_print >= 3) {
 		csp_print("UDPOUT: S %u, D %u, Dp %u, Sp %u, Pr %u, Fl 0x%02X, Sz %"PRIu16" VIA: %u\n",
          packet->id.src, packet->id.dst, packet->id.dport,
-         packet->id.sport, packet->id.pri, packet->id.flags, packet->length, packet->id.dst);
+         packet->id.sport, packet->id.pri, packet->id.flags, packet->length, to);
 	}
 
 	csp_id_prepend(packet);
-	ifconf->peer_addr.sin_family = AF_INET;
-	ifconf->peer_addr.sin_port = htons(ifconf->rport);
-	sendto(sockfd, packet->frame_begin, packet->frame_length, MSG_CONFIRM, (struct sockaddr *)&ifconf->peer_addr, sizeof(ifconf->peer_addr));
-	csp_buffer_free(packet);
 
-	close(sockfd);
+	pthread_mutex_lock(&ifconf->tx_lock);
+
+#if (CSP_USE_IO_URING)
+	/* The reactor batches the sends itself */
+	if (ifconf->rx[0].reactor != NULL) {
+		struct sockaddr_in sockaddr;
+		const bool found = csp_if_udp_peer_lookup(ifconf, to, &sockaddr);
+		pthread_mutex_unlock(&ifconf->tx_lock);
+		return found ? csp_reactor_send(ifconf->rx[0].reactor, packet, &sockaddr) : CSP_ERR_TX;
+	}
+#endif
+
+	/* Wait for the task sending to take the batch, like a blocking send */
+	while (ifconf->tx_count == CSP_IF_UDP_BATCH) {
+		pthread_cond_wait(&ifconf->tx_cond, &ifconf->tx_lock);
+	}
+
+	if (!csp_if_udp_peer_lookup(ifconf, to, &ifconf->tx_addr[ifconf->tx_count])) {
+		pthread_mutex_unlock(&ifconf->tx_lock);
+		return CSP_ERR_TX;
+	}
+	ifconf->tx_batch[ifconf->tx_count++] = packet;
+
+	/* Wait for the task sending to finish, unless it takes this packet into its next batch meanwhile */
+	const unsigned int taken = ifconf->tx_taken;
+	while (ifconf->tx_flushing && (ifconf->tx_taken == taken)) {
+		pthread_cond_wait(&ifconf->tx_cond, &ifconf->tx_lock);
+	}
+	if (ifconf->tx_taken != taken) {
+		pthread_mutex_unlock(&ifconf->tx_lock);
+		return CSP_ERR_NONE;
+	}
+
+	/* Send one batch, with the packets queued meanwhile by other tasks, the next task to send takes over */
+	csp_packet_t * packets[CSP_IF_UDP_BATCH];
+	struct sockaddr_in addrs[CSP_IF_UDP_BATCH];
+	const unsigned int count = ifconf->tx_count;
+	memcpy(packets, ifconf->tx_batch, count * sizeof(packets[0]));
+	memcpy(addrs, ifconf->tx_addr, count * sizeof(addrs[0]));
+	ifconf->tx_count = 0;
+	ifconf->tx_taken++;
+	ifconf->tx_flushing = true;
+	pthread_cond_broadcast(&ifconf->tx_cond);
+
+	pthread_mutex_unlock(&ifconf->tx_lock);
+	csp_if_udp_tx_batch(iface, ifconf, packets, addrs, count);
+	pthread_mutex_lock(&ifconf->tx_lock);
+
+	ifconf->tx_flushing = false;
+	pthread_cond_broadcast(&ifconf->tx_cond);
+
+	pthread_mutex_unlock(&ifconf->tx_lock);
 
 	return CSP_ERR_NONE;
 }
 
-int csp_if_udp_rx_get_socket(int lport) {
+/* Socket bound to the listen port, shared by the receive tasks with reuseport */
+static int csp_if_udp_rx_bind(int lport, bool reuseport) {
 
 	int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sockfd < 0) {
+		return -1;
+	}
+
+	const int enable = 1;
+	if (reuseport && (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0)) {
+		close(sockfd);
+		return -1;
+	}
 
 	struct sockaddr_in server_addr = {0};
 	server_addr.sin_family = AF_INET;
 	server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
 	server_addr.sin_port = htons(lport);
 
-	bind(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr));
+	if (bind(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+		close(sockfd);
+		return -1;
+	}
 	return sockfd;
 }
 
-int csp_if_udp_rx_work(int sockfd, size_t mtu, csp_iface_t * iface) {
+int csp_if_udp_rx_get_socket(int lport) {
+	return csp_if_udp_rx_bind(lport, false);
+}
 
-	csp_packet_t * packet = csp_buffer_get(mtu);
-	if (packet == NULL) {
-		iface->drop++;
-		return CSP_ERR_NOMEM;
-	}
+/* Count in the task, and in the interface shared by the tasks */
+static void csp_if_udp_rx_count(csp_if_udp_rx_t * rx, uint32_t * task_counter, uint32_t * iface_counter) {
+	csp_if_udp_conf_t * ifconf = rx->iface->driver_data;
+	(*task_counter)++;
+	pthread_mutex_lock(&ifconf->rx_lock);
+	(*iface_counter)++;
+	pthread_mutex_unlock(&ifconf->rx_lock);
+}
+
+/* Parse a received frame, and pass it on to the router, from is the source if known */
+static int csp_if_udp_rx_frame(csp_iface_t * iface, csp_packet_t * packet, int received_len, const struct sockaddr_in * from) {
 
-	/* Setup RX frane to point to ID */
-	int header_size = csp_id_setup_rx(packet);
-	int received_len = recvfrom(sockfd, (char *)packet->frame_begin, mtu + header_size, MSG_WAITALL, NULL, NULL);
-	
 	if (received_len <= 4) {
 		csp_buffer_free(packet);
-		iface->rx_error++;
 		return CSP_ERR_NOMEM;
 	}
 
@@ -77,7 +330,6 @@ int csp_if_udp_rx_work(int sockfd, size_t mtu, csp_iface_t * iface) {
 	/* Parse the frame and strip the ID field */
 	if (csp_id_strip(packet) != 0) {
 		csp_buffer_free(packet);
-		iface->rx_error++;
 		return CSP_ERR_INVAL;
 	}
 
@@ -87,38 +339,165 @@ int csp_if_udp_rx_work(int sockfd, size_t mtu, csp_iface_t * iface) {
 			packet->id.sport, packet->id.pri, packet->id.flags, packet->length, "UDP");
 	}
 
+	/* Not authenticated yet, see csp_if_udp_peer_learn() */
+	csp_if_udp_conf_t * ifconf = iface->driver_data;
+	if (__atomic_load_n(&ifconf->peer_learn, __ATOMIC_RELAXED) && (from != NULL) && (from->sin_family == AF_INET)) {
+		csp_if_udp_peer_update(ifconf, packet->id.src, from);
+	}
+
 	csp_qfifo_write(packet, iface, NULL);
 
 	return CSP_ERR_NONE;
 }
 
-void * csp_if_udp_rx_loop(void * param) {
+int csp_if_udp_rx_work(int sockfd, size_t mtu, csp_iface_t * iface) {
 
-	csp_iface_t * iface = param;
-	csp_if_udp_conf_t * ifconf = iface->driver_data;
-	int sockfd = -1;
+	csp_packet_t * packet = csp_buffer_get(mtu);
+	if (packet == NULL) {
+		iface->drop++;
+		return CSP_ERR_NOMEM;
+	}
+
+	/* Setup RX frane to point to ID */
+	int header_size = csp_id_setup_rx(packet);
+	int received_len = recvfrom(sockfd, (char *)packet->frame_begin, mtu + header_size, MSG_WAITALL, NULL, NULL);
+
+	int ret = csp_if_udp_rx_frame(iface, packet, received_len, NULL);
+	if (ret != CSP_ERR_NONE) {
+		iface->rx_error++;
+	}
+	return ret;
+}
+
+/* Receive buffers, allocated in advance */
+typedef struct {
+	unsigned int count;
+	csp_packet_t * packets[CSP_IF_UDP_BATCH];
+	struct iovec iov[CSP_IF_UDP_BATCH];
+	struct sockaddr_in addrs[CSP_IF_UDP_BATCH];
+	struct mmsghdr msgs[CSP_IF_UDP_BATCH];
+} csp_if_udp_rx_slots_t;
+
+/* Allocate buffers up to batch, only the first while few buffers are free */
+static void csp_if_udp_rx_fill(csp_if_udp_rx_slots_t * slots, size_t mtu, unsigned int batch) {
+
+	while (slots->count < batch) {
+		if ((slots->count > 0) && (csp_buffer_remaining() <= CSP_IF_UDP_RX_RESERVE)) {
+			break;
+		}
+		csp_packet_t * packet = csp_buffer_get(mtu);
+		if (packet == NULL) {
+			break;
+		}
+		/* Setup RX frame to point to ID */
+		const int header_size = csp_id_setup_rx(packet);
+		const unsigned int i = slots->count++;
+		slots->packets[i] = packet;
+		slots->iov[i].iov_base = packet->frame_begin;
+		slots->iov[i].iov_len = mtu + header_size;
+		memset(&slots->msgs[i], 0, sizeof(slots->msgs[i]));
+		slots->msgs[i].msg_hdr.msg_iov = &slots->iov[i];
+		slots->msgs[i].msg_hdr.msg_iovlen = 1;
+		slots->msgs[i].msg_hdr.msg_name = &slots->addrs[i];
+	}
+}
+
+/* Receive a burst of packets, blocking until the first arrives */
+static int csp_if_udp_rx_burst(csp_if_udp_rx_t * rx, csp_if_udp_rx_slots_t * slots, unsigned int batch) {
+
+	csp_iface_t * iface = rx->iface;
+
+	csp_if_udp_rx_fill(slots, iface->mtu, batch);
+	if (slots->count == 0) {
+		csp_if_udp_rx_count(rx, &rx->drop, &iface->drop);
+		return CSP_ERR_NOMEM;
+	}
+
+	/* Set for every call, the source address length is returned in it */
+	for (unsigned int i = 0; i < slots->count; i++) {
+		slots->msgs[i].msg_hdr.msg_namelen = sizeof(slots->addrs[i]);
+	}
 
-	while (sockfd < 0) {
-		sockfd = csp_if_udp_rx_get_socket(ifconf->lport);
-		if (sockfd < 0) {
-			csp_print("  UDP server waiting for port %d\n", ifconf->lport);
-			sleep(1);
+	int received = recvmmsg(rx->sockfd, slots->msgs, slots->count, MSG_WAITFORONE, NULL);
+	if (received <= 0) {
+		return (received < 0) && (errno != EINTR) ? CSP_ERR_INVAL : CSP_ERR_NONE;
+	}
+
+	rx->bursts++;
+	rx->frames += received;
+	for (int i = 0; i < received; i++) {
+		if (csp_if_udp_rx_frame(iface, slots->packets[i], slots->msgs[i].msg_len, &slots->addrs[i]) != CSP_ERR_NONE) {
+			csp_if_udp_rx_count(rx, &rx->rx_error, &iface->rx_error);
+		}
+	}
+
+	/* Move the unused buffers first */
+	slots->count -= received;
+	for (unsigned int i = 0; i < slots->count; i++) {
+		slots->packets[i] = slots->packets[received + i];
+		slots->iov[i] = slots->iov[received + i];
+		slots->msgs[i].msg_hdr.msg_iov = &slots->iov[i];
+	}
+
+	return CSP_ERR_NONE;
+}
+
+void * csp_if_udp_rx_loop(void * param) {
+
+	csp_if_udp_rx_t * rx = param;
+	csp_if_udp_conf_t * ifconf = rx->iface->driver_data;
+
+	/* Bound at init, unless the port was in use */
+	if (rx->sockfd < 0) {
+		while (rx->sockfd < 0) {
+			rx->sockfd = csp_if_udp_rx_bind(ifconf->lport, ifconf->rx_threads > 1);
+			if (rx->sockfd < 0) {
+				csp_print("  UDP server waiting for port %d\n", ifconf->lport);
+				sleep(1);
+			}
 		}
+		csp_if_udp_set_buffers(rx->sockfd, ifconf);
+	}
+
+	unsigned int batch = ifconf->rx_batch;
+	if ((batch == 0) || (batch > CSP_IF_UDP_BATCH)) {
+		batch = CSP_IF_UDP_BATCH;
 	}
 
+	csp_if_udp_rx_slots_t slots = {.count = 0};
+
 	while (1) {
 		int ret;
-		ret = csp_if_udp_rx_work(sockfd, iface->mtu, iface);
+		ret = csp_if_udp_rx_burst(rx, &slots, batch);
 		if (ret == CSP_ERR_INVAL) {
-			iface->rx_error++;
+			csp_if_udp_rx_count(rx, &rx->rx_error, &rx->iface->rx_error);
 		} else if (ret == CSP_ERR_NOMEM) {
-			usleep(10000);
+			/* Leave packets in the socket buffer, until buffers are freed */
+			usleep(1000);
 		}
 	}
 
 	return NULL;
 }
 
+#if (CSP_USE_IO_URING)
+/* Frame received by the reactor */
+static void csp_if_udp_reactor_rx(void * user_data, csp_packet_t * packet, int length, const struct sockaddr_in * from) {
+
+	csp_if_udp_rx_t * rx = user_data;
+
+	if (packet == NULL) {
+		csp_if_udp_rx_count(rx, &rx->rx_error, &rx->iface->rx_error);
+		return;
+	}
+
+	rx->frames++;
+	if (csp_if_udp_rx_frame(rx->iface, packet, length, from) != CSP_ERR_NONE) {
+		csp_if_udp_rx_count(rx, &rx->rx_error, &rx->iface->rx_error);
+	}
+}
+#endif
+
 void csp_if_udp_init(csp_iface_t * iface, csp_if_udp_conf_t * ifconf) {
 
 	pthread_attr_t attributes;
@@ -126,13 +505,76 @@ void csp_if_udp_init(csp_iface_t * iface, csp_if_udp_conf_t * ifconf) {
 
 	iface->driver_data = ifconf;
 
-	if (inet_aton(ifconf->host, &ifconf->peer_addr.sin_addr) == 0) {
-		csp_print("  Unknown peer address %s\n", ifconf->host);
+	/* Default peer, for addresses without a peer of their own */
+	memset(&ifconf->peer_addr, 0, sizeof(ifconf->peer_addr));
+	if (ifconf->host != NULL) {
+		if (inet_aton(ifconf->host, &ifconf->peer_addr.sin_addr) == 0) {
+			csp_print("  Unknown peer address %s\n", ifconf->host);
+		}
+		ifconf->peer_addr.sin_family = AF_INET;
+		ifconf->peer_addr.sin_port = htons(ifconf->rport);
+		csp_print("UDP peer address: %s:%d (listening on port %d)\n", inet_ntoa(ifconf->peer_addr.sin_addr), ifconf->rport, ifconf->lport);
+	} else {
+		csp_print("UDP listening on port %d\n", ifconf->lport);
 	}
 
-	csp_print("UDP peer address: %s:%d (listening on port %d)\n", inet_ntoa(ifconf->peer_addr.sin_addr), ifconf->rport, ifconf->lport);
+	pthread_mutex_init(&ifconf->tx_lock, NULL);
+	pthread_cond_init(&ifconf->tx_cond, NULL);
+	ifconf->tx_flushing = false;
+	ifconf->tx_taken = 0;
+	ifconf->tx_count = 0;
+	ifconf->peer_count = 0;
+	ifconf->peer_learn = false;
+
+	pthread_mutex_init(&ifconf->rx_lock, NULL);
+	if ((ifconf->rx_threads == 0) || (ifconf->rx_threads > CSP_IF_UDP_RX_THREADS)) {
+		ifconf->rx_threads = (ifconf->rx_threads == 0) ? 1 : CSP_IF_UDP_RX_THREADS;
+	}
 
-	/* Start server thread */
+	/* Bind all receive sockets first, so the kernel spreads the flows over all of them from the start */
+	for (unsigned int i = 0; i < ifconf->rx_threads; i++) {
+		csp_if_udp_rx_t * rx = &ifconf->rx[i];
+		memset(rx, 0, sizeof(*rx));
+		rx->iface = iface;
+		rx->sockfd = csp_if_udp_rx_bind(ifconf->lport, ifconf->rx_threads > 1);
+		if (rx->sockfd >= 0) {
+			csp_if_udp_set_buffers(rx->sockfd, ifconf);
+		}
+	}
+
+	/* Send from the listen port, so replies to the source of a frame reach the server task */
+	if (ifconf->rx[0].sockfd >= 0) {
+		ifconf->sockfd = ifconf->rx[0].sockfd;
+	} else {
+		ifconf->sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+		if (ifconf->sockfd < 0) {
+			csp_print("csp_if_udp_init: failed to open socket: %s\n", strerror(errno));
+		} else {
+			csp_if_udp_set_buffers(ifconf->sockfd, ifconf);
+		}
+	}
+
+	/* MTU is datasize, set before the server thread allocates buffers for it */
+	iface->mtu = csp_buffer_data_size();
+
+#if (CSP_USE_IO_URING)
+	/* Sockets bound are served by the reactor, the others by server threads binding them later. The first socket
+	 * sends, if bound */
+	if (csp_reactor_running()) {
+		for (unsigned int i = 0; i < ifconf->rx_threads; i++) {
+			csp_if_udp_rx_t * rx = &ifconf->rx[i];
+			if (rx->sockfd < 0) {
+				continue;
+			}
+			rx->reactor = csp_reactor_add_frames(rx->sockfd, iface, ifconf->rx_batch, true, csp_if_udp_reactor_rx, rx);
+			if (rx->reactor == NULL) {
+				csp_print("csp_if_udp_init: failed to add socket to reactor\n");
+			}
+		}
+	}
+#endif
+
+	/* Start server threads */
 	ret = pthread_attr_init(&attributes);
 	if (ret != 0) {
 		csp_print("csp_if_udp_init: pthread_attr_init failed: %s: %d\n", strerror(ret), ret);
@@ -141,10 +583,15 @@ void csp_if_udp_init(csp_iface_t * iface, csp_if_udp_conf_t * ifconf) {
 	if (ret != 0) {
 		csp_print("csp_if_udp_init: pthread_attr_setdetachstate failed: %s: %d\n", strerror(ret), ret);
 	}
-	ret = pthread_create(&ifconf->server_handle, &attributes, csp_if_udp_rx_loop, iface);
-
-	/* MTU is datasize */
-	iface->mtu = csp_buffer_data_size();
+	for (unsigned int i = 0; i < ifconf->rx_threads; i++) {
+		if (ifconf->rx[i].reactor != NULL) {
+			continue;
+		}
+		ret = pthread_create(&ifconf->rx[i].handle, &attributes, csp_if_udp_rx_loop, &ifconf->rx[i]);
+		if (ret != 0) {
+			csp_print("csp_if_udp_init: pthread_create failed: %s: %d\n", strerror(ret), ret);
+		}
+	}
 
 	/* Regsiter interface */
 	iface->name = "UDP",
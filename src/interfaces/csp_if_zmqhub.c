@@ -13,6 +13,9 @@
 
 #include <csp/csp_id.h>
 
+/* Min. number of free buffers to send without copy */
+#define CSP_ZMQ_ZEROCOPY_MIN_FREE (CSP_BUFFER_COUNT / 4)
+
 /* ZMQ driver & interface */
 typedef struct {
 	pthread_t rx_thread;
@@ -36,6 +39,11 @@ static void sa_set_addr(zmq_driver_t *drv, int addr);
 static void set_filters(zmq_driver_t *drv, uint16_t addr, uint16_t hostmask, int version);
 
 
+/* Free a packet sent without copy, called by ZMQ when done with it */
+static void csp_zmqhub_free(void * data, void * hint) {
+	csp_buffer_free(hint);
+}
+
 /**
  * Interface transmit function
  * @param packet Packet to transmit
@@ -91,19 +99,38 @@ int csp_zmqhub_tx(csp_iface_t * iface, uint16_t via, csp_packet_t * packet) {
 		}
 	}
 
+	/* Hand the buffer to ZMQ, freed when sent. Copy instead while few buffers are free, as a slow peer
+	 * holds the buffers queued for it. If no message could be set up, the packet is still ours, and freed by the
+	 * caller on error */
+	zmq_msg_t msg;
+	if (csp_buffer_remaining() > CSP_ZMQ_ZEROCOPY_MIN_FREE) {
+		if (zmq_msg_init_data(&msg, packet->frame_begin, packet->frame_length, csp_zmqhub_free, packet) != 0) {
+			csp_print("ZMQ message error: %s\n", zmq_strerror(zmq_errno()));
+			return CSP_ERR_NOMEM;
+		}
+	} else {
+		if (zmq_msg_init_size(&msg, packet->frame_length) != 0) {
+			csp_print("ZMQ message error: %s\n", zmq_strerror(zmq_errno()));
+			return CSP_ERR_NOMEM;
+		}
+		memcpy(zmq_msg_data(&msg), packet->frame_begin, packet->frame_length);
+		csp_buffer_free(packet);
+	}
+
 	/** 
 	 * While a ZMQ context is thread safe, sockets are NOT threadsafe, so by sharing drv->publisher, we 
 	 * need to have a lock around any calls that uses that */
 	pthread_mutex_lock(&lock);
-	int result = zmq_send(drv->publisher, packet->frame_begin, packet->frame_length, 0);
+	int result = zmq_msg_send(&msg, drv->publisher, 0);
 	pthread_mutex_unlock(&lock);
 
 	if (result < 0) {
-		csp_print("ZMQ send error: %u %s\n", result, zmq_strerror(zmq_errno()));
+		csp_print("ZMQ send error: %d %s\n", result, zmq_strerror(zmq_errno()));
+		iface->tx_error++;
+		/* Still owned by the message */
+		zmq_msg_close(&msg);
 	}
 
-	csp_buffer_free(packet);
-
 	return CSP_ERR_NONE;
 }
 
@@ -112,56 +139,45 @@ void * csp_zmqhub_task(void * param) {
 	zmq_driver_t * drv = param;
 	csp_packet_t * packet;
 	const csp_conf_t * conf = csp_get_conf();
-	const uint32_t HEADER_SIZE = (conf->version == 2) ? 6 : 4;
 
 	while (1) {
-		int ret;
-		zmq_msg_t msg;
-
-		ret = zmq_msg_init_size(&msg, CSP_ZMQ_MTU + HEADER_SIZE);
-		assert(ret == 0);
-
-		// Receive data
-		if (zmq_msg_recv(&msg, drv->subscriber, 0) < 0) {
-			csp_print("ZMQ RX err %s: %s\n", drv->iface.name, zmq_strerror(zmq_errno()));
-			continue;
-		}
 
-		unsigned int datalen = zmq_msg_size(&msg);
-		if (datalen < HEADER_SIZE) {
-			csp_print("ZMQ RX %s: Too short datalen: %u - expected min %u bytes\n", drv->iface.name, datalen, HEADER_SIZE);
+		// Create new csp packet, and receive the frame straight into it
+		packet = csp_buffer_get(csp_buffer_data_size());
+		if (packet == NULL) {
+			zmq_msg_t msg;
+			zmq_msg_init(&msg);
+			if (zmq_msg_recv(&msg, drv->subscriber, 0) >= 0) {
+				csp_print("RX %s: Failed to get csp_buffer(%u) errno(%d)\n", drv->iface.name, (unsigned int)zmq_msg_size(&msg), csp_dbg_errno);
+				drv->iface.drop++;
+			}
 			zmq_msg_close(&msg);
 			continue;
 		}
 
-		if ((datalen - HEADER_SIZE) > CSP_BUFFER_SIZE) {
-			csp_print("ZMQ RX %s: Too long datalen: %u - expected min %u bytes\n", drv->iface.name, datalen - HEADER_SIZE, CSP_BUFFER_SIZE);
-			zmq_msg_close(&msg);
+		// the prepended topiclen is received into the padding before the header
+		const unsigned int header_size = csp_id_setup_rx(packet);
+		const size_t rx_size = drv->topiclen + header_size + csp_buffer_data_size();
+		int ret = zmq_recv(drv->subscriber, packet->frame_begin - drv->topiclen, rx_size, 0);
+		if (ret < 0) {
+			csp_print("ZMQ RX err %s: %s\n", drv->iface.name, zmq_strerror(zmq_errno()));
+			csp_buffer_free(packet);
 			continue;
 		}
 
-		// Create new csp packet
-		packet = csp_buffer_get(datalen - HEADER_SIZE);
-		if (packet == NULL) {
-			csp_print("RX %s: Failed to get csp_buffer(%u) errno(%d)\n", drv->iface.name, datalen, csp_dbg_errno);
-			zmq_msg_close(&msg);
-			drv->iface.drop++;
+		if ((size_t)ret > rx_size) {
+			csp_print("ZMQ RX %s: Too long datalen: %d - expected max %u bytes\n", drv->iface.name, ret - drv->topiclen - (int)header_size, (unsigned int)csp_buffer_data_size());
+			csp_buffer_free(packet);
 			continue;
 		}
 
-		// Copy the data from zmq to csp
-		const uint8_t * rx_data = zmq_msg_data(&msg);
-
-		// skip over the prepended topiclen
-		if(drv->topiclen > 0) {
-			rx_data += drv->topiclen;
-			datalen -= drv->topiclen;
+		if (ret < (int)(drv->topiclen + header_size)) {
+			csp_print("ZMQ RX %s: Too short datalen: %d - expected min %u bytes\n", drv->iface.name, ret, drv->topiclen + header_size);
+			csp_buffer_free(packet);
+			continue;
 		}
 
-		csp_id_setup_rx(packet);
-
-		memcpy(packet->frame_begin, rx_data, datalen);
-		packet->frame_length = datalen;
+		packet->frame_length = ret - drv->topiclen;
 
 		/* Parse the frame and strip the ID field */
 		if (csp_id_strip(packet) != 0) {
@@ -226,8 +242,6 @@ void * csp_zmqhub_task(void * param) {
 
 		// Route packet
 		csp_qfifo_write(packet, &drv->iface, NULL);
-
-		zmq_msg_close(&msg);
 	}
 
 	return NULL;